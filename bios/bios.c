@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <string.h>
 
 #include "bios/bios.h"
 #include "log.h"
@@ -11,7 +12,23 @@ void bios_print_header(uint8_t *bios)
     uint8_t bios_date_month = (bios_date & 0x0000FF00) >> 8;
     uint8_t bios_date_day = (bios_date & 0x000000FF);
 
-    #ifdef LOG_DEBUG_BIOS
-    log_debug("BIOS", "Date: %02x/%02x/%04x\n", bios_date_month, bios_date_day, bios_date_year);
-    #endif
-}
\ No newline at end of file
+    log_debug(LOG_BIOS, "BIOS", "Date: %02x/%02x/%04x\n", bios_date_month, bios_date_day, bios_date_year);
+}
+
+/* TTY output of the putchar calls, printed line by line */
+void bios_tty_putchar(bios_tty_t *tty, char c)
+{
+    if (c != '\n' && tty->index < sizeof(tty->buf) - 1) {
+        tty->buf[tty->index++] = c;
+        return;
+    }
+
+    log_debug(LOG_BIOS_TTY, "TTY", "%s\n", tty->buf);
+
+    tty->index = 0;
+    memset(tty->buf, 0x00, sizeof(tty->buf));
+
+    if (c != '\n') {
+        tty->buf[tty->index++] = c;
+    }
+}
@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bios/boot.h"
+#include "cpu/block_cache.h"
+#include "log.h"
+
+typedef struct boot_section_t {
+    void *data;
+    uint32_t size;
+} boot_section_t;
+
+typedef struct boot_cache_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t bios_checksum;
+} boot_cache_header_t;
+
+void boot_init(boot_t *boot, const char *cache_path)
+{
+    boot->exe = NULL;
+    boot->exe_size = 0;
+
+    boot->cache_path = cache_path;
+    boot->restored = false;
+}
+
+void boot_destroy(boot_t *boot)
+{
+    free(boot->exe);
+    boot->exe = NULL;
+}
+
+bool boot_load_exe(boot_t *boot, const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+
+    if (!fp) {
+        log_error("BOOT", "Failed to open %s\n", path);
+        return false;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    if (size < BOOT_EXE_HEADER_SIZE) {
+        log_error("BOOT", "%s is too small for a PS-X EXE\n", path);
+        fclose(fp);
+        return false;
+    }
+
+    boot->exe = (uint8_t *) malloc(size);
+    boot->exe_size = fread(boot->exe, 1, size, fp);
+    fclose(fp);
+
+    boot_exe_header_t *header = (boot_exe_header_t *) boot->exe;
+
+    // Written so that a huge t_size can not wrap around
+    if (boot->exe_size < BOOT_EXE_HEADER_SIZE || memcmp(header->id, "PS-X EXE", 8) || header->t_size > boot->exe_size - BOOT_EXE_HEADER_SIZE) {
+        log_error("BOOT", "%s is not a valid PS-X EXE\n", path);
+
+        free(boot->exe);
+        boot->exe = NULL;
+        return false;
+    }
+
+    if (header->t_size > BUS_RAM_SIZE - (header->t_addr & (BUS_RAM_SIZE - 1))) {
+        log_error("BOOT", "%s does not fit into RAM\n", path);
+
+        free(boot->exe);
+        boot->exe = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+/* Everything of the kernel state at the handoff, in file order */
+static uint32_t boot_cache_sections(r3000_state_t *r3000_state, bus_state_t *bus_state, boot_section_t *sections)
+{
+    uint32_t count = 0;
+
+    sections[count++] = (boot_section_t) {r3000_state->regs, sizeof(r3000_state->regs)};
+    sections[count++] = (boot_section_t) {&r3000_state->hi, sizeof(r3000_state->hi)};
+    sections[count++] = (boot_section_t) {&r3000_state->lo, sizeof(r3000_state->lo)};
+    sections[count++] = (boot_section_t) {r3000_state->cop0_state.regs, sizeof(r3000_state->cop0_state.regs)};
+    sections[count++] = (boot_section_t) {&bus_state->irq_state.i_mask, sizeof(bus_state->irq_state.i_mask)};
+    sections[count++] = (boot_section_t) {&bus_state->dma_state.dpcr, sizeof(bus_state->dma_state.dpcr)};
+    sections[count++] = (boot_section_t) {&bus_state->dma_state.dicr, sizeof(bus_state->dma_state.dicr)};
+    sections[count++] = (boot_section_t) {bus_state->ram, BUS_RAM_SIZE};
+    sections[count++] = (boot_section_t) {bus_state->scratchpad, 0x400};
+
+    return count;
+}
+
+/* A cache from another BIOS would have a different kernel in RAM */
+uint32_t boot_bios_checksum(bus_state_t *bus_state)
+{
+    uint32_t hash = 2166136261u;
+
+    for (uint32_t i=0; i < BUS_BIOS_SIZE; i++) {
+        hash = (hash ^ bus_state->bios[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+static void boot_save_cache(boot_t *boot, r3000_state_t *r3000_state, bus_state_t *bus_state)
+{
+    FILE *fp = fopen(boot->cache_path, "wb");
+
+    if (!fp) {
+        log_error("BOOT", "Failed to write %s\n", boot->cache_path);
+        return;
+    }
+
+    boot_cache_header_t header;
+    memcpy(header.magic, BOOT_CACHE_MAGIC, 8);
+    header.version = BOOT_CACHE_VERSION;
+    header.bios_checksum = boot_bios_checksum(bus_state);
+
+    fwrite(&header, sizeof(header), 1, fp);
+
+    boot_section_t sections[16];
+    uint32_t count = boot_cache_sections(r3000_state, bus_state, sections);
+
+    for (uint32_t i=0; i < count; i++) {
+        fwrite(sections[i].data, 1, sections[i].size, fp);
+    }
+
+    fclose(fp);
+
+    log_info("BOOT", "Saved kernel state to %s\n", boot->cache_path);
+}
+
+/* Starts at the shell handoff with the cached kernel state, false if there is no usable cache */
+bool boot_restore(boot_t *boot, r3000_state_t *r3000_state, bus_state_t *bus_state)
+{
+    if (!boot->cache_path) {
+        return false;
+    }
+
+    FILE *fp = fopen(boot->cache_path, "rb");
+
+    if (!fp) {
+        return false;
+    }
+
+    boot_section_t sections[16];
+    uint32_t count = boot_cache_sections(r3000_state, bus_state, sections);
+
+    uint32_t size = sizeof(boot_cache_header_t);
+
+    for (uint32_t i=0; i < count; i++) {
+        size += sections[i].size;
+    }
+
+    // Read it all first, a bad file must not leave half a state behind
+    uint8_t *data = (uint8_t *) malloc(size);
+    bool valid = fread(data, 1, size, fp) == size && fgetc(fp) == EOF;
+    fclose(fp);
+
+    boot_cache_header_t *header = (boot_cache_header_t *) data;
+
+    if (!valid || memcmp(header->magic, BOOT_CACHE_MAGIC, 8) || header->version != BOOT_CACHE_VERSION || header->bios_checksum != boot_bios_checksum(bus_state)) {
+        log_info("BOOT", "Ignoring stale kernel state in %s\n", boot->cache_path);
+
+        free(data);
+        return false;
+    }
+
+    uint8_t *ptr = data + sizeof(boot_cache_header_t);
+
+    for (uint32_t i=0; i < count; i++) {
+        memcpy(sections[i].data, ptr, sections[i].size);
+        ptr += sections[i].size;
+    }
+
+    free(data);
+
+    r3000_state->pc_instruction = BOOT_SHELL_PC;
+    r3000_state->pc = BOOT_SHELL_PC;
+    r3000_state->pc_next = BOOT_SHELL_PC + 4;
+
+    r3000_update_irqs(r3000_state);
+
+    boot->restored = true;
+
+    log_info("BOOT", "Restored kernel state from %s\n", boot->cache_path);
+
+    return true;
+}
+
+static void boot_exe(boot_t *boot, r3000_state_t *r3000_state, bus_state_t *bus_state)
+{
+    boot_exe_header_t *header = (boot_exe_header_t *) boot->exe;
+
+    memcpy(bus_state->ram + (header->t_addr & (BUS_RAM_SIZE - 1)), boot->exe + BOOT_EXE_HEADER_SIZE, header->t_size);
+
+    if (header->b_size) {
+        uint32_t b_addr = header->b_addr & (BUS_RAM_SIZE - 1);
+        uint32_t b_size = (b_addr + header->b_size > BUS_RAM_SIZE) ? BUS_RAM_SIZE - b_addr : header->b_size;
+
+        memset(bus_state->ram + b_addr, 0x00, b_size);
+    }
+
+    // RAM was written behind the cache's back
+    if (bus_state->block_cache) {
+        block_cache_flush(bus_state->block_cache);
+    }
+
+    r3000_state->regs[R3000_REG_GP] = header->gp;
+
+    if (header->s_addr) {
+        r3000_state->regs[R3000_REG_SP] = header->s_addr + header->s_size;
+        r3000_state->regs[R3000_REG_FP] = header->s_addr + header->s_size;
+    }
+
+    r3000_state->pc_instruction = header->pc;
+    r3000_state->pc = header->pc;
+    r3000_state->pc_next = header->pc + 4;
+
+    log_info("BOOT", "Starting EXE at %08X | text: %08X (%x bytes)\n", header->pc, header->t_addr, header->t_size);
+}
+
+/* Called once the CPU gets to the shell */
+void boot_shell(boot_t *boot, r3000_state_t *r3000_state, bus_state_t *bus_state)
+{
+    if (boot->cache_path && !boot->restored) {
+        boot_save_cache(boot, r3000_state, bus_state);
+    }
+
+    if (boot->exe) {
+        boot_exe(boot, r3000_state, bus_state);
+    }
+}
@@ -0,0 +1,706 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+
+#include "bios/hle.h"
+#include "bios/bios.h"
+#include "cpu/block_cache.h"
+#include "log.h"
+
+void bios_hle_init(bios_hle_t *hle, const char *dir)
+{
+    hle->dir = dir;
+
+    for (int i=0; i < BIOS_HLE_FILES; i++) {
+        hle->files[i] = NULL;
+    }
+}
+
+/* Closes whatever the guest left open */
+void bios_hle_destroy(bios_hle_t *hle)
+{
+    for (int i=0; i < BIOS_HLE_FILES; i++) {
+        if (hle->files[i]) {
+            fclose(hle->files[i]);
+            hle->files[i] = NULL;
+        }
+    }
+}
+
+static inline uint8_t bios_hle_read8(bus_state_t *bus_state, uint32_t addr)
+{
+    return bus_read(bus_state, BUS_SIZE_BYTE, addr);
+}
+
+static inline uint32_t bios_hle_read32(bus_state_t *bus_state, uint32_t addr)
+{
+    return bus_read(bus_state, BUS_SIZE_DWORD, addr);
+}
+
+static inline void bios_hle_write8(bus_state_t *bus_state, uint32_t addr, uint8_t value)
+{
+    bus_write(bus_state, BUS_SIZE_BYTE, addr, value);
+}
+
+static inline void bios_hle_write32(bus_state_t *bus_state, uint32_t addr, uint32_t value)
+{
+    bus_write(bus_state, BUS_SIZE_DWORD, addr, value);
+}
+
+/* Argument n of the call, the ones after a3 are on the stack behind their home slots */
+static uint32_t bios_hle_arg(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t n)
+{
+    if (n < 4) {
+        return r3000_state->regs[R3000_REG_A0 + n];
+    }
+
+    return bios_hle_read32(bus_state, r3000_state->regs[R3000_REG_SP] + (n << 2));
+}
+
+/* Copies a guest string, always terminated */
+static void bios_hle_read_string(bus_state_t *bus_state, uint32_t addr, char *buf, uint32_t size)
+{
+    uint32_t i = 0;
+
+    for (; i + 1 < size; i++) {
+        buf[i] = bios_hle_read8(bus_state, addr + i);
+
+        if (!buf[i]) {
+            return;
+        }
+    }
+
+    buf[i] = 0;
+}
+
+/* Memory */
+
+static uint32_t bios_hle_memcpy(bus_state_t *bus_state, uint32_t dst, uint32_t src, int32_t len)
+{
+    if (!dst || !src) {
+        return 0;
+    }
+
+    for (int32_t i=0; i < len; i++) {
+        bios_hle_write8(bus_state, dst + i, bios_hle_read8(bus_state, src + i));
+    }
+
+    return dst;
+}
+
+static uint32_t bios_hle_memset(bus_state_t *bus_state, uint32_t dst, uint8_t value, int32_t len)
+{
+    if (!dst || len <= 0) {
+        return 0;
+    }
+
+    for (int32_t i=0; i < len; i++) {
+        bios_hle_write8(bus_state, dst + i, value);
+    }
+
+    return dst;
+}
+
+static uint32_t bios_hle_strlen(bus_state_t *bus_state, uint32_t src)
+{
+    uint32_t len = 0;
+
+    if (!src) {
+        return 0;
+    }
+
+    while (bios_hle_read8(bus_state, src + len)) {
+        len++;
+    }
+
+    return len;
+}
+
+/* TTY */
+
+static uint32_t bios_hle_puts(r3000_state_t *r3000_state, bus_state_t *bus_state, uint32_t src)
+{
+    char c;
+
+    if (!src) {
+        return 0;
+    }
+
+    while ((c = bios_hle_read8(bus_state, src++))) {
+        bios_tty_putchar(&r3000_state->tty, c);
+    }
+
+    return 1;
+}
+
+static uint32_t bios_hle_printf(r3000_state_t *r3000_state, bus_state_t *bus_state)
+{
+    uint32_t fmt = bios_hle_arg(r3000_state, bus_state, 0);
+    uint8_t arg = 1;
+    uint32_t count = 0;
+
+    char spec[32];
+    char str[256];
+    char out[512];
+
+    char c;
+
+    while ((c = bios_hle_read8(bus_state, fmt++))) {
+        if (c != '%') {
+            bios_tty_putchar(&r3000_state->tty, c);
+            count++;
+            continue;
+        }
+
+        // Rebuild the conversion for the host printf, lengths are dropped since everything is 32 bit
+        uint32_t start = fmt - 1;
+        uint8_t spec_len = 0;
+        spec[spec_len++] = '%';
+
+        while ((c = bios_hle_read8(bus_state, fmt++))) {
+            if (c == 'l' || c == 'h') {
+                continue;
+            }
+
+            // Only flags, width and precision, the host never sees %n or a floating point conversion
+            if (!strchr("-+ #0123456789.*", c) || spec_len >= sizeof(spec) - 12) {
+                break;
+            }
+
+            if (c == '*') {
+                spec_len += snprintf(spec + spec_len, sizeof(spec) - spec_len, "%d", (int32_t) bios_hle_arg(r3000_state, bus_state, arg++));
+            } else {
+                spec[spec_len++] = c;
+            }
+        }
+
+        // Anything else is printed as it is
+        if (!c || !strchr("diuoxXcsp%", c)) {
+            uint32_t end = c ? fmt : fmt - 1;
+
+            for (uint32_t addr=start; addr < end; addr++) {
+                bios_tty_putchar(&r3000_state->tty, bios_hle_read8(bus_state, addr));
+                count++;
+            }
+
+            if (!c) {
+                break;
+            }
+
+            continue;
+        }
+
+        spec[spec_len++] = c;
+        spec[spec_len] = 0;
+
+        int len;
+
+        switch(c) {
+            case 'd': case 'i':
+                len = snprintf(out, sizeof(out), spec, (int32_t) bios_hle_arg(r3000_state, bus_state, arg++));
+                break;
+
+            case 'u': case 'o': case 'x': case 'X': case 'c':
+                len = snprintf(out, sizeof(out), spec, bios_hle_arg(r3000_state, bus_state, arg++));
+                break;
+
+            case 'p':
+                spec[spec_len - 1] = 'x';
+                len = snprintf(out, sizeof(out), spec, bios_hle_arg(r3000_state, bus_state, arg++));
+                break;
+
+            case 's':
+                bios_hle_read_string(bus_state, bios_hle_arg(r3000_state, bus_state, arg++), str, sizeof(str));
+                len = snprintf(out, sizeof(out), spec, str);
+                break;
+
+            default:
+                len = snprintf(out, sizeof(out), "%%");
+                break;
+        }
+
+        if (len > (int) sizeof(out) - 1) {
+            len = sizeof(out) - 1;
+        }
+
+        for (int i=0; i < len; i++) {
+            bios_tty_putchar(&r3000_state->tty, out[i]);
+        }
+
+        count += len;
+    }
+
+    return count;
+}
+
+/* Events, the control blocks live in kernel RAM so the BIOS code sees the same state */
+
+static uint32_t bios_hle_evcb(bus_state_t *bus_state, uint32_t handle)
+{
+    uint32_t base = bios_hle_read32(bus_state, BIOS_HLE_EVCB_TABLE);
+    uint32_t count = bios_hle_read32(bus_state, BIOS_HLE_EVCB_TABLE + 4) / BIOS_HLE_EVCB_SIZE;
+    uint32_t index = handle & 0xFFFF;
+
+    if ((handle & 0xFFFF0000) != 0xF1000000 || index >= count) {
+        return 0;
+    }
+
+    return base + index * BIOS_HLE_EVCB_SIZE;
+}
+
+static uint32_t bios_hle_open_event(bus_state_t *bus_state, uint32_t class, uint32_t spec, uint32_t mode, uint32_t func)
+{
+    uint32_t base = bios_hle_read32(bus_state, BIOS_HLE_EVCB_TABLE);
+    uint32_t count = bios_hle_read32(bus_state, BIOS_HLE_EVCB_TABLE + 4) / BIOS_HLE_EVCB_SIZE;
+
+    for (uint32_t i=0; i < count; i++) {
+        uint32_t evcb = base + i * BIOS_HLE_EVCB_SIZE;
+
+        if (bios_hle_read32(bus_state, evcb + 0x04) != BIOS_EVENT_STATUS_FREE) {
+            continue;
+        }
+
+        bios_hle_write32(bus_state, evcb + 0x00, class);
+        bios_hle_write32(bus_state, evcb + 0x04, BIOS_EVENT_STATUS_DISABLED);
+        bios_hle_write32(bus_state, evcb + 0x08, spec);
+        bios_hle_write32(bus_state, evcb + 0x0C, mode);
+        bios_hle_write32(bus_state, evcb + 0x10, func);
+
+        return 0xF1000000 | i;
+    }
+
+    return 0xFFFFFFFF;
+}
+
+/* Only marks events ready, returns false if one of them wants its callback run */
+static bool bios_hle_deliver_event(bus_state_t *bus_state, uint32_t class, uint32_t spec)
+{
+    uint32_t base = bios_hle_read32(bus_state, BIOS_HLE_EVCB_TABLE);
+    uint32_t count = bios_hle_read32(bus_state, BIOS_HLE_EVCB_TABLE + 4) / BIOS_HLE_EVCB_SIZE;
+
+    for (int pass=0; pass < 2; pass++) {
+        for (uint32_t i=0; i < count; i++) {
+            uint32_t evcb = base + i * BIOS_HLE_EVCB_SIZE;
+
+            if (bios_hle_read32(bus_state, evcb + 0x00) != class || bios_hle_read32(bus_state, evcb + 0x08) != spec) {
+                continue;
+            }
+
+            if (bios_hle_read32(bus_state, evcb + 0x04) != BIOS_EVENT_STATUS_ENABLED) {
+                continue;
+            }
+
+            uint32_t mode = bios_hle_read32(bus_state, evcb + 0x0C);
+
+            if (!pass && mode == BIOS_EVENT_MODE_CALLBACK && bios_hle_read32(bus_state, evcb + 0x10)) {
+                return false;
+            }
+
+            if (pass && mode == BIOS_EVENT_MODE_READY) {
+                bios_hle_write32(bus_state, evcb + 0x04, BIOS_EVENT_STATUS_READY);
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool bios_hle_event(bus_state_t *bus_state, uint8_t function, uint32_t handle, uint32_t *result)
+{
+    uint32_t evcb = bios_hle_evcb(bus_state, handle);
+
+    if (!evcb) {
+        *result = 0;
+        return true;
+    }
+
+    uint32_t status = bios_hle_read32(bus_state, evcb + 0x04);
+
+    switch(function) {
+        case 0x09:
+            bios_hle_write32(bus_state, evcb + 0x04, BIOS_EVENT_STATUS_FREE);
+            *result = 1;
+            break;
+
+        case 0x0A:
+            // Busy events are waited on by the BIOS, interrupts have to come in meanwhile
+            if (status == BIOS_EVENT_STATUS_ENABLED) {
+                return false;
+            }
+            // Fall through
+
+        case 0x0B:
+            if (status == BIOS_EVENT_STATUS_READY) {
+                bios_hle_write32(bus_state, evcb + 0x04, BIOS_EVENT_STATUS_ENABLED);
+                *result = 1;
+            } else {
+                *result = 0;
+            }
+            break;
+
+        case 0x0C:
+            if (status != BIOS_EVENT_STATUS_FREE) {
+                bios_hle_write32(bus_state, evcb + 0x04, BIOS_EVENT_STATUS_ENABLED);
+            }
+
+            *result = 1;
+            break;
+
+        case 0x0D:
+            if (status != BIOS_EVENT_STATUS_FREE) {
+                bios_hle_write32(bus_state, evcb + 0x04, BIOS_EVENT_STATUS_DISABLED);
+            }
+
+            *result = 1;
+            break;
+    }
+
+    return true;
+}
+
+/* Threads, only opening and closing, switching needs the exception handler */
+
+static uint32_t bios_hle_open_thread(bus_state_t *bus_state, uint32_t pc, uint32_t sp, uint32_t gp)
+{
+    uint32_t base = bios_hle_read32(bus_state, BIOS_HLE_TCB_TABLE);
+    uint32_t count = bios_hle_read32(bus_state, BIOS_HLE_TCB_TABLE + 4) / BIOS_HLE_TCB_SIZE;
+
+    for (uint32_t i=0; i < count; i++) {
+        uint32_t tcb = base + i * BIOS_HLE_TCB_SIZE;
+
+        if (bios_hle_read32(bus_state, tcb) != BIOS_THREAD_STATUS_FREE) {
+            continue;
+        }
+
+        bios_hle_write32(bus_state, tcb, BIOS_THREAD_STATUS_USED);
+        bios_hle_write32(bus_state, tcb + 0x08 + (R3000_REG_GP << 2), gp);
+        bios_hle_write32(bus_state, tcb + 0x08 + (R3000_REG_SP << 2), sp);
+        bios_hle_write32(bus_state, tcb + 0x08 + (R3000_REG_FP << 2), sp);
+        bios_hle_write32(bus_state, tcb + 0x88, pc);
+
+        return 0xFF000000 | i;
+    }
+
+    return 0xFFFFFFFF;
+}
+
+static uint32_t bios_hle_close_thread(bus_state_t *bus_state, uint32_t handle)
+{
+    uint32_t base = bios_hle_read32(bus_state, BIOS_HLE_TCB_TABLE);
+    uint32_t count = bios_hle_read32(bus_state, BIOS_HLE_TCB_TABLE + 4) / BIOS_HLE_TCB_SIZE;
+    uint32_t index = handle & 0xFFFF;
+
+    // Only handles OpenThread gave out are closed
+    if ((handle & 0xFFFF0000) != 0xFF000000 || index >= count) {
+        return 0;
+    }
+
+    bios_hle_write32(bus_state, base + index * BIOS_HLE_TCB_SIZE, BIOS_THREAD_STATUS_FREE);
+
+    return 1;
+}
+
+/* Files, "cdrom:" paths come from the host directory instead of the disc */
+
+static bool bios_hle_path(bios_hle_t *hle, const char *name, char *path, uint32_t size)
+{
+    const char *colon = strchr(name, ':');
+
+    if (!colon || strncasecmp(name, "cdrom", 5)) {
+        return false;
+    }
+
+    name = colon + 1;
+
+    while (*name == '\\' || *name == '/') {
+        name++;
+    }
+
+    if (strstr(name, "..")) {
+        return false;
+    }
+
+    uint32_t len = snprintf(path, size, "%s/", hle->dir);
+
+    // Backslashes become separators and the ";1" version suffix is dropped
+    for (; *name && *name != ';' && len + 1 < size; name++) {
+        path[len++] = (*name == '\\') ? '/' : *name;
+    }
+
+    path[len] = 0;
+
+    return true;
+}
+
+static FILE *bios_hle_file(bios_hle_t *hle, uint32_t fd)
+{
+    if (fd < BIOS_HLE_FILE_BASE || fd >= BIOS_HLE_FILE_BASE + BIOS_HLE_FILES) {
+        return NULL;
+    }
+
+    return hle->files[fd - BIOS_HLE_FILE_BASE];
+}
+
+static bool bios_hle_open(bios_hle_t *hle, bus_state_t *bus_state, uint32_t name_addr, uint32_t mode, uint32_t *result)
+{
+    char name[128];
+    char path[512];
+
+    bios_hle_read_string(bus_state, name_addr, name, sizeof(name));
+
+    // Other devices stay with the BIOS
+    if (!bios_hle_path(hle, name, path, sizeof(path))) {
+        return false;
+    }
+
+    *result = 0xFFFFFFFF;
+
+    for (int i=0; i < BIOS_HLE_FILES; i++) {
+        if (hle->files[i]) {
+            continue;
+        }
+
+        if (mode & BIOS_FILE_MODE_CREATE) {
+            hle->files[i] = fopen(path, "w+b");
+        } else if (mode & BIOS_FILE_MODE_WRITE) {
+            hle->files[i] = fopen(path, "r+b");
+        } else {
+            hle->files[i] = fopen(path, "rb");
+        }
+
+        if (hle->files[i]) {
+            *result = BIOS_HLE_FILE_BASE + i;
+        }
+
+        log_debug(LOG_BIOS_HLE, "HLE", "open(%s, %x) -> %s (%x)\n", name, mode, path, *result);
+
+        break;
+    }
+
+    return true;
+}
+
+static bool bios_hle_file_call(bios_hle_t *hle, r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t function, uint32_t *result)
+{
+    uint32_t *regs = r3000_state->regs;
+
+    if (!hle->dir) {
+        return false;
+    }
+
+    if (function == 0) {
+        return bios_hle_open(hle, bus_state, regs[R3000_REG_A0], regs[R3000_REG_A1], result);
+    }
+
+    // Handles the BIOS opened itself
+    FILE *file = bios_hle_file(hle, regs[R3000_REG_A0]);
+
+    if (!file) {
+        return false;
+    }
+
+    uint8_t buf[0x800];
+
+    uint32_t addr = regs[R3000_REG_A1];
+    uint32_t len = regs[R3000_REG_A2];
+
+    // A negative length fails the read or write like on the BIOS
+    if ((function == 2 || function == 3) && (int32_t) len < 0) {
+        *result = 0xFFFFFFFF;
+        return true;
+    }
+
+    switch(function) {
+        case 1:
+            if (regs[R3000_REG_A2] > 1 || fseek(file, (int32_t) regs[R3000_REG_A1], regs[R3000_REG_A2] ? SEEK_CUR : SEEK_SET)) {
+                *result = 0xFFFFFFFF;
+            } else {
+                *result = ftell(file);
+            }
+            break;
+
+        case 2:
+            *result = 0;
+
+            while (len > 0) {
+                uint32_t chunk = len < sizeof(buf) ? len : sizeof(buf);
+                uint32_t read = fread(buf, 1, chunk, file);
+
+                for (uint32_t i=0; i < read; i++) {
+                    bios_hle_write8(bus_state, addr++, buf[i]);
+                }
+
+                *result += read;
+                len -= read;
+
+                if (read < sizeof(buf)) {
+                    break;
+                }
+            }
+            break;
+
+        case 3:
+            *result = 0;
+
+            while (len > 0) {
+                uint32_t chunk = len < sizeof(buf) ? len : sizeof(buf);
+
+                for (uint32_t i=0; i < chunk; i++) {
+                    buf[i] = bios_hle_read8(bus_state, addr++);
+                }
+
+                uint32_t written = fwrite(buf, 1, chunk, file);
+
+                *result += written;
+                len -= chunk;
+
+                if (written < chunk) {
+                    break;
+                }
+            }
+            break;
+
+        case 4:
+            fclose(file);
+            hle->files[regs[R3000_REG_A0] - BIOS_HLE_FILE_BASE] = NULL;
+
+            *result = regs[R3000_REG_A0];
+            break;
+    }
+
+    return true;
+}
+
+static bool bios_hle_a0(bios_hle_t *hle, r3000_state_t *r3000_state, bus_state_t *bus_state, uint32_t function, uint32_t *result)
+{
+    uint32_t *regs = r3000_state->regs;
+
+    switch(function) {
+        case 0x00: case 0x01: case 0x02: case 0x03: case 0x04:
+            return bios_hle_file_call(hle, r3000_state, bus_state, function, result);
+
+        case 0x1B:
+            *result = bios_hle_strlen(bus_state, regs[R3000_REG_A0]);
+            return true;
+
+        case 0x2A:
+            *result = bios_hle_memcpy(bus_state, regs[R3000_REG_A0], regs[R3000_REG_A1], regs[R3000_REG_A2]);
+            return true;
+
+        case 0x2B:
+            *result = bios_hle_memset(bus_state, regs[R3000_REG_A0], regs[R3000_REG_A1], regs[R3000_REG_A2]);
+            return true;
+
+        case 0x3C:
+            bios_tty_putchar(&r3000_state->tty, regs[R3000_REG_A0]);
+            *result = regs[R3000_REG_A0];
+            return true;
+
+        case 0x3E:
+            *result = bios_hle_puts(r3000_state, bus_state, regs[R3000_REG_A0]);
+            return true;
+
+        case 0x3F:
+            *result = bios_hle_printf(r3000_state, bus_state);
+            return true;
+
+        case 0x44:
+            // Drops the RAM blocks the same way an isolated cache flush does
+            if (bus_state->block_cache) {
+                bus_state->block_cache->flush_pending = true;
+            }
+
+            *result = 0;
+            return true;
+    }
+
+    return false;
+}
+
+static bool bios_hle_b0(bios_hle_t *hle, r3000_state_t *r3000_state, bus_state_t *bus_state, uint32_t function, uint32_t *result)
+{
+    uint32_t *regs = r3000_state->regs;
+
+    switch(function) {
+        case 0x07:
+            *result = 0;
+            return bios_hle_deliver_event(bus_state, regs[R3000_REG_A0], regs[R3000_REG_A1]);
+
+        case 0x08:
+            *result = bios_hle_open_event(bus_state, regs[R3000_REG_A0], regs[R3000_REG_A1], regs[R3000_REG_A2], regs[R3000_REG_A3]);
+            return true;
+
+        case 0x09: case 0x0A: case 0x0B: case 0x0C: case 0x0D:
+            return bios_hle_event(bus_state, function, regs[R3000_REG_A0], result);
+
+        case 0x0E:
+            *result = bios_hle_open_thread(bus_state, regs[R3000_REG_A0], regs[R3000_REG_A1], regs[R3000_REG_A2]);
+            return true;
+
+        case 0x0F:
+            *result = bios_hle_close_thread(bus_state, regs[R3000_REG_A0]);
+            return true;
+
+        case 0x32: case 0x33: case 0x34: case 0x35: case 0x36:
+            return bios_hle_file_call(hle, r3000_state, bus_state, function - 0x32, result);
+
+        case 0x3D:
+            bios_tty_putchar(&r3000_state->tty, regs[R3000_REG_A0]);
+            *result = regs[R3000_REG_A0];
+            return true;
+
+        case 0x3F:
+            *result = bios_hle_puts(r3000_state, bus_state, regs[R3000_REG_A0]);
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Called when the CPU gets to one of the kernel call vectors. Handles the call
+ * natively and returns to ra like the BIOS function would, or returns false to
+ * leave it to the BIOS code.
+ */
+bool bios_hle_call(bios_hle_t *hle, r3000_state_t *r3000_state, bus_state_t *bus_state)
+{
+    uint32_t table = r3000_state->pc;
+    uint32_t function = r3000_state->regs[R3000_REG_T1];
+    uint32_t result = 0;
+    bool handled = false;
+
+    // A load from the delay slot of the call lands first
+    if (r3000_state->load_reg) {
+        r3000_state->regs[r3000_state->load_reg] = r3000_state->load_value;
+        r3000_state->load_reg = 0;
+    }
+
+    switch(table) {
+        case 0xA0:
+            handled = bios_hle_a0(hle, r3000_state, bus_state, function, &result);
+            break;
+
+        case 0xB0:
+            handled = bios_hle_b0(hle, r3000_state, bus_state, function, &result);
+            break;
+    }
+
+    if (!handled) {
+        return false;
+    }
+
+    log_debug(LOG_BIOS_HLE, "HLE", "%X(%02X) | a0: %x a1: %x a2: %x -> %x\n", table, function, r3000_state->regs[R3000_REG_A0], r3000_state->regs[R3000_REG_A1], r3000_state->regs[R3000_REG_A2], result);
+
+    r3000_state->regs[R3000_REG_V0] = result;
+
+    r3000_state->pc_instruction = r3000_state->regs[R3000_REG_RA];
+    r3000_state->pc = r3000_state->regs[R3000_REG_RA];
+    r3000_state->pc_next = r3000_state->regs[R3000_REG_RA] + 4;
+
+    r3000_state->cycles += BIOS_HLE_CYCLES;
+    r3000_state->idle_cycles += BIOS_HLE_CYCLES;
+
+    return true;
+}
@@ -1,9 +1,18 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
 #include "bus/bus.h"
 #include "cpu/r3000.h"
+#include "cpu/block_cache.h"
+#include "core/instrument.h"
 #include "log.h"
 
 const char *BUS_SIZE_names[] = {
@@ -31,7 +40,23 @@ const char *dma_reg_names[] = {
     "MADR", "", "", "", "BCR", "", "", "", "CHCR"
 };
 
-void dma_set_irq(dma_state_t *state, dma_channel_state_t *channel_state, uint8_t channel_type)
+/* DICR bit 31, raises the DMA interrupt when it goes up */
+void dma_update_irq(dma_state_t *state, irq_state_t *irq_state)
+{
+    bool master = state->dicr & (1 << 15);
+
+    if ((state->dicr & DMA_DICR_IRQ_MASTER_ENABLE) && (state->dicr & (state->dicr << 8) & 0x7F000000)) {
+        master = true;
+    }
+
+    if (master && !(state->dicr & DMA_DICR_IRQ_MASTER)) {
+        irq_raise(irq_state, IRQ_DMA);
+    }
+
+    state->dicr = master ? (state->dicr | DMA_DICR_IRQ_MASTER) : (state->dicr & ~DMA_DICR_IRQ_MASTER);
+}
+
+void dma_set_irq(dma_state_t *state, dma_channel_state_t *channel_state, uint8_t channel_type, bus_state_t *bus_state)
 {
     bool irq_enabled = state->dicr & (1 << (16 + channel_type));
     
@@ -39,9 +64,11 @@ void dma_set_irq(dma_state_t *state, dma_channel_state_t *channel_state, uint8_t
         // Set irq flag
         state->dicr |= (1 << (24 + channel_type));
     }
+
+    dma_update_irq(state, &bus_state->irq_state);
 }
 
-void dma_transfer_words(dma_state_t *state, dma_channel_state_t *channel_state, uint8_t channel_type, bus_state_t *bus_state)
+uint32_t dma_transfer_words(dma_state_t *state, dma_channel_state_t *channel_state, uint8_t channel_type, bus_state_t *bus_state)
 {
     uint32_t words = 0;
 
@@ -52,9 +79,7 @@ void dma_transfer_words(dma_state_t *state, dma_channel_state_t *channel_state,
         words = (channel_state->bcr & 0x0000FFFF) * ((channel_state->bcr >> 16) & 0x0000FFFF);
     }
 
-    #ifdef LOG_DEBUG_DMA
-    log_debug("DMA", "Transfering %d words | sync_mode: %d | madr: %08X\n", words, sync_mode, channel_state->madr);
-    #endif
+    log_debug(LOG_DMA, "DMA", "Transfering %d words | sync_mode: %d | madr: %08X\n", words, sync_mode, channel_state->madr);
 
     uint32_t addr = channel_state->madr;
     int8_t addr_step = (channel_state->chcr & DMA_CHANNEL_CHCR_ADDR_STEP) ? -4 : 4;
@@ -91,20 +116,23 @@ void dma_transfer_words(dma_state_t *state, dma_channel_state_t *channel_state,
     
         addr = (addr + addr_step);
     }
+
+    return words;
 }
 
-void dma_transfer_linked_list(dma_state_t *state, dma_channel_state_t *channel_state, bus_state_t *bus_state)
+uint32_t dma_transfer_linked_list(dma_state_t *state, dma_channel_state_t *channel_state, bus_state_t *bus_state)
 {
-    #ifdef LOG_DEBUG_DMA
-    log_debug("DMA", "Transfering linked list from %08X\n", channel_state->madr);
-    #endif
+    log_debug(LOG_DMA, "DMA", "Transfering linked list from %08X\n", channel_state->madr);
 
     uint32_t addr = channel_state->madr & 0x1FFFFC;
+    uint32_t words = 0;
 
     while(true) {
         uint32_t node_header = bus_read(bus_state, BUS_SIZE_DWORD, addr);
         uint32_t word_count = (node_header >> 24);
 
+        words += word_count + 1;
+
         //printf("%08X | words: %d next_addr: %x\n", addr, word_count, node_header & 0x1FFFFC);
 
         // Read all words that belong to this node
@@ -118,47 +146,94 @@ void dma_transfer_linked_list(dma_state_t *state, dma_channel_state_t *channel_s
         }
 
         if (node_header & (1 << 23)) {
-            #ifdef LOG_DEBUG_DMA
-            log_debug("DMA", "End of linked list\n");
-            #endif
+            log_debug(LOG_DMA, "DMA", "End of linked list\n");
 
             break;
         }
 
         addr = (node_header & 0x1FFFFC);
     }
+
+    return words;
+}
+
+/* Puts the DMA event at the first running channel to finish */
+void dma_schedule(dma_state_t *state, bus_state_t *bus_state)
+{
+    uint64_t next = SCHEDULER_NEVER;
+
+    for (uint8_t channel_type=0; channel_type < 7; channel_type++) {
+        dma_channel_state_t *channel_state = &state->channels[channel_type];
+
+        if ((channel_state->chcr & DMA_CHANNEL_CHCR_START_BUSY) && channel_state->end < next) {
+            next = channel_state->end;
+        }
+    }
+
+    if (next == SCHEDULER_NEVER) {
+        scheduler_cancel(&bus_state->scheduler, SCHEDULER_EVENT_DMA);
+    } else {
+        scheduler_schedule(&bus_state->scheduler, SCHEDULER_EVENT_DMA, next);
+    }
+}
+
+/* Scheduler event, finishes every channel that is done by now */
+void dma_event(void *data, uint64_t cycles)
+{
+    bus_state_t *bus_state = (bus_state_t *) data;
+    dma_state_t *state = &bus_state->dma_state;
+
+    instrument_begin(INSTRUMENT_DMA);
+
+    for (uint8_t channel_type=0; channel_type < 7; channel_type++) {
+        dma_channel_state_t *channel_state = &state->channels[channel_type];
+
+        if ((channel_state->chcr & DMA_CHANNEL_CHCR_START_BUSY) && channel_state->end <= cycles) {
+            channel_state->chcr &= ~DMA_CHANNEL_CHCR_START_BUSY;
+
+            dma_set_irq(state, channel_state, channel_type, bus_state);
+        }
+    }
+
+    dma_schedule(state, bus_state);
+
+    instrument_end();
 }
 
 void dma_transfer(dma_state_t *state, dma_channel_state_t *channel_state, uint8_t channel_type, bus_state_t *bus_state)
 {
     /* Calculate the amount of words we need to transfer */
     uint8_t sync_mode = (channel_state->chcr >> 9) & 0x3;
+    uint32_t words = 0;
+
+    instrument_begin(INSTRUMENT_DMA);
 
     switch(sync_mode) {
         case 0:
-            dma_transfer_words(state, channel_state, channel_type, bus_state);
+            words = dma_transfer_words(state, channel_state, channel_type, bus_state);
             break;
 
         case 1:
-            dma_transfer_words(state, channel_state, channel_type, bus_state);
+            words = dma_transfer_words(state, channel_state, channel_type, bus_state);
             break;
 
         case 2:
-            dma_transfer_linked_list(state, channel_state, bus_state);
+            words = dma_transfer_linked_list(state, channel_state, bus_state);
             break;
     }
 
-    dma_set_irq(state, channel_state, channel_type);
-
-    channel_state->chcr &= ~DMA_CHANNEL_CHCR_START_BUSY;
+    // The data moves right away, the channel stays busy for about a cycle per word
+    channel_state->end = scheduler_cycles(&bus_state->scheduler, *bus_state->cycles) + words;
     channel_state->chcr &= ~DMA_CHANNEL_CHCR_TRIGGER;
+
+    dma_schedule(state, bus_state);
+
+    instrument_end();
 }
 
 void dma_channel_write(dma_state_t *state, dma_channel_state_t *channel_state, uint8_t channel_type, bus_state_t *bus_state, uint8_t reg, uint32_t value)
 {
-    #ifdef LOG_DEBUG_DMA
-    log_debug("DMA", "%08X -> %s %s\n", value, dma_channel_names[channel_type], dma_reg_names[reg]);
-    #endif
+    log_debug(LOG_DMA, "DMA", "%08X -> %s %s\n", value, dma_channel_names[channel_type], dma_reg_names[reg]);
 
     switch(reg) {
         case DMA_CHANNEL_REG_MADR:
@@ -199,29 +274,28 @@ uint32_t dma_channel_read(dma_state_t *state, dma_channel_state_t *channel_state
             break;
     }
 
-    #ifdef LOG_DEBUG_DMA
-    log_debug("DMA", "%08X <- %s %s\n", result, dma_channel_names[channel_type], dma_reg_names[reg]);
-    #endif
+    log_debug(LOG_DMA, "DMA", "%08X <- %s %s\n", result, dma_channel_names[channel_type], dma_reg_names[reg]);
 
     return result;
 }
 
 void dma_write_dpcr(dma_state_t *dma_state, uint32_t value)
 {
-    #ifdef LOG_DEBUG_DMA
-    log_debug("DMA", "%08X -> DPCR\n", value);
-    #endif
+    log_debug(LOG_DMA, "DMA", "%08X -> DPCR\n", value);
 
     dma_state->dpcr = value;
 }
 
-void dma_write_dicr(dma_state_t *dma_state, uint32_t value)
+void dma_write_dicr(dma_state_t *dma_state, bus_state_t *bus_state, uint32_t value)
 {
-    #ifdef LOG_DEBUG_DMA
-    log_debug("DMA", "%08X -> DICR\n", value);
-    #endif
+    log_debug(LOG_DMA, "DMA", "%08X -> DICR\n", value);
+
+    // Flags are acknowledged by writing 1, the master flag is read only
+    uint32_t flags = dma_state->dicr & ~value & 0x7F000000;
 
-    dma_state->dicr = value;
+    dma_state->dicr = (value & 0x00FFFFFF) | flags | (dma_state->dicr & DMA_DICR_IRQ_MASTER);
+
+    dma_update_irq(dma_state, &bus_state->irq_state);
 }
 
 void dma_write(dma_state_t *dma_state, bus_state_t *bus_state, uint32_t addr, uint32_t value)
@@ -250,7 +324,7 @@ void dma_write(dma_state_t *dma_state, bus_state_t *bus_state, uint32_t addr, ui
             if ((addr & 0xF) == 0) {
                 dma_write_dpcr(dma_state, value);
             } else if ((addr & 0xF) == 4) {
-                dma_write_dicr(dma_state, value);
+                dma_write_dicr(dma_state, bus_state, value);
             }
 
             break;
@@ -285,15 +359,11 @@ uint32_t dma_read(dma_state_t *dma_state, uint32_t addr)
             if ((addr & 0xF) == 0) {
                 result = dma_state->dpcr;
 
-                #ifdef LOG_DEBUG_DMA
-                log_debug("DMA", "%08X <- DPCR\n", result);
-                #endif
+                log_debug(LOG_DMA, "DMA", "%08X <- DPCR\n", result);
             } else if ((addr & 0xF) == 4) {
                 result = dma_state->dicr;
 
-                #ifdef LOG_DEBUG_DMA
-                log_debug("DMA", "%08X <- DICR\n", result);
-                #endif
+                log_debug(LOG_DMA, "DMA", "%08X <- DICR\n", result);
             }
 
             break;
@@ -302,138 +372,277 @@ uint32_t dma_read(dma_state_t *dma_state, uint32_t addr)
     return result;
 }
 
-uint32_t bus_read(bus_state_t *state, uint8_t size, uint32_t addr)
+/*
+ * Reserves a window for the whole physical address space and maps RAM with its
+ * mirrors, scratchpad and BIOS into it from one memfd. Everything else stays
+ * inaccessible, so IO accesses fault and the JIT sends them down the slow path.
+ */
+static bool bus_map_fastmem(bus_state_t *state)
 {
-    uint32_t result = 0;
+    #ifdef __linux__
+    // File layout: RAM, BIOS, scratchpad
+    const off_t bios_offset = BUS_RAM_SIZE;
+    const off_t scratchpad_offset = BUS_RAM_SIZE + BUS_BIOS_SIZE;
 
-    uint32_t phy_addr = addr & bus_segment_map[addr >> 29];
+    int fd = memfd_create("mdpsx", 0);
 
-    if (phy_addr >= 0x00000000 && phy_addr <= 0x001FFFFF) {
-        if (size == BUS_SIZE_BYTE) {
-            result = *((uint8_t *) &state->ram[phy_addr & 0x1FFFFF]);
-        } else if (size == BUS_SIZE_WORD) {
-            result = *((uint16_t *) &state->ram[phy_addr & 0x1FFFFF]);
-        } else {
-            result = *((uint32_t *) &state->ram[phy_addr & 0x1FFFFF]);
-        }
-    } else if (phy_addr >= 0x1F800000 && phy_addr <= 0x1F8003FF) {
-        if (size == BUS_SIZE_BYTE) {
-            result = *((uint8_t *) &state->scratchpad[phy_addr & 0x3FF]);
-        } else if (size == BUS_SIZE_WORD) {
-            result = *((uint16_t *) &state->scratchpad[phy_addr & 0x3FF]);
-        } else {
-            result = *((uint32_t *) &state->scratchpad[phy_addr & 0x3FF]);
-        }
-    } else if (phy_addr == 0x1F801070) {
-        result = state->i_stat;
-    } else if (phy_addr == 0x1F801074) {
-        result = state->i_mask;
+    if (fd < 0) {
+        return false;
+    }
+
+    if (ftruncate(fd, scratchpad_offset + BUS_PAGE_SIZE) < 0) {
+        close(fd);
+        return false;
+    }
+
+    uint8_t *window = mmap(NULL, BUS_FASTMEM_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    uint8_t *bios = mmap(NULL, BUS_BIOS_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, bios_offset);
+    bool mapped = window != MAP_FAILED && bios != MAP_FAILED;
+
+    for (uint32_t addr=0; mapped && addr < BUS_RAM_MIRROR_SIZE; addr += BUS_RAM_SIZE) {
+        mapped = mmap(window + addr, BUS_RAM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED;
+    }
+
+    mapped = mapped && mmap(window + BUS_SCRATCHPAD_BASE, BUS_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, scratchpad_offset) != MAP_FAILED;
+    mapped = mapped && mmap(window + BUS_BIOS_BASE, BUS_BIOS_SIZE, PROT_READ, MAP_SHARED | MAP_FIXED, fd, bios_offset) != MAP_FAILED;
+
+    // The mappings keep the memory alive
+    close(fd);
+
+    if (!mapped) {
+        if (window != MAP_FAILED) munmap(window, BUS_FASTMEM_SIZE);
+        if (bios != MAP_FAILED) munmap(bios, BUS_BIOS_SIZE);
+
+        return false;
+    }
+
+    state->fastmem = window;
+    state->ram = window;
+    state->scratchpad = window + BUS_SCRATCHPAD_BASE;
+
+    // Writable view of the ROM to load it
+    state->bios = bios;
+
+    return true;
+    #else
+    return false;
+    #endif
+}
+
+void bus_init(bus_state_t *state, bool fastmem)
+{
+    state->fastmem = NULL;
+
+    if (!fastmem || !bus_map_fastmem(state)) {
+        state->ram = (uint8_t *) calloc(1, BUS_RAM_SIZE);
+        state->bios = (uint8_t *) malloc(BUS_BIOS_SIZE);
+
+        // Only the first 1 KiB is scratchpad, the rest of the page is never used
+        state->scratchpad = (uint8_t *) calloc(1, BUS_PAGE_SIZE);
+    }
+
+    state->read_pages = (uint8_t **) calloc(BUS_PAGE_COUNT, sizeof(uint8_t *));
+    state->write_pages = (uint8_t **) calloc(BUS_PAGE_COUNT, sizeof(uint8_t *));
+
+    // RAM and its mirrors
+    for (uint32_t addr=0; addr < BUS_RAM_MIRROR_SIZE; addr += BUS_PAGE_SIZE) {
+        state->read_pages[addr >> BUS_PAGE_SHIFT] = &state->ram[addr & (BUS_RAM_SIZE - 1)];
+        state->write_pages[addr >> BUS_PAGE_SHIFT] = &state->ram[addr & (BUS_RAM_SIZE - 1)];
+    }
+
+    state->read_pages[BUS_SCRATCHPAD_BASE >> BUS_PAGE_SHIFT] = state->scratchpad;
+    state->write_pages[BUS_SCRATCHPAD_BASE >> BUS_PAGE_SHIFT] = state->scratchpad;
+
+    // BIOS is read only, writes are dropped by the IO handler
+    for (uint32_t addr=0; addr < BUS_BIOS_SIZE; addr += BUS_PAGE_SIZE) {
+        state->read_pages[(BUS_BIOS_BASE + addr) >> BUS_PAGE_SHIFT] = &state->bios[addr];
+    }
+
+    // Devices raise their interrupts straight into the controller
+    state->timer_state.irq_state = &state->irq_state;
+    state->gpu_state.irq_state = &state->irq_state;
+
+    // and put their future work on the scheduler
+    scheduler_init(&state->scheduler);
+    scheduler_register(&state->scheduler, SCHEDULER_EVENT_VBLANK, gpu_vblank, &state->gpu_state);
+    scheduler_register(&state->scheduler, SCHEDULER_EVENT_TIMER, timer_event, &state->timer_state);
+    scheduler_register(&state->scheduler, SCHEDULER_EVENT_DMA, dma_event, state);
+
+    state->timer_state.scheduler = &state->scheduler;
+    state->timer_state.gpu_state = &state->gpu_state;
+    state->gpu_state.scheduler = &state->scheduler;
+
+    scheduler_schedule(&state->scheduler, SCHEDULER_EVENT_VBLANK, gpu_line_cycles(&state->gpu_state, gpu_vblank_line(&state->gpu_state)));
+    state->next_event = 0;
+}
+
+void bus_destroy(bus_state_t *state)
+{
+    if (state->fastmem) {
+        #ifdef __linux__
+        munmap(state->fastmem, BUS_FASTMEM_SIZE);
+        munmap(state->bios, BUS_BIOS_SIZE);
+        #endif
+    } else {
+        free(state->ram);
+        free(state->bios);
+        free(state->scratchpad);
+    }
+
+    free(state->read_pages);
+    free(state->write_pages);
+}
+
+static uint32_t bus_read_io(bus_state_t *state, uint32_t phy_addr)
+{
+    uint32_t result = 0;
+
+    if (phy_addr == 0x1F801070 || phy_addr == 0x1F801074) {
+        result = irq_read(&state->irq_state, phy_addr);
     } else if (phy_addr >= 0x1F801080 && phy_addr <= 0x1F8010FC) {
         result = dma_read(&state->dma_state, phy_addr);
     } else if (phy_addr >= 0x1F801100 && phy_addr <= 0x1F801128) {
+        timer_sync(&state->timer_state, *state->cycles);
         result = timer_read(&state->timer_state, phy_addr);
     } else if (phy_addr >= 0x1F801800 && phy_addr <= 0x1F801803) {
-        printf("cdrom: %x\n", phy_addr);
+        log_debug(LOG_CDROM, "CDROM", "Read %x\n", phy_addr);
     } else if (phy_addr == 0x1F801810 || phy_addr == 0x1F801814) {
         result = gpu_read(&state->gpu_state, phy_addr);
-    } else if (phy_addr >= 0x1FC00000 && phy_addr <= 0x1FC7FFFF) {
-        if (size == BUS_SIZE_BYTE) {
-            result = *((uint8_t *) &state->bios[phy_addr & 0x7FFFF]);
-        } else if (size == BUS_SIZE_WORD) {
-            result = *((uint16_t *) &state->bios[phy_addr & 0x7FFFF]);
-        } else {
-            result = *((uint32_t *) &state->bios[phy_addr & 0x7FFFF]);
-        }
     } else {
         //printf("else read: %x\n", phy_addr);
     }
 
-    #ifdef LOG_DEBUG_BUS_READ
-    log_debug("BUS", "%08x <- %08x (%08x)\n", result, addr, phy_addr);
-    #endif
-
     return result;
 }
 
-void bus_write(bus_state_t *state, uint8_t size, uint32_t addr, uint32_t value)
+static void bus_write_io(bus_state_t *state, uint32_t phy_addr, uint32_t value)
 {
-    uint32_t phy_addr = addr & bus_segment_map[addr >> 29];
-
-    if (phy_addr >= 0x00000000 && phy_addr <= 0x001FFFFF) {
-        if (size == BUS_SIZE_BYTE) {
-            *((uint8_t *) &state->ram[phy_addr & 0x1FFFFF]) = value;
-        } else if (size == BUS_SIZE_WORD) {
-            *((uint16_t *) &state->ram[phy_addr & 0x1FFFFF]) = value;
-        } else {
-            *((uint32_t *) &state->ram[phy_addr & 0x1FFFFF]) = value;
-        }
-    } else if (phy_addr >= 0x1F800000 && phy_addr <= 0x1F8003FF) {
-        if (size == BUS_SIZE_BYTE) {
-            *((uint8_t *) &state->scratchpad[phy_addr & 0x400]) = value;
-        } else if (size == BUS_SIZE_WORD) {
-            *((uint16_t *) &state->scratchpad[phy_addr & 0x400]) = value;
-        } else {
-            *((uint32_t *) &state->scratchpad[phy_addr & 0x400]) = value;
-        }
-    } else if (phy_addr == 0x1F801008) {
-        #ifdef LOG_DEBUG_BUS_WRITE_IO
-        log_debug("BUS", "%x -> EXP1_DELAY (unused)\n", value);
-        #endif
+    if (phy_addr == 0x1F801008) {
+        log_debug(LOG_BUS_WRITE_IO, "BUS", "%x -> EXP1_DELAY (unused)\n", value);
     } else if (phy_addr == 0x1F801010) {
-        #ifdef LOG_DEBUG_BUS_WRITE_IO
-        log_debug("BUS", "%x -> BIOS_DELAY (unused)\n", value);
-        #endif
+        log_debug(LOG_BUS_WRITE_IO, "BUS", "%x -> BIOS_DELAY (unused)\n", value);
     } else if (phy_addr == 0x1F801014) {
-        #ifdef LOG_DEBUG_BUS_WRITE_IO
-        log_debug("BUS", "%x -> SPU_DELAY (unused)\n", value);
-        #endif
+        log_debug(LOG_BUS_WRITE_IO, "BUS", "%x -> SPU_DELAY (unused)\n", value);
     } else if (phy_addr == 0x1F801018) {
-        #ifdef LOG_DEBUG_BUS_WRITE_IO
-        log_debug("BUS", "%x -> CDROM_DELAY (unused)\n", value);
-        #endif
+        log_debug(LOG_BUS_WRITE_IO, "BUS", "%x -> CDROM_DELAY (unused)\n", value);
     } else if (phy_addr == 0x1F80101C) {
-        #ifdef LOG_DEBUG_BUS_WRITE_IO
-        log_debug("BUS", "%x -> EXP2_DELAY (unused)\n", value);
-        #endif
+        log_debug(LOG_BUS_WRITE_IO, "BUS", "%x -> EXP2_DELAY (unused)\n", value);
     } else if (phy_addr == 0x1F801020) {
-        #ifdef LOG_DEBUG_BUS_WRITE_IO
-        log_debug("BUS", "%x -> COM_DELAY (unused)\n", value);
-        #endif
-    } else if (phy_addr == 0x1F801070) {
-        #ifdef LOG_DEBUG_BUS_WRITE_IO
-        state->i_stat = value;
-
-        log_debug("BUS", "%x -> I_STAT\n", value);
-        #endif
-    } else if (phy_addr == 0x1F801074) {
-        #ifdef LOG_DEBUG_BUS_WRITE_IO
-        state->i_mask = value;
-
-        log_debug("BUS", "%x -> I_MASK\n", value);
-        #endif
+        log_debug(LOG_BUS_WRITE_IO, "BUS", "%x -> COM_DELAY (unused)\n", value);
+    } else if (phy_addr == 0x1F801070 || phy_addr == 0x1F801074) {
+        irq_write(&state->irq_state, phy_addr, value);
     } else if (phy_addr >= 0x1F801080 && phy_addr <= 0x1F8010FC) {
         dma_write(&state->dma_state, state, phy_addr, value);
+
+        // A transfer that was started finishes with an event
+        bus_sync(state, *state->cycles);
     } else if (phy_addr >= 0x1F801100 && phy_addr <= 0x1F801128) {
+        timer_sync(&state->timer_state, *state->cycles);
         timer_write(&state->timer_state, phy_addr, value);
+
+        // A new target or mode can move the next timer interrupt
+        timer_schedule(&state->timer_state);
+        bus_sync(state, *state->cycles);
     } else if (phy_addr >= 0x1F801800 && phy_addr <= 0x1F801803) {
-        printf("cdrom: %x\n", phy_addr);
-    } else if (phy_addr == 0x1F801810 || phy_addr == 0x1F801814) {
+        log_debug(LOG_CDROM, "CDROM", "%02x -> %x\n", value, phy_addr);
+    } else if (phy_addr == 0x1F801810) {
         gpu_write(&state->gpu_state, phy_addr, value);
+    } else if (phy_addr == 0x1F801814) {
+        // The display mode sets the dot clock and scanline length the timers can count
+        timer_sync(&state->timer_state, *state->cycles);
+        gpu_write(&state->gpu_state, phy_addr, value);
+
+        timer_schedule(&state->timer_state);
+        bus_sync(state, *state->cycles);
     } else if (phy_addr >= 0x1F801C00 && phy_addr <= 0x1F801FFF) {
         //printf("spu %x %x\n", phy_addr, value);
     } else if (phy_addr == 0x1F802041) {
-        #ifdef LOG_DEBUG_BUS_WRITE_IO
-        log_debug("BUS", "POST %x\n", value);
-        #endif
+        log_debug(LOG_BUS_WRITE_IO, "BUS", "POST %x\n", value);
     } else if (phy_addr == 0xFFFE0130) {
-        #ifdef LOG_DEBUG_BUS_WRITE_IO
-        log_debug("BUS", "%x -> Cache Control\n", value);
-        #endif
+        log_debug(LOG_BUS_WRITE_IO, "BUS", "%x -> Cache Control\n", value);
     } else {
         //printf("else write: %x\n", phy_addr);
     }
+}
 
-    #ifdef LOG_DEBUG_BUS_WRITE
-    log_debug("BUS", "%08x -> %08x (%08x) | test: %08x\n", value, addr, phy_addr, bus_read(state, size, addr));
-    #endif
+uint32_t bus_read(bus_state_t *state, uint8_t size, uint32_t addr)
+{
+    uint32_t result;
+
+    uint32_t phy_addr = addr & bus_segment_map[addr >> 29];
+    uint8_t *page = phy_addr < BUS_PHYSICAL_SIZE ? state->read_pages[phy_addr >> BUS_PAGE_SHIFT] : NULL;
+
+    if (page) {
+        if (size == BUS_SIZE_BYTE) {
+            result = *((uint8_t *) &page[phy_addr & BUS_PAGE_MASK]);
+        } else if (size == BUS_SIZE_WORD) {
+            result = *((uint16_t *) &page[phy_addr & BUS_PAGE_MASK]);
+        } else {
+            result = *((uint32_t *) &page[phy_addr & BUS_PAGE_MASK]);
+        }
+    } else {
+        instrument_begin(INSTRUMENT_BUS_IO);
+        result = bus_read_io(state, phy_addr);
+        instrument_end();
+    }
+
+    log_debug(LOG_BUS_READ, "BUS", "%08x <- %08x (%08x)\n", result, addr, phy_addr);
+
+    return result;
+}
+
+void bus_write(bus_state_t *state, uint8_t size, uint32_t addr, uint32_t value)
+{
+    uint32_t phy_addr = addr & bus_segment_map[addr >> 29];
+    uint8_t *page = phy_addr < BUS_PHYSICAL_SIZE ? state->write_pages[phy_addr >> BUS_PAGE_SHIFT] : NULL;
+
+    if (page) {
+        if (size == BUS_SIZE_BYTE) {
+            *((uint8_t *) &page[phy_addr & BUS_PAGE_MASK]) = value;
+        } else if (size == BUS_SIZE_WORD) {
+            *((uint16_t *) &page[phy_addr & BUS_PAGE_MASK]) = value;
+        } else {
+            *((uint32_t *) &page[phy_addr & BUS_PAGE_MASK]) = value;
+        }
+
+        if (phy_addr < BUS_RAM_MIRROR_SIZE && state->block_cache) {
+            block_cache_write(state->block_cache, phy_addr);
+        }
+    } else {
+        instrument_begin(INSTRUMENT_BUS_IO);
+        bus_write_io(state, phy_addr, value);
+        instrument_end();
+    }
+
+    log_debug(LOG_BUS_WRITE, "BUS", "%08x -> %08x (%08x) | test: %08x\n", value, addr, phy_addr, bus_read(state, size, addr));
+}
+
+/*
+ * Runs the scheduler events due by the given cycle and finds the next one.
+ * The CPU only has to call this again once it gets there, or after a device
+ * register write moved an event.
+ */
+void bus_sync(bus_state_t *state, uint32_t cycles)
+{
+    scheduler_run(&state->scheduler, cycles);
+
+    // Timers without an interrupt armed are otherwise only synced when they are accessed
+    timer_sync(&state->timer_state, cycles);
+
+    uint64_t next = scheduler_next(&state->scheduler);
+
+    // The CPU compares against its 32 bit counter
+    if (next - state->scheduler.cycles > BUS_SYNC_MAX_CYCLES) {
+        next = state->scheduler.cycles + BUS_SYNC_MAX_CYCLES;
+    }
+
+    state->next_event = (uint32_t) next;
+}
+
+/* Store while the cache is isolated, it never reaches memory */
+void bus_write_isolated(bus_state_t *state)
+{
+    if (state->block_cache) {
+        block_cache_isolated_write(state->block_cache);
+    }
 }
\ No newline at end of file
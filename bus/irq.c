@@ -0,0 +1,64 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "bus/irq.h"
+#include "log.h"
+
+const char *irq_names[] = {
+    "VBLANK", "GPU", "CDROM", "DMA", "TIMER0", "TIMER1", "TIMER2", "CONTROLLER", "SIO", "SPU", "LIGHTPEN"
+};
+
+/* Recomputed whenever one of its inputs changes, never per instruction */
+static void irq_update(irq_state_t *state)
+{
+    state->pending = (irq_cause(state) & state->cpu_mask) != 0;
+}
+
+void irq_raise(irq_state_t *state, uint8_t irq)
+{
+    log_debug(LOG_IRQ, "IRQ", "Request %s\n", irq_names[irq]);
+
+    state->i_stat |= (1 << irq);
+
+    irq_update(state);
+}
+
+/* Called by the CPU whenever SR or CAUSE change */
+void irq_set_cpu(irq_state_t *state, uint32_t sr, uint32_t cause)
+{
+    // SR.IEc
+    state->cpu_mask = (sr & 1) ? (sr & 0xFF00) : 0;
+    state->cpu_software = cause & IRQ_CAUSE_SOFTWARE;
+
+    irq_update(state);
+}
+
+uint32_t irq_read(irq_state_t *state, uint32_t addr)
+{
+    uint32_t result = 0;
+
+    if (addr == 0x1F801070) {
+        result = state->i_stat;
+    } else if (addr == 0x1F801074) {
+        result = state->i_mask;
+    }
+
+    return result;
+}
+
+void irq_write(irq_state_t *state, uint32_t addr, uint32_t value)
+{
+    if (addr == 0x1F801070) {
+        log_debug(LOG_IRQ, "IRQ", "%x -> I_STAT\n", value);
+
+        // Writing 0 acknowledges
+        state->i_stat &= value;
+    } else if (addr == 0x1F801074) {
+        log_debug(LOG_IRQ, "IRQ", "%x -> I_MASK\n", value);
+
+        state->i_mask = value & IRQ_MASK;
+    }
+
+    irq_update(state);
+}
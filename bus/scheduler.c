@@ -0,0 +1,160 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "bus/scheduler.h"
+#include "log.h"
+
+const char *scheduler_event_names[] = {
+    "VBLANK", "TIMER", "DMA"
+};
+
+static bool scheduler_before(scheduler_t *scheduler, uint8_t a, uint8_t b)
+{
+    uint64_t cycles_a = scheduler->events[a].cycles;
+    uint64_t cycles_b = scheduler->events[b].cycles;
+
+    return cycles_a < cycles_b || (cycles_a == cycles_b && a < b);
+}
+
+static void scheduler_place(scheduler_t *scheduler, uint8_t slot, uint8_t id)
+{
+    scheduler->heap[slot] = id;
+    scheduler->events[id].slot = slot;
+}
+
+static void scheduler_sift_up(scheduler_t *scheduler, uint8_t slot)
+{
+    uint8_t id = scheduler->heap[slot];
+
+    while (slot) {
+        uint8_t parent = (slot - 1) / 2;
+
+        if (!scheduler_before(scheduler, id, scheduler->heap[parent])) {
+            break;
+        }
+
+        scheduler_place(scheduler, slot, scheduler->heap[parent]);
+        slot = parent;
+    }
+
+    scheduler_place(scheduler, slot, id);
+}
+
+static void scheduler_sift_down(scheduler_t *scheduler, uint8_t slot)
+{
+    uint8_t id = scheduler->heap[slot];
+
+    while (true) {
+        uint8_t child = slot * 2 + 1;
+
+        if (child >= scheduler->count) {
+            break;
+        }
+
+        if (child + 1 < scheduler->count && scheduler_before(scheduler, scheduler->heap[child + 1], scheduler->heap[child])) {
+            child++;
+        }
+
+        if (!scheduler_before(scheduler, scheduler->heap[child], id)) {
+            break;
+        }
+
+        scheduler_place(scheduler, slot, scheduler->heap[child]);
+        slot = child;
+    }
+
+    scheduler_place(scheduler, slot, id);
+}
+
+void scheduler_init(scheduler_t *scheduler)
+{
+    scheduler->cycles = 0;
+    scheduler->count = 0;
+
+    for (uint8_t id=0; id < SCHEDULER_EVENT_COUNT; id++) {
+        scheduler->events[id].cycles = SCHEDULER_NEVER;
+        scheduler->events[id].callback = NULL;
+        scheduler->events[id].data = NULL;
+        scheduler->events[id].slot = -1;
+    }
+}
+
+void scheduler_register(scheduler_t *scheduler, uint8_t id, scheduler_callback_t callback, void *data)
+{
+    scheduler->events[id].callback = callback;
+    scheduler->events[id].data = data;
+}
+
+/* Sets the absolute cycle the event is due at, moving it if it was already scheduled */
+void scheduler_schedule(scheduler_t *scheduler, uint8_t id, uint64_t cycles)
+{
+    scheduler_event_t *event = &scheduler->events[id];
+
+    log_debug(LOG_SCHEDULER, "SCHEDULER", "%s at %llu\n", scheduler_event_names[id], (unsigned long long) cycles);
+
+    if (event->slot < 0) {
+        event->cycles = cycles;
+        scheduler_place(scheduler, scheduler->count++, id);
+        scheduler_sift_up(scheduler, event->slot);
+        return;
+    }
+
+    bool earlier = cycles < event->cycles;
+    event->cycles = cycles;
+
+    if (earlier) {
+        scheduler_sift_up(scheduler, event->slot);
+    } else {
+        scheduler_sift_down(scheduler, event->slot);
+    }
+}
+
+void scheduler_cancel(scheduler_t *scheduler, uint8_t id)
+{
+    scheduler_event_t *event = &scheduler->events[id];
+
+    if (event->slot < 0) {
+        return;
+    }
+
+    uint8_t slot = event->slot;
+    uint8_t last = scheduler->heap[--scheduler->count];
+
+    event->cycles = SCHEDULER_NEVER;
+    event->slot = -1;
+
+    if (last == id) {
+        return;
+    }
+
+    // The last event takes the free slot and moves whichever way it has to
+    scheduler_place(scheduler, slot, last);
+    scheduler_sift_up(scheduler, slot);
+    scheduler_sift_down(scheduler, scheduler->events[last].slot);
+}
+
+/* Absolute cycle of the earliest event */
+uint64_t scheduler_next(scheduler_t *scheduler)
+{
+    return scheduler->count ? scheduler->events[scheduler->heap[0]].cycles : SCHEDULER_NEVER;
+}
+
+/* Moves the clock to the given CPU cycle and runs every event due until then, in order */
+void scheduler_run(scheduler_t *scheduler, uint32_t cycles)
+{
+    scheduler->cycles = scheduler_cycles(scheduler, cycles);
+
+    while (scheduler->count && scheduler_next(scheduler) <= scheduler->cycles) {
+        uint8_t id = scheduler->heap[0];
+        scheduler_event_t *event = &scheduler->events[id];
+        uint64_t due = event->cycles;
+
+        // Callbacks usually schedule the event again
+        scheduler_cancel(scheduler, id);
+
+        log_debug(LOG_SCHEDULER, "SCHEDULER", "Running %s due at %llu\n", scheduler_event_names[id], (unsigned long long) due);
+
+        event->callback(event->data, due);
+    }
+}
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "core/forkserver.h"
+#include "log.h"
+
+const char *forkserver_result_names[] = {"budget", "stop", "crash"};
+
+/* With a stop PC every slice is a single instruction, so any PC is caught */
+static bool forkserver_run_cycles(mdpsx_t *mdpsx, uint32_t cycles, uint32_t stop_pc)
+{
+    r3000_state_t *r3000_state = &mdpsx->r3000_state;
+
+    if (!stop_pc) {
+        mdpsx_run_cycles(mdpsx, cycles);
+        return false;
+    }
+
+    uint32_t start = r3000_state->cycles;
+    bool stopped = false;
+
+    while (!(stopped = r3000_state->pc == stop_pc) && (uint32_t) (r3000_state->cycles - start) < cycles) {
+        r3000_run_slice(r3000_state, &mdpsx->bus_state, 1);
+    }
+
+    log_flush();
+
+    return stopped;
+}
+
+/* Boot point for the fork server, false if the PC was not reached within the cycles */
+bool forkserver_run_to_pc(mdpsx_t *mdpsx, uint32_t pc, uint32_t cycles)
+{
+    return forkserver_run_cycles(mdpsx, cycles, pc);
+}
+
+bool forkserver_init(forkserver_t *forkserver, mdpsx_t *mdpsx, uint32_t jobs)
+{
+    memset(forkserver, 0x00, sizeof(forkserver_t));
+
+    if (mdpsx->bus_state.fastmem) {
+        log_error("FORKSERVER", "Fastmem instances share their RAM with every child\n");
+        return false;
+    }
+
+    forkserver->mdpsx = mdpsx;
+    forkserver->jobs = jobs ? jobs : 1;
+    forkserver->cycles = gpu_frame_cycles(&mdpsx->bus_state.gpu_state);
+
+    if (pipe(forkserver->pipe) < 0) {
+        log_error("FORKSERVER", "Failed to create the result pipe\n");
+        return false;
+    }
+
+    // Results are collected whenever a child is reaped, there may be none left
+    fcntl(forkserver->pipe[0], F_SETFL, O_NONBLOCK);
+
+    return true;
+}
+
+void forkserver_destroy(forkserver_t *forkserver)
+{
+    close(forkserver->pipe[0]);
+    close(forkserver->pipe[1]);
+}
+
+static void forkserver_child(forkserver_t *forkserver, uint32_t test)
+{
+    mdpsx_t *mdpsx = forkserver->mdpsx;
+    r3000_state_t *r3000_state = &mdpsx->r3000_state;
+    gpu_state_t *gpu_state = &mdpsx->bus_state.gpu_state;
+
+    close(forkserver->pipe[0]);
+
+    if (forkserver->setup) {
+        forkserver->setup(mdpsx, test, forkserver->data);
+    }
+
+    forkserver_result_t result;
+    memset(&result, 0x00, sizeof(result));
+
+    result.test = test;
+    result.result = FORKSERVER_RESULT_BUDGET;
+
+    uint32_t start = r3000_state->cycles;
+
+    if (forkserver->frames) {
+        for (uint32_t i=0; i < forkserver->frames && result.result == FORKSERVER_RESULT_BUDGET; i++) {
+            if (forkserver_run_cycles(mdpsx, gpu_frame_cycles(gpu_state), forkserver->stop_pc)) {
+                result.result = FORKSERVER_RESULT_STOP;
+            }
+        }
+    } else if (forkserver_run_cycles(mdpsx, forkserver->cycles, forkserver->stop_pc)) {
+        result.result = FORKSERVER_RESULT_STOP;
+    }
+
+    result.pc = r3000_state->pc;
+    result.cycles = r3000_state->cycles - start;
+    result.ram_hash = mdpsx_hash(mdpsx->bus_state.ram, BUS_RAM_SIZE);
+    result.vram_hash = mdpsx_hash((uint8_t *) gpu_state->vram, sizeof(gpu_state->vram));
+
+    // A child without its whole report is counted as a crash
+    if (write(forkserver->pipe[1], &result, sizeof(result)) != sizeof(result)) {
+        _exit(1);
+    }
+
+    // The log writes straight to stdout in a child, its lines are only buffered
+    fflush(stdout);
+
+    // Nothing of the parent's, like buffered output, must run twice
+    _exit(0);
+}
+
+static void forkserver_collect(forkserver_t *forkserver, uint32_t tests, forkserver_result_t *results)
+{
+    forkserver_result_t result;
+
+    while (read(forkserver->pipe[0], &result, sizeof(result)) == sizeof(result)) {
+        if (result.test < tests) {
+            results[result.test] = result;
+        }
+    }
+}
+
+/*
+ * Runs tests children, the setup gets the index of the test case. Children
+ * that die without a report are left as FORKSERVER_RESULT_CRASH.
+ */
+bool forkserver_run(forkserver_t *forkserver, uint32_t tests, forkserver_result_t *results)
+{
+    for (uint32_t i=0; i < tests; i++) {
+        memset(&results[i], 0x00, sizeof(forkserver_result_t));
+
+        results[i].test = i;
+        results[i].result = FORKSERVER_RESULT_CRASH;
+    }
+
+    // Children would write what is still buffered again
+    fflush(stdout);
+    fflush(stderr);
+    log_flush();
+
+    // Children in the order they were forked, only they are waited for
+    pid_t *pids = (pid_t *) malloc(forkserver->jobs * sizeof(pid_t));
+    uint32_t *pid_tests = (uint32_t *) malloc(forkserver->jobs * sizeof(uint32_t));
+
+    uint32_t next = 0;
+    uint32_t running = 0;
+
+    while (next < tests || running) {
+        while (running < forkserver->jobs && next < tests) {
+            pid_t pid = fork();
+
+            if (pid < 0) {
+                log_error("FORKSERVER", "Failed to fork test %u\n", next);
+
+                if (!running) {
+                    free(pids);
+                    free(pid_tests);
+                    return false;
+                }
+
+                break;
+            }
+
+            if (!pid) {
+                forkserver_child(forkserver, next);
+            }
+
+            pids[running] = pid;
+            pid_tests[running] = next;
+
+            running++;
+            next++;
+        }
+
+        // Blocks on the oldest child, the others are reaped if they are done too
+        for (uint32_t i=0; i < running;) {
+            int status;
+            pid_t pid = waitpid(pids[i], &status, i ? WNOHANG : 0);
+
+            if (pid < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (!pid) {
+                i++;
+                continue;
+            }
+
+            // The report is in the pipe before the child exits
+            forkserver_collect(forkserver, tests, results);
+
+            if (pid > 0 && WIFEXITED(status) && WEXITSTATUS(status)) {
+                results[pid_tests[i]].result = FORKSERVER_RESULT_CRASH;
+            }
+
+            running--;
+            memmove(&pids[i], &pids[i + 1], (running - i) * sizeof(pid_t));
+            memmove(&pid_tests[i], &pid_tests[i + 1], (running - i) * sizeof(uint32_t));
+        }
+    }
+
+    forkserver_collect(forkserver, tests, results);
+
+    free(pids);
+    free(pid_tests);
+
+    return true;
+}
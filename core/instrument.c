@@ -0,0 +1,48 @@
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "core/instrument.h"
+
+#define INSTRUMENT_SECTION_NAME(id, name) name,
+
+const char *instrument_section_names[INSTRUMENT_COUNT] = {
+    INSTRUMENT_SECTIONS(INSTRUMENT_SECTION_NAME)
+};
+
+static _Thread_local uint8_t instrument_current = INSTRUMENT_NONE;
+static _Thread_local uint64_t instrument_last;
+static _Thread_local uint64_t instrument_totals[INSTRUMENT_COUNT + 1];
+
+static inline uint64_t instrument_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* Charges the time since the last switch to the current section, returns that section */
+uint8_t instrument_switch(uint8_t section)
+{
+    uint64_t now = instrument_now();
+    uint8_t previous = instrument_current;
+
+    instrument_totals[previous] += now - instrument_last;
+
+    instrument_current = section;
+    instrument_last = now;
+
+    return previous;
+}
+
+void instrument_reset(void)
+{
+    memset(instrument_totals, 0x00, sizeof(instrument_totals));
+    instrument_last = instrument_now();
+}
+
+uint64_t instrument_nanoseconds(uint8_t section)
+{
+    return instrument_totals[section];
+}
@@ -0,0 +1,485 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/lockstep.h"
+#include "log.h"
+
+#define LOCKSTEP_REG_HI     32
+#define LOCKSTEP_REG_LO     33
+
+static const char *lockstep_engine_names[] = {"interpreter", "cached", "jit"};
+
+/* One reference instruction of the slice that went wrong */
+typedef struct lockstep_step_t {
+    uint32_t pc;
+    uint32_t word;
+
+    // Registers it changed, bit 32 is HI and 33 LO
+    uint64_t writes;
+
+    // Physical address of a store, UINT32_MAX for everything else
+    uint32_t store;
+} lockstep_step_t;
+
+/* Also needed when both sides were changed from outside, like by loading a save state */
+void lockstep_checkpoint(lockstep_t *lockstep)
+{
+    mdpsx_snapshot_save(lockstep->reference, lockstep->reference_checkpoint);
+    mdpsx_snapshot_save(lockstep->candidate, lockstep->candidate_checkpoint);
+
+    lockstep->checkpoint_slice = lockstep->slices;
+}
+
+bool lockstep_init(lockstep_t *lockstep, const mdpsx_config_t *config, uint32_t interval, FILE *report)
+{
+    memset(lockstep, 0x00, sizeof(lockstep_t));
+
+    // The debugging features only go on the candidate
+    mdpsx_config_t reference_config = *config;
+
+    reference_config.engine = R3000_ENGINE_INTERPRETER;
+    reference_config.profile = false;
+    reference_config.trace_path = NULL;
+
+    lockstep->candidate = mdpsx_create(config);
+    lockstep->reference = lockstep->candidate ? mdpsx_create(&reference_config) : NULL;
+
+    if (!lockstep->reference) {
+        lockstep_destroy(lockstep);
+        return false;
+    }
+
+    lockstep->interval = interval ? interval : 1;
+    lockstep->budgets = (uint32_t *) malloc(lockstep->interval * sizeof(uint32_t));
+    lockstep->report = report;
+
+    lockstep->reference_checkpoint = mdpsx_snapshot_create();
+    lockstep->candidate_checkpoint = mdpsx_snapshot_create();
+
+    lockstep_checkpoint(lockstep);
+
+    return true;
+}
+
+void lockstep_destroy(lockstep_t *lockstep)
+{
+    if (lockstep->candidate) {
+        mdpsx_destroy(lockstep->candidate);
+    }
+
+    if (lockstep->reference) {
+        mdpsx_destroy(lockstep->reference);
+    }
+
+    if (lockstep->reference_checkpoint) {
+        mdpsx_snapshot_destroy(lockstep->reference_checkpoint);
+        mdpsx_snapshot_destroy(lockstep->candidate_checkpoint);
+    }
+
+    free(lockstep->budgets);
+}
+
+/*
+ * Runs the reference up to the cycle the candidate got to. It is a plain
+ * interpreter run with its own device syncs at its own events and every idle
+ * loop iteration executed, so late events or skipped cycles on the candidate
+ * side show up as a difference.
+ */
+static void lockstep_follow(lockstep_t *lockstep)
+{
+    r3000_state_t *reference = &lockstep->reference->r3000_state;
+    r3000_state_t *candidate = &lockstep->candidate->r3000_state;
+    int32_t behind = candidate->cycles - reference->cycles;
+
+    if (behind > 0) {
+        r3000_run(reference, &lockstep->reference->bus_state, behind);
+    } else if (!behind) {
+        // Kernel calls the HLE returns from take no cycles
+        r3000_run_slice(reference, &lockstep->reference->bus_state, 1);
+    }
+}
+
+static void lockstep_slice(lockstep_t *lockstep, uint32_t cycles)
+{
+    r3000_run_slice(&lockstep->candidate->r3000_state, &lockstep->candidate->bus_state, cycles);
+    lockstep_follow(lockstep);
+}
+
+static bool lockstep_compare(lockstep_t *lockstep)
+{
+    r3000_state_t *reference = &lockstep->reference->r3000_state;
+    r3000_state_t *candidate = &lockstep->candidate->r3000_state;
+    bus_state_t *reference_bus = &lockstep->reference->bus_state;
+    bus_state_t *candidate_bus = &lockstep->candidate->bus_state;
+
+    lockstep->comparisons++;
+
+    // Cheapest first
+    return reference->pc == candidate->pc && reference->pc_next == candidate->pc_next &&
+        reference->cycles == candidate->cycles &&
+        reference->hi == candidate->hi && reference->lo == candidate->lo &&
+        reference->load_reg == candidate->load_reg && (!reference->load_reg || reference->load_value == candidate->load_value) &&
+        reference->branch_delay_slot_state == candidate->branch_delay_slot_state &&
+        !memcmp(reference->regs, candidate->regs, sizeof(reference->regs)) &&
+        !memcmp(&reference->cop0_state, &candidate->cop0_state, sizeof(cop0_state_t)) &&
+        !memcmp(&reference->gte_state, &candidate->gte_state, sizeof(gte_state_t)) &&
+        reference_bus->irq_state.i_stat == candidate_bus->irq_state.i_stat &&
+        reference_bus->irq_state.i_mask == candidate_bus->irq_state.i_mask &&
+        !memcmp(reference_bus->scratchpad, candidate_bus->scratchpad, BUS_PAGE_SIZE) &&
+        !memcmp(reference_bus->ram, candidate_bus->ram, BUS_RAM_SIZE) &&
+        !memcmp(reference_bus->gpu_state.vram, candidate_bus->gpu_state.vram, sizeof(reference_bus->gpu_state.vram));
+}
+
+static void lockstep_report_value(lockstep_t *lockstep, const char *name, uint32_t reference, uint32_t candidate)
+{
+    if (reference != candidate) {
+        fprintf(lockstep->report, "  %-12s %08X  %08X\n", name, reference, candidate);
+    }
+}
+
+static void lockstep_report_memory(lockstep_t *lockstep, const char *name, uint32_t base, const uint8_t *reference, const uint8_t *candidate, uint32_t size)
+{
+    uint32_t count = 0;
+
+    for (uint32_t addr=0; addr < size; addr += 4) {
+        uint32_t reference_word = *((uint32_t *) &reference[addr]);
+        uint32_t candidate_word = *((uint32_t *) &candidate[addr]);
+
+        if (reference_word != candidate_word && count++ < LOCKSTEP_REPORT_WORDS) {
+            fprintf(lockstep->report, "  %-3s %08X %08X  %08X\n", name, base + addr, reference_word, candidate_word);
+        }
+    }
+
+    if (count > LOCKSTEP_REPORT_WORDS) {
+        fprintf(lockstep->report, "  %s: %u more differing words\n", name, count - LOCKSTEP_REPORT_WORDS);
+    }
+}
+
+/* Everything lockstep_compare looks at that differs right now */
+static void lockstep_report_state(lockstep_t *lockstep)
+{
+    r3000_state_t *reference = &lockstep->reference->r3000_state;
+    r3000_state_t *candidate = &lockstep->candidate->r3000_state;
+    bus_state_t *reference_bus = &lockstep->reference->bus_state;
+    bus_state_t *candidate_bus = &lockstep->candidate->bus_state;
+
+    fprintf(lockstep->report, "  %-12s %-9s %s\n", "", "Reference", lockstep_engine_names[candidate->engine]);
+
+    lockstep_report_value(lockstep, "pc", reference->pc, candidate->pc);
+    lockstep_report_value(lockstep, "pc_next", reference->pc_next, candidate->pc_next);
+    lockstep_report_value(lockstep, "cycles", reference->cycles, candidate->cycles);
+    lockstep_report_value(lockstep, "load_reg", reference->load_reg, candidate->load_reg);
+
+    // Left over from the last load unless one is pending, compiled blocks do not keep it
+    if (reference->load_reg || candidate->load_reg) {
+        lockstep_report_value(lockstep, "load_value", reference->load_value, candidate->load_value);
+    }
+
+    lockstep_report_value(lockstep, "branch_delay", reference->branch_delay_slot_state, candidate->branch_delay_slot_state);
+
+    for (uint8_t i=0; i < 32; i++) {
+        lockstep_report_value(lockstep, r3000_register_names[i], reference->regs[i], candidate->regs[i]);
+    }
+
+    lockstep_report_value(lockstep, "hi", reference->hi, candidate->hi);
+    lockstep_report_value(lockstep, "lo", reference->lo, candidate->lo);
+
+    for (uint8_t i=0; i < 32; i++) {
+        lockstep_report_value(lockstep, cop0_register_names[i][0] ? cop0_register_names[i] : "cop0", reference->cop0_state.regs[i], candidate->cop0_state.regs[i]);
+    }
+
+    if (memcmp(&reference->gte_state, &candidate->gte_state, sizeof(gte_state_t))) {
+        fprintf(lockstep->report, "  GTE registers differ\n");
+    }
+
+    lockstep_report_value(lockstep, "I_STAT", reference_bus->irq_state.i_stat, candidate_bus->irq_state.i_stat);
+    lockstep_report_value(lockstep, "I_MASK", reference_bus->irq_state.i_mask, candidate_bus->irq_state.i_mask);
+
+    lockstep_report_memory(lockstep, "RAM", 0x00000000, reference_bus->ram, candidate_bus->ram, BUS_RAM_SIZE);
+    lockstep_report_memory(lockstep, "SPD", BUS_SCRATCHPAD_BASE, reference_bus->scratchpad, candidate_bus->scratchpad, BUS_PAGE_SIZE);
+
+    if (memcmp(reference_bus->gpu_state.vram, candidate_bus->gpu_state.vram, sizeof(reference_bus->gpu_state.vram))) {
+        fprintf(lockstep->report, "  VRAM differs\n");
+    }
+}
+
+/* Both sides back to the checkpoint and forward by the given number of recorded slices */
+static void lockstep_replay(lockstep_t *lockstep, uint32_t slices)
+{
+    mdpsx_snapshot_restore(lockstep->reference, lockstep->reference_checkpoint);
+    mdpsx_snapshot_restore(lockstep->candidate, lockstep->candidate_checkpoint);
+
+    for (uint32_t i=0; i < slices; i++) {
+        lockstep_slice(lockstep, lockstep->budgets[i]);
+    }
+}
+
+/* Word at pc without going through the IO handlers, fetches from anywhere else read 0 */
+static uint32_t lockstep_peek(bus_state_t *bus_state, uint32_t addr)
+{
+    uint32_t phy_addr = addr & bus_segment_map[addr >> 29];
+    uint8_t *page = phy_addr < BUS_PHYSICAL_SIZE ? bus_state->read_pages[phy_addr >> BUS_PAGE_SHIFT] : NULL;
+
+    return (page && !(addr & 3)) ? *((uint32_t *) &page[phy_addr & BUS_PAGE_MASK]) : 0;
+}
+
+static uint32_t lockstep_store_address(r3000_state_t *r3000_state, r3000_instruction_t *instruction)
+{
+    switch(instruction->op) {
+        case R3000_OP_SB: case R3000_OP_SH: case R3000_OP_SW:
+        case R3000_OP_SWL: case R3000_OP_SWR: case R3000_OP_SWC2: {
+            uint32_t addr = r3000_state->regs[instruction->rs] + (uint32_t) (int16_t) instruction->imm;
+            return (addr & bus_segment_map[addr >> 29]) & ~0x3;
+        }
+    }
+
+    return UINT32_MAX;
+}
+
+/* Word at a physical address in RAM or scratchpad, reads of other addresses compare equal */
+static uint32_t lockstep_memory_word(bus_state_t *bus_state, uint32_t phy_addr)
+{
+    if (phy_addr < BUS_RAM_MIRROR_SIZE) {
+        return *((uint32_t *) &bus_state->ram[phy_addr & (BUS_RAM_SIZE - 1)]);
+    } else if (phy_addr >= BUS_SCRATCHPAD_BASE && phy_addr < BUS_SCRATCHPAD_BASE + BUS_PAGE_SIZE) {
+        return *((uint32_t *) &bus_state->scratchpad[phy_addr - BUS_SCRATCHPAD_BASE]);
+    }
+
+    return 0;
+}
+
+/* Word index of a physical address in RAM followed by the scratchpad, -1 for everything else */
+static int32_t lockstep_memory_index(uint32_t phy_addr)
+{
+    if (phy_addr < BUS_RAM_MIRROR_SIZE) {
+        return (phy_addr & (BUS_RAM_SIZE - 1)) >> 2;
+    } else if (phy_addr >= BUS_SCRATCHPAD_BASE && phy_addr < BUS_SCRATCHPAD_BASE + BUS_PAGE_SIZE) {
+        return (BUS_RAM_SIZE + phy_addr - BUS_SCRATCHPAD_BASE) >> 2;
+    }
+
+    return -1;
+}
+
+static void lockstep_reference_regs(r3000_state_t *r3000_state, uint32_t *regs)
+{
+    memcpy(regs, r3000_state->regs, sizeof(r3000_state->regs));
+
+    regs[LOCKSTEP_REG_HI] = r3000_state->hi;
+    regs[LOCKSTEP_REG_LO] = r3000_state->lo;
+}
+
+/*
+ * Runs the slice that went wrong once more, the reference one instruction at a
+ * time, and points at the instruction that last wrote something that differs
+ * afterwards. Of several such writes the earliest one is the likely cause.
+ */
+static void lockstep_report_slice(lockstep_t *lockstep, uint32_t cycles)
+{
+    r3000_state_t *reference = &lockstep->reference->r3000_state;
+    r3000_state_t *candidate = &lockstep->candidate->r3000_state;
+    bus_state_t *reference_bus = &lockstep->reference->bus_state;
+    bus_state_t *candidate_bus = &lockstep->candidate->bus_state;
+
+    r3000_run_slice(candidate, candidate_bus, cycles);
+
+    uint32_t count = 0;
+    uint32_t size = 256;
+    lockstep_step_t *steps = (lockstep_step_t *) malloc(size * sizeof(lockstep_step_t));
+
+    uint32_t before[34], after[34];
+    uint8_t pending_load = 0;
+
+    do {
+        if (count == size) {
+            size *= 2;
+            steps = (lockstep_step_t *) realloc(steps, size * sizeof(lockstep_step_t));
+        }
+
+        lockstep_step_t *step = &steps[count];
+        r3000_instruction_t instruction;
+
+        step->pc = reference->pc;
+        step->word = lockstep_peek(reference_bus, reference->pc);
+
+        r3000_decode(&instruction, step->word);
+        step->store = lockstep_store_address(reference, &instruction);
+        step->writes = 0;
+
+        lockstep_reference_regs(reference, before);
+        r3000_run_slice(reference, reference_bus, 1);
+        lockstep_reference_regs(reference, after);
+
+        for (uint8_t i=0; i < 34; i++) {
+            if (before[i] == after[i]) {
+                continue;
+            }
+
+            // Loads land one instruction late
+            if (count && i == pending_load) {
+                steps[count - 1].writes |= (1ULL << i);
+            } else {
+                step->writes |= (1ULL << i);
+            }
+        }
+
+        pending_load = reference->load_reg;
+        count++;
+    } while ((int32_t) (candidate->cycles - reference->cycles) > 0);
+
+    // Registers that differ now
+    lockstep_reference_regs(reference, before);
+    lockstep_reference_regs(candidate, after);
+
+    uint64_t differs = 0;
+
+    for (uint8_t i=1; i < 34; i++) {
+        if (before[i] != after[i]) {
+            differs |= (1ULL << i);
+        }
+    }
+
+    // Earliest of the last writes to every differing register and memory word, found going backwards
+    uint32_t culprit = count;
+    uint64_t later = 0;
+    uint8_t *stored = (uint8_t *) calloc((BUS_RAM_SIZE + BUS_PAGE_SIZE) >> 5, 1);
+
+    for (uint32_t i=count; i > 0; i--) {
+        lockstep_step_t *step = &steps[i - 1];
+        bool cause = step->writes & differs & ~later;
+
+        int32_t word = lockstep_memory_index(step->store);
+
+        if (word >= 0 && !(stored[word >> 3] & (1 << (word & 7)))) {
+            stored[word >> 3] |= (1 << (word & 7));
+            cause = cause || lockstep_memory_word(reference_bus, step->store) != lockstep_memory_word(candidate_bus, step->store);
+        }
+
+        later |= step->writes;
+
+        if (cause) {
+            culprit = i - 1;
+        }
+    }
+
+    free(stored);
+
+    // Only the control flow differs, the last branch decided it
+    if (culprit == count && reference->pc != candidate->pc) {
+        for (uint32_t i=count; i > 0; i--) {
+            r3000_instruction_t instruction;
+            r3000_decode(&instruction, steps[i - 1].word);
+
+            if (block_cache_is_branch(&instruction)) {
+                culprit = i - 1;
+                break;
+            }
+        }
+    }
+
+    // Instructions around the culprit, or the end of the slice if there is none
+    uint32_t center = (culprit < count) ? culprit : count - 1;
+    uint32_t first = (center >= LOCKSTEP_REPORT_INSTRUCTIONS / 2) ? center - LOCKSTEP_REPORT_INSTRUCTIONS / 2 : 0;
+    uint32_t last = (first + LOCKSTEP_REPORT_INSTRUCTIONS < count) ? first + LOCKSTEP_REPORT_INSTRUCTIONS : count;
+
+    fprintf(lockstep->report, "Reference instructions %u-%u of %u:\n", first, last - 1, count);
+
+    for (uint32_t i=first; i < last; i++) {
+        r3000_instruction_t instruction;
+        r3000_decode(&instruction, steps[i].word);
+
+        fprintf(lockstep->report, "%c %08X  %08X  %s\n", (i == culprit) ? '>' : ' ', steps[i].pc, steps[i].word, steps[i].word ? r3000_op_names[instruction.op] : "NOP");
+    }
+
+    if (culprit == count) {
+        fprintf(lockstep->report, "No single instruction explains the difference\n");
+    }
+
+    fprintf(lockstep->report, "Differences after the slice:\n");
+    lockstep_report_state(lockstep);
+
+    free(steps);
+}
+
+/* Finds the first slice since the checkpoint the two sides differ after, by bisection */
+static void lockstep_diverged(lockstep_t *lockstep)
+{
+    uint32_t count = lockstep->slices - lockstep->checkpoint_slice;
+    r3000_state_t *candidate = &lockstep->candidate->r3000_state;
+
+    fprintf(lockstep->report, "Lockstep: %s diverged from the interpreter in slices %lu-%lu, cycle %u\n",
+        lockstep_engine_names[candidate->engine], lockstep->checkpoint_slice, lockstep->slices - 1, candidate->cycles);
+
+    lockstep_report_state(lockstep);
+
+    // Compiled blocks are kept over a restore, replays should take the same path
+    lockstep_replay(lockstep, count);
+
+    if (lockstep_compare(lockstep)) {
+        fprintf(lockstep->report, "The difference did not come back when replayed from the checkpoint\n");
+        return;
+    }
+
+    // Same after good slices, different after bad ones
+    uint32_t good = 0;
+    uint32_t bad = count;
+
+    while (bad - good > 1) {
+        uint32_t middle = good + (bad - good) / 2;
+
+        lockstep_replay(lockstep, middle);
+
+        if (lockstep_compare(lockstep)) {
+            good = middle;
+        } else {
+            bad = middle;
+        }
+    }
+
+    lockstep_replay(lockstep, good);
+
+    r3000_state_t *reference = &lockstep->reference->r3000_state;
+
+    fprintf(lockstep->report, "First differing slice %lu starts at %08X, cycle %u\n", lockstep->checkpoint_slice + good, reference->pc, reference->cycles);
+    lockstep_report_slice(lockstep, lockstep->budgets[good]);
+
+    fflush(lockstep->report);
+}
+
+/* Runs both for at least the given candidate cycles, false once they diverged */
+bool lockstep_run(lockstep_t *lockstep, uint32_t cycles)
+{
+    r3000_state_t *candidate = &lockstep->candidate->r3000_state;
+    uint32_t start = candidate->cycles;
+
+    if (lockstep->diverged) {
+        return false;
+    }
+
+    while (candidate->cycles - start < cycles) {
+        uint32_t budget = cycles - (candidate->cycles - start);
+
+        lockstep->budgets[lockstep->slices - lockstep->checkpoint_slice] = budget;
+        lockstep_slice(lockstep, budget);
+        lockstep->slices++;
+
+        if (lockstep->slices - lockstep->checkpoint_slice < lockstep->interval) {
+            continue;
+        }
+
+        if (!lockstep_compare(lockstep)) {
+            lockstep_diverged(lockstep);
+            lockstep->diverged = true;
+
+            break;
+        }
+
+        lockstep_checkpoint(lockstep);
+    }
+
+    log_flush();
+
+    return !lockstep->diverged;
+}
@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/mdpsx.h"
+#include "bios/bios.h"
+#include "core/instrument.h"
+#include "log.h"
+
+mdpsx_t *mdpsx_create(const mdpsx_config_t *config)
+{
+    // Zeroed, mdpsx_destroy only cleans up what got set up
+    mdpsx_t *mdpsx = (mdpsx_t *) calloc(1, sizeof(mdpsx_t));
+
+    r3000_state_t *r3000_state = &mdpsx->r3000_state;
+    bus_state_t *bus_state = &mdpsx->bus_state;
+
+    r3000_state->engine = config->engine;
+
+    /* Init memory, the page tables take over if the fastmem window can not be mapped */
+    bus_init(bus_state, config->fastmem);
+
+    if (config->fastmem && !bus_state->fastmem) {
+        log_info("mdpsx", "Fastmem not available\n");
+    }
+
+    memcpy(bus_state->bios, config->bios, BUS_BIOS_SIZE);
+    bios_print_header(bus_state->bios);
+
+    /* Init CPU */
+    r3000_state->pc_instruction = 0xBFC00000;
+    r3000_state->pc = 0xBFC00000;
+    r3000_state->pc_next = 0xBFC00004;
+
+    gte_init(&r3000_state->gte_state);
+
+    /* Kernel calls go to the BIOS code unless HLE is enabled */
+    if (config->hle) {
+        bios_hle_init(&mdpsx->bios_hle, config->hle_dir);
+        r3000_state->hle = &mdpsx->bios_hle;
+    }
+
+    r3000_state->irq_state = &bus_state->irq_state;
+    bus_state->cycles = &r3000_state->cycles;
+
+    /* Fast boot, the EXE replaces the shell and a cached kernel state skips the BIOS init */
+    if (config->exe_path || config->boot_cache) {
+        boot_init(&mdpsx->boot, config->boot_cache);
+
+        if (config->exe_path && !boot_load_exe(&mdpsx->boot, config->exe_path)) {
+            mdpsx_destroy(mdpsx);
+            return NULL;
+        }
+
+        boot_restore(&mdpsx->boot, r3000_state, bus_state);
+        r3000_state->boot = &mdpsx->boot;
+    }
+
+    /* Init profiler, it needs every instruction so compiled blocks are left out */
+    if (config->profile) {
+        #ifdef R3000_PROFILER
+        profiler_init(&mdpsx->profiler, r3000_state->pc, r3000_state->cycles);
+        r3000_state->profiler = &mdpsx->profiler;
+
+        if (r3000_state->engine == R3000_ENGINE_JIT) {
+            r3000_state->engine = R3000_ENGINE_CACHED;
+        }
+        #else
+        log_error("mdpsx", "Built without the profiler, use make PROFILE=1\n");
+        mdpsx_destroy(mdpsx);
+        return NULL;
+        #endif
+    }
+
+    /* Init trace, compiled blocks would skip it as well */
+    if (config->trace_path) {
+        #ifdef R3000_TRACE
+        if (!trace_open(&mdpsx->trace, config->trace_path)) {
+            mdpsx_destroy(mdpsx);
+            return NULL;
+        }
+
+        r3000_state->trace = &mdpsx->trace;
+
+        if (r3000_state->engine == R3000_ENGINE_JIT) {
+            r3000_state->engine = R3000_ENGINE_CACHED;
+        }
+        #else
+        log_error("mdpsx", "Built without the trace, use make TRACE=1\n");
+        mdpsx_destroy(mdpsx);
+        return NULL;
+        #endif
+    }
+
+    /* Init block cache */
+    block_cache_init(&mdpsx->block_cache);
+    bus_state->block_cache = &mdpsx->block_cache;
+
+    /* Init JIT, the cached interpreter takes over if it is not available */
+    if (r3000_state->engine == R3000_ENGINE_JIT && !jit_init(&mdpsx->jit, &mdpsx->block_cache)) {
+        r3000_state->engine = R3000_ENGINE_CACHED;
+    }
+
+    return mdpsx;
+}
+
+static void mdpsx_update_video(mdpsx_t *mdpsx)
+{
+    mdpsx->bus_state.gpu_state.video = (mdpsx->has_video && !mdpsx->hidden) ? &mdpsx->video : NULL;
+}
+
+/* NULL runs headless, the GPU still keeps its state and VRAM */
+void mdpsx_set_video(mdpsx_t *mdpsx, const gpu_video_sink_t *video)
+{
+    if (video) {
+        mdpsx->video = *video;
+    }
+
+    mdpsx->has_video = video != NULL;
+    mdpsx_update_video(mdpsx);
+}
+
+/* Frames that are emulated but not shown, nothing is drawn or presented while set */
+void mdpsx_set_hidden(mdpsx_t *mdpsx, bool hidden)
+{
+    mdpsx->hidden = hidden;
+    mdpsx_update_video(mdpsx);
+}
+
+/* Runs up to the next VBlank, where the frame gets presented */
+void mdpsx_run_frame(mdpsx_t *mdpsx)
+{
+    gpu_state_t *gpu_state = &mdpsx->bus_state.gpu_state;
+    scheduler_t *scheduler = &mdpsx->bus_state.scheduler;
+    uint32_t frames = gpu_state->frames;
+
+    // Slices end at block boundaries, the VBlank may be due a little after one
+    while (gpu_state->frames == frames) {
+        uint64_t now = scheduler_cycles(scheduler, mdpsx->r3000_state.cycles);
+        uint64_t vblank = scheduler->events[SCHEDULER_EVENT_VBLANK].cycles;
+
+        mdpsx_run_cycles(mdpsx, vblank > now ? vblank - now : 1);
+    }
+}
+
+/*
+ * Run-ahead, the real frame runs hidden and the one shown is the given number
+ * of frames further on, emulated from a copy of the state that is thrown away.
+ * What the game only shows a few frames after reading the input is on screen
+ * that much earlier. Side effects outside of the state, like HLE file access
+ * and TTY output, happen for the speculative frames as well.
+ */
+void mdpsx_run_frame_ahead(mdpsx_t *mdpsx, mdpsx_snapshot_t *snapshot, uint32_t frames)
+{
+    if (!frames) {
+        mdpsx_run_frame(mdpsx);
+        return;
+    }
+
+    bool hidden = mdpsx->hidden;
+
+    mdpsx_set_hidden(mdpsx, true);
+    mdpsx_run_frame(mdpsx);
+
+    mdpsx_snapshot_save(mdpsx, snapshot);
+
+    for (uint32_t i=0; i < frames; i++) {
+        mdpsx_set_hidden(mdpsx, hidden || i + 1 < frames);
+        mdpsx_run_frame(mdpsx);
+    }
+
+    mdpsx_snapshot_restore(mdpsx, snapshot);
+    mdpsx_set_hidden(mdpsx, hidden);
+}
+
+void mdpsx_run_cycles(mdpsx_t *mdpsx, uint32_t cycles)
+{
+    instrument_begin(INSTRUMENT_CPU);
+    r3000_run(&mdpsx->r3000_state, &mdpsx->bus_state, cycles);
+    instrument_end();
+
+    // Log buffers are per thread, the writer only sees them once they are handed over
+    log_flush();
+}
+
+void mdpsx_destroy(mdpsx_t *mdpsx)
+{
+    r3000_state_t *r3000_state = &mdpsx->r3000_state;
+
+    #ifdef R3000_TRACE
+    if (r3000_state->trace) {
+        trace_close(&mdpsx->trace);
+    }
+    #endif
+
+    #ifdef R3000_PROFILER
+    if (r3000_state->profiler) {
+        profiler_destroy(&mdpsx->profiler);
+    }
+    #endif
+
+    // Links between blocks go before the blocks
+    if (mdpsx->block_cache.jit) {
+        jit_destroy(&mdpsx->jit);
+    }
+
+    if (mdpsx->block_cache.ram_blocks) {
+        block_cache_destroy(&mdpsx->block_cache);
+    }
+
+    if (r3000_state->hle) {
+        bios_hle_destroy(&mdpsx->bios_hle);
+    }
+
+    boot_destroy(&mdpsx->boot);
+    bus_destroy(&mdpsx->bus_state);
+
+    free(mdpsx);
+}
+
+/* FNV-1a, the same run on another engine or in another process has to end up with the same hash */
+uint64_t mdpsx_hash(const uint8_t *data, size_t size)
+{
+    uint64_t hash = 0xCBF29CE484222325;
+
+    for (size_t i=0; i < size; i++) {
+        hash = (hash ^ data[i]) * 0x100000001B3;
+    }
+
+    return hash;
+}
+
+mdpsx_snapshot_t *mdpsx_snapshot_create(void)
+{
+    mdpsx_snapshot_t *snapshot = (mdpsx_snapshot_t *) calloc(1, sizeof(mdpsx_snapshot_t));
+
+    snapshot->ram = (uint8_t *) malloc(BUS_RAM_SIZE);
+    snapshot->scratchpad = (uint8_t *) malloc(BUS_PAGE_SIZE);
+
+    return snapshot;
+}
+
+/* The structs are copied bytewise, so copies of the same state compare equal with memcmp */
+void mdpsx_snapshot_save(mdpsx_t *mdpsx, mdpsx_snapshot_t *snapshot)
+{
+    memcpy(&snapshot->r3000_state, &mdpsx->r3000_state, sizeof(r3000_state_t));
+    memcpy(&snapshot->bus_state, &mdpsx->bus_state, sizeof(bus_state_t));
+
+    memcpy(snapshot->ram, mdpsx->bus_state.ram, BUS_RAM_SIZE);
+    memcpy(snapshot->scratchpad, mdpsx->bus_state.scratchpad, BUS_PAGE_SIZE);
+}
+
+void mdpsx_snapshot_restore(mdpsx_t *mdpsx, const mdpsx_snapshot_t *snapshot)
+{
+    r3000_state_t *r3000_state = &mdpsx->r3000_state;
+    bus_state_t *bus_state = &mdpsx->bus_state;
+    block_cache_t *cache = &mdpsx->block_cache;
+
+    // Only blocks over code that differs in the restored RAM have to go
+    uint32_t *ram = (uint32_t *) bus_state->ram;
+    const uint32_t *snapshot_ram = (const uint32_t *) snapshot->ram;
+
+    // A chunk of the code bitmap covers 64 words, most of RAM is not code at all
+    const uint64_t *ram_code = (const uint64_t *) cache->ram_code;
+
+    for (uint32_t chunk=0; chunk < (BUS_RAM_SIZE >> 8); chunk++) {
+        uint64_t bits = ram_code[chunk];
+
+        while (bits) {
+            uint32_t word = (chunk << 6) + __builtin_ctzll(bits);
+            bits &= bits - 1;
+
+            if (ram[word] != snapshot_ram[word]) {
+                block_cache_invalidate(cache, word << 2);
+            }
+        }
+    }
+
+    // Setup of the instance rather than state, it stays as it is now
+    uint8_t engine = r3000_state->engine;
+    bios_hle_t *hle = r3000_state->hle;
+    profiler_t *profiler = r3000_state->profiler;
+    trace_t *trace = r3000_state->trace;
+    gpu_video_sink_t *video = bus_state->gpu_state.video;
+
+    memcpy(r3000_state, &snapshot->r3000_state, sizeof(r3000_state_t));
+    memcpy(bus_state, &snapshot->bus_state, sizeof(bus_state_t));
+
+    memcpy(bus_state->ram, snapshot->ram, BUS_RAM_SIZE);
+    memcpy(bus_state->scratchpad, snapshot->scratchpad, BUS_PAGE_SIZE);
+
+    r3000_state->engine = engine;
+    r3000_state->hle = hle;
+    r3000_state->profiler = profiler;
+    r3000_state->trace = trace;
+    bus_state->gpu_state.video = video;
+}
+
+void mdpsx_snapshot_destroy(mdpsx_snapshot_t *snapshot)
+{
+    free(snapshot->ram);
+    free(snapshot->scratchpad);
+    free(snapshot);
+}
@@ -0,0 +1,88 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "core/pacer.h"
+#include "gpu/gpu.h"
+
+static uint64_t pacer_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void pacer_init(pacer_t *pacer, uint32_t turbo, uint32_t max_skip)
+{
+    memset(pacer, 0x00, sizeof(pacer_t));
+
+    pacer->turbo = turbo;
+    pacer->max_skip = max_skip;
+}
+
+/* Starts counting from the next frame, after anything that held the emulator up on purpose */
+void pacer_reset(pacer_t *pacer)
+{
+    pacer->deadline = 0;
+    pacer->behind = false;
+}
+
+/* Whether the frame about to run gets presented */
+bool pacer_present(pacer_t *pacer)
+{
+    if (pacer->turbo) {
+        return pacer->frames++ % pacer->turbo == 0;
+    }
+
+    // Even far behind a frame gets shown now and then
+    if (pacer->behind && pacer->skipped < pacer->max_skip) {
+        pacer->skipped++;
+        pacer->skips++;
+        return false;
+    }
+
+    pacer->skipped = 0;
+
+    return true;
+}
+
+/* Called after every frame with the cycles it took, returns once it is due */
+void pacer_wait(pacer_t *pacer, uint32_t cycles)
+{
+    if (pacer->turbo) {
+        return;
+    }
+
+    uint64_t frame = (uint64_t) cycles * 1000000000 / GPU_CPU_CLOCK;
+    uint64_t now = pacer_now();
+
+    // Deadlines add up from the first one so rounding and wake up jitter do not drift
+    pacer->deadline = (pacer->deadline ? pacer->deadline : now) + frame;
+    pacer->behind = now >= pacer->deadline;
+
+    if (pacer->behind) {
+        pacer->late++;
+
+        // Catching up would run the game fast for a while, better to drop the time
+        if (now - pacer->deadline > PACER_RESYNC_FRAMES * frame) {
+            pacer->deadline = now;
+            pacer->resyncs++;
+        }
+
+        return;
+    }
+
+    if (pacer->deadline - now > PACER_SPIN_NS) {
+        uint64_t wake = pacer->deadline - PACER_SPIN_NS;
+        struct timespec until = {wake / 1000000000, wake % 1000000000};
+
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR) {
+        }
+    }
+
+    while (pacer_now() < pacer->deadline) {
+    }
+}
@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "core/rewind.h"
+#include "core/rle.h"
+#include "log.h"
+
+typedef struct rewind_region_t {
+    uint32_t *data;
+    size_t words;
+} rewind_region_t;
+
+/* The whole snapshot as word arrays, pointers in the structs XOR to zero */
+static void rewind_regions(mdpsx_snapshot_t *snapshot, rewind_region_t *regions)
+{
+    regions[0] = (rewind_region_t) {(uint32_t *) &snapshot->r3000_state, sizeof(r3000_state_t) >> 2};
+    regions[1] = (rewind_region_t) {(uint32_t *) &snapshot->bus_state, sizeof(bus_state_t) >> 2};
+    regions[2] = (rewind_region_t) {(uint32_t *) snapshot->ram, BUS_RAM_SIZE >> 2};
+    regions[3] = (rewind_region_t) {(uint32_t *) snapshot->scratchpad, BUS_PAGE_SIZE >> 2};
+}
+
+static void rewind_copy(mdpsx_snapshot_t *dst, mdpsx_snapshot_t *src)
+{
+    rewind_region_t dst_regions[REWIND_REGION_COUNT];
+    rewind_region_t src_regions[REWIND_REGION_COUNT];
+
+    rewind_regions(dst, dst_regions);
+    rewind_regions(src, src_regions);
+
+    for (uint32_t i=0; i < REWIND_REGION_COUNT; i++) {
+        memcpy(dst_regions[i].data, src_regions[i].data, src_regions[i].words << 2);
+    }
+}
+
+/* A keyframe replaces the snapshot, a delta is XORed onto the keyframe in it */
+static void rewind_decode(rewind_entry_t *entry, mdpsx_snapshot_t *snapshot)
+{
+    rewind_region_t regions[REWIND_REGION_COUNT];
+    rewind_regions(snapshot, regions);
+
+    const uint32_t *data = entry->data;
+
+    for (uint32_t i=0; i < REWIND_REGION_COUNT; i++) {
+        if (entry->keyframe) {
+            rle_decode(data, entry->words[i], regions[i].data, regions[i].words);
+        } else {
+            rle_decode_delta(data, entry->words[i], regions[i].data, regions[i].words);
+        }
+
+        data += entry->words[i];
+    }
+}
+
+/* Runs on the helper thread while a capture is pending, nothing else touches the group state then */
+static rewind_entry_t rewind_encode(rewind_t *rewind)
+{
+    rewind_entry_t entry;
+
+    // Deltas get bigger the further they are from the keyframe
+    entry.keyframe = rewind->need_keyframe || rewind->group_entries >= rewind->keyframe_interval || rewind->group_size > rewind->limit / 4;
+
+    rewind_region_t regions[REWIND_REGION_COUNT];
+    rewind_region_t base[REWIND_REGION_COUNT];
+
+    rewind_regions(rewind->capture, regions);
+    rewind_regions(rewind->keyframe, base);
+
+    size_t words = 0;
+
+    for (uint32_t i=0; i < REWIND_REGION_COUNT; i++) {
+        if (entry.keyframe) {
+            entry.words[i] = rle_encode(regions[i].data, regions[i].words, rewind->buffer + words);
+        } else {
+            entry.words[i] = rle_encode_delta(regions[i].data, base[i].data, regions[i].words, rewind->buffer + words);
+        }
+
+        words += entry.words[i];
+    }
+
+    entry.size = words << 2;
+    entry.data = (uint32_t *) malloc(entry.size);
+    memcpy(entry.data, rewind->buffer, entry.size);
+
+    if (entry.keyframe) {
+        rewind_copy(rewind->keyframe, rewind->capture);
+
+        rewind->group++;
+        rewind->keyframe_group = rewind->group;
+        rewind->group_entries = 0;
+        rewind->group_size = 0;
+        rewind->need_keyframe = false;
+    }
+
+    entry.group = rewind->group;
+
+    return entry;
+}
+
+static void rewind_evict(rewind_t *rewind)
+{
+    rewind_entry_t *entry = &rewind->entries[rewind->first];
+
+    rewind->size -= entry->size;
+    free(entry->data);
+
+    rewind->first = (rewind->first + 1) % REWIND_MAX_ENTRIES;
+    rewind->count--;
+}
+
+/* Deltas are useless without their keyframe, so the oldest groups go as a whole */
+static void rewind_add(rewind_t *rewind, rewind_entry_t *entry)
+{
+    while (rewind->count && rewind->entries[rewind->first].group != entry->group &&
+        (rewind->size + entry->size > rewind->limit || rewind->count == REWIND_MAX_ENTRIES)) {
+        uint64_t group = rewind->entries[rewind->first].group;
+
+        while (rewind->count && rewind->entries[rewind->first].group == group) {
+            rewind_evict(rewind);
+        }
+    }
+
+    // Only the group it belongs to is left and that is already too big
+    if (rewind->size + entry->size > rewind->limit || rewind->count == REWIND_MAX_ENTRIES) {
+        free(entry->data);
+
+        rewind->need_keyframe = true;
+        rewind->dropped++;
+        return;
+    }
+
+    rewind->entries[(rewind->first + rewind->count) % REWIND_MAX_ENTRIES] = *entry;
+    rewind->count++;
+    rewind->size += entry->size;
+
+    rewind->group_entries++;
+    rewind->group_size += entry->size;
+}
+
+static void *rewind_worker(void *data)
+{
+    rewind_t *rewind = (rewind_t *) data;
+
+    pthread_mutex_lock(&rewind->mutex);
+
+    while (true) {
+        while (!rewind->pending && !rewind->quit) {
+            pthread_cond_wait(&rewind->cond, &rewind->mutex);
+        }
+
+        if (rewind->quit) {
+            break;
+        }
+
+        pthread_mutex_unlock(&rewind->mutex);
+        rewind_entry_t entry = rewind_encode(rewind);
+        pthread_mutex_lock(&rewind->mutex);
+
+        rewind_add(rewind, &entry);
+
+        rewind->pending = false;
+        pthread_cond_broadcast(&rewind->cond);
+    }
+
+    pthread_mutex_unlock(&rewind->mutex);
+
+    return NULL;
+}
+
+/* A state every interval frames and a keyframe every keyframe_interval states, limit bytes of coded states at most */
+bool rewind_init(rewind_t *rewind, uint32_t interval, uint32_t keyframe_interval, size_t limit)
+{
+    memset(rewind, 0x00, sizeof(rewind_t));
+
+    rewind->interval = interval ? interval : 1;
+    rewind->keyframe_interval = keyframe_interval;
+    rewind->limit = limit;
+
+    rewind->entries = (rewind_entry_t *) calloc(REWIND_MAX_ENTRIES, sizeof(rewind_entry_t));
+
+    rewind->capture = mdpsx_snapshot_create();
+    rewind->keyframe = mdpsx_snapshot_create();
+    rewind->restore = mdpsx_snapshot_create();
+    rewind->need_keyframe = true;
+
+    rewind_region_t regions[REWIND_REGION_COUNT];
+    rewind_regions(rewind->capture, regions);
+
+    size_t words = 0;
+
+    for (uint32_t i=0; i < REWIND_REGION_COUNT; i++) {
+        words += RLE_MAX_WORDS(regions[i].words);
+    }
+
+    rewind->buffer = (uint32_t *) malloc(words << 2);
+
+    pthread_mutex_init(&rewind->mutex, NULL);
+    pthread_cond_init(&rewind->cond, NULL);
+
+    if (pthread_create(&rewind->thread, NULL, rewind_worker, rewind)) {
+        log_error("REWIND", "Failed to start the helper thread\n");
+
+        rewind->thread = 0;
+        rewind_destroy(rewind);
+        return false;
+    }
+
+    return true;
+}
+
+void rewind_destroy(rewind_t *rewind)
+{
+    if (rewind->thread) {
+        pthread_mutex_lock(&rewind->mutex);
+        rewind->quit = true;
+        pthread_cond_broadcast(&rewind->cond);
+        pthread_mutex_unlock(&rewind->mutex);
+
+        pthread_join(rewind->thread, NULL);
+    }
+
+    while (rewind->count) {
+        rewind_evict(rewind);
+    }
+
+    pthread_mutex_destroy(&rewind->mutex);
+    pthread_cond_destroy(&rewind->cond);
+
+    mdpsx_snapshot_destroy(rewind->capture);
+    mdpsx_snapshot_destroy(rewind->keyframe);
+    mdpsx_snapshot_destroy(rewind->restore);
+
+    free(rewind->buffer);
+    free(rewind->entries);
+}
+
+/* Called once per emulated frame, all the emulator thread does is copy the state */
+void rewind_frame(rewind_t *rewind, mdpsx_t *mdpsx)
+{
+    if (++rewind->frames < rewind->interval) {
+        return;
+    }
+
+    rewind->frames = 0;
+
+    pthread_mutex_lock(&rewind->mutex);
+
+    // Still coding the last one, better a gap than a stall
+    if (rewind->pending) {
+        rewind->dropped++;
+        pthread_mutex_unlock(&rewind->mutex);
+        return;
+    }
+
+    pthread_mutex_unlock(&rewind->mutex);
+
+    mdpsx_snapshot_save(mdpsx, rewind->capture);
+
+    pthread_mutex_lock(&rewind->mutex);
+    rewind->pending = true;
+    rewind->captures++;
+    pthread_cond_broadcast(&rewind->cond);
+    pthread_mutex_unlock(&rewind->mutex);
+}
+
+/* Goes back to the newest state and drops it, false once there is nothing left */
+bool rewind_back(rewind_t *rewind, mdpsx_t *mdpsx)
+{
+    pthread_mutex_lock(&rewind->mutex);
+
+    while (rewind->pending) {
+        pthread_cond_wait(&rewind->cond, &rewind->mutex);
+    }
+
+    if (!rewind->count) {
+        pthread_mutex_unlock(&rewind->mutex);
+        return false;
+    }
+
+    uint32_t index = (rewind->first + rewind->count - 1) % REWIND_MAX_ENTRIES;
+    rewind_entry_t *entry = &rewind->entries[index];
+
+    // Groups are contiguous, going back through one decodes its keyframe once
+    if (entry->group != rewind->keyframe_group) {
+        uint32_t keyframe = index;
+
+        while (!rewind->entries[keyframe].keyframe) {
+            keyframe = (keyframe + REWIND_MAX_ENTRIES - 1) % REWIND_MAX_ENTRIES;
+        }
+
+        rewind_decode(&rewind->entries[keyframe], rewind->keyframe);
+        rewind->keyframe_group = entry->group;
+    }
+
+    rewind_copy(rewind->restore, rewind->keyframe);
+
+    if (!entry->keyframe) {
+        rewind_decode(entry, rewind->restore);
+    }
+
+    mdpsx_snapshot_restore(mdpsx, rewind->restore);
+
+    rewind->size -= entry->size;
+    free(entry->data);
+    rewind->count--;
+
+    // The next state starts over from what was restored
+    rewind->frames = 0;
+    rewind->need_keyframe = true;
+
+    pthread_mutex_unlock(&rewind->mutex);
+
+    return true;
+}
@@ -0,0 +1,108 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "core/rle.h"
+
+/*
+ * Word based run length coding of zeros. Memory images and XOR deltas between
+ * two of them are mostly zero words, everything else is copied as it is.
+ * Single zero words stay in the literal runs, so the output is at most one
+ * word longer than the input. A base makes it code the XOR against it.
+ */
+static inline size_t rle_encode_words(const uint32_t *src, const uint32_t *base, size_t words, uint32_t *dst)
+{
+    size_t in = 0;
+    size_t out = 0;
+
+    #define RLE_WORD(i) (base ? src[i] ^ base[i] : src[i])
+
+    while (in < words) {
+        size_t start = in;
+
+        if (!RLE_WORD(in)) {
+            while (in < words && !RLE_WORD(in) && in - start < RLE_LENGTH_MASK) {
+                in++;
+            }
+
+            dst[out++] = RLE_ZERO_RUN | (in - start);
+        } else {
+            uint32_t *header = &dst[out++];
+
+            // Up to the next two zero words
+            while (in < words && (RLE_WORD(in) || (in + 1 < words && RLE_WORD(in + 1))) && in - start < RLE_LENGTH_MASK) {
+                dst[out++] = RLE_WORD(in);
+                in++;
+            }
+
+            *header = in - start;
+        }
+    }
+
+    #undef RLE_WORD
+
+    return out;
+}
+
+/* Returns the number of words written */
+size_t rle_encode(const uint32_t *src, size_t words, uint32_t *dst)
+{
+    return rle_encode_words(src, NULL, words, dst);
+}
+
+/* Codes src XOR base, words that did not change become zero runs */
+size_t rle_encode_delta(const uint32_t *src, const uint32_t *base, size_t words, uint32_t *dst)
+{
+    return rle_encode_words(src, base, words, dst);
+}
+
+static inline bool rle_decode_words(const uint32_t *src, size_t src_words, uint32_t *dst, size_t words, bool delta)
+{
+    size_t in = 0;
+    size_t out = 0;
+
+    while (in < src_words) {
+        uint32_t header = src[in++];
+        size_t length = header & RLE_LENGTH_MASK;
+
+        if (length > words - out) {
+            return false;
+        }
+
+        if (header & RLE_ZERO_RUN) {
+            if (!delta) {
+                memset(&dst[out], 0x00, length * sizeof(uint32_t));
+            }
+        } else {
+            if (length > src_words - in) {
+                return false;
+            }
+
+            if (delta) {
+                for (size_t i=0; i < length; i++) {
+                    dst[out + i] ^= src[in + i];
+                }
+            } else {
+                memcpy(&dst[out], &src[in], length * sizeof(uint32_t));
+            }
+
+            in += length;
+        }
+
+        out += length;
+    }
+
+    return out == words;
+}
+
+/* False if the input is damaged or does not decode to exactly the given number of words */
+bool rle_decode(const uint32_t *src, size_t src_words, uint32_t *dst, size_t words)
+{
+    return rle_decode_words(src, src_words, dst, words, false);
+}
+
+/* Applies a delta of rle_encode_delta to the base in dst */
+bool rle_decode_delta(const uint32_t *src, size_t src_words, uint32_t *dst, size_t words)
+{
+    return rle_decode_words(src, src_words, dst, words, true);
+}
@@ -0,0 +1,631 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "core/savestate.h"
+#include "core/rle.h"
+#include "log.h"
+
+#define SAVESTATE_MAX_FIELDS    32
+
+typedef struct savestate_field_t {
+    void *data;
+    uint32_t size;
+} savestate_field_t;
+
+#define SAVESTATE_FIELD(field)  ((savestate_field_t) {&(field), sizeof(field)})
+
+// Fields of a section in file order, the same list is used to write and to read it
+typedef uint32_t (*savestate_fields_t)(mdpsx_snapshot_t *snapshot, bool *boot_pending, savestate_field_t *fields);
+
+typedef struct savestate_section_t {
+    char id[4];
+    uint32_t version;
+    savestate_fields_t fields;
+} savestate_section_t;
+
+/* Only state, pointers and the setup of the instance are left out */
+static uint32_t savestate_cpu_fields(mdpsx_snapshot_t *snapshot, bool *boot_pending, savestate_field_t *fields)
+{
+    r3000_state_t *r3000_state = &snapshot->r3000_state;
+    uint32_t count = 0;
+
+    fields[count++] = SAVESTATE_FIELD(r3000_state->regs);
+    fields[count++] = SAVESTATE_FIELD(r3000_state->hi);
+    fields[count++] = SAVESTATE_FIELD(r3000_state->lo);
+    fields[count++] = SAVESTATE_FIELD(r3000_state->pc_instruction);
+    fields[count++] = SAVESTATE_FIELD(r3000_state->pc);
+    fields[count++] = SAVESTATE_FIELD(r3000_state->pc_next);
+    fields[count++] = SAVESTATE_FIELD(r3000_state->branch_delay_slot_state);
+    fields[count++] = SAVESTATE_FIELD(r3000_state->branch_addr);
+    fields[count++] = SAVESTATE_FIELD(r3000_state->load_delay_slot_state);
+    fields[count++] = SAVESTATE_FIELD(r3000_state->load_reg);
+    fields[count++] = SAVESTATE_FIELD(r3000_state->load_value);
+    fields[count++] = SAVESTATE_FIELD(r3000_state->load_delay_reg);
+    fields[count++] = SAVESTATE_FIELD(r3000_state->load_delay_value);
+    fields[count++] = SAVESTATE_FIELD(r3000_state->cop0_state.regs);
+    fields[count++] = SAVESTATE_FIELD(r3000_state->tty.buf);
+    fields[count++] = SAVESTATE_FIELD(r3000_state->tty.index);
+    fields[count++] = SAVESTATE_FIELD(r3000_state->cycles);
+    fields[count++] = SAVESTATE_FIELD(r3000_state->idle_cycles);
+    fields[count++] = SAVESTATE_FIELD(r3000_state->cycles_target);
+
+    // The fast boot still has to side-load the EXE at the shell handoff
+    fields[count++] = SAVESTATE_FIELD(*boot_pending);
+
+    return count;
+}
+
+static uint32_t savestate_gte_fields(mdpsx_snapshot_t *snapshot, bool *boot_pending, savestate_field_t *fields)
+{
+    (void) boot_pending;
+
+    gte_state_t *gte_state = &snapshot->r3000_state.gte_state;
+    uint32_t count = 0;
+
+    fields[count++] = SAVESTATE_FIELD(gte_state->v);
+    fields[count++] = SAVESTATE_FIELD(gte_state->rgbc);
+    fields[count++] = SAVESTATE_FIELD(gte_state->otz);
+    fields[count++] = SAVESTATE_FIELD(gte_state->ir);
+    fields[count++] = SAVESTATE_FIELD(gte_state->sxy);
+    fields[count++] = SAVESTATE_FIELD(gte_state->sz);
+    fields[count++] = SAVESTATE_FIELD(gte_state->rgb);
+    fields[count++] = SAVESTATE_FIELD(gte_state->res1);
+    fields[count++] = SAVESTATE_FIELD(gte_state->mac);
+    fields[count++] = SAVESTATE_FIELD(gte_state->lzcs);
+    fields[count++] = SAVESTATE_FIELD(gte_state->lzcr);
+    fields[count++] = SAVESTATE_FIELD(gte_state->matrix);
+    fields[count++] = SAVESTATE_FIELD(gte_state->vector);
+    fields[count++] = SAVESTATE_FIELD(gte_state->ofx);
+    fields[count++] = SAVESTATE_FIELD(gte_state->ofy);
+    fields[count++] = SAVESTATE_FIELD(gte_state->h);
+    fields[count++] = SAVESTATE_FIELD(gte_state->dqa);
+    fields[count++] = SAVESTATE_FIELD(gte_state->dqb);
+    fields[count++] = SAVESTATE_FIELD(gte_state->zsf3);
+    fields[count++] = SAVESTATE_FIELD(gte_state->zsf4);
+    fields[count++] = SAVESTATE_FIELD(gte_state->flag);
+
+    return count;
+}
+
+static uint32_t savestate_irq_fields(mdpsx_snapshot_t *snapshot, bool *boot_pending, savestate_field_t *fields)
+{
+    (void) boot_pending;
+
+    irq_state_t *irq_state = &snapshot->bus_state.irq_state;
+    uint32_t count = 0;
+
+    fields[count++] = SAVESTATE_FIELD(irq_state->i_stat);
+    fields[count++] = SAVESTATE_FIELD(irq_state->i_mask);
+    fields[count++] = SAVESTATE_FIELD(irq_state->cpu_mask);
+    fields[count++] = SAVESTATE_FIELD(irq_state->cpu_software);
+    fields[count++] = SAVESTATE_FIELD(irq_state->pending);
+
+    return count;
+}
+
+static uint32_t savestate_dma_fields(mdpsx_snapshot_t *snapshot, bool *boot_pending, savestate_field_t *fields)
+{
+    (void) boot_pending;
+
+    dma_state_t *dma_state = &snapshot->bus_state.dma_state;
+    uint32_t count = 0;
+
+    fields[count++] = SAVESTATE_FIELD(dma_state->dpcr);
+    fields[count++] = SAVESTATE_FIELD(dma_state->dicr);
+
+    for (uint32_t i=0; i < 7; i++) {
+        fields[count++] = SAVESTATE_FIELD(dma_state->channels[i].madr);
+        fields[count++] = SAVESTATE_FIELD(dma_state->channels[i].bcr);
+        fields[count++] = SAVESTATE_FIELD(dma_state->channels[i].chcr);
+        fields[count++] = SAVESTATE_FIELD(dma_state->channels[i].end);
+    }
+
+    return count;
+}
+
+static uint32_t savestate_timer_fields(mdpsx_snapshot_t *snapshot, bool *boot_pending, savestate_field_t *fields)
+{
+    (void) boot_pending;
+
+    timer_state_t *timer_state = &snapshot->bus_state.timer_state;
+    timer_channel_t *channels[] = {&timer_state->channel_0, &timer_state->channel_1, &timer_state->channel_2};
+    uint32_t count = 0;
+
+    for (uint32_t i=0; i < 3; i++) {
+        fields[count++] = SAVESTATE_FIELD(channels[i]->counter);
+        fields[count++] = SAVESTATE_FIELD(channels[i]->mode);
+        fields[count++] = SAVESTATE_FIELD(channels[i]->target);
+        fields[count++] = SAVESTATE_FIELD(channels[i]->fraction);
+        fields[count++] = SAVESTATE_FIELD(channels[i]->irq_req);
+    }
+
+    fields[count++] = SAVESTATE_FIELD(timer_state->cycles);
+    fields[count++] = SAVESTATE_FIELD(timer_state->reads);
+
+    return count;
+}
+
+static uint32_t savestate_gpu_fields(mdpsx_snapshot_t *snapshot, bool *boot_pending, savestate_field_t *fields)
+{
+    (void) boot_pending;
+
+    gpu_state_t *gpu_state = &snapshot->bus_state.gpu_state;
+    uint32_t count = 0;
+
+    fields[count++] = SAVESTATE_FIELD(gpu_state->vram_transfer_loc_x);
+    fields[count++] = SAVESTATE_FIELD(gpu_state->vram_transfer_loc_y);
+    fields[count++] = SAVESTATE_FIELD(gpu_state->horizontal_resolution);
+    fields[count++] = SAVESTATE_FIELD(gpu_state->vertical_resolution);
+    fields[count++] = SAVESTATE_FIELD(gpu_state->pal);
+    fields[count++] = SAVESTATE_FIELD(gpu_state->depth_24bit);
+    fields[count++] = SAVESTATE_FIELD(gpu_state->display_enable);
+    fields[count++] = SAVESTATE_FIELD(gpu_state->dma_direction);
+    fields[count++] = SAVESTATE_FIELD(gpu_state->state);
+    fields[count++] = SAVESTATE_FIELD(gpu_state->command_buf);
+    fields[count++] = SAVESTATE_FIELD(gpu_state->command_buf_index);
+    fields[count++] = SAVESTATE_FIELD(gpu_state->command_buf_left);
+    fields[count++] = SAVESTATE_FIELD(gpu_state->irq);
+    fields[count++] = SAVESTATE_FIELD(gpu_state->frames);
+
+    return count;
+}
+
+/* The callbacks are registered by bus_init, only when the events are due is state */
+static uint32_t savestate_scheduler_fields(mdpsx_snapshot_t *snapshot, bool *boot_pending, savestate_field_t *fields)
+{
+    (void) boot_pending;
+
+    scheduler_t *scheduler = &snapshot->bus_state.scheduler;
+    uint32_t count = 0;
+
+    fields[count++] = SAVESTATE_FIELD(scheduler->cycles);
+
+    for (uint32_t i=0; i < SCHEDULER_EVENT_COUNT; i++) {
+        fields[count++] = SAVESTATE_FIELD(scheduler->events[i].cycles);
+        fields[count++] = SAVESTATE_FIELD(scheduler->events[i].slot);
+    }
+
+    fields[count++] = SAVESTATE_FIELD(scheduler->heap);
+    fields[count++] = SAVESTATE_FIELD(scheduler->count);
+    fields[count++] = SAVESTATE_FIELD(snapshot->bus_state.next_event);
+
+    return count;
+}
+
+static uint32_t savestate_ram_fields(mdpsx_snapshot_t *snapshot, bool *boot_pending, savestate_field_t *fields)
+{
+    (void) boot_pending;
+
+    fields[0] = (savestate_field_t) {snapshot->ram, BUS_RAM_SIZE};
+
+    return 1;
+}
+
+static uint32_t savestate_scratchpad_fields(mdpsx_snapshot_t *snapshot, bool *boot_pending, savestate_field_t *fields)
+{
+    (void) boot_pending;
+
+    fields[0] = (savestate_field_t) {snapshot->scratchpad, 0x400};
+
+    return 1;
+}
+
+static uint32_t savestate_vram_fields(mdpsx_snapshot_t *snapshot, bool *boot_pending, savestate_field_t *fields)
+{
+    (void) boot_pending;
+
+    fields[0] = SAVESTATE_FIELD(snapshot->bus_state.gpu_state.vram);
+
+    return 1;
+}
+
+/* A change to the fields of a section needs a new version of it */
+static const savestate_section_t savestate_sections[] = {
+    {"CPU ", 1, savestate_cpu_fields},
+    {"GTE ", 1, savestate_gte_fields},
+    {"IRQ ", 1, savestate_irq_fields},
+    {"DMA ", 1, savestate_dma_fields},
+    {"TIMR", 2, savestate_timer_fields},
+    {"GPU ", 1, savestate_gpu_fields},
+    {"SCHD", 1, savestate_scheduler_fields},
+    {"RAM ", 1, savestate_ram_fields},
+    {"SPAD", 1, savestate_scratchpad_fields},
+    {"VRAM", 1, savestate_vram_fields}
+};
+
+#define SAVESTATE_SECTION_COUNT (sizeof(savestate_sections) / sizeof(savestate_sections[0]))
+
+static uint32_t savestate_fields_size(savestate_field_t *fields, uint32_t count)
+{
+    uint32_t size = 0;
+
+    for (uint32_t i=0; i < count; i++) {
+        size += fields[i].size;
+    }
+
+    return size;
+}
+
+static bool savestate_write(savestate_t *savestate)
+{
+    mdpsx_snapshot_t *snapshot = savestate->snapshot;
+
+    // Written next to it and renamed, an interrupted save keeps the old file
+    char *tmp_path = (char *) malloc(strlen(savestate->path) + 5);
+    sprintf(tmp_path, "%s.tmp", savestate->path);
+
+    FILE *fp = fopen(tmp_path, "wb");
+
+    if (!fp) {
+        log_error("SAVESTATE", "Failed to write %s\n", tmp_path);
+
+        free(tmp_path);
+        return false;
+    }
+
+    savestate_header_t header;
+    memcpy(header.magic, SAVESTATE_MAGIC, 8);
+    header.version = SAVESTATE_VERSION;
+    header.bios_checksum = boot_bios_checksum(&snapshot->bus_state);
+    header.sections = SAVESTATE_SECTION_COUNT;
+
+    fwrite(&header, sizeof(header), 1, fp);
+
+    for (uint32_t i=0; i < SAVESTATE_SECTION_COUNT; i++) {
+        const savestate_section_t *section = &savestate_sections[i];
+
+        savestate_field_t fields[SAVESTATE_MAX_FIELDS];
+        uint32_t count = section->fields(snapshot, &savestate->boot_pending, fields);
+        uint32_t size = savestate_fields_size(fields, count);
+
+        // Gathered into one block, so it can be coded as a whole
+        uint32_t *data = (uint32_t *) malloc(size + 4);
+        uint8_t *ptr = (uint8_t *) data;
+
+        for (uint32_t j=0; j < count; j++) {
+            memcpy(ptr, fields[j].data, fields[j].size);
+            ptr += fields[j].size;
+        }
+
+        savestate_section_header_t section_header;
+        memcpy(section_header.id, section->id, 4);
+        section_header.version = section->version;
+        section_header.flags = 0;
+        section_header.size = size;
+        section_header.stored = size;
+
+        uint32_t *stored = data;
+
+        if (savestate->compress && !(size & 3)) {
+            uint32_t *encoded = (uint32_t *) malloc(RLE_MAX_WORDS(size >> 2) << 2);
+            uint32_t encoded_size = rle_encode(data, size >> 2, encoded) << 2;
+
+            if (encoded_size < size) {
+                section_header.flags |= SAVESTATE_SECTION_RLE;
+                section_header.stored = encoded_size;
+                stored = encoded;
+            } else {
+                free(encoded);
+            }
+        }
+
+        // Sections start at multiples of four, coded data is read as words
+        uint32_t padding = 0;
+
+        fwrite(&section_header, sizeof(section_header), 1, fp);
+        fwrite(stored, 1, section_header.stored, fp);
+        fwrite(&padding, 1, -section_header.stored & 3, fp);
+
+        if (stored != data) {
+            free(stored);
+        }
+
+        free(data);
+    }
+
+    bool valid = !ferror(fp);
+    valid = !fclose(fp) && valid;
+
+    if (!valid || rename(tmp_path, savestate->path)) {
+        log_error("SAVESTATE", "Failed to write %s\n", savestate->path);
+
+        remove(tmp_path);
+        free(tmp_path);
+        return false;
+    }
+
+    free(tmp_path);
+
+    log_info("SAVESTATE", "Saved state to %s\n", savestate->path);
+
+    return true;
+}
+
+static void *savestate_worker(void *data)
+{
+    savestate_t *savestate = (savestate_t *) data;
+
+    savestate->result = savestate_write(savestate);
+
+    return NULL;
+}
+
+void savestate_init(savestate_t *savestate)
+{
+    savestate->snapshot = mdpsx_snapshot_create();
+    savestate->boot_pending = false;
+
+    savestate->path = NULL;
+    savestate->compress = false;
+
+    savestate->busy = false;
+    savestate->result = false;
+}
+
+void savestate_destroy(savestate_t *savestate)
+{
+    savestate_wait(savestate);
+
+    mdpsx_snapshot_destroy(savestate->snapshot);
+    free(savestate->path);
+}
+
+/*
+ * Copies the state and writes it to path in the background, see savestate_wait.
+ * The copy is all the emulator thread waits for.
+ */
+bool savestate_save(savestate_t *savestate, mdpsx_t *mdpsx, const char *path, bool compress)
+{
+    // The last state is still being written from the snapshot
+    savestate_wait(savestate);
+
+    mdpsx_snapshot_save(mdpsx, savestate->snapshot);
+    savestate->boot_pending = mdpsx->r3000_state.boot != NULL;
+
+    free(savestate->path);
+    savestate->path = strdup(path);
+    savestate->compress = compress;
+
+    if (pthread_create(&savestate->thread, NULL, savestate_worker, savestate)) {
+        savestate->result = savestate_write(savestate);
+        return savestate->result;
+    }
+
+    savestate->busy = true;
+
+    return true;
+}
+
+/* Result of the last save once it is on disk */
+bool savestate_wait(savestate_t *savestate)
+{
+    if (savestate->busy) {
+        pthread_join(savestate->thread, NULL);
+        savestate->busy = false;
+    }
+
+    return savestate->result;
+}
+
+static const savestate_section_t *savestate_find_section(const char *id)
+{
+    for (uint32_t i=0; i < SAVESTATE_SECTION_COUNT; i++) {
+        if (!memcmp(savestate_sections[i].id, id, 4)) {
+            return &savestate_sections[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Values that index arrays while running, a file that was edited or damaged could point them anywhere */
+static bool savestate_validate(mdpsx_snapshot_t *snapshot, const char *path)
+{
+    r3000_state_t *r3000_state = &snapshot->r3000_state;
+    gpu_state_t *gpu_state = &snapshot->bus_state.gpu_state;
+    scheduler_t *scheduler = &snapshot->bus_state.scheduler;
+
+    if (r3000_state->load_reg >= 32 || r3000_state->load_delay_reg >= 32 ||
+        r3000_state->branch_delay_slot_state > DELAY_SLOT_STATE_DONE ||
+        r3000_state->tty.index >= sizeof(r3000_state->tty.buf)) {
+        log_error("SAVESTATE", "%s has an invalid CPU state\n", path);
+        return false;
+    }
+
+    // Arguments are stored after the index, the last one has to fit the buffer
+    bool gpu_valid = gpu_state->state <= GPU_STATE_WAITING_FOR_VRAM_DATA &&
+        gpu_state->command_buf_index < GPU_COMMAND_BUFFER_SIZE;
+
+    if (gpu_valid && gpu_state->state == GPU_STATE_WAITING_FOR_ARG) {
+        gpu_valid = gpu_state->command_buf_left < (uint32_t) (GPU_COMMAND_BUFFER_SIZE - gpu_state->command_buf_index);
+    }
+
+    if (!gpu_valid) {
+        log_error("SAVESTATE", "%s has an invalid GPU state\n", path);
+        return false;
+    }
+
+    // The heap and the slots of the events have to point at each other
+    bool scheduler_valid = scheduler->count <= SCHEDULER_EVENT_COUNT;
+
+    for (uint32_t i=0; scheduler_valid && i < scheduler->count; i++) {
+        scheduler_valid = scheduler->heap[i] < SCHEDULER_EVENT_COUNT && scheduler->events[scheduler->heap[i]].slot == (int8_t) i;
+    }
+
+    for (uint32_t i=0; scheduler_valid && i < SCHEDULER_EVENT_COUNT; i++) {
+        int8_t slot = scheduler->events[i].slot;
+        scheduler_valid = slot == -1 || (slot >= 0 && slot < scheduler->count);
+    }
+
+    if (!scheduler_valid) {
+        log_error("SAVESTATE", "%s has an invalid scheduler state\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+/* Fills the snapshot from the mapped file, false if anything does not fit */
+static bool savestate_read(mdpsx_snapshot_t *snapshot, bool *boot_pending, const uint8_t *file, size_t size, const char *path)
+{
+    bool found[SAVESTATE_SECTION_COUNT] = {false};
+    size_t offset = sizeof(savestate_header_t);
+
+    uint32_t sections = ((const savestate_header_t *) file)->sections;
+
+    for (uint32_t i=0; i < sections; i++) {
+        if (size - offset < sizeof(savestate_section_header_t)) {
+            log_error("SAVESTATE", "%s is truncated\n", path);
+            return false;
+        }
+
+        const savestate_section_header_t *section_header = (const savestate_section_header_t *) (file + offset);
+        offset += sizeof(savestate_section_header_t);
+
+        if (size - offset < section_header->stored) {
+            log_error("SAVESTATE", "%s is truncated\n", path);
+            return false;
+        }
+
+        const uint8_t *data = file + offset;
+        offset += (section_header->stored + 3) & ~3;
+
+        // Sections of newer builds are left to them
+        const savestate_section_t *section = savestate_find_section(section_header->id);
+
+        if (!section) {
+            log_info("SAVESTATE", "Skipping unknown section %.4s\n", section_header->id);
+            continue;
+        }
+
+        savestate_field_t fields[SAVESTATE_MAX_FIELDS];
+        uint32_t count = section->fields(snapshot, boot_pending, fields);
+        uint32_t section_size = savestate_fields_size(fields, count);
+
+        if (section_header->version != section->version || section_header->size != section_size) {
+            log_error("SAVESTATE", "Section %.4s version %u is not supported\n", section->id, section_header->version);
+            return false;
+        }
+
+        uint8_t *buffer = NULL;
+
+        if (section_header->flags & SAVESTATE_SECTION_RLE) {
+            // Memory sections are a single field and decoded in place
+            buffer = (count == 1) ? (uint8_t *) fields[0].data : (uint8_t *) malloc(section_size);
+
+            if ((section_size & 3) || !rle_decode((const uint32_t *) data, section_header->stored >> 2, (uint32_t *) buffer, section_size >> 2)) {
+                log_error("SAVESTATE", "Section %.4s is damaged\n", section->id);
+
+                if (count != 1) {
+                    free(buffer);
+                }
+
+                return false;
+            }
+
+            data = buffer;
+        } else if (section_header->stored != section_size) {
+            log_error("SAVESTATE", "Section %.4s is damaged\n", section->id);
+            return false;
+        }
+
+        for (uint32_t j=0; j < count; j++) {
+            if (fields[j].data != data) {
+                memcpy(fields[j].data, data, fields[j].size);
+            }
+
+            data += fields[j].size;
+        }
+
+        if (count != 1) {
+            free(buffer);
+        }
+
+        found[section - savestate_sections] = true;
+    }
+
+    for (uint32_t i=0; i < SAVESTATE_SECTION_COUNT; i++) {
+        if (!found[i]) {
+            log_error("SAVESTATE", "%s has no %.4s section\n", path, savestate_sections[i].id);
+            return false;
+        }
+    }
+
+    return savestate_validate(snapshot, path);
+}
+
+/* The running state is only replaced once the whole file has been read */
+bool savestate_load(mdpsx_t *mdpsx, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        log_error("SAVESTATE", "Failed to open %s\n", path);
+        return false;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) || st.st_size < (off_t) sizeof(savestate_header_t)) {
+        log_error("SAVESTATE", "%s is not a save state\n", path);
+
+        close(fd);
+        return false;
+    }
+
+    const uint8_t *file = (const uint8_t *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (file == MAP_FAILED) {
+        log_error("SAVESTATE", "Failed to map %s\n", path);
+        return false;
+    }
+
+    const savestate_header_t *header = (const savestate_header_t *) file;
+
+    if (memcmp(header->magic, SAVESTATE_MAGIC, 8) || header->version != SAVESTATE_VERSION) {
+        log_error("SAVESTATE", "%s is not a save state of this version\n", path);
+
+        munmap((void *) file, st.st_size);
+        return false;
+    }
+
+    // RAM holds a kernel that came from the BIOS
+    if (header->bios_checksum != boot_bios_checksum(&mdpsx->bus_state)) {
+        log_error("SAVESTATE", "%s was saved with another BIOS\n", path);
+
+        munmap((void *) file, st.st_size);
+        return false;
+    }
+
+    // Pointers and whatever the file does not have come from the running state
+    mdpsx_snapshot_t *snapshot = mdpsx_snapshot_create();
+    mdpsx_snapshot_save(mdpsx, snapshot);
+
+    bool boot_pending = false;
+    bool valid = savestate_read(snapshot, &boot_pending, file, st.st_size, path);
+
+    munmap((void *) file, st.st_size);
+
+    if (valid) {
+        mdpsx_snapshot_restore(mdpsx, snapshot);
+
+        // Only an instance set up for fast boot has anything to do at the handoff
+        bool boot = mdpsx->boot.exe || mdpsx->boot.cache_path;
+        mdpsx->r3000_state.boot = (boot_pending && boot) ? &mdpsx->boot : NULL;
+
+        log_info("SAVESTATE", "Loaded state from %s\n", path);
+    }
+
+    mdpsx_snapshot_destroy(snapshot);
+
+    return valid;
+}
@@ -0,0 +1,354 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cpu/block_cache.h"
+#include "cpu/jit.h"
+#include "core/instrument.h"
+#include "log.h"
+
+void block_cache_init(block_cache_t *cache)
+{
+    cache->ram_blocks = (block_t **) calloc(BLOCK_CACHE_RAM_SIZE >> 2, sizeof(block_t *));
+    cache->bios_blocks = (block_t **) calloc(BLOCK_CACHE_BIOS_SIZE >> 2, sizeof(block_t *));
+    cache->ram_code = (uint8_t *) calloc(BLOCK_CACHE_RAM_SIZE >> 5, 1);
+
+    cache->free_list = NULL;
+    cache->invalidated = false;
+    cache->flush_pending = false;
+
+    cache->jit = NULL;
+}
+
+static void block_cache_retire(block_cache_t *cache, block_t *block)
+{
+    // Nothing may jump into the block anymore
+    if (block->links) {
+        jit_unlink(block);
+    }
+
+    block->next_free = cache->free_list;
+    cache->free_list = block;
+
+    cache->invalidated = true;
+}
+
+static void block_cache_collect(block_cache_t *cache)
+{
+    while (cache->free_list) {
+        block_t *block = cache->free_list;
+        cache->free_list = block->next_free;
+
+        free(block);
+    }
+
+    cache->invalidated = false;
+}
+
+/* Call jit_destroy first, it drops the links between the blocks */
+void block_cache_destroy(block_cache_t *cache)
+{
+    for (uint32_t i=0; i < (BLOCK_CACHE_RAM_SIZE >> 2); i++) {
+        free(cache->ram_blocks[i]);
+    }
+
+    for (uint32_t i=0; i < (BLOCK_CACHE_BIOS_SIZE >> 2); i++) {
+        free(cache->bios_blocks[i]);
+    }
+
+    block_cache_collect(cache);
+
+    free(cache->ram_blocks);
+    free(cache->bios_blocks);
+    free(cache->ram_code);
+}
+
+/* Drops all blocks in RAM, BIOS blocks can never change */
+void block_cache_flush(block_cache_t *cache)
+{
+    for (uint32_t i=0; i < (BLOCK_CACHE_RAM_SIZE >> 2); i++) {
+        if (cache->ram_blocks[i]) {
+            block_cache_retire(cache, cache->ram_blocks[i]);
+            cache->ram_blocks[i] = NULL;
+        }
+    }
+
+    memset(cache->ram_code, 0x00, BLOCK_CACHE_RAM_SIZE >> 5);
+}
+
+void block_cache_invalidate(block_cache_t *cache, uint32_t phy_addr)
+{
+    uint32_t word = (phy_addr & (BLOCK_CACHE_RAM_SIZE - 1)) >> 2;
+    uint32_t first = (word >= BLOCK_CACHE_MAX_INSTRUCTIONS - 1) ? word - (BLOCK_CACHE_MAX_INSTRUCTIONS - 1) : 0;
+
+    // Every block covering this word starts at most one block length before it
+    for (uint32_t i=first; i <= word; i++) {
+        block_t *block = cache->ram_blocks[i];
+
+        if (block && i + block->length > word) {
+            log_debug(LOG_BLOCK_CACHE, "BLOCK", "Invalidate %08X (%d instructions) | write to %08X\n", block->phy_addr, block->length, phy_addr);
+
+            block_cache_retire(cache, block);
+            cache->ram_blocks[i] = NULL;
+        }
+    }
+
+    // No block covers this word anymore
+    cache->ram_code[word >> 3] &= ~(1 << (word & 7));
+}
+
+/*
+ * Stores with COP0_SR_ISC set go to the instruction cache, the BIOS uses them to flush it.
+ * We drop all RAM blocks once the cache is connected again.
+ */
+void block_cache_isolated_write(block_cache_t *cache)
+{
+    cache->flush_pending = true;
+}
+
+bool block_cache_is_branch(r3000_instruction_t *instruction)
+{
+    switch(instruction->op) {
+        case R3000_OP_JR: case R3000_OP_JALR:
+        case R3000_OP_BLTZ: case R3000_OP_BGEZ: case R3000_OP_BLTZAL: case R3000_OP_BGEZAL:
+        case R3000_OP_J: case R3000_OP_JAL: case R3000_OP_BEQ: case R3000_OP_BNE: case R3000_OP_BLEZ: case R3000_OP_BGTZ:
+            return true;
+    }
+
+    return false;
+}
+
+/* Instructions that may raise an exception or change SR */
+bool block_cache_ends_block(r3000_instruction_t *instruction)
+{
+    switch(instruction->op) {
+        case R3000_OP_SYSCALL: case R3000_OP_BREAK:
+        case R3000_OP_MFC0: case R3000_OP_MTC0: case R3000_OP_RFE:
+        case R3000_OP_MFC2: case R3000_OP_CFC2: case R3000_OP_MTC2: case R3000_OP_CTC2:
+        case R3000_OP_COP2: case R3000_OP_LWC2: case R3000_OP_SWC2:
+        case R3000_OP_COP_UNUSABLE: case R3000_OP_RESERVED:
+            return true;
+    }
+
+    return false;
+}
+
+static bool block_cache_is_load(r3000_instruction_t *instruction)
+{
+    return instruction->op >= R3000_OP_LB && instruction->op <= R3000_OP_LWR;
+}
+
+/* Registers an instruction reads and writes, false for anything that is not allowed in an idle loop */
+static bool block_cache_idle_operands(r3000_instruction_t *instruction, uint32_t *reads, uint32_t *writes)
+{
+    *reads = 0;
+    *writes = 0;
+
+    switch(instruction->op) {
+        case R3000_OP_SLL: case R3000_OP_SRL: case R3000_OP_SRA:
+            *reads = 1 << instruction->rt;
+            *writes = 1 << instruction->rd;
+            break;
+
+        case R3000_OP_SLLV: case R3000_OP_SRLV: case R3000_OP_SRAV:
+        case R3000_OP_ADD: case R3000_OP_ADDU: case R3000_OP_SUB: case R3000_OP_SUBU:
+        case R3000_OP_AND: case R3000_OP_OR: case R3000_OP_XOR: case R3000_OP_NOR: case R3000_OP_SLT: case R3000_OP_SLTU:
+            *reads = (1 << instruction->rs) | (1 << instruction->rt);
+            *writes = 1 << instruction->rd;
+            break;
+
+        case R3000_OP_ADDI: case R3000_OP_ADDIU: case R3000_OP_SLTI: case R3000_OP_SLTIU:
+        case R3000_OP_ANDI: case R3000_OP_ORI: case R3000_OP_XORI:
+        case R3000_OP_LB: case R3000_OP_LH: case R3000_OP_LW: case R3000_OP_LBU: case R3000_OP_LHU:
+            *reads = 1 << instruction->rs;
+            *writes = 1 << instruction->rt;
+            break;
+
+        case R3000_OP_LUI:
+            *writes = 1 << instruction->rt;
+            break;
+
+        case R3000_OP_BEQ: case R3000_OP_BNE:
+            *reads = (1 << instruction->rs) | (1 << instruction->rt);
+            break;
+
+        case R3000_OP_BLTZ: case R3000_OP_BGEZ: case R3000_OP_BLEZ: case R3000_OP_BGTZ:
+            *reads = 1 << instruction->rs;
+            break;
+
+        case R3000_OP_J:
+            break;
+
+        default:
+            return false;
+    }
+
+    // R0 is never state
+    *reads &= ~1;
+    *writes &= ~1;
+
+    return true;
+}
+
+/*
+ * A short loop that branches back to its own start, has no stores and no
+ * register carried over from one iteration to the next. Every iteration
+ * computes the same from the same memory, so it can only be waiting for
+ * a device to change something.
+ */
+static bool block_cache_is_idle_loop(block_t *block, uint32_t pc)
+{
+    uint32_t length = block->length;
+
+    if (length < 2 || length > BLOCK_CACHE_IDLE_MAX_INSTRUCTIONS) {
+        return false;
+    }
+
+    r3000_instruction_t *branch = &block->instructions[length - 2];
+    uint32_t branch_pc = pc + ((length - 2) << 2);
+    uint32_t target;
+
+    // Linking branches and register jumps are turned away below
+    if (!block_cache_is_branch(branch)) {
+        return false;
+    }
+
+    if (branch->op == R3000_OP_J) {
+        target = ((branch_pc + 4) & 0xF0000000) | (branch->imm_jump << 2);
+    } else {
+        target = branch_pc + 4 + (((uint32_t) (int16_t) branch->imm) << 2);
+    }
+
+    // A load in the delay slot would land in the next iteration
+    if (target != pc || block_cache_is_load(&block->instructions[length - 1])) {
+        return false;
+    }
+
+    uint32_t reads, writes;
+    uint32_t loop_writes = 0;
+
+    for (uint32_t i=0; i < length; i++) {
+        if (!block_cache_idle_operands(&block->instructions[i], &reads, &writes)) {
+            return false;
+        }
+
+        loop_writes |= writes;
+    }
+
+    // Every register the loop changes has to be written before it is read
+    uint32_t written = 0;
+    uint32_t load_pending = 0;
+
+    for (uint32_t i=0; i < length; i++) {
+        r3000_instruction_t *instruction = &block->instructions[i];
+
+        block_cache_idle_operands(instruction, &reads, &writes);
+
+        if (reads & loop_writes & ~written) {
+            return false;
+        }
+
+        written |= load_pending;
+        load_pending = 0;
+
+        if (block_cache_is_load(instruction)) {
+            load_pending = writes;
+        } else {
+            written |= writes;
+        }
+    }
+
+    return true;
+}
+
+static block_t *block_cache_compile(bus_state_t *bus_state, uint32_t pc, uint32_t phy_addr, uint32_t phy_limit)
+{
+    r3000_instruction_t instructions[BLOCK_CACHE_MAX_INSTRUCTIONS];
+    uint32_t length = 0;
+    bool delay_slot = false;
+
+    while (length < BLOCK_CACHE_MAX_INSTRUCTIONS && phy_addr + (length << 2) < phy_limit) {
+        r3000_instruction_t *instruction = &instructions[length++];
+
+        r3000_decode(instruction, bus_read(bus_state, BUS_SIZE_DWORD, pc + ((length - 1) << 2)));
+
+        if (delay_slot) {
+            break;
+        }
+
+        if (block_cache_is_branch(instruction)) {
+            delay_slot = true;
+        } else if (block_cache_ends_block(instruction)) {
+            break;
+        }
+    }
+
+    block_t *block = (block_t *) malloc(sizeof(block_t) + length * sizeof(r3000_instruction_t));
+    block->phy_addr = phy_addr;
+    block->length = length;
+    block->next_free = NULL;
+
+    block->code = NULL;
+    block->jit_pc = 0;
+    block->jit_length = 0;
+    block->jit_failed = false;
+    block->links = NULL;
+
+    memcpy(block->instructions, instructions, length * sizeof(r3000_instruction_t));
+
+    block->idle_loop = block_cache_is_idle_loop(block, pc);
+
+    log_debug(LOG_BLOCK_CACHE, "BLOCK", "Compiled %08X (%d instructions)\n", phy_addr, length);
+
+    return block;
+}
+
+block_t *block_cache_lookup(block_cache_t *cache, r3000_state_t *r3000_state, bus_state_t *bus_state)
+{
+    block_cache_collect(cache);
+
+    if (cache->flush_pending && !(r3000_state->cop0_state.regs[COP0_REG_SR] & COP0_SR_ISC)) {
+        block_cache_flush(cache);
+        block_cache_collect(cache);
+
+        cache->flush_pending = false;
+    }
+
+    uint32_t pc = r3000_state->pc;
+    uint32_t phy_addr = pc & bus_segment_map[pc >> 29];
+
+    if (pc & 0x3) {
+        return NULL;
+    }
+
+    if (phy_addr < BLOCK_CACHE_RAM_SIZE) {
+        block_t **slot = &cache->ram_blocks[phy_addr >> 2];
+
+        if (!*slot) {
+            instrument_begin(INSTRUMENT_COMPILE);
+            *slot = block_cache_compile(bus_state, pc, phy_addr, BLOCK_CACHE_RAM_SIZE);
+            instrument_end();
+
+            // Mark the words so writes to them invalidate the block
+            for (uint32_t i=0; i < (*slot)->length; i++) {
+                uint32_t word = (phy_addr >> 2) + i;
+                cache->ram_code[word >> 3] |= (1 << (word & 7));
+            }
+        }
+
+        return *slot;
+    } else if (phy_addr >= BLOCK_CACHE_BIOS_BASE && phy_addr < BLOCK_CACHE_BIOS_BASE + BLOCK_CACHE_BIOS_SIZE) {
+        block_t **slot = &cache->bios_blocks[(phy_addr - BLOCK_CACHE_BIOS_BASE) >> 2];
+
+        if (!*slot) {
+            instrument_begin(INSTRUMENT_COMPILE);
+            *slot = block_cache_compile(bus_state, pc, phy_addr, BLOCK_CACHE_BIOS_BASE + BLOCK_CACHE_BIOS_SIZE);
+            instrument_end();
+        }
+
+        return *slot;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,1023 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "cpu/gte.h"
+#include "log.h"
+
+// MAC1-3 hold 44 bit sums
+#define GTE_MAC_MAX     ((1LL << 43) - 1)
+#define GTE_MAC_MIN     (-(1LL << 43))
+
+/*
+ * Matrix times vector plus translation SHL 12 for a number of vectors. Every
+ * row sum is checked for 44 bit overflow and wrapped after each of the first
+ * two terms, the last one is left to gte_set_mac. Returns the FLAG bits.
+ */
+typedef uint32_t (*gte_transform_t)(int16_t matrix[3][3], int32_t translation[3], int16_t vectors[][3], uint8_t count, int64_t results[][3]);
+
+static gte_transform_t gte_transform;
+
+// Reciprocal table for the UNR division
+static uint8_t gte_unr_table[0x101];
+
+static int32_t gte_zero[3];
+
+// The tables above are shared by every GTE in the process
+static pthread_once_t gte_setup_once = PTHREAD_ONCE_INIT;
+
+static int64_t gte_check_mac(uint32_t *flag, uint8_t index, int64_t value)
+{
+    if (value > GTE_MAC_MAX) {
+        *flag |= GTE_FLAG_MAC1_POSITIVE >> (index - 1);
+    } else if (value < GTE_MAC_MIN) {
+        *flag |= GTE_FLAG_MAC1_NEGATIVE >> (index - 1);
+    }
+
+    // Sign extend from 44 bits
+    return (int64_t) ((uint64_t) value << 20) >> 20;
+}
+
+static uint32_t gte_transform_scalar(int16_t matrix[3][3], int32_t translation[3], int16_t vectors[][3], uint8_t count, int64_t results[][3])
+{
+    uint32_t flag = 0;
+
+    for (uint8_t n=0; n < count; n++) {
+        for (uint8_t i=0; i < 3; i++) {
+            int64_t sum = (int64_t) translation[i] * 0x1000 + matrix[i][0] * vectors[n][0];
+
+            sum = gte_check_mac(&flag, i + 1, sum);
+            sum = gte_check_mac(&flag, i + 1, sum + matrix[i][1] * vectors[n][1]);
+
+            results[n][i] = sum + matrix[i][2] * vectors[n][2];
+        }
+    }
+
+    return flag;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+
+/* Same as gte_transform_scalar with the three rows in 64 bit lanes, all vectors go through in one pass */
+__attribute__((target("avx2")))
+static uint32_t gte_transform_avx2(int16_t matrix[3][3], int32_t translation[3], int16_t vectors[][3], uint8_t count, int64_t results[][3])
+{
+    const __m256i max = _mm256_set1_epi64x(GTE_MAC_MAX);
+    const __m256i min = _mm256_set1_epi64x(GTE_MAC_MIN);
+    const __m256i mask = _mm256_set1_epi64x((1LL << 44) - 1);
+    const __m256i sign = _mm256_set1_epi64x(1LL << 43);
+
+    // Lane i is row i, lane 3 stays 0
+    __m256i column_0 = _mm256_setr_epi64x(matrix[0][0], matrix[1][0], matrix[2][0], 0);
+    __m256i column_1 = _mm256_setr_epi64x(matrix[0][1], matrix[1][1], matrix[2][1], 0);
+    __m256i column_2 = _mm256_setr_epi64x(matrix[0][2], matrix[1][2], matrix[2][2], 0);
+    __m256i base = _mm256_setr_epi64x((int64_t) translation[0] * 0x1000, (int64_t) translation[1] * 0x1000, (int64_t) translation[2] * 0x1000, 0);
+
+    __m256i positive = _mm256_setzero_si256();
+    __m256i negative = _mm256_setzero_si256();
+
+    for (uint8_t n=0; n < count; n++) {
+        __m256i sum = _mm256_add_epi64(base, _mm256_mul_epi32(column_0, _mm256_set1_epi64x(vectors[n][0])));
+
+        positive = _mm256_or_si256(positive, _mm256_cmpgt_epi64(sum, max));
+        negative = _mm256_or_si256(negative, _mm256_cmpgt_epi64(min, sum));
+        sum = _mm256_sub_epi64(_mm256_xor_si256(_mm256_and_si256(sum, mask), sign), sign);
+
+        sum = _mm256_add_epi64(sum, _mm256_mul_epi32(column_1, _mm256_set1_epi64x(vectors[n][1])));
+
+        positive = _mm256_or_si256(positive, _mm256_cmpgt_epi64(sum, max));
+        negative = _mm256_or_si256(negative, _mm256_cmpgt_epi64(min, sum));
+        sum = _mm256_sub_epi64(_mm256_xor_si256(_mm256_and_si256(sum, mask), sign), sign);
+
+        sum = _mm256_add_epi64(sum, _mm256_mul_epi32(column_2, _mm256_set1_epi64x(vectors[n][2])));
+
+        int64_t lanes[4];
+        _mm256_storeu_si256((__m256i *) lanes, sum);
+
+        results[n][0] = lanes[0];
+        results[n][1] = lanes[1];
+        results[n][2] = lanes[2];
+    }
+
+    // A lane can only overflow one way per step, but both over several steps
+    uint32_t positive_lanes = _mm256_movemask_pd(_mm256_castsi256_pd(positive));
+    uint32_t negative_lanes = _mm256_movemask_pd(_mm256_castsi256_pd(negative));
+    uint32_t flag = 0;
+
+    for (uint8_t i=0; i < 3; i++) {
+        if (positive_lanes & (1 << i)) flag |= GTE_FLAG_MAC1_POSITIVE >> i;
+        if (negative_lanes & (1 << i)) flag |= GTE_FLAG_MAC1_NEGATIVE >> i;
+    }
+
+    return flag;
+}
+
+#endif
+
+static void gte_setup(void)
+{
+    for (uint32_t i=0; i < 0x101; i++) {
+        int32_t value = (0x40000 / (i + 0x100) + 1) / 2 - 0x101;
+
+        gte_unr_table[i] = value > 0 ? value : 0;
+    }
+
+    gte_transform = gte_transform_scalar;
+
+    #if defined(__GNUC__) && defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2")) {
+        gte_transform = gte_transform_avx2;
+    }
+    #endif
+}
+
+void gte_init(gte_state_t *state)
+{
+    memset(state, 0, sizeof(gte_state_t));
+
+    pthread_once(&gte_setup_once, gte_setup);
+}
+
+/*
+ * Switches the transform kernel of every GTE in the process, false if the CPU
+ * can not run it. Only meant for cross-checks like mdmicro --check-gte.
+ */
+bool gte_set_transform(uint8_t transform)
+{
+    pthread_once(&gte_setup_once, gte_setup);
+
+    if (transform == GTE_TRANSFORM_SCALAR) {
+        gte_transform = gte_transform_scalar;
+        return true;
+    }
+
+    #if defined(__GNUC__) && defined(__x86_64__)
+    if (transform == GTE_TRANSFORM_AVX2 && __builtin_cpu_supports("avx2")) {
+        gte_transform = gte_transform_avx2;
+        return true;
+    }
+    #endif
+
+    return false;
+}
+
+/* Result registers */
+
+static void gte_set_mac(gte_state_t *state, uint8_t index, int64_t value, uint8_t shift)
+{
+    if (index == 0) {
+        if (value > INT32_MAX) {
+            state->flag |= GTE_FLAG_MAC0_POSITIVE;
+        } else if (value < INT32_MIN) {
+            state->flag |= GTE_FLAG_MAC0_NEGATIVE;
+        }
+
+        state->mac[0] = (int32_t) value;
+        return;
+    }
+
+    gte_check_mac(&state->flag, index, value);
+
+    state->mac[index] = (int32_t) (value >> shift);
+}
+
+static void gte_set_ir(gte_state_t *state, uint8_t index, int32_t value, bool lm)
+{
+    int32_t min = index == 0 ? 0 : (lm ? 0 : -0x8000);
+    int32_t max = index == 0 ? 0x1000 : 0x7FFF;
+    uint32_t saturated = index == 0 ? GTE_FLAG_IR0_SATURATED : GTE_FLAG_IR1_SATURATED >> (index - 1);
+
+    if (value < min) {
+        value = min;
+        state->flag |= saturated;
+    } else if (value > max) {
+        value = max;
+        state->flag |= saturated;
+    }
+
+    state->ir[index] = value;
+}
+
+static void gte_set_mac_ir(gte_state_t *state, uint8_t index, int64_t value, uint8_t shift, bool lm)
+{
+    gte_set_mac(state, index, value, shift);
+    gte_set_ir(state, index, state->mac[index], lm);
+}
+
+static void gte_set_otz(gte_state_t *state, int32_t value)
+{
+    if (value < 0) {
+        value = 0;
+        state->flag |= GTE_FLAG_SZ3_OTZ_SATURATED;
+    } else if (value > 0xFFFF) {
+        value = 0xFFFF;
+        state->flag |= GTE_FLAG_SZ3_OTZ_SATURATED;
+    }
+
+    state->otz = value;
+}
+
+static void gte_push_sz(gte_state_t *state, int32_t value)
+{
+    if (value < 0) {
+        value = 0;
+        state->flag |= GTE_FLAG_SZ3_OTZ_SATURATED;
+    } else if (value > 0xFFFF) {
+        value = 0xFFFF;
+        state->flag |= GTE_FLAG_SZ3_OTZ_SATURATED;
+    }
+
+    state->sz[0] = state->sz[1];
+    state->sz[1] = state->sz[2];
+    state->sz[2] = state->sz[3];
+    state->sz[3] = value;
+}
+
+static int16_t gte_clamp_screen(gte_state_t *state, int32_t value, uint32_t saturated)
+{
+    if (value < -0x400) {
+        state->flag |= saturated;
+        return -0x400;
+    } else if (value > 0x3FF) {
+        state->flag |= saturated;
+        return 0x3FF;
+    }
+
+    return value;
+}
+
+static void gte_push_sxy(gte_state_t *state, int32_t x, int32_t y)
+{
+    memcpy(state->sxy[0], state->sxy[1], sizeof(state->sxy[0]));
+    memcpy(state->sxy[1], state->sxy[2], sizeof(state->sxy[0]));
+
+    state->sxy[2][0] = gte_clamp_screen(state, x, GTE_FLAG_SX2_SATURATED);
+    state->sxy[2][1] = gte_clamp_screen(state, y, GTE_FLAG_SY2_SATURATED);
+}
+
+/* Color FIFO gets MAC1-3 / 16 and the code byte of RGBC */
+static void gte_push_rgb(gte_state_t *state)
+{
+    memcpy(state->rgb[0], state->rgb[1], sizeof(state->rgb[0]));
+    memcpy(state->rgb[1], state->rgb[2], sizeof(state->rgb[0]));
+
+    for (uint8_t i=0; i < 3; i++) {
+        int32_t value = state->mac[i + 1] >> 4;
+
+        if (value < 0) {
+            value = 0;
+            state->flag |= GTE_FLAG_R_SATURATED >> i;
+        } else if (value > 0xFF) {
+            value = 0xFF;
+            state->flag |= GTE_FLAG_R_SATURATED >> i;
+        }
+
+        state->rgb[2][i] = value;
+    }
+
+    state->rgb[2][3] = state->rgbc[3];
+}
+
+/* Arithmetic */
+
+/* H / SZ3 the way the hardware does it, with a reciprocal table and two Newton-Raphson steps */
+static uint32_t gte_divide(gte_state_t *state)
+{
+    if (state->h >= state->sz[3] * 2) {
+        state->flag |= GTE_FLAG_DIVIDE_OVERFLOW;
+        return 0x1FFFF;
+    }
+
+    uint32_t shift = __builtin_clz(state->sz[3]) - 16;
+    uint32_t n = (uint32_t) state->h << shift;
+    uint32_t d = (uint32_t) state->sz[3] << shift;
+    uint32_t u = gte_unr_table[(d - 0x7FC0) >> 7] + 0x101;
+
+    d = (0x2000080 - d * u) >> 8;
+    d = (0x0000080 + d * u) >> 8;
+
+    uint64_t result = ((uint64_t) n * d + 0x8000) >> 16;
+
+    return result < 0x1FFFF ? result : 0x1FFFF;
+}
+
+static void gte_multiply(gte_state_t *state, int16_t matrix[3][3], int32_t translation[3], int16_t vector[3], uint8_t shift, bool lm)
+{
+    int64_t mac[1][3];
+
+    state->flag |= gte_transform(matrix, translation, (int16_t (*)[3]) vector, 1, mac);
+
+    for (uint8_t i=0; i < 3; i++) {
+        gte_set_mac_ir(state, i + 1, mac[0][i], shift, lm);
+    }
+}
+
+/* MVMVA with the far color as translation, only the flags of the first term survive */
+static void gte_multiply_far_color(gte_state_t *state, int16_t matrix[3][3], int16_t vector[3], uint8_t shift, bool lm)
+{
+    for (uint8_t i=0; i < 3; i++) {
+        int64_t sum = gte_check_mac(&state->flag, i + 1, (int64_t) state->vector[GTE_VECTOR_FAR_COLOR][i] * 0x1000 + matrix[i][0] * vector[0]);
+
+        gte_set_ir(state, i + 1, (int32_t) (sum >> shift), false);
+
+        sum = gte_check_mac(&state->flag, i + 1, matrix[i][1] * vector[1]);
+        gte_set_mac_ir(state, i + 1, sum + matrix[i][2] * vector[2], shift, lm);
+    }
+}
+
+/* Perspective transformation of one vertex, MAC1-3 come from the rotation */
+static void gte_project(gte_state_t *state, const int64_t mac[3], uint8_t shift, bool lm, bool last)
+{
+    gte_set_mac(state, 1, mac[0], shift);
+    gte_set_mac(state, 2, mac[1], shift);
+    gte_set_mac(state, 3, mac[2], shift);
+
+    gte_set_ir(state, 1, state->mac[1], lm);
+    gte_set_ir(state, 2, state->mac[2], lm);
+
+    // IR3 saturates on MAC3, but the flag is only set if MAC3 SAR 12 is out of range
+    int32_t z = (int32_t) (mac[2] >> 12);
+
+    if (z < -0x8000 || z > 0x7FFF) {
+        state->flag |= GTE_FLAG_IR1_SATURATED >> 2;
+    }
+
+    int32_t ir3 = state->mac[3];
+    int32_t ir3_min = lm ? 0 : -0x8000;
+
+    state->ir[3] = ir3 < ir3_min ? ir3_min : (ir3 > 0x7FFF ? 0x7FFF : ir3);
+
+    gte_push_sz(state, z);
+
+    int64_t n = gte_divide(state);
+    int64_t x = n * state->ir[1] + state->ofx;
+    int64_t y = n * state->ir[2] + state->ofy;
+
+    // Both only go through MAC0 for the overflow flags
+    if (x > INT32_MAX || y > INT32_MAX) state->flag |= GTE_FLAG_MAC0_POSITIVE;
+    if (x < INT32_MIN || y < INT32_MIN) state->flag |= GTE_FLAG_MAC0_NEGATIVE;
+
+    gte_push_sxy(state, (int32_t) (x >> 16), (int32_t) (y >> 16));
+
+    if (last) {
+        int64_t depth = n * state->dqa + state->dqb;
+
+        gte_set_mac(state, 0, depth, 0);
+        gte_set_ir(state, 0, (int32_t) (depth >> 12), true);
+    }
+}
+
+static void gte_rtps(gte_state_t *state, uint8_t shift, bool lm)
+{
+    int64_t mac[1][3];
+
+    state->flag |= gte_transform(state->matrix[GTE_MATRIX_ROTATION], state->vector[GTE_VECTOR_TRANSLATION], state->v, 1, mac);
+
+    gte_project(state, mac[0], shift, lm, true);
+}
+
+/* All three rotations go through the transform at once, the projections depend on each other through the FIFOs */
+static void gte_rtpt(gte_state_t *state, uint8_t shift, bool lm)
+{
+    int64_t mac[3][3];
+
+    state->flag |= gte_transform(state->matrix[GTE_MATRIX_ROTATION], state->vector[GTE_VECTOR_TRANSLATION], state->v, 3, mac);
+
+    for (uint8_t n=0; n < 3; n++) {
+        gte_project(state, mac[n], shift, lm, n == 2);
+    }
+}
+
+static void gte_nclip(gte_state_t *state)
+{
+    int64_t x0 = state->sxy[0][0], y0 = state->sxy[0][1];
+    int64_t x1 = state->sxy[1][0], y1 = state->sxy[1][1];
+    int64_t x2 = state->sxy[2][0], y2 = state->sxy[2][1];
+
+    gte_set_mac(state, 0, x0 * y1 + x1 * y2 + x2 * y0 - x0 * y2 - x1 * y0 - x2 * y1, 0);
+}
+
+static void gte_avsz(gte_state_t *state, int16_t zsf, uint8_t count)
+{
+    int64_t sum = 0;
+
+    for (uint8_t i=4 - count; i < 4; i++) {
+        sum += state->sz[i];
+    }
+
+    int64_t value = zsf * sum;
+
+    gte_set_mac(state, 0, value, 0);
+    gte_set_otz(state, (int32_t) (value >> 12));
+}
+
+static void gte_op(gte_state_t *state, uint8_t shift, bool lm)
+{
+    int64_t d1 = state->matrix[GTE_MATRIX_ROTATION][0][0];
+    int64_t d2 = state->matrix[GTE_MATRIX_ROTATION][1][1];
+    int64_t d3 = state->matrix[GTE_MATRIX_ROTATION][2][2];
+    int64_t ir1 = state->ir[1], ir2 = state->ir[2], ir3 = state->ir[3];
+
+    gte_set_mac_ir(state, 1, ir3 * d2 - ir2 * d3, shift, lm);
+    gte_set_mac_ir(state, 2, ir1 * d3 - ir3 * d1, shift, lm);
+    gte_set_mac_ir(state, 3, ir2 * d1 - ir1 * d2, shift, lm);
+}
+
+static void gte_sqr(gte_state_t *state, uint8_t shift, bool lm)
+{
+    for (uint8_t i=1; i < 4; i++) {
+        gte_set_mac_ir(state, i, state->ir[i] * state->ir[i], shift, lm);
+    }
+}
+
+static void gte_mvmva(gte_state_t *state, uint32_t command, uint8_t shift, bool lm)
+{
+    uint8_t mx = (command >> 17) & 0x3;
+    uint8_t vx = (command >> 15) & 0x3;
+    uint8_t tx = (command >> 13) & 0x3;
+
+    int16_t vector[3];
+    int16_t garbage[3][3];
+    int16_t (*matrix)[3] = state->matrix[mx];
+
+    if (vx == 3) {
+        memcpy(vector, &state->ir[1], sizeof(vector));
+    } else {
+        memcpy(vector, state->v[vx], sizeof(vector));
+    }
+
+    // Matrix 3 is not a register, it mixes RGBC, IR0 and rotation entries
+    if (mx == 3) {
+        int16_t rt13 = state->matrix[GTE_MATRIX_ROTATION][0][2];
+        int16_t rt22 = state->matrix[GTE_MATRIX_ROTATION][1][1];
+
+        garbage[0][0] = -(state->rgbc[0] << 4);
+        garbage[0][1] = state->rgbc[0] << 4;
+        garbage[0][2] = state->ir[0];
+        garbage[1][0] = garbage[1][1] = garbage[1][2] = rt13;
+        garbage[2][0] = garbage[2][1] = garbage[2][2] = rt22;
+
+        matrix = garbage;
+    }
+
+    if (tx == GTE_VECTOR_FAR_COLOR) {
+        gte_multiply_far_color(state, matrix, vector, shift, lm);
+    } else {
+        gte_multiply(state, matrix, tx == 3 ? gte_zero : state->vector[tx], vector, shift, lm);
+    }
+}
+
+/* Lighting */
+
+/* [IR1,IR2,IR3] = (BK*1000h + LCM*IR) SAR (sf*12) */
+static void gte_light_color(gte_state_t *state, uint8_t shift, bool lm)
+{
+    int16_t ir[3];
+
+    memcpy(ir, &state->ir[1], sizeof(ir));
+
+    gte_multiply(state, state->matrix[GTE_MATRIX_COLOR], state->vector[GTE_VECTOR_BACKGROUND], ir, shift, lm);
+}
+
+/* [IR1,IR2,IR3] = (LLM*V) SAR (sf*12), then through the light color matrix */
+static void gte_light(gte_state_t *state, int16_t vector[3], uint8_t shift, bool lm)
+{
+    gte_multiply(state, state->matrix[GTE_MATRIX_LIGHT], gte_zero, vector, shift, lm);
+    gte_light_color(state, shift, lm);
+}
+
+/* [R*IR1,G*IR2,B*IR3] SHL 4 */
+static void gte_color_product(gte_state_t *state, const uint8_t color[3], int64_t mac[3])
+{
+    for (uint8_t i=0; i < 3; i++) {
+        mac[i] = (int64_t) color[i] * state->ir[i + 1] * 16;
+    }
+}
+
+/* MAC + (FC - MAC) * IR0, SAR (sf*12) */
+static void gte_interpolate(gte_state_t *state, const int64_t mac[3], uint8_t shift, bool lm)
+{
+    for (uint8_t i=0; i < 3; i++) {
+        gte_set_mac_ir(state, i + 1, (int64_t) state->vector[GTE_VECTOR_FAR_COLOR][i] * 0x1000 - mac[i], shift, false);
+    }
+
+    for (uint8_t i=0; i < 3; i++) {
+        gte_set_mac_ir(state, i + 1, state->ir[i + 1] * state->ir[0] + mac[i], shift, lm);
+    }
+}
+
+static void gte_ncs(gte_state_t *state, int16_t vector[3], uint8_t shift, bool lm)
+{
+    gte_light(state, vector, shift, lm);
+    gte_push_rgb(state);
+}
+
+static void gte_nccs(gte_state_t *state, int16_t vector[3], uint8_t shift, bool lm)
+{
+    int64_t mac[3];
+
+    gte_light(state, vector, shift, lm);
+    gte_color_product(state, state->rgbc, mac);
+
+    for (uint8_t i=0; i < 3; i++) {
+        gte_set_mac_ir(state, i + 1, mac[i], shift, lm);
+    }
+
+    gte_push_rgb(state);
+}
+
+static void gte_ncds(gte_state_t *state, int16_t vector[3], uint8_t shift, bool lm)
+{
+    int64_t mac[3];
+
+    gte_light(state, vector, shift, lm);
+    gte_color_product(state, state->rgbc, mac);
+    gte_interpolate(state, mac, shift, lm);
+    gte_push_rgb(state);
+}
+
+static void gte_cc(gte_state_t *state, uint8_t shift, bool lm)
+{
+    int64_t mac[3];
+
+    gte_light_color(state, shift, lm);
+    gte_color_product(state, state->rgbc, mac);
+
+    for (uint8_t i=0; i < 3; i++) {
+        gte_set_mac_ir(state, i + 1, mac[i], shift, lm);
+    }
+
+    gte_push_rgb(state);
+}
+
+static void gte_cdp(gte_state_t *state, uint8_t shift, bool lm)
+{
+    int64_t mac[3];
+
+    gte_light_color(state, shift, lm);
+    gte_color_product(state, state->rgbc, mac);
+    gte_interpolate(state, mac, shift, lm);
+    gte_push_rgb(state);
+}
+
+/* Depth cueing of a color, [R,G,B] SHL 16 */
+static void gte_dpcs(gte_state_t *state, const uint8_t color[3], uint8_t shift, bool lm)
+{
+    int64_t mac[3];
+
+    for (uint8_t i=0; i < 3; i++) {
+        mac[i] = (int64_t) color[i] << 16;
+    }
+
+    gte_interpolate(state, mac, shift, lm);
+    gte_push_rgb(state);
+}
+
+static void gte_dcpl(gte_state_t *state, uint8_t shift, bool lm)
+{
+    int64_t mac[3];
+
+    gte_color_product(state, state->rgbc, mac);
+    gte_interpolate(state, mac, shift, lm);
+    gte_push_rgb(state);
+}
+
+static void gte_intpl(gte_state_t *state, uint8_t shift, bool lm)
+{
+    int64_t mac[3];
+
+    for (uint8_t i=0; i < 3; i++) {
+        mac[i] = (int64_t) state->ir[i + 1] * 0x1000;
+    }
+
+    gte_interpolate(state, mac, shift, lm);
+    gte_push_rgb(state);
+}
+
+static void gte_gpf(gte_state_t *state, uint8_t shift, bool lm)
+{
+    for (uint8_t i=1; i < 4; i++) {
+        gte_set_mac_ir(state, i, state->ir[i] * state->ir[0], shift, lm);
+    }
+
+    gte_push_rgb(state);
+}
+
+static void gte_gpl(gte_state_t *state, uint8_t shift, bool lm)
+{
+    for (uint8_t i=1; i < 4; i++) {
+        gte_set_mac_ir(state, i, (int64_t) state->mac[i] * (1 << shift) + state->ir[i] * state->ir[0], shift, lm);
+    }
+
+    gte_push_rgb(state);
+}
+
+void gte_command(gte_state_t *state, uint32_t command)
+{
+    uint8_t shift = (command & (1 << 19)) ? 12 : 0;
+    bool lm = command & (1 << 10);
+
+    state->flag = 0;
+
+    switch(command & 0x3F) {
+        case 0x01:
+            gte_rtps(state, shift, lm);
+            break;
+
+        case 0x06:
+            gte_nclip(state);
+            break;
+
+        case 0x0C:
+            gte_op(state, shift, lm);
+            break;
+
+        case 0x10:
+            gte_dpcs(state, state->rgbc, shift, lm);
+            break;
+
+        case 0x11:
+            gte_intpl(state, shift, lm);
+            break;
+
+        case 0x12:
+            gte_mvmva(state, command, shift, lm);
+            break;
+
+        case 0x13:
+            gte_ncds(state, state->v[0], shift, lm);
+            break;
+
+        case 0x14:
+            gte_cdp(state, shift, lm);
+            break;
+
+        case 0x16:
+            for (uint8_t n=0; n < 3; n++) gte_ncds(state, state->v[n], shift, lm);
+            break;
+
+        case 0x1B:
+            gte_nccs(state, state->v[0], shift, lm);
+            break;
+
+        case 0x1C:
+            gte_cc(state, shift, lm);
+            break;
+
+        case 0x1E:
+            gte_ncs(state, state->v[0], shift, lm);
+            break;
+
+        case 0x20:
+            for (uint8_t n=0; n < 3; n++) gte_ncs(state, state->v[n], shift, lm);
+            break;
+
+        case 0x28:
+            gte_sqr(state, shift, lm);
+            break;
+
+        case 0x29:
+            gte_dcpl(state, shift, lm);
+            break;
+
+        case 0x2A:
+            // Takes the oldest FIFO entry every time
+            for (uint8_t n=0; n < 3; n++) gte_dpcs(state, state->rgb[0], shift, lm);
+            break;
+
+        case 0x2D:
+            gte_avsz(state, state->zsf3, 3);
+            break;
+
+        case 0x2E:
+            gte_avsz(state, state->zsf4, 4);
+            break;
+
+        case 0x30:
+            gte_rtpt(state, shift, lm);
+            break;
+
+        case 0x3D:
+            gte_gpf(state, shift, lm);
+            break;
+
+        case 0x3E:
+            gte_gpl(state, shift, lm);
+            break;
+
+        case 0x3F:
+            for (uint8_t n=0; n < 3; n++) gte_nccs(state, state->v[n], shift, lm);
+            break;
+
+        default:
+            log_debug(LOG_GTE, "GTE", "Unhandled command %08x\n", command);
+
+            break;
+    }
+
+    if (state->flag & GTE_FLAG_ERROR_MASK) {
+        state->flag |= GTE_FLAG_ERROR;
+    }
+}
+
+/* Registers */
+
+static uint32_t gte_pack16(int16_t low, int16_t high)
+{
+    return (uint16_t) low | ((uint32_t) (uint16_t) high << 16);
+}
+
+/* IR1-3 as 5 bit colors, IRGB and ORGB */
+static uint32_t gte_read_orgb(gte_state_t *state)
+{
+    uint32_t result = 0;
+
+    for (uint8_t i=0; i < 3; i++) {
+        int32_t value = state->ir[i + 1] >> 7;
+
+        value = value < 0 ? 0 : (value > 0x1F ? 0x1F : value);
+        result |= value << (i * 5);
+    }
+
+    return result;
+}
+
+uint32_t gte_read_data(gte_state_t *state, uint8_t reg)
+{
+    uint32_t result = 0;
+
+    switch(reg) {
+        case 0: case 2: case 4:
+            result = gte_pack16(state->v[reg >> 1][0], state->v[reg >> 1][1]);
+            break;
+
+        case 1: case 3: case 5:
+            result = (int32_t) state->v[reg >> 1][2];
+            break;
+
+        case 6:
+            memcpy(&result, state->rgbc, sizeof(result));
+            break;
+
+        case 7:
+            result = state->otz;
+            break;
+
+        case 8: case 9: case 10: case 11:
+            result = (int32_t) state->ir[reg - 8];
+            break;
+
+        case 12: case 13: case 14:
+            result = gte_pack16(state->sxy[reg - 12][0], state->sxy[reg - 12][1]);
+            break;
+
+        case 15:
+            // SXYP reads as SXY2
+            result = gte_pack16(state->sxy[2][0], state->sxy[2][1]);
+            break;
+
+        case 16: case 17: case 18: case 19:
+            result = state->sz[reg - 16];
+            break;
+
+        case 20: case 21: case 22:
+            memcpy(&result, state->rgb[reg - 20], sizeof(result));
+            break;
+
+        case 23:
+            result = state->res1;
+            break;
+
+        case 24: case 25: case 26: case 27:
+            result = state->mac[reg - 24];
+            break;
+
+        case 28: case 29:
+            result = gte_read_orgb(state);
+            break;
+
+        case 30:
+            result = state->lzcs;
+            break;
+
+        case 31:
+            result = state->lzcr;
+            break;
+    }
+
+    log_debug(LOG_GTE, "GTE", "%08x <- data %d\n", result, reg);
+
+    return result;
+}
+
+void gte_write_data(gte_state_t *state, uint8_t reg, uint32_t value)
+{
+    log_debug(LOG_GTE, "GTE", "%08x -> data %d\n", value, reg);
+
+    switch(reg) {
+        case 0: case 2: case 4:
+            state->v[reg >> 1][0] = value;
+            state->v[reg >> 1][1] = value >> 16;
+            break;
+
+        case 1: case 3: case 5:
+            state->v[reg >> 1][2] = value;
+            break;
+
+        case 6:
+            memcpy(state->rgbc, &value, sizeof(value));
+            break;
+
+        case 7:
+            state->otz = value;
+            break;
+
+        case 8: case 9: case 10: case 11:
+            state->ir[reg - 8] = value;
+            break;
+
+        case 12: case 13: case 14:
+            state->sxy[reg - 12][0] = value;
+            state->sxy[reg - 12][1] = value >> 16;
+            break;
+
+        case 15:
+            // Writing SXYP pushes onto the FIFO
+            memcpy(state->sxy[0], state->sxy[1], sizeof(state->sxy[0]));
+            memcpy(state->sxy[1], state->sxy[2], sizeof(state->sxy[0]));
+
+            state->sxy[2][0] = value;
+            state->sxy[2][1] = value >> 16;
+            break;
+
+        case 16: case 17: case 18: case 19:
+            state->sz[reg - 16] = value;
+            break;
+
+        case 20: case 21: case 22:
+            memcpy(state->rgb[reg - 20], &value, sizeof(value));
+            break;
+
+        case 23:
+            state->res1 = value;
+            break;
+
+        case 24: case 25: case 26: case 27:
+            state->mac[reg - 24] = value;
+            break;
+
+        case 28:
+            for (uint8_t i=0; i < 3; i++) {
+                state->ir[i + 1] = ((value >> (i * 5)) & 0x1F) << 7;
+            }
+
+            break;
+
+        case 30:
+            state->lzcs = value;
+
+            // Leading bits equal to the sign bit
+            value = (int32_t) value < 0 ? ~value : value;
+            state->lzcr = value ? __builtin_clz(value) : 32;
+
+            break;
+
+        // ORGB and LZCR are read only
+    }
+}
+
+uint32_t gte_read_control(gte_state_t *state, uint8_t reg)
+{
+    uint32_t result = 0;
+
+    switch(reg) {
+        case 0: case 1: case 2: case 3:
+        case 8: case 9: case 10: case 11:
+        case 16: case 17: case 18: case 19: {
+            // Matrices are packed two entries per register, row by row
+            int16_t *entries = &state->matrix[reg >> 3][0][0];
+            uint8_t entry = (reg & 0x7) * 2;
+
+            result = gte_pack16(entries[entry], entries[entry + 1]);
+            break;
+        }
+
+        case 4: case 12: case 20:
+            result = (int32_t) state->matrix[reg >> 3][2][2];
+            break;
+
+        case 5: case 6: case 7:
+        case 13: case 14: case 15:
+        case 21: case 22: case 23:
+            result = state->vector[reg >> 3][(reg & 0x7) - 5];
+            break;
+
+        case 24:
+            result = state->ofx;
+            break;
+
+        case 25:
+            result = state->ofy;
+            break;
+
+        case 26:
+            // H is unsigned but reads sign extended
+            result = (int32_t) (int16_t) state->h;
+            break;
+
+        case 27:
+            result = (int32_t) state->dqa;
+            break;
+
+        case 28:
+            result = state->dqb;
+            break;
+
+        case 29:
+            result = (int32_t) state->zsf3;
+            break;
+
+        case 30:
+            result = (int32_t) state->zsf4;
+            break;
+
+        case 31:
+            result = state->flag;
+            break;
+    }
+
+    log_debug(LOG_GTE, "GTE", "%08x <- control %d\n", result, reg);
+
+    return result;
+}
+
+void gte_write_control(gte_state_t *state, uint8_t reg, uint32_t value)
+{
+    log_debug(LOG_GTE, "GTE", "%08x -> control %d\n", value, reg);
+
+    switch(reg) {
+        case 0: case 1: case 2: case 3:
+        case 8: case 9: case 10: case 11:
+        case 16: case 17: case 18: case 19: {
+            int16_t *entries = &state->matrix[reg >> 3][0][0];
+            uint8_t entry = (reg & 0x7) * 2;
+
+            entries[entry] = value;
+            entries[entry + 1] = value >> 16;
+            break;
+        }
+
+        case 4: case 12: case 20:
+            state->matrix[reg >> 3][2][2] = value;
+            break;
+
+        case 5: case 6: case 7:
+        case 13: case 14: case 15:
+        case 21: case 22: case 23:
+            state->vector[reg >> 3][(reg & 0x7) - 5] = value;
+            break;
+
+        case 24:
+            state->ofx = value;
+            break;
+
+        case 25:
+            state->ofy = value;
+            break;
+
+        case 26:
+            state->h = value;
+            break;
+
+        case 27:
+            state->dqa = value;
+            break;
+
+        case 28:
+            state->dqb = value;
+            break;
+
+        case 29:
+            state->zsf3 = value;
+            break;
+
+        case 30:
+            state->zsf4 = value;
+            break;
+
+        case 31:
+            state->flag = value & 0x7FFFF000;
+
+            if (state->flag & GTE_FLAG_ERROR_MASK) {
+                state->flag |= GTE_FLAG_ERROR;
+            }
+
+            break;
+    }
+}
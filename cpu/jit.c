@@ -0,0 +1,1122 @@
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "cpu/jit.h"
+#include "cpu/x64.h"
+#include "core/instrument.h"
+#include "log.h"
+
+/*
+ * Host register usage inside compiled blocks:
+ *  rbx         r3000_state_t *
+ *  rbp         bus_state_t *
+ *  r12 - r15   guest registers, picked per block
+ *  rax - r11   scratch, clobbered by calls into C
+ */
+
+#define JIT_STATE(field)    ((int32_t) offsetof(r3000_state_t, field))
+#define JIT_REG(r)          (JIT_STATE(regs) + (r) * 4)
+#define JIT_BUS(field)      ((int32_t) offsetof(bus_state_t, field))
+
+#define JIT_HOST_REGS       4
+
+static const uint8_t jit_host_regs[JIT_HOST_REGS] = {
+    X64_R12, X64_R13, X64_R14, X64_R15
+};
+
+typedef struct jit_compiler_t {
+    x64_emitter_t e;
+
+    jit_t *jit;
+    block_t *block;
+
+    // Host register holding a guest register, -1 if it lives in r3000_state
+    int8_t host[32];
+    bool dirty[32];
+
+    // Instructions already added to r3000_state->cycles
+    uint32_t synced;
+
+    // Register the pending load goes to once the current instruction is done
+    uint8_t load_reg;
+
+    // Memory accesses go through bus_state->fastmem
+    bool fastmem;
+} jit_compiler_t;
+
+// The JIT last entered on this thread, the SIGSEGV handler looks up faulting accesses in it
+static _Thread_local jit_t *jit_fault_jit;
+static struct sigaction jit_fault_previous;
+static pthread_once_t jit_fault_once = PTHREAD_ONCE_INIT;
+
+/* Guest register access */
+
+static void jit_read(jit_compiler_t *c, uint8_t dst, uint8_t r)
+{
+    if (!r) {
+        x64_alu_rr(&c->e, X64_XOR, dst, dst);
+    } else if (c->host[r] >= 0) {
+        x64_mov_rr(&c->e, dst, c->host[r]);
+    } else {
+        x64_load(&c->e, 4, false, dst, X64_RBX, X64_NO_INDEX, JIT_REG(r));
+    }
+}
+
+static void jit_write(jit_compiler_t *c, uint8_t r, uint8_t src)
+{
+    if (!r) {
+        return;
+    }
+
+    if (c->host[r] >= 0) {
+        x64_mov_rr(&c->e, c->host[r], src);
+        c->dirty[r] = true;
+    } else {
+        x64_store(&c->e, 4, src, X64_RBX, X64_NO_INDEX, JIT_REG(r));
+    }
+}
+
+/* Writes dirty host registers back, the compiler state is left alone for side exits */
+static void jit_writeback(jit_compiler_t *c)
+{
+    for (uint8_t r=1; r < 32; r++) {
+        if (c->host[r] >= 0 && c->dirty[r]) {
+            x64_store(&c->e, 4, c->host[r], X64_RBX, X64_NO_INDEX, JIT_REG(r));
+        }
+    }
+}
+
+static void jit_flush(jit_compiler_t *c)
+{
+    jit_writeback(c);
+    memset(c->dirty, 0, sizeof(c->dirty));
+}
+
+static void jit_reload(jit_compiler_t *c)
+{
+    for (uint8_t r=1; r < 32; r++) {
+        if (c->host[r] >= 0) {
+            x64_load(&c->e, 4, false, c->host[r], X64_RBX, X64_NO_INDEX, JIT_REG(r));
+        }
+    }
+}
+
+/* Brings r3000_state->cycles up to the start of instruction i, C code may look at it */
+static void jit_sync(jit_compiler_t *c, uint32_t i)
+{
+    if (i != c->synced) {
+        x64_alu_mi(&c->e, X64_ADD, X64_RBX, JIT_STATE(cycles), i - c->synced);
+        c->synced = i;
+    }
+}
+
+/* Gives the most used guest registers of the block a host register */
+static void jit_allocate(jit_compiler_t *c, uint32_t length)
+{
+    uint32_t uses[32] = {0};
+
+    for (uint32_t i=0; i < length; i++) {
+        r3000_instruction_t *instruction = &c->block->instructions[i];
+
+        uses[instruction->rs]++;
+        uses[instruction->rt]++;
+
+        if (!instruction->opcode) {
+            uses[instruction->rd]++;
+        }
+    }
+
+    memset(c->host, -1, sizeof(c->host));
+
+    for (uint8_t h=0; h < JIT_HOST_REGS; h++) {
+        uint8_t best = 0;
+
+        for (uint8_t r=1; r < 32; r++) {
+            if (c->host[r] < 0 && uses[r] >= 2 && (!best || uses[r] > uses[best])) {
+                best = r;
+            }
+        }
+
+        if (!best) {
+            break;
+        }
+
+        c->host[best] = jit_host_regs[h];
+    }
+}
+
+/* Block exits */
+
+static void jit_emit_exit(jit_compiler_t *c, uint8_t kind, uint32_t target, uint32_t count)
+{
+    x64_emitter_t *e = &c->e;
+
+    jit_writeback(c);
+
+    if (count != c->synced) {
+        x64_alu_mi(e, X64_ADD, X64_RBX, JIT_STATE(cycles), count - c->synced);
+    }
+
+    x64_store_imm(e, 1, X64_RBX, JIT_STATE(load_reg), c->load_reg);
+
+    switch(kind) {
+        case JIT_EXIT_STATIC:
+            x64_store_imm(e, 4, X64_RBX, JIT_STATE(pc), target);
+            x64_store_imm(e, 4, X64_RBX, JIT_STATE(pc_next), target + 4);
+            x64_store_imm(e, 4, X64_RBX, JIT_STATE(pc_instruction), target);
+            break;
+
+        case JIT_EXIT_BRANCH:
+            x64_load(e, 4, false, X64_RAX, X64_RBX, X64_NO_INDEX, JIT_STATE(branch_addr));
+            x64_store(e, 4, X64_RAX, X64_RBX, X64_NO_INDEX, JIT_STATE(pc));
+            x64_store(e, 4, X64_RAX, X64_RBX, X64_NO_INDEX, JIT_STATE(pc_instruction));
+            x64_alu_ri(e, X64_ADD, X64_RAX, 4);
+            x64_store(e, 4, X64_RAX, X64_RBX, X64_NO_INDEX, JIT_STATE(pc_next));
+            break;
+
+        case JIT_EXIT_STATE:
+            // pc was set by an exception or the fallback handler
+            x64_load(e, 4, false, X64_RAX, X64_RBX, X64_NO_INDEX, JIT_STATE(pc));
+            x64_store(e, 4, X64_RAX, X64_RBX, X64_NO_INDEX, JIT_STATE(pc_instruction));
+            break;
+    }
+
+    if (kind == JIT_EXIT_STATIC) {
+        // Goes to the stub right behind it until the dispatcher links the target
+        uint8_t *site = x64_jmp(e);
+        x64_bind(e, site);
+
+        x64_mov_ri64(e, X64_RAX, (uint64_t) site);
+        x64_mov_ri64(e, X64_RCX, (uint64_t) &c->jit->link_site);
+        x64_store(e, 8, X64_RAX, X64_RCX, X64_NO_INDEX, 0);
+    }
+
+    x64_patch(x64_jmp(e), c->jit->exit);
+}
+
+/* Applies the pending load once instruction i is done, mirrors the end of r3000_execute */
+static void jit_emit_load_delay(jit_compiler_t *c, uint32_t i, uint8_t delay_reg)
+{
+    x64_emitter_t *e = &c->e;
+
+    if (!i) {
+        // The load was started before the block, its register is only known at runtime
+        jit_flush(c);
+
+        x64_load(e, 1, false, X64_RAX, X64_RBX, X64_NO_INDEX, JIT_STATE(load_reg));
+        x64_alu_ri(e, X64_CMP, X64_RAX, delay_reg);
+        uint8_t *skip = x64_jcc(e, X64_CC_E);
+
+        x64_load(e, 4, false, X64_RCX, X64_RBX, X64_NO_INDEX, JIT_STATE(load_value));
+        x64_shift_ri(e, X64_SHL, X64_RAX, 2);
+        x64_store(e, 4, X64_RCX, X64_RBX, X64_RAX, JIT_STATE(regs));
+        x64_store_imm(e, 4, X64_RBX, JIT_REG(0), 0);
+
+        x64_bind(e, skip);
+        jit_reload(c);
+    } else if (c->load_reg && c->load_reg != delay_reg) {
+        x64_load(e, 4, false, X64_RAX, X64_RBX, X64_NO_INDEX, JIT_STATE(load_value));
+        jit_write(c, c->load_reg, X64_RAX);
+    }
+
+    if (delay_reg) {
+        x64_load(e, 4, false, X64_RAX, X64_RBX, X64_NO_INDEX, JIT_STATE(load_delay_value));
+        x64_store(e, 4, X64_RAX, X64_RBX, X64_NO_INDEX, JIT_STATE(load_value));
+    }
+
+    c->load_reg = delay_reg;
+}
+
+/* Register a load started by this instruction goes to */
+static uint8_t jit_delay_reg(r3000_instruction_t *instruction)
+{
+    switch(instruction->op) {
+        case R3000_OP_LB: case R3000_OP_LH: case R3000_OP_LWL: case R3000_OP_LW:
+        case R3000_OP_LBU: case R3000_OP_LHU: case R3000_OP_LWR:
+        case R3000_OP_MFC0: case R3000_OP_MFC2: case R3000_OP_CFC2:
+            return instruction->rt;
+    }
+
+    return 0;
+}
+
+static bool jit_is_store(r3000_instruction_t *instruction)
+{
+    switch(instruction->op) {
+        case R3000_OP_SB: case R3000_OP_SH: case R3000_OP_SWL: case R3000_OP_SW: case R3000_OP_SWR:
+            return true;
+    }
+
+    return false;
+}
+
+/* Loads and stores reach the devices, which may raise an interrupt */
+static bool jit_is_access(r3000_instruction_t *instruction)
+{
+    switch(instruction->op) {
+        case R3000_OP_LB: case R3000_OP_LH: case R3000_OP_LWL: case R3000_OP_LW:
+        case R3000_OP_LBU: case R3000_OP_LHU: case R3000_OP_LWR:
+            return true;
+    }
+
+    return jit_is_store(instruction);
+}
+
+static uint32_t jit_branch_target(r3000_instruction_t *instruction, uint32_t addr)
+{
+    if (instruction->op == R3000_OP_J || instruction->op == R3000_OP_JAL) {
+        return ((addr + 4) & 0xF0000000) | (instruction->imm_jump << 2);
+    }
+
+    return addr + 4 + (((uint32_t) (int16_t) instruction->imm) << 2);
+}
+
+/* Instructions */
+
+static void jit_emit_fallback(jit_compiler_t *c, r3000_instruction_t *instruction, uint32_t i, uint32_t addr)
+{
+    x64_emitter_t *e = &c->e;
+
+    jit_flush(c);
+    jit_sync(c, i);
+
+    // Handlers expect pc to be advanced already
+    x64_store_imm(e, 4, X64_RBX, JIT_STATE(pc), addr + 4);
+    x64_store_imm(e, 4, X64_RBX, JIT_STATE(pc_next), addr + 8);
+    x64_store_imm(e, 4, X64_RBX, JIT_STATE(pc_instruction), addr);
+
+    x64_mov_rr64(e, X64_RDI, X64_RBX);
+    x64_mov_rr64(e, X64_RSI, X64_RBP);
+    x64_mov_ri64(e, X64_RDX, (uint64_t) instruction);
+    x64_call(e, instruction->handler);
+
+    if (jit_delay_reg(instruction)) {
+        x64_store_imm(e, 1, X64_RBX, JIT_STATE(load_delay_reg), 0);
+    }
+
+    jit_reload(c);
+}
+
+static void jit_emit_alu(jit_compiler_t *c, r3000_instruction_t *instruction, uint8_t op)
+{
+    if (!instruction->rd) {
+        return;
+    }
+
+    jit_read(c, X64_RAX, instruction->rs);
+    jit_read(c, X64_RCX, instruction->rt);
+    x64_alu_rr(&c->e, op, X64_RAX, X64_RCX);
+    jit_write(c, instruction->rd, X64_RAX);
+}
+
+static void jit_emit_nor(jit_compiler_t *c, r3000_instruction_t *instruction)
+{
+    if (!instruction->rd) {
+        return;
+    }
+
+    jit_read(c, X64_RAX, instruction->rs);
+    jit_read(c, X64_RCX, instruction->rt);
+    x64_alu_rr(&c->e, X64_OR, X64_RAX, X64_RCX);
+    x64_not(&c->e, X64_RAX);
+    jit_write(c, instruction->rd, X64_RAX);
+}
+
+static void jit_emit_set(jit_compiler_t *c, r3000_instruction_t *instruction, uint8_t cc)
+{
+    if (!instruction->rd) {
+        return;
+    }
+
+    jit_read(c, X64_RAX, instruction->rs);
+    jit_read(c, X64_RCX, instruction->rt);
+    x64_alu_rr(&c->e, X64_CMP, X64_RAX, X64_RCX);
+    x64_setcc(&c->e, cc, X64_RAX);
+    jit_write(c, instruction->rd, X64_RAX);
+}
+
+static void jit_emit_shift(jit_compiler_t *c, r3000_instruction_t *instruction, uint8_t op)
+{
+    if (!instruction->rd) {
+        return;
+    }
+
+    jit_read(c, X64_RAX, instruction->rt);
+
+    if (instruction->shamt) {
+        x64_shift_ri(&c->e, op, X64_RAX, instruction->shamt);
+    }
+
+    jit_write(c, instruction->rd, X64_RAX);
+}
+
+static void jit_emit_shift_variable(jit_compiler_t *c, r3000_instruction_t *instruction, uint8_t op)
+{
+    if (!instruction->rd) {
+        return;
+    }
+
+    // x86 masks the count to 5 bits just like the R3000
+    jit_read(c, X64_RAX, instruction->rt);
+    jit_read(c, X64_RCX, instruction->rs);
+    x64_shift_rcl(&c->e, op, X64_RAX);
+    jit_write(c, instruction->rd, X64_RAX);
+}
+
+static void jit_emit_alu_imm(jit_compiler_t *c, r3000_instruction_t *instruction, uint8_t op, uint32_t imm)
+{
+    if (!instruction->rt) {
+        return;
+    }
+
+    jit_read(c, X64_RAX, instruction->rs);
+
+    if (imm || op == X64_AND) {
+        x64_alu_ri(&c->e, op, X64_RAX, imm);
+    }
+
+    jit_write(c, instruction->rt, X64_RAX);
+}
+
+static void jit_emit_set_imm(jit_compiler_t *c, r3000_instruction_t *instruction, uint8_t cc)
+{
+    if (!instruction->rt) {
+        return;
+    }
+
+    jit_read(c, X64_RAX, instruction->rs);
+    x64_alu_ri(&c->e, X64_CMP, X64_RAX, (uint32_t) (int16_t) instruction->imm);
+    x64_setcc(&c->e, cc, X64_RAX);
+    jit_write(c, instruction->rt, X64_RAX);
+}
+
+static void jit_emit_lui(jit_compiler_t *c, r3000_instruction_t *instruction)
+{
+    if (!instruction->rt) {
+        return;
+    }
+
+    x64_mov_ri(&c->e, X64_RAX, instruction->imm << 16);
+    jit_write(c, instruction->rt, X64_RAX);
+}
+
+static void jit_emit_mult(jit_compiler_t *c, r3000_instruction_t *instruction, bool sign)
+{
+    x64_emitter_t *e = &c->e;
+
+    jit_read(c, X64_RAX, instruction->rs);
+    jit_read(c, X64_RCX, instruction->rt);
+
+    // 32 bit moves already zero extend for MULTU
+    if (sign) {
+        x64_movsxd(e, X64_RAX, X64_RAX);
+        x64_movsxd(e, X64_RCX, X64_RCX);
+    }
+
+    x64_imul64(e, X64_RAX, X64_RCX);
+    x64_store(e, 4, X64_RAX, X64_RBX, X64_NO_INDEX, JIT_STATE(lo));
+    x64_shift_ri64(e, X64_SHR, X64_RAX, 32);
+    x64_store(e, 4, X64_RAX, X64_RBX, X64_NO_INDEX, JIT_STATE(hi));
+}
+
+static void jit_emit_move_from(jit_compiler_t *c, r3000_instruction_t *instruction, int32_t disp)
+{
+    if (!instruction->rd) {
+        return;
+    }
+
+    x64_load(&c->e, 4, false, X64_RAX, X64_RBX, X64_NO_INDEX, disp);
+    jit_write(c, instruction->rd, X64_RAX);
+}
+
+static void jit_emit_move_to(jit_compiler_t *c, r3000_instruction_t *instruction, int32_t disp)
+{
+    jit_read(c, X64_RAX, instruction->rs);
+    x64_store(&c->e, 4, X64_RAX, X64_RBX, X64_NO_INDEX, disp);
+}
+
+/* Branches only arm the delay slot, the exit after it picks the target */
+static void jit_emit_taken(jit_compiler_t *c, uint32_t target)
+{
+    x64_store_imm(&c->e, 4, X64_RBX, JIT_STATE(branch_addr), target);
+    x64_store_imm(&c->e, 1, X64_RBX, JIT_STATE(branch_delay_slot_state), DELAY_SLOT_STATE_DELAY_CYCLE);
+}
+
+static void jit_emit_branch(jit_compiler_t *c, r3000_instruction_t *instruction, uint32_t addr, uint8_t cc_not_taken, bool compare_rt, bool link)
+{
+    jit_read(c, X64_RAX, instruction->rs);
+
+    if (compare_rt) {
+        jit_read(c, X64_RCX, instruction->rt);
+        x64_alu_rr(&c->e, X64_CMP, X64_RAX, X64_RCX);
+    } else {
+        x64_alu_ri(&c->e, X64_CMP, X64_RAX, 0);
+    }
+
+    uint8_t *skip = x64_jcc(&c->e, cc_not_taken);
+    jit_emit_taken(c, jit_branch_target(instruction, addr));
+    x64_bind(&c->e, skip);
+
+    // BLTZAL, BGEZAL link whether the branch is taken or not
+    if (link) {
+        x64_mov_ri(&c->e, X64_RAX, addr + 8);
+        jit_write(c, R3000_REG_RA, X64_RAX);
+    }
+}
+
+static void jit_emit_jump(jit_compiler_t *c, r3000_instruction_t *instruction, uint32_t addr, bool link)
+{
+    jit_emit_taken(c, jit_branch_target(instruction, addr));
+
+    if (link) {
+        x64_mov_ri(&c->e, X64_RAX, addr + 8);
+        jit_write(c, R3000_REG_RA, X64_RAX);
+    }
+}
+
+static void jit_emit_jump_register(jit_compiler_t *c, r3000_instruction_t *instruction, uint32_t addr, bool link)
+{
+    x64_emitter_t *e = &c->e;
+
+    jit_read(c, X64_RAX, instruction->rs);
+    x64_store(e, 4, X64_RAX, X64_RBX, X64_NO_INDEX, JIT_STATE(branch_addr));
+    x64_store_imm(e, 1, X64_RBX, JIT_STATE(branch_delay_slot_state), DELAY_SLOT_STATE_DELAY_CYCLE);
+
+    if (link) {
+        x64_mov_ri(e, X64_RAX, addr + 8);
+        jit_write(c, instruction->rd, X64_RAX);
+    }
+}
+
+/* Leaves the guest address in edx and the physical address in eax */
+static void jit_emit_address(jit_compiler_t *c, r3000_instruction_t *instruction)
+{
+    x64_emitter_t *e = &c->e;
+
+    jit_read(c, X64_RDX, instruction->rs);
+
+    if (instruction->imm) {
+        x64_alu_ri(e, X64_ADD, X64_RDX, (uint32_t) (int16_t) instruction->imm);
+    }
+
+    // phy_addr = addr & bus_segment_map[addr >> 29]
+    x64_mov_rr(e, X64_RAX, X64_RDX);
+    x64_shift_ri(e, X64_SHR, X64_RAX, 27);
+    x64_alu_ri(e, X64_AND, X64_RAX, 0x1C);
+    x64_mov_ri64(e, X64_R8, (uint64_t) bus_segment_map);
+    x64_load(e, 4, false, X64_RAX, X64_R8, X64_RAX, 0);
+    x64_alu_rr(e, X64_AND, X64_RAX, X64_RDX);
+}
+
+/* Sites are emitted in address order, so the list stays sorted for jit_find_fastmem */
+static void jit_add_fastmem(jit_t *jit, uint8_t *access, uint8_t *site, uint8_t *slow)
+{
+    if (jit->fastmem_count == jit->fastmem_size) {
+        jit->fastmem_size = jit->fastmem_size ? jit->fastmem_size * 2 : 1024;
+        jit->fastmem = (jit_fastmem_t *) realloc(jit->fastmem, jit->fastmem_size * sizeof(jit_fastmem_t));
+    }
+
+    jit_fastmem_t *fastmem = &jit->fastmem[jit->fastmem_count++];
+    fastmem->access = access;
+    fastmem->site = site;
+    fastmem->slow = slow;
+}
+
+/*
+ * Looks up the page of the physical address in eax, see bus_read. Mapped pages
+ * go on with the host page in r8, the page offset in eax and the physical
+ * address in r9. Both jumps in slow are taken for accesses that need the bus.
+ */
+static void jit_emit_page(jit_compiler_t *c, int32_t pages, uint8_t **slow)
+{
+    x64_emitter_t *e = &c->e;
+
+    x64_alu_ri(e, X64_CMP, X64_RAX, BUS_PHYSICAL_SIZE);
+    slow[0] = x64_jcc(e, X64_CC_AE);
+
+    // Byte offset of the entry, (phy_addr >> BUS_PAGE_SHIFT) * 8
+    x64_mov_rr(e, X64_R8, X64_RAX);
+    x64_shift_ri(e, X64_SHR, X64_R8, BUS_PAGE_SHIFT - 3);
+    x64_alu_ri(e, X64_AND, X64_R8, ~7);
+
+    x64_load64(e, X64_R9, X64_RBP, pages);
+    x64_load(e, 8, false, X64_R8, X64_R9, X64_R8, 0);
+    x64_alu_ri64(e, X64_CMP, X64_R8, 0);
+    slow[1] = x64_jcc(e, X64_CC_E);
+
+    x64_mov_rr(e, X64_R9, X64_RAX);
+    x64_alu_ri(e, X64_AND, X64_RAX, BUS_PAGE_MASK);
+}
+
+static void jit_emit_load(jit_compiler_t *c, r3000_instruction_t *instruction, uint32_t i, uint8_t size, bool sign)
+{
+    x64_emitter_t *e = &c->e;
+    uint8_t *slow[2];
+    uint8_t *site = NULL;
+    uint8_t *access = NULL;
+
+    jit_sync(c, i);
+    jit_emit_address(c, instruction);
+
+    if (c->fastmem) {
+        site = e->ptr;
+        x64_load64(e, X64_R8, X64_RBP, JIT_BUS(fastmem));
+
+        access = e->ptr;
+        x64_load(e, size, sign, X64_RAX, X64_R8, X64_RAX, 0);
+    } else {
+        jit_emit_page(c, JIT_BUS(read_pages), slow);
+        x64_load(e, size, sign, X64_RAX, X64_R8, X64_RAX, 0);
+    }
+
+    uint8_t *done = x64_jmp(e);
+
+    // Everything that is not memory goes through the bus
+    if (c->fastmem) {
+        jit_add_fastmem(c->jit, access, site, e->ptr);
+    } else {
+        x64_bind(e, slow[0]);
+        x64_bind(e, slow[1]);
+    }
+
+    x64_mov_rr64(e, X64_RDI, X64_RBP);
+    x64_mov_ri(e, X64_RSI, size == 1 ? BUS_SIZE_BYTE : size == 2 ? BUS_SIZE_WORD : BUS_SIZE_DWORD);
+    x64_call(e, bus_read);
+
+    if (size != 4) {
+        x64_movx_rr(e, size, sign, X64_RAX, X64_RAX);
+    }
+
+    x64_bind(e, done);
+    x64_store(e, 4, X64_RAX, X64_RBX, X64_NO_INDEX, JIT_STATE(load_delay_value));
+}
+
+static void jit_emit_store(jit_compiler_t *c, r3000_instruction_t *instruction, uint32_t i, uint8_t size)
+{
+    x64_emitter_t *e = &c->e;
+    uint8_t *slow[2];
+    uint8_t *site = NULL;
+    uint8_t *access = NULL;
+
+    jit_sync(c, i);
+
+    // Isolated cache, see opcode_sw
+    x64_test_mi(e, X64_RBX, JIT_STATE(cop0_state.regs[COP0_REG_SR]), COP0_SR_ISC);
+    uint8_t *normal = x64_jcc(e, X64_CC_E);
+
+    x64_mov_rr64(e, X64_RDI, X64_RBP);
+    x64_call(e, bus_write_isolated);
+    uint8_t *done_isolated = x64_jmp(e);
+
+    x64_bind(e, normal);
+    jit_emit_address(c, instruction);
+    jit_read(c, X64_RCX, instruction->rt);
+
+    if (size != 4) {
+        x64_movx_rr(e, size, false, X64_RCX, X64_RCX);
+    }
+
+    if (c->fastmem) {
+        site = e->ptr;
+        x64_load64(e, X64_R8, X64_RBP, JIT_BUS(fastmem));
+
+        access = e->ptr;
+        x64_store(e, size, X64_RCX, X64_R8, X64_RAX, 0);
+        x64_mov_rr(e, X64_R9, X64_RAX);
+    } else {
+        jit_emit_page(c, JIT_BUS(write_pages), slow);
+        x64_store(e, size, X64_RCX, X64_R8, X64_RAX, 0);
+    }
+
+    // Check RAM words against the code bitmap, see block_cache_write
+    x64_alu_ri(e, X64_CMP, X64_R9, BUS_RAM_MIRROR_SIZE);
+    uint8_t *done_scratchpad = x64_jcc(e, X64_CC_AE);
+
+    x64_alu_ri(e, X64_AND, X64_R9, BLOCK_CACHE_RAM_SIZE - 1);
+    x64_mov_rr(e, X64_RSI, X64_R9);
+    x64_shift_ri(e, X64_SHR, X64_R9, 2);
+    x64_mov_ri64(e, X64_R8, (uint64_t) c->jit->cache->ram_code);
+    x64_bt_m(e, X64_R8, X64_R9);
+    uint8_t *done_ram = x64_jcc(e, X64_CC_AE);
+
+    x64_mov_ri64(e, X64_RDI, (uint64_t) c->jit->cache);
+    x64_call(e, block_cache_invalidate);
+    uint8_t *done_code = x64_jmp(e);
+
+    // IO and the read only BIOS go through the bus
+    if (c->fastmem) {
+        jit_add_fastmem(c->jit, access, site, e->ptr);
+    } else {
+        x64_bind(e, slow[0]);
+        x64_bind(e, slow[1]);
+    }
+
+    x64_mov_rr64(e, X64_RDI, X64_RBP);
+    x64_mov_ri(e, X64_RSI, size == 1 ? BUS_SIZE_BYTE : size == 2 ? BUS_SIZE_WORD : BUS_SIZE_DWORD);
+    x64_call(e, bus_write);
+
+    x64_bind(e, done_isolated);
+    x64_bind(e, done_scratchpad);
+    x64_bind(e, done_ram);
+    x64_bind(e, done_code);
+}
+
+static void jit_emit_instruction(jit_compiler_t *c, r3000_instruction_t *instruction, uint32_t i, uint32_t addr)
+{
+    uint32_t imm = instruction->imm;
+    uint32_t simm = (uint32_t) (int16_t) instruction->imm;
+
+    switch(instruction->op) {
+        case R3000_OP_SLL: jit_emit_shift(c, instruction, X64_SHL); return;
+        case R3000_OP_SRL: jit_emit_shift(c, instruction, X64_SHR); return;
+        case R3000_OP_SRA: jit_emit_shift(c, instruction, X64_SAR); return;
+        case R3000_OP_SLLV: jit_emit_shift_variable(c, instruction, X64_SHL); return;
+        case R3000_OP_SRLV: jit_emit_shift_variable(c, instruction, X64_SHR); return;
+        case R3000_OP_SRAV: jit_emit_shift_variable(c, instruction, X64_SAR); return;
+        case R3000_OP_JR: jit_emit_jump_register(c, instruction, addr, false); return;
+        case R3000_OP_JALR: jit_emit_jump_register(c, instruction, addr, true); return;
+        case R3000_OP_MFHI: jit_emit_move_from(c, instruction, JIT_STATE(hi)); return;
+        case R3000_OP_MTHI: jit_emit_move_to(c, instruction, JIT_STATE(hi)); return;
+        case R3000_OP_MFLO: jit_emit_move_from(c, instruction, JIT_STATE(lo)); return;
+        case R3000_OP_MTLO: jit_emit_move_to(c, instruction, JIT_STATE(lo)); return;
+        case R3000_OP_MULT: jit_emit_mult(c, instruction, true); return;
+        case R3000_OP_MULTU: jit_emit_mult(c, instruction, false); return;
+        case R3000_OP_ADD: jit_emit_alu(c, instruction, X64_ADD); return;
+        case R3000_OP_ADDU: jit_emit_alu(c, instruction, X64_ADD); return;
+        case R3000_OP_SUB: jit_emit_alu(c, instruction, X64_SUB); return;
+        case R3000_OP_SUBU: jit_emit_alu(c, instruction, X64_SUB); return;
+        case R3000_OP_AND: jit_emit_alu(c, instruction, X64_AND); return;
+        case R3000_OP_OR: jit_emit_alu(c, instruction, X64_OR); return;
+        case R3000_OP_XOR: jit_emit_alu(c, instruction, X64_XOR); return;
+        case R3000_OP_NOR: jit_emit_nor(c, instruction); return;
+        case R3000_OP_SLT: jit_emit_set(c, instruction, X64_CC_L); return;
+        case R3000_OP_SLTU: jit_emit_set(c, instruction, X64_CC_B); return;
+        case R3000_OP_BLTZ: jit_emit_branch(c, instruction, addr, X64_CC_GE, false, false); return;
+        case R3000_OP_BGEZ: jit_emit_branch(c, instruction, addr, X64_CC_L, false, false); return;
+        case R3000_OP_BLTZAL: jit_emit_branch(c, instruction, addr, X64_CC_GE, false, true); return;
+        case R3000_OP_BGEZAL: jit_emit_branch(c, instruction, addr, X64_CC_L, false, true); return;
+        case R3000_OP_J: jit_emit_jump(c, instruction, addr, false); return;
+        case R3000_OP_JAL: jit_emit_jump(c, instruction, addr, true); return;
+        case R3000_OP_BEQ: jit_emit_branch(c, instruction, addr, X64_CC_NE, true, false); return;
+        case R3000_OP_BNE: jit_emit_branch(c, instruction, addr, X64_CC_E, true, false); return;
+        case R3000_OP_BLEZ: jit_emit_branch(c, instruction, addr, X64_CC_G, false, false); return;
+        case R3000_OP_BGTZ: jit_emit_branch(c, instruction, addr, X64_CC_LE, false, false); return;
+        case R3000_OP_ADDI: jit_emit_alu_imm(c, instruction, X64_ADD, simm); return;
+        case R3000_OP_ADDIU: jit_emit_alu_imm(c, instruction, X64_ADD, simm); return;
+        case R3000_OP_SLTI: jit_emit_set_imm(c, instruction, X64_CC_L); return;
+        case R3000_OP_SLTIU: jit_emit_set_imm(c, instruction, X64_CC_B); return;
+        case R3000_OP_ANDI: jit_emit_alu_imm(c, instruction, X64_AND, imm); return;
+        case R3000_OP_ORI: jit_emit_alu_imm(c, instruction, X64_OR, imm); return;
+        case R3000_OP_XORI: jit_emit_alu_imm(c, instruction, X64_XOR, imm); return;
+        case R3000_OP_LUI: jit_emit_lui(c, instruction); return;
+        case R3000_OP_LB: jit_emit_load(c, instruction, i, 1, true); return;
+        case R3000_OP_LH: jit_emit_load(c, instruction, i, 2, true); return;
+        case R3000_OP_LW: jit_emit_load(c, instruction, i, 4, false); return;
+        case R3000_OP_LBU: jit_emit_load(c, instruction, i, 1, false); return;
+        case R3000_OP_LHU: jit_emit_load(c, instruction, i, 2, false); return;
+        case R3000_OP_SB: jit_emit_store(c, instruction, i, 1); return;
+        case R3000_OP_SH: jit_emit_store(c, instruction, i, 2); return;
+        case R3000_OP_SW: jit_emit_store(c, instruction, i, 4); return;
+    }
+
+    // DIV, LWL/LWR, SWL/SWR, SYSCALL, COP0, ...
+    jit_emit_fallback(c, instruction, i, addr);
+}
+
+/* Picks the exit after a delay slot */
+static void jit_emit_branch_exit(jit_compiler_t *c, r3000_instruction_t *branch, r3000_instruction_t *delay, uint32_t addr, uint32_t count)
+{
+    x64_emitter_t *e = &c->e;
+
+    // A SYSCALL or BREAK in the delay slot went to the exception vector instead
+    if (block_cache_ends_block(delay)) {
+        x64_alu_mi(e, X64_CMP, X64_RBX, JIT_STATE(pc), addr + 8);
+        uint8_t *no_exception = x64_jcc(e, X64_CC_E);
+
+        jit_emit_exit(c, JIT_EXIT_STATE, 0, count);
+        x64_bind(e, no_exception);
+    }
+
+    if (branch->op == R3000_OP_JR || branch->op == R3000_OP_JALR) {
+        x64_store_imm(e, 1, X64_RBX, JIT_STATE(branch_delay_slot_state), 0);
+        jit_emit_exit(c, JIT_EXIT_BRANCH, 0, count);
+        return;
+    }
+
+    x64_cmp_mi8(e, X64_RBX, JIT_STATE(branch_delay_slot_state), DELAY_SLOT_STATE_DELAY_CYCLE);
+    uint8_t *not_taken = x64_jcc(e, X64_CC_NE);
+
+    x64_store_imm(e, 1, X64_RBX, JIT_STATE(branch_delay_slot_state), 0);
+    jit_emit_exit(c, JIT_EXIT_STATIC, jit_branch_target(branch, addr), count);
+
+    x64_bind(e, not_taken);
+    jit_emit_exit(c, JIT_EXIT_STATIC, addr + 8, count);
+}
+
+/* Number of instructions the JIT handles, blocks are cut before branches without a usable delay slot */
+static uint32_t jit_block_length(block_t *block, uint32_t pc)
+{
+    for (uint32_t i=0; i < block->length; i++) {
+        uint32_t addr = pc + (i << 2);
+
+        // BIOS calls are sniffed by r3000_execute or handled by the HLE
+        if (addr == 0xA0 || addr == 0xB0 || addr == 0xC0) {
+            return i;
+        }
+
+        if (block_cache_is_branch(&block->instructions[i])) {
+            if (i + 1 == block->length || block_cache_is_branch(&block->instructions[i + 1])) {
+                return i;
+            }
+
+            i++;
+        }
+    }
+
+    return block->length;
+}
+
+static void jit_compile(jit_t *jit, bus_state_t *bus_state, block_t *block, uint32_t pc)
+{
+    uint32_t length = jit_block_length(block, pc);
+
+    block->jit_pc = pc;
+
+    if (!length) {
+        block->jit_failed = true;
+        return;
+    }
+
+    jit_compiler_t compiler;
+    jit_compiler_t *c = &compiler;
+    x64_emitter_t *e = &c->e;
+
+    memset(c, 0, sizeof(jit_compiler_t));
+    c->e.ptr = jit->ptr;
+    c->jit = jit;
+    c->block = block;
+    c->fastmem = bus_state->fastmem != NULL;
+
+    jit_allocate(c, length);
+
+    block->jit_length = length;
+
+    uint8_t *code = e->ptr;
+
+    // Give control back if the whole block does not fit the cycle budget or an interrupt is pending
+    x64_load(e, 4, false, X64_RAX, X64_RBX, X64_NO_INDEX, JIT_STATE(cycles_target));
+    x64_alu_rm(e, X64_SUB, X64_RAX, X64_RBX, JIT_STATE(cycles));
+    x64_alu_ri(e, X64_SUB, X64_RAX, length);
+    x64_patch(x64_jcc(e, X64_CC_S), jit->exit);
+
+    x64_cmp_mi8(e, X64_RBP, JIT_BUS(irq_state.pending), 0);
+    x64_patch(x64_jcc(e, X64_CC_NE), jit->exit);
+
+    jit_reload(c);
+
+    for (uint32_t i=0; i < length; i++) {
+        r3000_instruction_t *instruction = &block->instructions[i];
+        uint32_t addr = pc + (i << 2);
+        bool delay_slot = i && block_cache_is_branch(&block->instructions[i - 1]);
+
+        jit_emit_instruction(c, instruction, i, addr);
+        jit_emit_load_delay(c, i, jit_delay_reg(instruction));
+
+        if (delay_slot) {
+            jit_emit_branch_exit(c, &block->instructions[i - 1], instruction, addr - 4, i + 1);
+            break;
+        }
+
+        if (block_cache_ends_block(instruction)) {
+            jit_emit_exit(c, JIT_EXIT_STATE, 0, i + 1);
+            break;
+        }
+
+        if (jit_is_access(instruction)) {
+            uint8_t *invalidated = NULL;
+
+            // The store hit cached code, this block might be gone
+            if (jit_is_store(instruction)) {
+                x64_mov_ri64(e, X64_RAX, (uint64_t) &jit->cache->invalidated);
+                x64_cmp_mi8(e, X64_RAX, 0, 0);
+                invalidated = x64_jcc(e, X64_CC_NE);
+            }
+
+            // The interpreter takes an interrupt the access raised before the next instruction
+            x64_cmp_mi8(e, X64_RBP, JIT_BUS(irq_state.pending), 0);
+            uint8_t *valid = x64_jcc(e, X64_CC_E);
+
+            if (invalidated) {
+                x64_bind(e, invalidated);
+            }
+
+            jit_emit_exit(c, JIT_EXIT_STATIC, addr + 4, i + 1);
+            x64_bind(e, valid);
+        }
+
+        if (i + 1 == length) {
+            jit_emit_exit(c, JIT_EXIT_STATIC, addr + 4, i + 1);
+        }
+    }
+
+    jit->ptr = e->ptr;
+    block->code = code;
+
+    log_debug(LOG_JIT, "JIT", "Compiled %08X (%d instructions, %ld bytes)\n", pc, length, (long) (e->ptr - code));
+}
+
+static void jit_unlink_all(block_t **blocks, uint32_t count)
+{
+    for (uint32_t i=0; i < count; i++) {
+        block_t *block = blocks[i];
+
+        if (!block) {
+            continue;
+        }
+
+        while (block->links) {
+            jit_link_t *link = block->links;
+            block->links = link->next;
+
+            free(link);
+        }
+
+        block->code = NULL;
+        block->jit_failed = false;
+    }
+}
+
+/* Drops all native code, blocks get compiled again on their next run */
+static void jit_reset(jit_t *jit)
+{
+    log_debug(LOG_JIT, "JIT", "Code buffer full, flushing\n");
+
+    jit_unlink_all(jit->cache->ram_blocks, BLOCK_CACHE_RAM_SIZE >> 2);
+    jit_unlink_all(jit->cache->bios_blocks, BLOCK_CACHE_BIOS_SIZE >> 2);
+
+    jit->ptr = jit->blocks;
+    jit->link_site = NULL;
+    jit->fastmem_count = 0;
+}
+
+static jit_fastmem_t *jit_find_fastmem(jit_t *jit, uint8_t *access)
+{
+    uint32_t low = 0;
+    uint32_t high = jit->fastmem_count;
+
+    while (low < high) {
+        uint32_t middle = (low + high) / 2;
+
+        if (jit->fastmem[middle].access < access) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    if (low < jit->fastmem_count && jit->fastmem[low].access == access) {
+        return &jit->fastmem[low];
+    }
+
+    return NULL;
+}
+
+#ifdef __linux__
+/*
+ * A fastmem access hit something that is not memory. It gets patched to jump
+ * straight to its slow path, which is also where the faulting access goes on.
+ */
+static void jit_fault(int signal, siginfo_t *info, void *context)
+{
+    ucontext_t *ucontext = (ucontext_t *) context;
+    uint8_t *rip = (uint8_t *) ucontext->uc_mcontext.gregs[REG_RIP];
+    jit_fastmem_t *fastmem = jit_fault_jit ? jit_find_fastmem(jit_fault_jit, rip) : NULL;
+
+    if (!fastmem) {
+        // Not ours, the fault repeats with the previous handler
+        sigaction(SIGSEGV, &jit_fault_previous, NULL);
+        return;
+    }
+
+    log_debug(LOG_JIT, "JIT", "Fastmem fault at %p, patching\n", rip);
+
+    jit_fault_jit->fastmem_faults++;
+
+    x64_emitter_t emitter = { fastmem->site };
+    x64_patch(x64_jmp(&emitter), fastmem->slow);
+
+    ucontext->uc_mcontext.gregs[REG_RIP] = (greg_t) fastmem->slow;
+}
+
+/* One handler for every JIT in the process, installing it twice would make it its own previous one */
+static void jit_fault_install(void)
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = jit_fault;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+
+    sigaction(SIGSEGV, &action, &jit_fault_previous);
+}
+#endif
+
+/* Points all jumps into this block back to their exit stubs */
+void jit_unlink(block_t *block)
+{
+    while (block->links) {
+        jit_link_t *link = block->links;
+        block->links = link->next;
+
+        x64_patch(link->site, link->site + 4);
+        free(link);
+    }
+}
+
+bool jit_init(jit_t *jit, block_cache_t *cache)
+{
+    #if !defined(__x86_64__)
+    log_error("JIT", "Only x86-64 hosts are supported\n");
+    return false;
+    #endif
+
+    jit->buffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (jit->buffer == MAP_FAILED) {
+        log_error("JIT", "Failed to map code buffer\n");
+        return false;
+    }
+
+    x64_emitter_t emitter = { jit->buffer };
+    x64_emitter_t *e = &emitter;
+
+    // void enter(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t *code)
+    jit->enter = (jit_enter_t) e->ptr;
+
+    x64_push(e, X64_RBX);
+    x64_push(e, X64_RBP);
+    x64_push(e, X64_R12);
+    x64_push(e, X64_R13);
+    x64_push(e, X64_R14);
+    x64_push(e, X64_R15);
+    x64_alu_ri64(e, X64_SUB, X64_RSP, 8);
+
+    x64_mov_rr64(e, X64_RBX, X64_RDI);
+    x64_mov_rr64(e, X64_RBP, X64_RSI);
+    x64_jmp_r(e, X64_RDX);
+
+    // Every block leaves through here
+    jit->exit = e->ptr;
+
+    x64_alu_ri64(e, X64_ADD, X64_RSP, 8);
+    x64_pop(e, X64_R15);
+    x64_pop(e, X64_R14);
+    x64_pop(e, X64_R13);
+    x64_pop(e, X64_R12);
+    x64_pop(e, X64_RBP);
+    x64_pop(e, X64_RBX);
+    x64_ret(e);
+
+    jit->blocks = e->ptr;
+    jit->ptr = e->ptr;
+
+    jit->link_site = NULL;
+    jit->link_pc = 0;
+
+    jit->fastmem = NULL;
+    jit->fastmem_count = 0;
+    jit->fastmem_size = 0;
+    jit->fastmem_faults = 0;
+
+    jit->cache = cache;
+    cache->jit = jit;
+
+    #ifdef __linux__
+    // Fastmem accesses that fault end up in jit_fault, see bus_map_fastmem
+    pthread_once(&jit_fault_once, jit_fault_install);
+    #endif
+
+    return true;
+}
+
+void jit_destroy(jit_t *jit)
+{
+    jit_unlink_all(jit->cache->ram_blocks, BLOCK_CACHE_RAM_SIZE >> 2);
+    jit_unlink_all(jit->cache->bios_blocks, BLOCK_CACHE_BIOS_SIZE >> 2);
+
+    jit->cache->jit = NULL;
+
+    if (jit_fault_jit == jit) {
+        jit_fault_jit = NULL;
+    }
+
+    munmap(jit->buffer, JIT_BUFFER_SIZE);
+    free(jit->fastmem);
+}
+
+/* Runs the block and whatever it links to, returns false if the caller has to interpret it */
+bool jit_execute(jit_t *jit, r3000_state_t *r3000_state, bus_state_t *bus_state, block_t *block, uint32_t cycles)
+{
+    uint8_t *link_site = jit->link_site;
+    jit->link_site = NULL;
+
+    // Compiled code starts with empty delay slots, idle loops are left to the interpreter to skip
+    if (r3000_state->branch_delay_slot_state || block->jit_failed || block->idle_loop) {
+        return false;
+    }
+
+    if (!block->code) {
+        if (jit->ptr + JIT_BLOCK_MAX_SIZE > jit->buffer + JIT_BUFFER_SIZE) {
+            jit_reset(jit);
+            link_site = NULL;
+        }
+
+        instrument_begin(INSTRUMENT_COMPILE);
+        jit_compile(jit, bus_state, block, r3000_state->pc);
+        instrument_end();
+
+        if (!block->code) {
+            return false;
+        }
+    }
+
+    // Same physical code seen through another segment
+    if (block->jit_pc != r3000_state->pc) {
+        return false;
+    }
+
+    // Blocks that would run past the next event are interpreted up to it, see r3000_run_instructions
+    if (block->jit_length > cycles) {
+        return false;
+    }
+
+    // Link the block we came from straight to this one
+    if (link_site && jit->link_pc == r3000_state->pc) {
+        jit_link_t *link = (jit_link_t *) malloc(sizeof(jit_link_t));
+        link->site = link_site;
+        link->next = block->links;
+        block->links = link;
+
+        x64_patch(link_site, block->code);
+    }
+
+    r3000_state->cycles_target = r3000_state->cycles + (cycles < JIT_MAX_CHAIN_CYCLES ? cycles : JIT_MAX_CHAIN_CYCLES);
+
+    jit_fault_jit = jit;
+    jit->enter(r3000_state, bus_state, block->code);
+
+    if (jit->link_site) {
+        jit->link_pc = r3000_state->pc;
+    }
+
+    return true;
+}
@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu/profiler.h"
+#include "log.h"
+
+static profiler_function_t *profiler_function(profiler_t *profiler, uint32_t addr)
+{
+    uint32_t index = ((addr >> 2) * 2654435761u) >> 16;
+
+    for (uint32_t i=0; i < PROFILER_FUNCTIONS - 1; i++) {
+        profiler_function_t *function = &profiler->functions[(index + i) % (PROFILER_FUNCTIONS - 1)];
+
+        if (!function->used) {
+            function->used = true;
+            function->addr = addr;
+            return function;
+        }
+
+        if (function->addr == addr) {
+            return function;
+        }
+    }
+
+    profiler->functions[PROFILER_FUNCTIONS - 1].used = true;
+    profiler->functions[PROFILER_FUNCTIONS - 1].addr = UINT32_MAX;
+
+    return &profiler->functions[PROFILER_FUNCTIONS - 1];
+}
+
+static uint32_t profiler_node(profiler_t *profiler, uint32_t parent, uint32_t function)
+{
+    if (parent != UINT32_MAX) {
+        for (uint32_t i=profiler->nodes[parent].child; i; i=profiler->nodes[i].sibling) {
+            if (profiler->nodes[i].function == function) {
+                return i;
+            }
+        }
+    }
+
+    if (profiler->node_count == profiler->node_size) {
+        profiler->node_size *= 2;
+        profiler->nodes = (profiler_node_t *) realloc(profiler->nodes, profiler->node_size * sizeof(profiler_node_t));
+    }
+
+    uint32_t index = profiler->node_count++;
+    profiler_node_t *node = &profiler->nodes[index];
+
+    node->function = function;
+    node->parent = parent;
+    node->child = 0;
+    node->sibling = 0;
+    node->cycles = 0;
+
+    if (parent != UINT32_MAX) {
+        node->sibling = profiler->nodes[parent].child;
+        profiler->nodes[parent].child = index;
+    }
+
+    return index;
+}
+
+void profiler_init(profiler_t *profiler, uint32_t pc, uint32_t cycles)
+{
+    profiler->ram_counts = (uint32_t *) calloc(PROFILER_RAM_WORDS, sizeof(uint32_t));
+    profiler->bios_counts = (uint32_t *) calloc(PROFILER_BIOS_WORDS, sizeof(uint32_t));
+    profiler->functions = (profiler_function_t *) calloc(PROFILER_FUNCTIONS, sizeof(profiler_function_t));
+
+    profiler->node_size = 0x1000;
+    profiler->node_count = 0;
+    profiler->nodes = (profiler_node_t *) malloc(profiler->node_size * sizeof(profiler_node_t));
+
+    profiler->cycles = 0;
+    profiler->last_cycles = cycles;
+
+    // Whatever runs first is the root, nothing returns from it
+    profiler->stack[0].function = profiler_function(profiler, pc);
+    profiler->stack[0].function->calls = 1;
+    profiler->stack[0].node = profiler_node(profiler, UINT32_MAX, pc);
+    profiler->stack[0].ret = UINT32_MAX;
+    profiler->stack[0].exception = false;
+    profiler->stack[0].start = 0;
+
+    profiler->depth = 1;
+}
+
+void profiler_destroy(profiler_t *profiler)
+{
+    free(profiler->ram_counts);
+    free(profiler->bios_counts);
+    free(profiler->functions);
+    free(profiler->nodes);
+}
+
+/* Charges the cycles since the last call to the innermost frame */
+static inline void profiler_charge(profiler_t *profiler, uint32_t cycles)
+{
+    uint32_t delta = cycles - profiler->last_cycles;
+    profiler_frame_t *frame = &profiler->stack[profiler->depth - 1];
+
+    profiler->last_cycles = cycles;
+    profiler->cycles += delta;
+
+    frame->function->exclusive += delta;
+    profiler->nodes[frame->node].cycles += delta;
+}
+
+static void profiler_push(profiler_t *profiler, uint32_t addr, uint32_t ret, bool exception)
+{
+    // Deeper calls are charged to the innermost frame we still have
+    if (profiler->depth == PROFILER_MAX_DEPTH) {
+        return;
+    }
+
+    profiler_frame_t *frame = &profiler->stack[profiler->depth];
+
+    frame->function = profiler_function(profiler, addr);
+    frame->node = profiler_node(profiler, profiler->stack[profiler->depth - 1].node, addr);
+    frame->ret = ret;
+    frame->exception = exception;
+    frame->start = profiler->cycles;
+
+    frame->function->calls++;
+
+    profiler->depth++;
+}
+
+/* Leaves every frame from the given one up */
+static void profiler_pop(profiler_t *profiler, uint32_t depth)
+{
+    while (profiler->depth > depth) {
+        profiler_frame_t *frame = &profiler->stack[--profiler->depth];
+        bool recursive = false;
+
+        // Recursive calls are already covered by the outer one
+        for (uint32_t i=0; i < profiler->depth; i++) {
+            if (profiler->stack[i].function == frame->function) {
+                recursive = true;
+                break;
+            }
+        }
+
+        if (!recursive) {
+            frame->function->inclusive += profiler->cycles - frame->start;
+        }
+    }
+}
+
+/* Called before every instruction, counts it and follows calls and returns */
+void profiler_instruction(profiler_t *profiler, r3000_state_t *r3000_state, r3000_instruction_t *instruction)
+{
+    uint32_t pc = r3000_state->pc;
+    uint32_t phy_addr = pc & 0x1FFFFFFF;
+
+    profiler_charge(profiler, r3000_state->cycles);
+
+    if (phy_addr < 0x800000) {
+        profiler->ram_counts[(phy_addr & 0x1FFFFF) >> 2]++;
+    } else if (phy_addr >= 0x1FC00000 && phy_addr < 0x1FC80000) {
+        profiler->bios_counts[(phy_addr & 0x7FFFF) >> 2]++;
+    }
+
+    uint32_t *regs = r3000_state->regs;
+
+    switch(instruction->op) {
+        case R3000_OP_JAL:
+            profiler_push(profiler, ((pc + 4) & 0xF0000000) | (instruction->imm_jump << 2), pc + 8, false);
+            break;
+
+        case R3000_OP_JALR:
+            profiler_push(profiler, regs[instruction->rs], pc + 8, false);
+            break;
+
+        case R3000_OP_BLTZAL:
+            if ((int32_t) regs[instruction->rs] < 0) {
+                profiler_push(profiler, pc + 4 + ((int16_t) instruction->imm << 2), pc + 8, false);
+            }
+            break;
+
+        case R3000_OP_BGEZAL:
+            if ((int32_t) regs[instruction->rs] >= 0) {
+                profiler_push(profiler, pc + 4 + ((int16_t) instruction->imm << 2), pc + 8, false);
+            }
+            break;
+
+        case R3000_OP_JR:
+            // Returns to one of the callers, tail calls and longjmps skip frames
+            for (uint32_t i=profiler->depth - 1; i > 0 && !profiler->stack[i].exception; i--) {
+                if (profiler->stack[i].ret == regs[instruction->rs]) {
+                    profiler_pop(profiler, i);
+                    break;
+                }
+            }
+            break;
+
+        case R3000_OP_RFE:
+            for (uint32_t i=profiler->depth - 1; i > 0; i--) {
+                if (profiler->stack[i].exception) {
+                    profiler_pop(profiler, i);
+                    break;
+                }
+            }
+            break;
+    }
+}
+
+/* The handler runs as a call from the interrupted code, RFE ends it */
+void profiler_exception(profiler_t *profiler, r3000_state_t *r3000_state)
+{
+    profiler_charge(profiler, r3000_state->cycles);
+    profiler_push(profiler, r3000_state->pc, r3000_state->cop0_state.regs[COP0_REG_EPC], true);
+}
+
+static int profiler_compare_functions(const void *a, const void *b)
+{
+    uint64_t x = (*(profiler_function_t **) a)->exclusive;
+    uint64_t y = (*(profiler_function_t **) b)->exclusive;
+
+    return (x < y) - (x > y);
+}
+
+/* Top functions by exclusive cycles and the most executed instructions */
+void profiler_report(profiler_t *profiler, FILE *fp)
+{
+    profiler_function_t **functions = (profiler_function_t **) malloc(PROFILER_FUNCTIONS * sizeof(profiler_function_t *));
+    uint32_t count = 0;
+
+    for (uint32_t i=0; i < PROFILER_FUNCTIONS; i++) {
+        if (profiler->functions[i].used) {
+            functions[count++] = &profiler->functions[i];
+        }
+    }
+
+    qsort(functions, count, sizeof(profiler_function_t *), profiler_compare_functions);
+
+    double total = profiler->cycles ? (double) profiler->cycles : 1.0;
+
+    fprintf(fp, "Profile: %llu cycles, %d functions\n\n", (unsigned long long) profiler->cycles, count);
+    fprintf(fp, "%-10s %14s %7s %14s %7s %10s\n", "function", "exclusive", "%", "inclusive", "%", "calls");
+
+    for (uint32_t i=0; i < count && i < PROFILER_TOP; i++) {
+        profiler_function_t *function = functions[i];
+
+        // Frames still on the stack only count up to now
+        uint64_t inclusive = function->inclusive;
+
+        for (uint32_t j=0; j < profiler->depth; j++) {
+            if (profiler->stack[j].function == function) {
+                inclusive += profiler->cycles - profiler->stack[j].start;
+                break;
+            }
+        }
+
+        fprintf(fp, "%08X   %14llu %6.2f%% %14llu %6.2f%% %10llu\n", function->addr,
+            (unsigned long long) function->exclusive, function->exclusive * 100.0 / total,
+            (unsigned long long) inclusive, inclusive * 100.0 / total,
+            (unsigned long long) function->calls);
+    }
+
+    free(functions);
+
+    /* Keeps the top entries sorted, insertion from the back */
+    uint32_t top_pc[PROFILER_TOP];
+    uint32_t top_count[PROFILER_TOP];
+    uint32_t top = 0;
+
+    for (uint32_t i=0; i < PROFILER_RAM_WORDS + PROFILER_BIOS_WORDS; i++) {
+        uint32_t n = (i < PROFILER_RAM_WORDS) ? profiler->ram_counts[i] : profiler->bios_counts[i - PROFILER_RAM_WORDS];
+        uint32_t pc = (i < PROFILER_RAM_WORDS) ? 0x80000000 | (i << 2) : 0xBFC00000 | ((i - PROFILER_RAM_WORDS) << 2);
+
+        if (!n || (top == PROFILER_TOP && n <= top_count[top - 1])) {
+            continue;
+        }
+
+        uint32_t j = (top < PROFILER_TOP) ? top++ : top - 1;
+
+        for (; j > 0 && top_count[j - 1] < n; j--) {
+            top_pc[j] = top_pc[j - 1];
+            top_count[j] = top_count[j - 1];
+        }
+
+        top_pc[j] = pc;
+        top_count[j] = n;
+    }
+
+    fprintf(fp, "\n%-10s %14s\n", "pc", "count");
+
+    for (uint32_t i=0; i < top; i++) {
+        fprintf(fp, "%08X   %14u\n", top_pc[i], top_count[i]);
+    }
+}
+
+/* Collapsed stacks, one "root;caller;callee cycles" line per call path */
+bool profiler_export(profiler_t *profiler, const char *path)
+{
+    FILE *fp = fopen(path, "w");
+
+    if (!fp) {
+        log_error("PROFILER", "Failed to write %s\n", path);
+        return false;
+    }
+
+    uint32_t stack[PROFILER_MAX_DEPTH + 1];
+
+    for (uint32_t i=0; i < profiler->node_count; i++) {
+        if (!profiler->nodes[i].cycles) {
+            continue;
+        }
+
+        uint32_t depth = 0;
+
+        for (uint32_t node=i; node != UINT32_MAX; node=profiler->nodes[node].parent) {
+            stack[depth++] = profiler->nodes[node].function;
+        }
+
+        while (depth--) {
+            fprintf(fp, depth ? "%08X;" : "%08X", stack[depth]);
+        }
+
+        fprintf(fp, " %llu\n", (unsigned long long) profiler->nodes[i].cycles);
+    }
+
+    fclose(fp);
+
+    return true;
+}
@@ -5,37 +5,84 @@
 
 #include "cpu/r3000.h"
 #include "cpu/opcodes.h"
+#include "cpu/block_cache.h"
+#include "cpu/jit.h"
+#include "bios/bios.h"
+#include "bios/hle.h"
+#include "bios/boot.h"
+#include "cpu/profiler.h"
+#include "cpu/trace.h"
+#include "core/instrument.h"
 #include "log.h"
 
-char tty_buf[100];
-uint8_t tty_buf_index;
-
-const char *r3000_primary_opcode_names[] = {
-    "", "BcondZ", "J", "JAL", "BEQ", "BNE", "BLEZ", "BGTZ",
-    "ADDI", "ADDIU", "SLTI", "SLTIU", "ANDI", "ORI", "XORI", "LUI",
-    "COP0", "COP1", "COP2", "COP3", "", "", "", "", 
-    "", "", "", "", "", "", "", "",
-    "LB", "LH", "LWL", "LW", "LBU", "LHU", "LWR", "",
-    "SB", "SH", "SWL", "SW", "", "", "SWR", "",
-    "LWC0", "LWC1", "LWC2", "LWC3", "", "", "", "",
-    "SWC0", "SWC1", "SWC2", "SWC3", "", "", "", ""
+#define R3000_HANDLER(id, name) opcode_##name,
+#define R3000_NAME(id, name) #id,
+
+const r3000_handler_t r3000_handlers[R3000_OP_COUNT] = {
+    R3000_OPS(R3000_HANDLER)
+};
+
+const char *r3000_op_names[R3000_OP_COUNT] = {
+    R3000_OPS(R3000_NAME)
+};
+
+/* Decode tables, SPECIAL, BcondZ, COP0 and COP2 have their own */
+#define R R3000_OP_RESERVED
+#define CU R3000_OP_COP_UNUSABLE
+
+static const uint8_t r3000_primary_ops[64] = {
+    R, R, R3000_OP_J, R3000_OP_JAL, R3000_OP_BEQ, R3000_OP_BNE, R3000_OP_BLEZ, R3000_OP_BGTZ,
+    R3000_OP_ADDI, R3000_OP_ADDIU, R3000_OP_SLTI, R3000_OP_SLTIU, R3000_OP_ANDI, R3000_OP_ORI, R3000_OP_XORI, R3000_OP_LUI,
+    R, CU, R3000_OP_COP2, CU, R, R, R, R,
+    R, R, R, R, R, R, R, R,
+    R3000_OP_LB, R3000_OP_LH, R3000_OP_LWL, R3000_OP_LW, R3000_OP_LBU, R3000_OP_LHU, R3000_OP_LWR, R,
+    R3000_OP_SB, R3000_OP_SH, R3000_OP_SWL, R3000_OP_SW, R, R, R3000_OP_SWR, R,
+    CU, CU, R3000_OP_LWC2, CU, R, R, R, R,
+    CU, CU, R3000_OP_SWC2, CU, R, R, R, R
+};
+
+static const uint8_t r3000_special_ops[64] = {
+    R3000_OP_SLL, R, R3000_OP_SRL, R3000_OP_SRA, R3000_OP_SLLV, R, R3000_OP_SRLV, R3000_OP_SRAV,
+    R3000_OP_JR, R3000_OP_JALR, R, R, R3000_OP_SYSCALL, R3000_OP_BREAK, R, R,
+    R3000_OP_MFHI, R3000_OP_MTHI, R3000_OP_MFLO, R3000_OP_MTLO, R, R, R, R,
+    R3000_OP_MULT, R3000_OP_MULTU, R3000_OP_DIV, R3000_OP_DIVU, R, R, R, R,
+    R3000_OP_ADD, R3000_OP_ADDU, R3000_OP_SUB, R3000_OP_SUBU, R3000_OP_AND, R3000_OP_OR, R3000_OP_XOR, R3000_OP_NOR,
+    R, R, R3000_OP_SLT, R3000_OP_SLTU, R, R, R, R,
+    R, R, R, R, R, R, R, R,
+    R, R, R, R, R, R, R, R
+};
+
+/* Indexed by rt, bit 0 selects BGEZ and only 0x10/0x11 link */
+static const uint8_t r3000_bcondz_ops[32] = {
+    R3000_OP_BLTZ, R3000_OP_BGEZ, R3000_OP_BLTZ, R3000_OP_BGEZ, R3000_OP_BLTZ, R3000_OP_BGEZ, R3000_OP_BLTZ, R3000_OP_BGEZ,
+    R3000_OP_BLTZ, R3000_OP_BGEZ, R3000_OP_BLTZ, R3000_OP_BGEZ, R3000_OP_BLTZ, R3000_OP_BGEZ, R3000_OP_BLTZ, R3000_OP_BGEZ,
+    R3000_OP_BLTZAL, R3000_OP_BGEZAL, R3000_OP_BLTZ, R3000_OP_BGEZ, R3000_OP_BLTZ, R3000_OP_BGEZ, R3000_OP_BLTZ, R3000_OP_BGEZ,
+    R3000_OP_BLTZ, R3000_OP_BGEZ, R3000_OP_BLTZ, R3000_OP_BGEZ, R3000_OP_BLTZ, R3000_OP_BGEZ, R3000_OP_BLTZ, R3000_OP_BGEZ
+};
+
+/* Indexed by rs, 0x10 - 0x1F are commands and RFE is the only one */
+static const uint8_t r3000_cop0_ops[32] = {
+    R3000_OP_MFC0, R, R, R, R3000_OP_MTC0, R, R, R,
+    R, R, R, R, R, R, R, R,
+    R3000_OP_RFE, R3000_OP_RFE, R3000_OP_RFE, R3000_OP_RFE, R3000_OP_RFE, R3000_OP_RFE, R3000_OP_RFE, R3000_OP_RFE,
+    R3000_OP_RFE, R3000_OP_RFE, R3000_OP_RFE, R3000_OP_RFE, R3000_OP_RFE, R3000_OP_RFE, R3000_OP_RFE, R3000_OP_RFE
 };
 
-const char *r3000_secondary_opcode_names[] = {
-    "SLL", "", "SRL", "SRA", "SLLV", "", "SRVL", "SRAV",
-    "JR", "JALR", "", "", "SYSCALL", "BREAK", "", "",
-    "MFHI", "MTHI", "MFLO", "MTLO", "", "", "", "",
-    "MULT", "MULTU", "DIV", "DIVU", "", "", "", "",
-    "ADD", "ADDU", "SUB", "SUBU", "AND", "OR", "XOR", "NOR",
-    "", "", "SLT", "SLTU", "", "", "", "",
-    "", "", "", "", "", "", "", "",
-    "", "", "", "", "", "", "", ""
+/* Indexed by rs, 0x10 - 0x1F are GTE commands */
+static const uint8_t r3000_cop2_ops[32] = {
+    R3000_OP_MFC2, R, R3000_OP_CFC2, R, R3000_OP_MTC2, R, R3000_OP_CTC2, R,
+    R, R, R, R, R, R, R, R,
+    R3000_OP_COP2, R3000_OP_COP2, R3000_OP_COP2, R3000_OP_COP2, R3000_OP_COP2, R3000_OP_COP2, R3000_OP_COP2, R3000_OP_COP2,
+    R3000_OP_COP2, R3000_OP_COP2, R3000_OP_COP2, R3000_OP_COP2, R3000_OP_COP2, R3000_OP_COP2, R3000_OP_COP2, R3000_OP_COP2
 };
 
+#undef R
+#undef CU
+
 const char *r3000_exception_cause_names[] = {
     "Interrupt", "", "", "",
     "Address error load/fetch", "Address error store", "Bus error on instruction fetch", "Bus error on load/store",
-    "Syscall"
+    "Syscall", "Breakpoint", "Reserved instruction", "Coprocessor unusable"
 };
 
 void r3000_enqueue_load(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rt, uint32_t value)
@@ -52,20 +99,10 @@ void r3000_branch(r3000_state_t *r3000_state, uint32_t addr)
     r3000_state->branch_addr = addr;
 }
 
-void r3000_check_irqs(r3000_state_t *r3000_state, bus_state_t *bus_state)
+/* Hands the interrupt enable bits of SR and the software interrupts in CAUSE to the controller */
+void r3000_update_irqs(r3000_state_t *r3000_state)
 {
-    bool irq = false;
-
-    if (bus_state->timer_state.channel_0.irq_req) {
-        irq = true;  
-        bus_state->timer_state.channel_0.irq_req = false;
-    }
-
-    if (irq) {
-        log_debug("IRQ", "Interrupt\n");
-
-        r3000_exception(r3000_state, COP0_CAUSE_INT);
-    }
+    irq_set_cpu(r3000_state->irq_state, r3000_state->cop0_state.regs[COP0_REG_SR], r3000_state->cop0_state.regs[COP0_REG_CAUSE]);
 }
 
 void r3000_exception(r3000_state_t *r3000_state, uint8_t cause) {
@@ -85,93 +122,153 @@ void r3000_exception(r3000_state_t *r3000_state, uint8_t cause) {
         r3000_state->cop0_state.regs[COP0_REG_EPC] = r3000_state->pc_instruction;
     }    
 
+    // Software interrupts stay pending, everything else describes this exception
+    r3000_state->cop0_state.regs[COP0_REG_CAUSE] &= IRQ_CAUSE_SOFTWARE;
+    r3000_state->cop0_state.regs[COP0_REG_CAUSE] |= cause << 2;
+
     // Check if we're in a branch delay slot
     if (r3000_state->branch_delay_slot_state == DELAY_SLOT_STATE_DELAY_CYCLE) {
         r3000_state->cop0_state.regs[COP0_REG_EPC] -= 4;
         r3000_state->cop0_state.regs[COP0_REG_CAUSE] |= (1 << 31);
     }
 
-    r3000_state->cop0_state.regs[COP0_REG_CAUSE] = cause << 2;
+    // EPC covers the branch, the handler must not jump to its target after its first instruction
+    r3000_state->branch_delay_slot_state = 0;
+
+    r3000_update_irqs(r3000_state);
 
     r3000_state->pc = (r3000_state->cop0_state.regs[COP0_REG_SR] & COP0_SR_BEV) ? 0xBFC00180 : 0x80000080;
     r3000_state->pc_next = r3000_state->pc + 4;
 
-    #ifdef LOG_DEBUG_R3000_EXCEPTIONS
-    log_debug("R3000", "Exception | Cause: %s EPC: %08x\n", r3000_exception_cause_names[cause], r3000_state->cop0_state.regs[COP0_REG_EPC]);
+    #ifdef R3000_PROFILER
+    if (r3000_state->profiler) {
+        profiler_exception(r3000_state->profiler, r3000_state);
+    }
     #endif
+
+    log_debug(LOG_R3000_EXCEPTIONS, "R3000", "Exception | Cause: %s EPC: %08x\n", r3000_exception_cause_names[cause], r3000_state->cop0_state.regs[COP0_REG_EPC]);
 }
 
 void r3000_rfe(r3000_state_t *r3000_state)
 {
-    #ifdef LOG_DEBUG_R3000_EXCEPTIONS
-    log_debug("R3000", "Return from exception\n");
-    #endif
+    log_debug(LOG_R3000_EXCEPTIONS, "R3000", "Return from exception\n");
 
     // Restore old mode
     uint8_t mode = r3000_state->cop0_state.regs[COP0_REG_SR] & 0x3F;
     
-    r3000_state->cop0_state.regs[COP0_REG_SR] &= ~0x3F;
+    r3000_state->cop0_state.regs[COP0_REG_SR] &= ~0x0F;
     r3000_state->cop0_state.regs[COP0_REG_SR] |= (mode >> 2);
+
+    r3000_update_irqs(r3000_state);
 }
 
-void r3000_step(r3000_state_t *r3000_state, bus_state_t *bus_state)
+void r3000_decode(r3000_instruction_t *instruction, uint32_t word)
+{
+    instruction->word = word;
+
+    instruction->opcode = (word & 0x0FC000000) >> 26;
+    instruction->funct = word & 0x0000003F;
+
+    instruction->rs = (word & 0x03E00000) >> 21;
+    instruction->rt = (word & 0x001F0000) >> 16;
+
+    /* R-Type */
+    instruction->rd = (word & 0x0000F800) >> 11;
+    instruction->shamt = (word & 0x000007C0) >> 6;
+
+    /* I-Type */
+    instruction->imm = (word & 0x0000FFFF);
+
+    /* J-Type */    
+    instruction->imm_jump = (word & 0x03FFFFFF);
+
+    switch(instruction->opcode) {
+        case 0x00: instruction->op = r3000_special_ops[instruction->funct]; break;
+        case 0x01: instruction->op = r3000_bcondz_ops[instruction->rt]; break;
+        case 0x10:
+            instruction->op = r3000_cop0_ops[instruction->rs];
+
+            if (instruction->op == R3000_OP_RFE && instruction->funct != 0x10) {
+                instruction->op = R3000_OP_RESERVED;
+            }
+
+            break;
+
+        case 0x12: instruction->op = r3000_cop2_ops[instruction->rs]; break;
+        default: instruction->op = r3000_primary_ops[instruction->opcode]; break;
+    }
+
+    instruction->handler = r3000_handlers[instruction->op];
+}
+
+/* Work done before every instruction, may redirect pc to an exception vector */
+static inline void r3000_begin(r3000_state_t *r3000_state, bus_state_t *bus_state)
 {
     if (r3000_state->branch_delay_slot_state == DELAY_SLOT_STATE_ARMED) {
         r3000_state->branch_delay_slot_state = DELAY_SLOT_STATE_DELAY_CYCLE;
     }
 
-    r3000_check_irqs(r3000_state, bus_state);
+    // Only changes when the controller or SR/CAUSE do
+    if (bus_state->irq_state.pending) {
+        log_debug(LOG_IRQ, "IRQ", "Interrupt | I_STAT: %03x I_MASK: %03x\n", bus_state->irq_state.i_stat, bus_state->irq_state.i_mask);
 
-    uint32_t instruction = bus_read(bus_state, BUS_SIZE_DWORD, r3000_state->pc);
+        r3000_exception(r3000_state, COP0_CAUSE_INT);
+    }
+}
 
-    uint8_t opcode = (instruction & 0x0FC000000) >> 26;
-    uint8_t funct = instruction & 0x0000003F;
+/* Kernel calls the HLE handles return straight to ra, see bios_hle_call */
+static inline bool r3000_hle(r3000_state_t *r3000_state, bus_state_t *bus_state)
+{
+    if (!r3000_state->hle || (r3000_state->pc != 0xA0 && r3000_state->pc != 0xB0 && r3000_state->pc != 0xC0)) {
+        return false;
+    }
 
-    uint8_t rs = (instruction & 0x03E00000) >> 21;
-    uint8_t rt = (instruction & 0x001F0000) >> 16;
+    instrument_begin(INSTRUMENT_HLE);
+    bool handled = bios_hle_call(r3000_state->hle, r3000_state, bus_state);
+    instrument_end();
 
-    /* R-Type */
-    uint8_t rd = (instruction & 0x0000F800) >> 11;
-    uint8_t shamt = (instruction & 0x000007C0) >> 6;
+    return handled;
+}
 
-    /* I-Type */
-    uint16_t imm = (instruction & 0x0000FFFF);
+/* One-shot hook for the fast boot, see boot_shell */
+static inline void r3000_boot(r3000_state_t *r3000_state, bus_state_t *bus_state)
+{
+    if (r3000_state->boot && r3000_state->pc == BOOT_SHELL_PC) {
+        boot_t *boot = r3000_state->boot;
+        r3000_state->boot = NULL;
 
-    /* J-Type */    
-    uint32_t imm_jump = (instruction & 0x03FFFFFF);
+        boot_shell(boot, r3000_state, bus_state);
+    }
+}
 
-    #ifdef LOG_DEBUG_R3000
-    if (*r3000_state->debug_enabled) {
-    log_debug("R3000", "cycles: %d pc: %08x | %s (%08x) | rs: %s rt: %s rd: %s imm: %x addr: %x | at: %x v0: %x v1: %x a0: %x a1: %x a2: %x a3: %x t0: %x t1: %x t2: %x t3: %x t4: %x t5: %x t6: %x t7: %x sp: %x ra: %x s0: %x s1: %x s2: %x s3: %x s4: %x s5: %x s6: %x s7: %x\n", r3000_state->cycles, r3000_state->pc, opcode ? r3000_primary_opcode_names[opcode] : r3000_secondary_opcode_names[funct], instruction, r3000_register_names[rs], r3000_register_names[rt], r3000_register_names[rd], imm, imm_jump,
+/* First half of an instruction, everything up to the handler */
+static inline void r3000_execute_start(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
+{
+    log_debug(LOG_R3000, "R3000", "cycles: %d pc: %08x | %s (%08x) | rs: %s rt: %s rd: %s imm: %x addr: %x | at: %x v0: %x v1: %x a0: %x a1: %x a2: %x a3: %x t0: %x t1: %x t2: %x t3: %x t4: %x t5: %x t6: %x t7: %x sp: %x ra: %x s0: %x s1: %x s2: %x s3: %x s4: %x s5: %x s6: %x s7: %x\n", r3000_state->cycles, r3000_state->pc, r3000_op_names[instruction->op], instruction->word, r3000_register_names[instruction->rs], r3000_register_names[instruction->rt], r3000_register_names[instruction->rd], instruction->imm, instruction->imm_jump,
         r3000_state->regs[R3000_REG_AT], r3000_state->regs[R3000_REG_V0], r3000_state->regs[R3000_REG_V1], r3000_state->regs[R3000_REG_A0], r3000_state->regs[R3000_REG_A1], r3000_state->regs[R3000_REG_A2], r3000_state->regs[R3000_REG_A3], r3000_state->regs[R3000_REG_T0],
         r3000_state->regs[R3000_REG_T1], r3000_state->regs[R3000_REG_T2], r3000_state->regs[R3000_REG_T3], r3000_state->regs[R3000_REG_T4], r3000_state->regs[R3000_REG_T5], r3000_state->regs[R3000_REG_T6], r3000_state->regs[R3000_REG_T7], r3000_state->regs[R3000_REG_SP],
         r3000_state->regs[R3000_REG_RA], r3000_state->regs[R3000_REG_S0], r3000_state->regs[R3000_REG_S1], r3000_state->regs[R3000_REG_S2], r3000_state->regs[R3000_REG_S3], r3000_state->regs[R3000_REG_S4], r3000_state->regs[R3000_REG_S5], r3000_state->regs[R3000_REG_S6],
         r3000_state->regs[R3000_REG_S7]
     );
+
+    #ifdef R3000_PROFILER
+    if (r3000_state->profiler) {
+        profiler_instruction(r3000_state->profiler, r3000_state, instruction);
     }
     #endif
 
-    //printf("pc: %08X\n", r3000_state->pc);
+    #ifdef R3000_TRACE
+    if (r3000_state->trace) {
+        trace_begin(r3000_state->trace, r3000_state, instruction);
+    }
+    #endif
 
     /* Handle Bios calls */
     if (r3000_state->pc == 0xA0 || r3000_state->pc == 0xB0 || r3000_state->pc == 0xC0) {
-        #ifdef LOG_DEBUG_BIOS
-        log_debug("BIOS", "Table: %X | Function: %X | R4: %x\n", r3000_state->pc, r3000_state->regs[9], r3000_state->regs[4]);
-        #endif
+        log_debug(LOG_BIOS, "BIOS", "Table: %X | Function: %X | R4: %x\n", r3000_state->pc, r3000_state->regs[9], r3000_state->regs[4]);
     
         if (r3000_state->pc == 0xB0 && r3000_state->regs[9] == 0x3D) {
-            char c = (char) r3000_state->regs[4];
-
-            if (c == '\n') {
-                #ifdef LOG_DEBUG_BIOS_TTY
-                log_debug("TTY", "%s\n", tty_buf);
-                #endif
-
-                tty_buf_index = 0;
-                memset(tty_buf, 0x00, 100);
-            } else {
-                tty_buf[tty_buf_index++] = (char) r3000_state->regs[4];
-            }
+            bios_tty_putchar(&r3000_state->tty, (char) r3000_state->regs[4]);
         }
     }
 
@@ -180,73 +277,11 @@ void r3000_step(r3000_state_t *r3000_state, bus_state_t *bus_state)
 
     /* R0 needs to be zero */
     r3000_state->regs[0] = 0;
-    
-    /* SPECIAL */
-    if (!opcode) {
-        switch(funct) {
-            case 0x00: opcode_sll(r3000_state, bus_state, rs, rt, rd, shamt); break;
-            case 0x02: opcode_srl(r3000_state, bus_state, rs, rt, rd, shamt); break;
-            case 0x03: opcode_sra(r3000_state, bus_state, rs, rt, rd, shamt); break;
-            case 0x04: opcode_sllv(r3000_state, bus_state, rs, rt, rd); break;
-            case 0x06: opcode_srlv(r3000_state, bus_state, rs, rt, rd); break;
-            case 0x07: opcode_srav(r3000_state, bus_state, rs, rt, rd); break;
-            case 0x08: opcode_jr(r3000_state, bus_state, rs); break;
-            case 0x09: opcode_jalr(r3000_state, bus_state, rs, rd); break;
-            case 0x0C: opcode_syscall(r3000_state, bus_state); break;
-            case 0x10: opcode_mfhi(r3000_state, bus_state, rd); break;
-            case 0x11: opcode_mthi(r3000_state, bus_state, rs); break;
-            case 0x12: opcode_mflo(r3000_state, bus_state, rd); break;
-            case 0x13: opcode_mtlo(r3000_state, bus_state, rs); break;
-            case 0x18: opcode_mult(r3000_state, bus_state, rs, rt); break;
-            case 0x19: opcode_multu(r3000_state, bus_state, rs, rt); break;
-            case 0x1A: opcode_div(r3000_state, bus_state, rs, rt); break;
-            case 0x1B: opcode_divu(r3000_state, bus_state, rs, rt); break;
-            case 0x20: opcode_add(r3000_state, bus_state, rs, rt, rd); break;
-            case 0x21: opcode_addu(r3000_state, bus_state, rs, rt, rd); break;
-            case 0x22: opcode_sub(r3000_state, bus_state, rs, rt, rd); break;
-            case 0x23: opcode_subu(r3000_state, bus_state, rs, rt, rd); break;
-            case 0x24: opcode_and(r3000_state, bus_state, rs, rt, rd); break;
-            case 0x25: opcode_or(r3000_state, bus_state, rs, rt, rd); break;
-            case 0x26: opcode_xor(r3000_state, bus_state, rs, rt, rd); break;
-            case 0x27: opcode_nor(r3000_state, bus_state, rs, rt, rd); break;
-            case 0x2A: opcode_slt(r3000_state, bus_state, rs, rt, rd); break;
-            case 0x2B: opcode_sltu(r3000_state, bus_state, rs, rt, rd); break;
-            default: exit(0); break;
-        }
-    } else {
-        switch(opcode) {
-            case 0x01: opcode_bcondz(r3000_state, bus_state, instruction, rs, imm); break;
-            case 0x02: opcode_j(r3000_state, bus_state, imm_jump); break;
-            case 0x03: opcode_jal(r3000_state, bus_state, imm_jump); break;
-            case 0x04: opcode_beq(r3000_state, bus_state, rs, rt, imm); break;
-            case 0x05: opcode_bne(r3000_state, bus_state, rs, rt, imm); break;
-            case 0x06: opcode_blez(r3000_state, bus_state, rs, imm); break;
-            case 0x07: opcode_bgtz(r3000_state, bus_state, rs, imm); break;
-            case 0x08: opcode_addi(r3000_state, bus_state, rs, rt, imm); break;
-            case 0x09: opcode_addiu(r3000_state, bus_state, rs, rt, imm); break;
-            case 0x0A: opcode_slti(r3000_state, bus_state, rs, rt, imm); break;
-            case 0x0B: opcode_sltiu(r3000_state, bus_state, rs, rt, imm); break;
-            case 0x0C: opcode_andi(r3000_state, bus_state, rs, rt, imm); break;
-            case 0x0D: opcode_ori(r3000_state, bus_state, rs, rt, imm); break;
-            case 0x0E: opcode_xori(r3000_state, bus_state, rs, rt, imm); break;
-            case 0x0F: opcode_lui(r3000_state, bus_state, rs, rt, imm); break;
-            case 0x10: opcode_cop0(r3000_state, bus_state, rs, rt, rd, imm); break;
-            case 0x20: opcode_lb(r3000_state, bus_state, rs, rt, imm); break;
-            case 0x21: opcode_lh(r3000_state, bus_state, rs, rt, imm); break;
-            case 0x22: opcode_lwl(r3000_state, bus_state, rs, rt, imm); break;
-            case 0x23: opcode_lw(r3000_state, bus_state, rs, rt, imm); break;
-            case 0x24: opcode_lbu(r3000_state, bus_state, rs, rt, imm); break;
-            case 0x26: opcode_lwr(r3000_state, bus_state, rs, rt, imm); break;
-            case 0x25: opcode_lhu(r3000_state, bus_state, rs, rt, imm); break;
-            case 0x28: opcode_sb(r3000_state, bus_state, rs, rt, imm); break;
-            case 0x29: opcode_sh(r3000_state, bus_state, rs, rt, imm); break;
-            case 0x2A: opcode_swl(r3000_state, bus_state, rs, rt, imm); break;
-            case 0x2B: opcode_sw(r3000_state, bus_state, rs, rt, imm); break;
-            case 0x2E: opcode_swr(r3000_state, bus_state, rs, rt, imm); break;
-            default: exit(0); break;
-        }
-    }
+}
 
+/* Second half of an instruction, resolves the delay slots */
+static inline void r3000_execute_finish(r3000_state_t *r3000_state)
+{
     if (r3000_state->load_delay_reg != r3000_state->load_reg) {
         r3000_state->regs[r3000_state->load_reg] = r3000_state->load_value;
     }
@@ -269,4 +304,218 @@ void r3000_step(r3000_state_t *r3000_state, bus_state_t *bus_state)
     r3000_state->regs[0] = 0;
 
     r3000_state->cycles++;
-}
\ No newline at end of file
+
+    #ifdef R3000_TRACE
+    if (r3000_state->trace) {
+        trace_end(r3000_state->trace, r3000_state);
+    }
+    #endif
+}
+
+#define R3000_CASE(id, name) case R3000_OP_##id: opcode_##name(r3000_state, bus_state, instruction); break;
+
+static inline void r3000_dispatch(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
+{
+    switch(instruction->op) {
+        R3000_OPS(R3000_CASE)
+    }
+}
+
+static inline void r3000_execute(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
+{
+    r3000_execute_start(r3000_state, bus_state, instruction);
+    r3000_dispatch(r3000_state, bus_state, instruction);
+    r3000_execute_finish(r3000_state);
+}
+
+static void r3000_fetch_execute(r3000_state_t *r3000_state, bus_state_t *bus_state)
+{
+    r3000_instruction_t instruction;
+
+    r3000_decode(&instruction, bus_read(bus_state, BUS_SIZE_DWORD, r3000_state->pc));
+    r3000_execute(r3000_state, bus_state, &instruction);
+}
+
+void r3000_step(r3000_state_t *r3000_state, bus_state_t *bus_state)
+{
+    r3000_begin(r3000_state, bus_state);
+    r3000_boot(r3000_state, bus_state);
+
+    if (r3000_hle(r3000_state, bus_state)) {
+        return;
+    }
+
+    r3000_fetch_execute(r3000_state, bus_state);
+}
+
+/* Computed gotos are a GCC/Clang extension, "make DISPATCH=switch" builds the portable loop */
+#if defined(__GNUC__) && !defined(R3000_DISPATCH_SWITCH)
+
+/*
+ * Threaded dispatch: every handler gets its own copy of the code that moves on
+ * to the next instruction, including the indirect jump to its handler.
+ */
+#define R3000_LABEL(id, name) &&op_##id,
+
+#define R3000_THREAD(id, name) \
+    op_##id: \
+        opcode_##name(r3000_state, bus_state, instruction); \
+        r3000_execute_finish(r3000_state); \
+        \
+        if (++i == block->length || cache->invalidated || r3000_state->pc != pc + (i << 2) || r3000_state->cycles - start >= cycles) { \
+            return; \
+        } \
+        \
+        r3000_begin(r3000_state, bus_state); \
+        \
+        if (r3000_state->pc != pc + (i << 2)) { \
+            r3000_fetch_execute(r3000_state, bus_state); \
+            return; \
+        } \
+        \
+        instruction = &block->instructions[i]; \
+        r3000_execute_start(r3000_state, bus_state, instruction); \
+        goto *labels[instruction->op];
+
+static void r3000_run_instructions(r3000_state_t *r3000_state, bus_state_t *bus_state, block_cache_t *cache, block_t *block, uint32_t cycles)
+{
+    static void *labels[R3000_OP_COUNT] = {
+        R3000_OPS(R3000_LABEL)
+    };
+
+    uint32_t pc = r3000_state->pc;
+    uint32_t start = r3000_state->cycles;
+    uint32_t i = 0;
+
+    r3000_instruction_t *instruction = &block->instructions[0];
+
+    r3000_execute_start(r3000_state, bus_state, instruction);
+    goto *labels[instruction->op];
+
+    R3000_OPS(R3000_THREAD)
+}
+
+#else
+
+static void r3000_run_instructions(r3000_state_t *r3000_state, bus_state_t *bus_state, block_cache_t *cache, block_t *block, uint32_t cycles)
+{
+    uint32_t pc = r3000_state->pc;
+    uint32_t start = r3000_state->cycles;
+    uint32_t i = 0;
+
+    while (true) {
+        r3000_execute(r3000_state, bus_state, &block->instructions[i++]);
+
+        // Leave on the end of the block, a taken branch, an exception, a write to cached code or the end of the slice
+        if (i == block->length || cache->invalidated || r3000_state->pc != pc + (i << 2) || r3000_state->cycles - start >= cycles) {
+            break;
+        }
+
+        r3000_begin(r3000_state, bus_state);
+
+        // An interrupt moved us to the exception vector
+        if (r3000_state->pc != pc + (i << 2)) {
+            r3000_fetch_execute(r3000_state, bus_state);
+            break;
+        }
+    }
+}
+
+#endif
+
+/*
+ * Runs one iteration of an idle loop. If it came back around without a pending
+ * delay slot or touching the timers, every further iteration would do the same,
+ * so the iterations that fit before the next device event are skipped.
+ */
+static void r3000_run_idle_loop(r3000_state_t *r3000_state, bus_state_t *bus_state, block_cache_t *cache, block_t *block, uint32_t cycles)
+{
+    uint32_t pc = r3000_state->pc;
+    uint32_t start = r3000_state->cycles;
+    uint32_t timer_reads = bus_state->timer_state.reads;
+    bool settled = !r3000_state->load_reg && !r3000_state->branch_delay_slot_state;
+
+    r3000_run_instructions(r3000_state, bus_state, cache, block, cycles);
+
+    if (!settled || r3000_state->pc != pc || cache->invalidated || bus_state->timer_state.reads != timer_reads) {
+        return;
+    }
+
+    uint32_t spent = r3000_state->cycles - start;
+
+    // Whole iterations only, the event is then taken at the same instruction as without skipping
+    uint32_t skip = (spent < cycles) ? (cycles - spent) / spent * spent : 0;
+
+    if (!skip) {
+        return;
+    }
+
+    log_debug(LOG_R3000, "R3000", "Idle loop at %08X, skipping %d cycles\n", pc, skip);
+
+    r3000_state->cycles += skip;
+    r3000_state->idle_cycles += skip;
+}
+
+/* Runs one cached block up to the given cycles, or a single instruction if no block can be built at pc */
+static void r3000_run_block(r3000_state_t *r3000_state, bus_state_t *bus_state, block_cache_t *cache, uint32_t cycles)
+{
+    r3000_begin(r3000_state, bus_state);
+    r3000_boot(r3000_state, bus_state);
+
+    if (r3000_hle(r3000_state, bus_state)) {
+        return;
+    }
+
+    block_t *block = block_cache_lookup(cache, r3000_state, bus_state);
+
+    if (!block) {
+        r3000_fetch_execute(r3000_state, bus_state);
+        return;
+    }
+
+    if (r3000_state->engine == R3000_ENGINE_JIT && cache->jit && jit_execute(cache->jit, r3000_state, bus_state, block, cycles)) {
+        return;
+    }
+
+    if (block->idle_loop) {
+        r3000_run_idle_loop(r3000_state, bus_state, cache, block, cycles);
+        return;
+    }
+
+    r3000_run_instructions(r3000_state, bus_state, cache, block, cycles);
+}
+
+/* One pass of the run loop, the devices catch up if an event is due and one block or instruction runs */
+static inline void r3000_slice(r3000_state_t *r3000_state, bus_state_t *bus_state, uint32_t cycles)
+{
+    block_cache_t *cache = bus_state->block_cache;
+    int32_t until_event = bus_state->next_event - r3000_state->cycles;
+
+    // Runs in slices up to the next scheduler event
+    if (until_event <= 0) {
+        bus_sync(bus_state, r3000_state->cycles);
+        until_event = bus_state->next_event - r3000_state->cycles;
+    }
+
+    if (r3000_state->engine == R3000_ENGINE_INTERPRETER || !cache) {
+        r3000_step(r3000_state, bus_state);
+    } else {
+        r3000_run_block(r3000_state, bus_state, cache, (uint32_t) until_event < cycles ? (uint32_t) until_event : cycles);
+    }
+}
+
+/* Single slice with at most the given cycles left, lets the lockstep mode compare between them */
+void r3000_run_slice(r3000_state_t *r3000_state, bus_state_t *bus_state, uint32_t cycles)
+{
+    r3000_slice(r3000_state, bus_state, cycles);
+}
+
+/* Runs for at least the given number of cycles */
+void r3000_run(r3000_state_t *r3000_state, bus_state_t *bus_state, uint32_t cycles)
+{
+    uint32_t start = r3000_state->cycles;
+
+    while (r3000_state->cycles - start < cycles) {
+        r3000_slice(r3000_state, bus_state, cycles - (r3000_state->cycles - start));
+    }
+}
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "cpu/trace.h"
+#include "log.h"
+
+/* Streams the ring to the file until trace_close, the CPU never touches the file */
+static void *trace_writer(void *data)
+{
+    trace_t *trace = (trace_t *) data;
+
+    while (true) {
+        // Read before head, everything pushed before the stop is still written
+        bool stop = atomic_load(&trace->stop);
+
+        uint32_t tail = atomic_load_explicit(&trace->tail, memory_order_relaxed);
+        uint32_t head = atomic_load_explicit(&trace->head, memory_order_acquire);
+
+        if (head == tail) {
+            if (stop) {
+                break;
+            }
+
+            usleep(1000);
+            continue;
+        }
+
+        uint32_t start = tail & TRACE_RING_MASK;
+        uint32_t count = head - tail;
+
+        // Up to the end of the ring, the rest comes next round
+        if (start + count > TRACE_RING_SIZE) {
+            count = TRACE_RING_SIZE - start;
+        }
+
+        fwrite(&trace->ring[start], sizeof(trace_record_t), count, trace->fp);
+
+        atomic_store_explicit(&trace->tail, tail + count, memory_order_release);
+    }
+
+    return NULL;
+}
+
+bool trace_open(trace_t *trace, const char *path)
+{
+    trace->fp = fopen(path, "wb");
+
+    if (!trace->fp) {
+        log_error("TRACE", "Failed to open %s\n", path);
+        return false;
+    }
+
+    trace_file_header_t header;
+    memcpy(header.magic, TRACE_MAGIC, 8);
+    header.record_size = sizeof(trace_record_t);
+    header.reserved = 0;
+
+    fwrite(&header, sizeof(header), 1, trace->fp);
+
+    trace->ring = (trace_record_t *) malloc(TRACE_RING_SIZE * sizeof(trace_record_t));
+    trace->stalls = 0;
+
+    atomic_init(&trace->head, 0);
+    atomic_init(&trace->tail, 0);
+    atomic_init(&trace->stop, false);
+
+    memset(&trace->record, 0x00, sizeof(trace->record));
+
+    pthread_create(&trace->thread, NULL, trace_writer, trace);
+
+    return true;
+}
+
+static inline void trace_push(trace_t *trace)
+{
+    uint32_t head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+
+    // Waiting for the writer keeps the trace complete, it only costs time while the disk is behind
+    while (head - atomic_load_explicit(&trace->tail, memory_order_acquire) == TRACE_RING_SIZE) {
+        trace->stalls++;
+        sched_yield();
+    }
+
+    trace->ring[head & TRACE_RING_MASK] = trace->record;
+
+    atomic_store_explicit(&trace->head, head + 1, memory_order_release);
+}
+
+/* Called from r3000_execute_start, before the handler */
+void trace_begin(trace_t *trace, r3000_state_t *r3000_state, r3000_instruction_t *instruction)
+{
+    trace_record_t *record = &trace->record;
+
+    record->cycles = r3000_state->cycles;
+    record->pc = r3000_state->pc;
+    record->word = instruction->word;
+    record->flags = 0;
+    record->reg = 0;
+    record->reg_value = 0;
+    record->mem_addr = 0;
+    record->mem_value = 0;
+
+    trace->op = instruction->op;
+    trace->rt = instruction->rt;
+
+    // Changes outside of instructions, like HLE calls, are not blamed on this one
+    memcpy(trace->regs, r3000_state->regs, sizeof(trace->regs));
+
+    uint32_t addr = r3000_state->regs[instruction->rs] + (int16_t) instruction->imm;
+    uint32_t value = r3000_state->regs[instruction->rt];
+
+    switch(instruction->op) {
+        case R3000_OP_LB: case R3000_OP_LH: case R3000_OP_LWL: case R3000_OP_LW:
+        case R3000_OP_LBU: case R3000_OP_LHU: case R3000_OP_LWR: case R3000_OP_LWC2:
+            record->flags = TRACE_MEM_READ;
+            record->mem_addr = addr;
+            break;
+
+        case R3000_OP_SB:
+            record->flags = TRACE_MEM_WRITE;
+            record->mem_addr = addr;
+            record->mem_value = value & 0xFF;
+            break;
+
+        case R3000_OP_SH:
+            record->flags = TRACE_MEM_WRITE;
+            record->mem_addr = addr;
+            record->mem_value = value & 0xFFFF;
+            break;
+
+        case R3000_OP_SWL: case R3000_OP_SW: case R3000_OP_SWR:
+            record->flags = TRACE_MEM_WRITE;
+            record->mem_addr = addr;
+            record->mem_value = value;
+            break;
+
+        case R3000_OP_SWC2:
+            record->flags = TRACE_MEM_WRITE;
+            record->mem_addr = addr;
+            record->mem_value = gte_read_data(&r3000_state->gte_state, instruction->rt);
+            break;
+    }
+}
+
+/* Called from r3000_execute_finish, once the delay slots are resolved */
+void trace_end(trace_t *trace, r3000_state_t *r3000_state)
+{
+    trace_record_t *record = &trace->record;
+
+    if (record->flags & TRACE_MEM_READ) {
+        // The loaded value sits in the delay slot until the next instruction
+        record->mem_value = (trace->op == R3000_OP_LWC2) ? gte_read_data(&r3000_state->gte_state, trace->rt) : r3000_state->load_value;
+    }
+
+    if (memcmp(trace->regs, r3000_state->regs, sizeof(trace->regs))) {
+        for (uint8_t i=1; i < 32; i++) {
+            if (trace->regs[i] == r3000_state->regs[i]) {
+                continue;
+            }
+
+            if (record->flags & TRACE_REG) {
+                record->flags |= TRACE_REG_MULTIPLE;
+                break;
+            }
+
+            record->flags |= TRACE_REG;
+            record->reg = i;
+            record->reg_value = r3000_state->regs[i];
+        }
+    }
+
+    trace_push(trace);
+}
+
+void trace_close(trace_t *trace)
+{
+    atomic_store(&trace->stop, true);
+    pthread_join(trace->thread, NULL);
+
+    fclose(trace->fp);
+    free(trace->ring);
+
+    if (trace->stalls) {
+        log_info("TRACE", "Waited %llu times for the writer\n", (unsigned long long) trace->stalls);
+    }
+}
@@ -0,0 +1,360 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "cpu/x64.h"
+
+void x64_byte(x64_emitter_t *e, uint8_t value)
+{
+    *e->ptr++ = value;
+}
+
+void x64_dword(x64_emitter_t *e, uint32_t value)
+{
+    memcpy(e->ptr, &value, 4);
+    e->ptr += 4;
+}
+
+void x64_qword(x64_emitter_t *e, uint64_t value)
+{
+    memcpy(e->ptr, &value, 8);
+    e->ptr += 8;
+}
+
+/* REX prefix, only emitted when needed. force is set for byte access to sil/dil */
+static void x64_rex(x64_emitter_t *e, bool w, uint8_t reg, uint8_t index, uint8_t base, bool force)
+{
+    uint8_t rex = 0x40 | (w << 3) | (((reg >> 3) & 1) << 2) | (((index >> 3) & 1) << 1) | ((base >> 3) & 1);
+
+    if (rex != 0x40 || force) {
+        x64_byte(e, rex);
+    }
+}
+
+static void x64_modrm_reg(x64_emitter_t *e, uint8_t reg, uint8_t rm)
+{
+    x64_byte(e, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* Always uses a 32 bit displacement, this avoids the rbp/r13 special cases */
+static void x64_modrm_mem(x64_emitter_t *e, uint8_t reg, uint8_t base, int8_t index, int32_t disp)
+{
+    if (index != X64_NO_INDEX) {
+        x64_byte(e, 0x80 | ((reg & 7) << 3) | 0x04);
+        x64_byte(e, ((index & 7) << 3) | (base & 7));
+    } else if ((base & 7) == X64_RSP) {
+        x64_byte(e, 0x80 | ((reg & 7) << 3) | 0x04);
+        x64_byte(e, 0x24);
+    } else {
+        x64_byte(e, 0x80 | ((reg & 7) << 3) | (base & 7));
+    }
+
+    x64_dword(e, disp);
+}
+
+static void x64_op_rr(x64_emitter_t *e, bool w, uint8_t opcode, uint8_t reg, uint8_t rm)
+{
+    x64_rex(e, w, reg, 0, rm, false);
+    x64_byte(e, opcode);
+    x64_modrm_reg(e, reg, rm);
+}
+
+static void x64_op_rm(x64_emitter_t *e, bool w, uint8_t opcode, uint8_t reg, uint8_t base, int8_t index, int32_t disp)
+{
+    x64_rex(e, w, reg, index == X64_NO_INDEX ? 0 : index, base, false);
+    x64_byte(e, opcode);
+    x64_modrm_mem(e, reg, base, index, disp);
+}
+
+void x64_mov_rr(x64_emitter_t *e, uint8_t dst, uint8_t src)
+{
+    x64_op_rr(e, false, 0x89, src, dst);
+}
+
+void x64_mov_rr64(x64_emitter_t *e, uint8_t dst, uint8_t src)
+{
+    x64_op_rr(e, true, 0x89, src, dst);
+}
+
+void x64_mov_ri(x64_emitter_t *e, uint8_t dst, uint32_t imm)
+{
+    x64_rex(e, false, 0, 0, dst, false);
+    x64_byte(e, 0xB8 + (dst & 7));
+    x64_dword(e, imm);
+}
+
+void x64_mov_ri64(x64_emitter_t *e, uint8_t dst, uint64_t imm)
+{
+    x64_rex(e, true, 0, 0, dst, false);
+    x64_byte(e, 0xB8 + (dst & 7));
+    x64_qword(e, imm);
+}
+
+void x64_movsxd(x64_emitter_t *e, uint8_t dst, uint8_t src)
+{
+    x64_op_rr(e, true, 0x63, dst, src);
+}
+
+/* Zero or sign extends the low byte/word of src */
+void x64_movx_rr(x64_emitter_t *e, uint8_t size, bool sign, uint8_t dst, uint8_t src)
+{
+    x64_rex(e, false, dst, 0, src, size == 1 && src >= 4);
+    x64_byte(e, 0x0F);
+
+    if (size == 1) {
+        x64_byte(e, sign ? 0xBE : 0xB6);
+    } else {
+        x64_byte(e, sign ? 0xBF : 0xB7);
+    }
+
+    x64_modrm_reg(e, dst, src);
+}
+
+/* Loads zero or sign extend into the full 32 bit register */
+void x64_load(x64_emitter_t *e, uint8_t size, bool sign, uint8_t dst, uint8_t base, int8_t index, int32_t disp)
+{
+    if (size == 4 || size == 8) {
+        x64_op_rm(e, size == 8, 0x8B, dst, base, index, disp);
+        return;
+    }
+
+    x64_rex(e, false, dst, index == X64_NO_INDEX ? 0 : index, base, false);
+    x64_byte(e, 0x0F);
+
+    if (size == 1) {
+        x64_byte(e, sign ? 0xBE : 0xB6);
+    } else {
+        x64_byte(e, sign ? 0xBF : 0xB7);
+    }
+
+    x64_modrm_mem(e, dst, base, index, disp);
+}
+
+void x64_load64(x64_emitter_t *e, uint8_t dst, uint8_t base, int32_t disp)
+{
+    x64_op_rm(e, true, 0x8B, dst, base, X64_NO_INDEX, disp);
+}
+
+void x64_store(x64_emitter_t *e, uint8_t size, uint8_t src, uint8_t base, int8_t index, int32_t disp)
+{
+    uint8_t rex_index = index == X64_NO_INDEX ? 0 : index;
+
+    if (size == 1) {
+        x64_rex(e, false, src, rex_index, base, src >= 4);
+        x64_byte(e, 0x88);
+    } else if (size == 2) {
+        x64_byte(e, 0x66);
+        x64_rex(e, false, src, rex_index, base, false);
+        x64_byte(e, 0x89);
+    } else {
+        x64_rex(e, size == 8, src, rex_index, base, false);
+        x64_byte(e, 0x89);
+    }
+
+    x64_modrm_mem(e, src, base, index, disp);
+}
+
+void x64_store_imm(x64_emitter_t *e, uint8_t size, uint8_t base, int32_t disp, uint32_t imm)
+{
+    if (size == 1) {
+        x64_rex(e, false, 0, 0, base, false);
+        x64_byte(e, 0xC6);
+        x64_modrm_mem(e, 0, base, X64_NO_INDEX, disp);
+        x64_byte(e, imm);
+    } else {
+        x64_rex(e, false, 0, 0, base, false);
+        x64_byte(e, 0xC7);
+        x64_modrm_mem(e, 0, base, X64_NO_INDEX, disp);
+        x64_dword(e, imm);
+    }
+}
+
+void x64_alu_rr(x64_emitter_t *e, uint8_t op, uint8_t dst, uint8_t src)
+{
+    x64_op_rr(e, false, (op << 3) | 0x01, src, dst);
+}
+
+void x64_alu_ri(x64_emitter_t *e, uint8_t op, uint8_t dst, uint32_t imm)
+{
+    x64_rex(e, false, 0, 0, dst, false);
+
+    if ((int32_t) imm >= -128 && (int32_t) imm <= 127) {
+        x64_byte(e, 0x83);
+        x64_modrm_reg(e, op, dst);
+        x64_byte(e, imm);
+    } else {
+        x64_byte(e, 0x81);
+        x64_modrm_reg(e, op, dst);
+        x64_dword(e, imm);
+    }
+}
+
+void x64_alu_ri64(x64_emitter_t *e, uint8_t op, uint8_t dst, uint32_t imm)
+{
+    x64_rex(e, true, 0, 0, dst, false);
+    x64_byte(e, 0x81);
+    x64_modrm_reg(e, op, dst);
+    x64_dword(e, imm);
+}
+
+void x64_alu_rm(x64_emitter_t *e, uint8_t op, uint8_t dst, uint8_t base, int32_t disp)
+{
+    x64_op_rm(e, false, (op << 3) | 0x03, dst, base, X64_NO_INDEX, disp);
+}
+
+void x64_alu_mi(x64_emitter_t *e, uint8_t op, uint8_t base, int32_t disp, uint32_t imm)
+{
+    x64_rex(e, false, 0, 0, base, false);
+    x64_byte(e, 0x81);
+    x64_modrm_mem(e, op, base, X64_NO_INDEX, disp);
+    x64_dword(e, imm);
+}
+
+void x64_cmp_mi8(x64_emitter_t *e, uint8_t base, int32_t disp, uint8_t imm)
+{
+    x64_rex(e, false, 0, 0, base, false);
+    x64_byte(e, 0x80);
+    x64_modrm_mem(e, X64_CMP, base, X64_NO_INDEX, disp);
+    x64_byte(e, imm);
+}
+
+void x64_test_ri(x64_emitter_t *e, uint8_t reg, uint32_t imm)
+{
+    x64_rex(e, false, 0, 0, reg, false);
+    x64_byte(e, 0xF7);
+    x64_modrm_reg(e, 0, reg);
+    x64_dword(e, imm);
+}
+
+void x64_test_mi(x64_emitter_t *e, uint8_t base, int32_t disp, uint32_t imm)
+{
+    x64_rex(e, false, 0, 0, base, false);
+    x64_byte(e, 0xF7);
+    x64_modrm_mem(e, 0, base, X64_NO_INDEX, disp);
+    x64_dword(e, imm);
+}
+
+void x64_shift_ri(x64_emitter_t *e, uint8_t op, uint8_t dst, uint8_t imm)
+{
+    x64_rex(e, false, 0, 0, dst, false);
+    x64_byte(e, 0xC1);
+    x64_modrm_reg(e, op, dst);
+    x64_byte(e, imm);
+}
+
+void x64_shift_rcl(x64_emitter_t *e, uint8_t op, uint8_t dst)
+{
+    x64_rex(e, false, 0, 0, dst, false);
+    x64_byte(e, 0xD3);
+    x64_modrm_reg(e, op, dst);
+}
+
+void x64_shift_ri64(x64_emitter_t *e, uint8_t op, uint8_t dst, uint8_t imm)
+{
+    x64_rex(e, true, 0, 0, dst, false);
+    x64_byte(e, 0xC1);
+    x64_modrm_reg(e, op, dst);
+    x64_byte(e, imm);
+}
+
+void x64_not(x64_emitter_t *e, uint8_t reg)
+{
+    x64_rex(e, false, 0, 0, reg, false);
+    x64_byte(e, 0xF7);
+    x64_modrm_reg(e, 2, reg);
+}
+
+void x64_imul64(x64_emitter_t *e, uint8_t dst, uint8_t src)
+{
+    x64_rex(e, true, dst, 0, src, false);
+    x64_byte(e, 0x0F);
+    x64_byte(e, 0xAF);
+    x64_modrm_reg(e, dst, src);
+}
+
+/* setcc followed by movzx, dst holds 0 or 1 afterwards */
+void x64_setcc(x64_emitter_t *e, uint8_t cc, uint8_t dst)
+{
+    x64_rex(e, false, 0, 0, dst, dst >= 4);
+    x64_byte(e, 0x0F);
+    x64_byte(e, 0x90 | cc);
+    x64_modrm_reg(e, 0, dst);
+
+    x64_rex(e, false, dst, 0, dst, dst >= 4);
+    x64_byte(e, 0x0F);
+    x64_byte(e, 0xB6);
+    x64_modrm_reg(e, dst, dst);
+}
+
+/* Tests bit number "bit" of the bit string at base, result in CF */
+void x64_bt_m(x64_emitter_t *e, uint8_t base, uint8_t bit)
+{
+    x64_rex(e, false, bit, 0, base, false);
+    x64_byte(e, 0x0F);
+    x64_byte(e, 0xA3);
+    x64_modrm_mem(e, bit, base, X64_NO_INDEX, 0);
+}
+
+/* Jumps return the location of their rel32 so they can be bound later */
+uint8_t *x64_jcc(x64_emitter_t *e, uint8_t cc)
+{
+    x64_byte(e, 0x0F);
+    x64_byte(e, 0x80 | cc);
+    x64_dword(e, 0);
+
+    return e->ptr - 4;
+}
+
+uint8_t *x64_jmp(x64_emitter_t *e)
+{
+    x64_byte(e, 0xE9);
+    x64_dword(e, 0);
+
+    return e->ptr - 4;
+}
+
+void x64_jmp_r(x64_emitter_t *e, uint8_t reg)
+{
+    x64_rex(e, false, 0, 0, reg, false);
+    x64_byte(e, 0xFF);
+    x64_modrm_reg(e, 4, reg);
+}
+
+void x64_call(x64_emitter_t *e, void *function)
+{
+    x64_mov_ri64(e, X64_RAX, (uint64_t) function);
+
+    x64_byte(e, 0xFF);
+    x64_modrm_reg(e, 2, X64_RAX);
+}
+
+void x64_push(x64_emitter_t *e, uint8_t reg)
+{
+    x64_rex(e, false, 0, 0, reg, false);
+    x64_byte(e, 0x50 + (reg & 7));
+}
+
+void x64_pop(x64_emitter_t *e, uint8_t reg)
+{
+    x64_rex(e, false, 0, 0, reg, false);
+    x64_byte(e, 0x58 + (reg & 7));
+}
+
+void x64_ret(x64_emitter_t *e)
+{
+    x64_byte(e, 0xC3);
+}
+
+/* Points the rel32 at site to target */
+void x64_patch(uint8_t *site, uint8_t *target)
+{
+    int32_t rel = (int32_t) (target - (site + 4));
+
+    memcpy(site, &rel, 4);
+}
+
+/* Points the rel32 at site to the current position */
+void x64_bind(x64_emitter_t *e, uint8_t *site)
+{
+    x64_patch(site, e->ptr);
+}
@@ -3,6 +3,7 @@
 #include <string.h>
 
 #include "gpu/gpu.h"
+#include "core/instrument.h"
 #include "log.h"
 
 void gpu_write(gpu_state_t *gpu_state, uint32_t addr, uint32_t value)
@@ -51,6 +52,9 @@ uint32_t gpu_read_gpustat(gpu_state_t *gpu_state)
     // Display enable
     if (gpu_state->display_enable) gpustat |= (1 << 23);
 
+    // Interrupt request
+    if (gpu_state->irq) gpustat |= (1 << 24);
+
     // Ready to receive cmds
     gpustat |= (1 << 26);
 
@@ -86,24 +90,26 @@ uint32_t gpu_read(gpu_state_t *gpu_state, uint32_t addr)
 {
     uint32_t result = 0;
 
+    instrument_begin(INSTRUMENT_GPU);
+
     // GPUSTAT
     if (addr == 0x1F801814) {
         result = gpu_read_gpustat(gpu_state);
 
-        #ifdef LOG_DEBUG_GPU_READ
-        log_debug("GPU", "%08x <- GPUSTAT\n", result);
-        #endif
+        log_debug(LOG_GPU_READ, "GPU", "%08x <- GPUSTAT\n", result);
     }
 
+    instrument_end();
+
     return result;
 }
 
 void gpu_send_gp0_command(gpu_state_t *gpu_state, uint32_t command)
 {
+    instrument_begin(INSTRUMENT_GPU);
+
     if (gpu_state->state == GPU_STATE_WAITING_FOR_CMD){
-        #ifdef LOG_DEBUG_GPU_COMMANDS
-        log_debug("GPU", "GP0 CMD (%08X) | ", command);
-        #endif
+        log_debug(LOG_GPU_COMMANDS, "GPU", "GP0 CMD (%08X) | ", command);
 
         gpu_state->command_buf[0] = command;
 
@@ -112,25 +118,30 @@ void gpu_send_gp0_command(gpu_state_t *gpu_state, uint32_t command)
         switch(type) {
             // NOP
             case 0x00:
-                #ifdef LOG_DEBUG_GPU_COMMANDS
-                printf("NOP");
-                #endif
+                log_continue(LOG_GPU_COMMANDS, "NOP");
 
                 break;
 
             // Clear cache
             case 0x01:
-                #ifdef LOG_DEBUG_GPU_COMMANDS
-                printf("Clear cache");
-                #endif
+                log_continue(LOG_GPU_COMMANDS, "Clear cache");
+
+                break;
+
+            // Interrupt request
+            case 0x1F:
+                log_continue(LOG_GPU_COMMANDS, "Interrupt request");
+
+                if (!gpu_state->irq) {
+                    gpu_state->irq = true;
+                    irq_raise(gpu_state->irq_state, IRQ_GPU);
+                }
 
                 break;
 
             // Monochrome Opaque Quad
             case 0x28:
-                #ifdef LOG_DEBUG_GPU_COMMANDS
-                printf("Monochrome Opaque Quad");
-                #endif
+                log_continue(LOG_GPU_COMMANDS, "Monochrome Opaque Quad");
 
                 gpu_state->command_buf_left = 4;
                 gpu_state->state = GPU_STATE_WAITING_FOR_ARG;
@@ -139,9 +150,7 @@ void gpu_send_gp0_command(gpu_state_t *gpu_state, uint32_t command)
 
             // Textured Blend Quad
             case 0x2C:
-                #ifdef LOG_DEBUG_GPU_COMMANDS
-                printf("Textured Blend Quad");
-                #endif
+                log_continue(LOG_GPU_COMMANDS, "Textured Blend Quad");
 
                 gpu_state->command_buf_left = 8;
                 gpu_state->state = GPU_STATE_WAITING_FOR_ARG;
@@ -150,9 +159,7 @@ void gpu_send_gp0_command(gpu_state_t *gpu_state, uint32_t command)
 
             // Gouraud Triangle
             case 0x30:
-                #ifdef LOG_DEBUG_GPU_COMMANDS
-                printf("Gouraud Triangle");
-                #endif
+                log_continue(LOG_GPU_COMMANDS, "Gouraud Triangle");
 
                 gpu_state->command_buf_left = 5;
                 gpu_state->state = GPU_STATE_WAITING_FOR_ARG;
@@ -161,9 +168,7 @@ void gpu_send_gp0_command(gpu_state_t *gpu_state, uint32_t command)
 
             // Gouraud Quad
             case 0x38:
-                #ifdef LOG_DEBUG_GPU_COMMANDS
-                printf("Gouraud Quad");
-                #endif
+                log_continue(LOG_GPU_COMMANDS, "Gouraud Quad");
 
                 gpu_state->command_buf_left = 7;
                 gpu_state->state = GPU_STATE_WAITING_FOR_ARG;
@@ -172,9 +177,7 @@ void gpu_send_gp0_command(gpu_state_t *gpu_state, uint32_t command)
 
             // CPU->VRAM
             case 0xA0:
-                #ifdef LOG_DEBUG_GPU_COMMANDS
-                printf("CPU->VRAM");
-                #endif
+                log_continue(LOG_GPU_COMMANDS, "CPU->VRAM");
 
                 // These are just the first two arguments we need to determine how much data we wait for
                 gpu_state->command_buf_left = 2;
@@ -184,77 +187,55 @@ void gpu_send_gp0_command(gpu_state_t *gpu_state, uint32_t command)
 
             // VRAM->CPU
             case 0xC0:
-                #ifdef LOG_DEBUG_GPU_COMMANDS
-                printf("VRAM->CPU");
-                #endif
+                log_continue(LOG_GPU_COMMANDS, "VRAM->CPU");
                 
                 break;
 
             // Texpage
             case 0xE1:
-                #ifdef LOG_DEBUG_GPU_COMMANDS
-                printf("Texpage");
-                #endif
+                log_continue(LOG_GPU_COMMANDS, "Texpage");
                 
                 break;
 
             // Texture Window
             case 0xE2:
-                #ifdef LOG_DEBUG_GPU_COMMANDS
-                printf("Texture Window");
-                #endif
+                log_continue(LOG_GPU_COMMANDS, "Texture Window");
                 
                 break;
 
             // Drawing Area top left
             case 0xE3:
-                #ifdef LOG_DEBUG_GPU_COMMANDS
-                printf("Drawing Area top left");
-                #endif
+                log_continue(LOG_GPU_COMMANDS, "Drawing Area top left");
                 
                 break;
 
             // Drawing Area bottom right
             case 0xE4:
-                #ifdef LOG_DEBUG_GPU_COMMANDS
-                printf("Drawing Area bottom right");
-                #endif
+                log_continue(LOG_GPU_COMMANDS, "Drawing Area bottom right");
 
                 break;
 
             // Set Drawing Offset
             case 0xE5:
-                #ifdef LOG_DEBUG_GPU_COMMANDS
-                printf("Render");
-                #endif
-                
-                renderer_render(gpu_state->renderer);
+                log_continue(LOG_GPU_COMMANDS, "Drawing Offset");
 
                 break;
 
             // Masking Bit
             case 0xE6:
-                #ifdef LOG_DEBUG_GPU_COMMANDS
-                printf("Masking bit");
-                #endif
+                log_continue(LOG_GPU_COMMANDS, "Masking bit");
                 
                 break;
 
             default:
-                #ifdef LOG_DEBUG_GPU_COMMANDS
-                printf("Unknown command");
-                #endif
+                log_continue(LOG_GPU_COMMANDS, "Unknown command");
 
                 break;
         }
 
-        #ifdef LOG_DEBUG_GPU_COMMANDS
-        printf("\n");
-        #endif
+        log_continue(LOG_GPU_COMMANDS, "\n");
     } else if (gpu_state->state == GPU_STATE_WAITING_FOR_ARG) {
-        #ifdef LOG_DEBUG_GPU_COMMANDS
-        log_debug("GPU", "GP0 ARG (%08X)\n", command);
-        #endif
+        log_debug(LOG_GPU_COMMANDS, "GPU", "GP0 ARG (%08X)\n", command);
 
         gpu_state->command_buf[++gpu_state->command_buf_index] = command;
 
@@ -268,22 +249,30 @@ void gpu_send_gp0_command(gpu_state_t *gpu_state, uint32_t command)
             switch((gpu_state->command_buf[0] >> 24) & 0xFF) {
                 // Monochrome Opaque Quad
                 case 0x28:
-                    renderer_monochrome_opaque_quad(gpu_state->renderer, gpu_state->command_buf);
+                    if (gpu_state->video) {
+                        gpu_state->video->monochrome_opaque_quad(gpu_state->video->data, gpu_state->command_buf);
+                    }
                     break;
 
                 // Textured Blend Quad
                 case 0x2C:
-                    renderer_textured_blend_quad(gpu_state->renderer, gpu_state->command_buf);
+                    if (gpu_state->video) {
+                        gpu_state->video->textured_blend_quad(gpu_state->video->data, gpu_state->command_buf);
+                    }
                     break;
 
                 // Gouraud Triangle
                 case 0x30:
-                    renderer_gouraud_triangle(gpu_state->renderer, gpu_state->command_buf);
+                    if (gpu_state->video) {
+                        gpu_state->video->gouraud_triangle(gpu_state->video->data, gpu_state->command_buf);
+                    }
                     break;
 
                 // Gouraud Quad
                 case 0x38:
-                    renderer_gouraud_quad(gpu_state->renderer, gpu_state->command_buf);
+                    if (gpu_state->video) {
+                        gpu_state->video->gouraud_quad(gpu_state->video->data, gpu_state->command_buf);
+                    }
                     break;
 
                 // CPU->VRAM
@@ -307,17 +296,17 @@ void gpu_send_gp0_command(gpu_state_t *gpu_state, uint32_t command)
     } else if (gpu_state->state == GPU_STATE_WAITING_FOR_VRAM_DATA) {
         gpu_state->command_buf_left--;
 
-        #ifdef LOG_DEBUG_GPU_COMMANDS
-        log_debug("GPU", "GP0 VRAM_DATA (%08X)\n", command);
-        #endif
+        log_debug(LOG_GPU_COMMANDS, "GPU", "GP0 VRAM_DATA (%08X)\n", command);
 
-        gpu_state->renderer->vram[gpu_state->vram_transfer_loc_x][gpu_state->vram_transfer_loc_y] = command;
+        gpu_state->vram[gpu_state->vram_transfer_loc_x & (GPU_VRAM_WIDTH - 1)][gpu_state->vram_transfer_loc_y & (GPU_VRAM_HEIGHT - 1)] = command;
 
         if (gpu_state->command_buf_left == 0) {
             gpu_state->command_buf_index = 0;
             gpu_state->state = GPU_STATE_WAITING_FOR_CMD;
         }
     }
+
+    instrument_end();
 }
 
 void gpu_gp1_dma_direction(gpu_state_t *gpu_state, uint32_t command)
@@ -326,9 +315,7 @@ void gpu_gp1_dma_direction(gpu_state_t *gpu_state, uint32_t command)
     uint8_t direction = (command & 0x3);
     char *direction_name = directions[direction];
 
-    #ifdef LOG_DEBUG_GPU_COMMANDS
-    printf("DMA Direction | %s\n", direction_name);
-    #endif
+    log_continue(LOG_GPU_COMMANDS, "DMA Direction | %s\n", direction_name);
 
     gpu_state->dma_direction = direction;
 }
@@ -338,9 +325,7 @@ void gpu_gp1_display_area(gpu_state_t *gpu_state, uint32_t command)
     uint16_t x = command & 0x000003FF;
     uint16_t y = (command >> 10) & 0x000001FF;
 
-    #ifdef LOG_DEBUG_GPU_COMMANDS
-    printf("Start of Display area | %d, %d\n", x, y);
-    #endif
+    log_continue(LOG_GPU_COMMANDS, "Start of Display area | %d, %d\n", x, y);
 }
 
 void gpu_gp1_display_mode(gpu_state_t *gpu_state, uint32_t command)
@@ -358,20 +343,25 @@ void gpu_gp1_display_mode(gpu_state_t *gpu_state, uint32_t command)
     gpu_state->pal = (command & (1 << 3));
     gpu_state->depth_24bit = (command & (1 << 4));
 
-    #ifdef LOG_DEBUG_GPU_COMMANDS
-    printf("Display mode | Horizontal Resolution: %d | Vertical Resolution: %d | Video Mode: %s | Color Depth: %s\n", gpu_state->horizontal_resolution, gpu_state->vertical_resolution, gpu_state->pal ? "PAL" : "NTSC", gpu_state->depth_24bit ? "24bit" : "15bit");
-    #endif
+    log_continue(LOG_GPU_COMMANDS, "Display mode | Horizontal Resolution: %d | Vertical Resolution: %d | Video Mode: %s | Color Depth: %s\n", gpu_state->horizontal_resolution, gpu_state->vertical_resolution, gpu_state->pal ? "PAL" : "NTSC", gpu_state->depth_24bit ? "24bit" : "15bit");
 }
 
 void gpu_send_gp1_command(gpu_state_t *gpu_state, uint32_t command)
 {
     uint8_t type = (command >> 24);
 
-    #ifdef LOG_DEBUG_GPU_COMMANDS
-    log_debug("GPU", "GP1 CMD (%08X) | ", command);
-    #endif
+    instrument_begin(INSTRUMENT_GPU);
+
+    log_debug(LOG_GPU_COMMANDS, "GPU", "GP1 CMD (%08X) | ", command);
 
     switch(type) {
+        // Acknowledge interrupt
+        case 0x02:
+            log_continue(LOG_GPU_COMMANDS, "Acknowledge interrupt\n");
+
+            gpu_state->irq = false;
+            break;
+
         // DMA Direction
         case 0x04:
             gpu_gp1_dma_direction(gpu_state, command);
@@ -388,11 +378,87 @@ void gpu_send_gp1_command(gpu_state_t *gpu_state, uint32_t command)
             break;
 
         default:
-            #ifdef LOG_DEBUG_GPU_COMMANDS
-            printf("\n");
-            #endif
+            log_continue(LOG_GPU_COMMANDS, "\n");
 
             break;
     }
+
+    instrument_end();
+}
+
+/* CPU cycles of a number of scanlines, counted in video clocks like the HBlank timer */
+uint64_t gpu_line_cycles(gpu_state_t *gpu_state, uint32_t lines)
+{
+    uint32_t num, den;
+
+    gpu_clock_ratio(gpu_state, &num, &den);
+
+    return (uint64_t) lines * gpu_scanline_clocks(gpu_state) * den / num;
+}
+
+uint32_t gpu_frame_cycles(gpu_state_t *gpu_state)
+{
+    return gpu_line_cycles(gpu_state, gpu_state->pal ? GPU_SCANLINES_PAL : GPU_SCANLINES_NTSC);
 }
 
+uint32_t gpu_vblank_line(gpu_state_t *gpu_state)
+{
+    return gpu_state->pal ? GPU_VBLANK_LINE_PAL : GPU_VBLANK_LINE_NTSC;
+}
+
+/* Video clocks per dot at the current horizontal resolution, the same for both standards */
+uint32_t gpu_dot_clocks(gpu_state_t *gpu_state)
+{
+    switch(gpu_state->horizontal_resolution) {
+        case 320:
+            return 8;
+
+        case 368:
+            return 7;
+
+        case 512:
+            return 5;
+
+        case 640:
+            return 4;
+
+        default:
+            return 10;
+    }
+}
+
+/* Video clocks per CPU cycle as num / den, NTSC runs slightly faster than PAL */
+void gpu_clock_ratio(gpu_state_t *gpu_state, uint32_t *num, uint32_t *den)
+{
+    *num = (gpu_state->pal ? GPU_VIDEO_CLOCK_PAL : GPU_VIDEO_CLOCK_NTSC) / GPU_CLOCK_FACTOR;
+    *den = GPU_CPU_CLOCK / GPU_CLOCK_FACTOR;
+}
+
+uint32_t gpu_scanline_clocks(gpu_state_t *gpu_state)
+{
+    return gpu_state->pal ? GPU_SCANLINE_CLOCKS_PAL : GPU_SCANLINE_CLOCKS_NTSC;
+}
+
+/*
+ * Scheduler event at the start of VBlank, the next one counts from when this
+ * one was due. The frame drawn since the last one is presented here. HBlank
+ * has no event of its own, one every scanline would split the CPU slices all
+ * the time and the HBlank timer derives it from the same scanline length.
+ */
+void gpu_vblank(void *data, uint64_t cycles)
+{
+    gpu_state_t *gpu_state = (gpu_state_t *) data;
+
+    instrument_begin(INSTRUMENT_GPU);
+
+    gpu_state->frames++;
+    irq_raise(gpu_state->irq_state, IRQ_VBLANK);
+
+    if (gpu_state->video) {
+        gpu_state->video->render(gpu_state->video->data);
+    }
+
+    scheduler_schedule(gpu_state->scheduler, SCHEDULER_EVENT_VBLANK, cycles + gpu_frame_cycles(gpu_state));
+
+    instrument_end();
+}
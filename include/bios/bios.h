@@ -1,6 +1,14 @@
 #ifndef _bios_h
 #define _bios_h
 
+#include <stdint.h>
+
+typedef struct bios_tty_t {
+    char buf[100];
+    uint8_t index;
+} bios_tty_t;
+
 void bios_print_header(uint8_t *bios);
+void bios_tty_putchar(bios_tty_t *tty, char c);
 
 #endif
\ No newline at end of file
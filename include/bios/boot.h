@@ -0,0 +1,53 @@
+#ifndef _boot_h
+#define _boot_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu/r3000.h"
+#include "bus/bus.h"
+
+// The BIOS jumps here once the kernel is set up, the shell would show the logo and start the disc
+#define BOOT_SHELL_PC       0x80030000
+
+#define BOOT_EXE_HEADER_SIZE    0x800
+
+#define BOOT_CACHE_MAGIC    "MDPSXKRN"
+#define BOOT_CACHE_VERSION  1
+
+typedef struct boot_exe_header_t {
+    char id[8];
+    uint32_t text;
+    uint32_t data;
+
+    uint32_t pc;
+    uint32_t gp;
+
+    uint32_t t_addr;
+    uint32_t t_size;
+    uint32_t d_addr;
+    uint32_t d_size;
+    uint32_t b_addr;
+    uint32_t b_size;
+    uint32_t s_addr;
+    uint32_t s_size;
+} boot_exe_header_t;
+
+typedef struct boot_t {
+    // PS-X EXE started instead of the shell, NULL to run the shell
+    uint8_t *exe;
+    uint32_t exe_size;
+
+    // Kernel state at the shell handoff, written by the first boot and restored by the next ones
+    const char *cache_path;
+    bool restored;
+} boot_t;
+
+void boot_init(boot_t *boot, const char *cache_path);
+void boot_destroy(boot_t *boot);
+uint32_t boot_bios_checksum(bus_state_t *bus_state);
+bool boot_load_exe(boot_t *boot, const char *path);
+bool boot_restore(boot_t *boot, r3000_state_t *r3000_state, bus_state_t *bus_state);
+void boot_shell(boot_t *boot, r3000_state_t *r3000_state, bus_state_t *bus_state);
+
+#endif
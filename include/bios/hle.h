@@ -0,0 +1,51 @@
+#ifndef _bios_hle_h
+#define _bios_hle_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu/r3000.h"
+#include "bus/bus.h"
+
+// Rough cost of a call that was handled natively
+#define BIOS_HLE_CYCLES     20
+
+// Kernel tables the event and thread functions work on, see bios_hle_events
+#define BIOS_HLE_TCB_TABLE  0x110
+#define BIOS_HLE_EVCB_TABLE 0x120
+
+#define BIOS_HLE_EVCB_SIZE  0x1C
+#define BIOS_HLE_TCB_SIZE   0xC0
+
+#define BIOS_EVENT_STATUS_FREE      0x0000
+#define BIOS_EVENT_STATUS_DISABLED  0x1000
+#define BIOS_EVENT_STATUS_ENABLED   0x2000
+#define BIOS_EVENT_STATUS_READY     0x4000
+
+#define BIOS_EVENT_MODE_CALLBACK    0x1000
+#define BIOS_EVENT_MODE_READY       0x2000
+
+#define BIOS_THREAD_STATUS_FREE     0x1000
+#define BIOS_THREAD_STATUS_USED     0x4000
+
+#define BIOS_FILE_MODE_READ     (1 << 0)
+#define BIOS_FILE_MODE_WRITE    (1 << 1)
+#define BIOS_FILE_MODE_CREATE   (1 << 9)
+
+// Handles are kept apart from the ones the BIOS hands out for its own devices
+#define BIOS_HLE_FILE_BASE  0x10
+#define BIOS_HLE_FILES      16
+
+typedef struct bios_hle_t {
+    // "cdrom:" paths are looked up in here, file calls go to the BIOS if NULL
+    const char *dir;
+
+    FILE *files[BIOS_HLE_FILES];
+} bios_hle_t;
+
+void bios_hle_init(bios_hle_t *hle, const char *dir);
+void bios_hle_destroy(bios_hle_t *hle);
+bool bios_hle_call(bios_hle_t *hle, r3000_state_t *r3000_state, bus_state_t *bus_state);
+
+#endif
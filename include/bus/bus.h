@@ -6,28 +6,69 @@
 
 #include "gpu/gpu.h"
 #include "bus/dma.h"
+#include "bus/irq.h"
+#include "bus/scheduler.h"
 #include "timer/timer.h"
 
 #define BUS_SIZE_BYTE   0
 #define BUS_SIZE_WORD   1
 #define BUS_SIZE_DWORD  2
 
+// The page tables cover the 512 MiB physical space in 4 KiB pages
+#define BUS_PHYSICAL_SIZE   0x20000000
+#define BUS_PAGE_SHIFT      12
+#define BUS_PAGE_SIZE       (1 << BUS_PAGE_SHIFT)
+#define BUS_PAGE_MASK       (BUS_PAGE_SIZE - 1)
+#define BUS_PAGE_COUNT      (BUS_PHYSICAL_SIZE >> BUS_PAGE_SHIFT)
+
+#define BUS_RAM_SIZE        0x200000
+#define BUS_RAM_MIRROR_SIZE 0x800000
+#define BUS_SCRATCHPAD_BASE 0x1F800000
+#define BUS_BIOS_BASE       0x1FC00000
+#define BUS_BIOS_SIZE       0x80000
+
+// Longest the CPU runs without calling bus_sync
+#define BUS_SYNC_MAX_CYCLES 0x1000000
+
+// Host window covering every 32 bit physical address, only memory is mapped into it
+#define BUS_FASTMEM_SIZE    (1ULL << 32)
+
+extern const uint32_t bus_segment_map[];
+
+typedef struct block_cache_t block_cache_t;
+
 typedef struct bus_state_t {
     uint8_t *ram;
     uint8_t *scratchpad;
     uint8_t *bios;
 
-    uint32_t i_stat;
-    uint32_t i_mask;
+    // Host pointer for every physical page, NULL pages go to the IO handlers
+    uint8_t **read_pages;
+    uint8_t **write_pages;
+
+    // Fastmem window, NULL if it could not be set up, see bus_init
+    uint8_t *fastmem;
 
+    scheduler_t scheduler;
+    irq_state_t irq_state;
     gpu_state_t gpu_state;
     dma_state_t dma_state;
     timer_state_t timer_state;
 
-    bool debug_enabled;
+    block_cache_t *block_cache;
+    uint32_t *cycles;
+
+    // CPU cycle the next scheduler event is due at, see bus_sync
+    uint32_t next_event;
 } bus_state_t;
 
+void bus_init(bus_state_t *state, bool fastmem);
+void bus_destroy(bus_state_t *state);
 uint32_t bus_read(bus_state_t *state, uint8_t size, uint32_t addr);
 void bus_write(bus_state_t *state, uint8_t size, uint32_t addr, uint32_t value);
+void bus_write_isolated(bus_state_t *state);
+void bus_sync(bus_state_t *state, uint32_t cycles);
+
+uint32_t dma_transfer_linked_list(dma_state_t *state, dma_channel_state_t *channel_state, bus_state_t *bus_state);
 
 #endif
\ No newline at end of file
@@ -25,6 +25,9 @@ typedef struct dma_channel_state_t {
     uint32_t madr;
     uint32_t bcr;
     uint32_t chcr;
+
+    // Absolute cycle a running transfer finishes at, see dma_event
+    uint64_t end;
 } dma_channel_state_t;
 
 typedef struct dma_state_t {
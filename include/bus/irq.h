@@ -0,0 +1,48 @@
+#ifndef _irq_h
+#define _irq_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define IRQ_VBLANK      0
+#define IRQ_GPU         1
+#define IRQ_CDROM       2
+#define IRQ_DMA         3
+#define IRQ_TIMER0      4
+#define IRQ_TIMER1      5
+#define IRQ_TIMER2      6
+#define IRQ_CONTROLLER  7
+#define IRQ_SIO         8
+#define IRQ_SPU         9
+#define IRQ_LIGHTPEN    10
+
+#define IRQ_MASK        0x7FF
+
+// CAUSE.IP bit the controller drives, the two below it are the software interrupts
+#define IRQ_CAUSE_HARDWARE  (1 << 10)
+#define IRQ_CAUSE_SOFTWARE  (3 << 8)
+
+typedef struct irq_state_t {
+    uint32_t i_stat;
+    uint32_t i_mask;
+
+    // SR.IM if SR.IEc is set, and the software bits of CAUSE, see irq_set_cpu
+    uint32_t cpu_mask;
+    uint32_t cpu_software;
+
+    // An interrupt is requested and the CPU would take it, the only thing checked per instruction
+    bool pending;
+} irq_state_t;
+
+void irq_raise(irq_state_t *state, uint8_t irq);
+void irq_set_cpu(irq_state_t *state, uint32_t sr, uint32_t cause);
+uint32_t irq_read(irq_state_t *state, uint32_t addr);
+void irq_write(irq_state_t *state, uint32_t addr, uint32_t value);
+
+/* CAUSE.IP as the CPU sees it */
+static inline uint32_t irq_cause(irq_state_t *state)
+{
+    return state->cpu_software | ((state->i_stat & state->i_mask) ? IRQ_CAUSE_HARDWARE : 0);
+}
+
+#endif
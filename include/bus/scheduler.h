@@ -0,0 +1,53 @@
+#ifndef _scheduler_h
+#define _scheduler_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SCHEDULER_EVENT_VBLANK  0
+#define SCHEDULER_EVENT_TIMER   1
+#define SCHEDULER_EVENT_DMA     2
+
+#define SCHEDULER_EVENT_COUNT   3
+
+// Due cycle of an event that is not scheduled
+#define SCHEDULER_NEVER         UINT64_MAX
+
+// Called with the cycle the event was due at, which can be a bit in the past
+typedef void (*scheduler_callback_t)(void *data, uint64_t cycles);
+
+typedef struct scheduler_event_t {
+    uint64_t cycles;
+
+    scheduler_callback_t callback;
+    void *data;
+
+    // Position in the heap, -1 while not scheduled
+    int8_t slot;
+} scheduler_event_t;
+
+typedef struct scheduler_t {
+    // Absolute cycle the events were last run at, the CPU counter is its lower half
+    uint64_t cycles;
+
+    scheduler_event_t events[SCHEDULER_EVENT_COUNT];
+
+    // Min-heap of event ids by due cycle, ties go to the lower id
+    uint8_t heap[SCHEDULER_EVENT_COUNT];
+    uint8_t count;
+} scheduler_t;
+
+void scheduler_init(scheduler_t *scheduler);
+void scheduler_register(scheduler_t *scheduler, uint8_t id, scheduler_callback_t callback, void *data);
+void scheduler_schedule(scheduler_t *scheduler, uint8_t id, uint64_t cycles);
+void scheduler_cancel(scheduler_t *scheduler, uint8_t id);
+uint64_t scheduler_next(scheduler_t *scheduler);
+void scheduler_run(scheduler_t *scheduler, uint32_t cycles);
+
+/* Absolute cycle of a CPU counter value close to the last run */
+static inline uint64_t scheduler_cycles(scheduler_t *scheduler, uint32_t cycles)
+{
+    return scheduler->cycles + (int32_t) (cycles - (uint32_t) scheduler->cycles);
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef _forkserver_h
+#define _forkserver_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "core/mdpsx.h"
+
+// Ran the whole budget
+#define FORKSERVER_RESULT_BUDGET    0
+// Got to the stop PC
+#define FORKSERVER_RESULT_STOP      1
+// Died before it could report
+#define FORKSERVER_RESULT_CRASH     2
+
+extern const char *forkserver_result_names[];
+
+/* Written by a child in one piece, well below PIPE_BUF */
+typedef struct forkserver_result_t {
+    uint32_t test;
+    uint32_t result;
+
+    uint32_t pc;
+    uint32_t cycles;
+
+    uint64_t ram_hash;
+    uint64_t vram_hash;
+} forkserver_result_t;
+
+// Runs in the child before the budget, puts the test case into the guest
+typedef void (*forkserver_setup_t)(mdpsx_t *mdpsx, uint32_t test, void *data);
+
+/*
+ * Runs every test case in a child forked from a booted instance, so RAM, VRAM
+ * and the compiled blocks are shared copy-on-write instead of booting again.
+ * The fastmem window is a shared mapping and would be written by every child,
+ * instances for the fork server have to use the page tables.
+ */
+typedef struct forkserver_t {
+    mdpsx_t *mdpsx;
+
+    // Children running at the same time
+    uint32_t jobs;
+
+    // Budget of a child, frames if set and cycles otherwise
+    uint32_t cycles;
+    uint32_t frames;
+
+    // Ends a child early once it gets there, 0 for none
+    uint32_t stop_pc;
+
+    forkserver_setup_t setup;
+    void *data;
+
+    int pipe[2];
+} forkserver_t;
+
+bool forkserver_run_to_pc(mdpsx_t *mdpsx, uint32_t pc, uint32_t cycles);
+bool forkserver_init(forkserver_t *forkserver, mdpsx_t *mdpsx, uint32_t jobs);
+void forkserver_destroy(forkserver_t *forkserver);
+bool forkserver_run(forkserver_t *forkserver, uint32_t tests, forkserver_result_t *results);
+
+#endif
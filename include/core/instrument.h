@@ -0,0 +1,39 @@
+#ifndef _instrument_h
+#define _instrument_h
+
+#include <stdint.h>
+
+/*
+ * Host time per subsystem, only in builds with MDPSX_INSTRUMENT (make INSTRUMENT=1).
+ * Time is charged to the innermost section, so a DMA started by an IO write
+ * counts as DMA and not as bus IO. Sections are per thread like the instances.
+ */
+#define INSTRUMENT_SECTIONS(X) \
+    X(CPU, "cpu") X(COMPILE, "compile") X(BUS_IO, "bus_io") X(GPU, "gpu") \
+    X(DMA, "dma") X(TIMER, "timer") X(HLE, "hle")
+
+#define INSTRUMENT_SECTION_ID(id, name) INSTRUMENT_##id,
+
+enum {
+    INSTRUMENT_SECTIONS(INSTRUMENT_SECTION_ID)
+    INSTRUMENT_COUNT,
+
+    // Outside of mdpsx_run_cycles, not reported
+    INSTRUMENT_NONE = INSTRUMENT_COUNT
+};
+
+extern const char *instrument_section_names[INSTRUMENT_COUNT];
+
+#ifdef MDPSX_INSTRUMENT
+#define instrument_begin(section)   uint8_t instrument_previous = instrument_switch(section)
+#define instrument_end()            instrument_switch(instrument_previous)
+#else
+#define instrument_begin(section)
+#define instrument_end()
+#endif
+
+uint8_t instrument_switch(uint8_t section);
+void instrument_reset(void);
+uint64_t instrument_nanoseconds(uint8_t section);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef _lockstep_h
+#define _lockstep_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "core/mdpsx.h"
+
+// Differing RAM words and slice instructions the report lists at most
+#define LOCKSTEP_REPORT_WORDS           16
+#define LOCKSTEP_REPORT_INSTRUCTIONS    32
+
+/*
+ * Runs the candidate engine next to the interpreter. The candidate runs one
+ * slice, a block or a chain of compiled blocks, and the reference runs on its
+ * own up to the same cycle, syncing its devices at its own events and stepping
+ * through idle loops. Every interval slices the two are compared, on a difference both
+ * go back to the last matching checkpoint and the slice it went wrong in is
+ * bisected and replayed instruction by instruction for the report.
+ */
+typedef struct lockstep_t {
+    mdpsx_t *reference;
+    mdpsx_t *candidate;
+
+    uint32_t interval;
+
+    // Both sides at the last comparison that matched
+    mdpsx_snapshot_t *reference_checkpoint;
+    mdpsx_snapshot_t *candidate_checkpoint;
+    uint64_t checkpoint_slice;
+
+    // Cycle budget of every slice since the checkpoint, replays have to get the same
+    uint32_t *budgets;
+
+    uint64_t slices;
+    uint64_t comparisons;
+    bool diverged;
+
+    // Divergence report
+    FILE *report;
+} lockstep_t;
+
+bool lockstep_init(lockstep_t *lockstep, const mdpsx_config_t *config, uint32_t interval, FILE *report);
+void lockstep_destroy(lockstep_t *lockstep);
+void lockstep_checkpoint(lockstep_t *lockstep);
+bool lockstep_run(lockstep_t *lockstep, uint32_t cycles);
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef _mdpsx_h
+#define _mdpsx_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cpu/r3000.h"
+#include "cpu/block_cache.h"
+#include "cpu/jit.h"
+#include "cpu/profiler.h"
+#include "cpu/trace.h"
+#include "bus/bus.h"
+#include "bios/hle.h"
+#include "bios/boot.h"
+
+/* Everything mdpsx_create needs, fields left at zero take the defaults */
+typedef struct mdpsx_config_t {
+    // BUS_BIOS_SIZE bytes of ROM, copied into the instance
+    const uint8_t *bios;
+
+    uint8_t engine;
+
+    // Off by default, the JIT then uses the page tables, see bus_map_fastmem
+    bool fastmem;
+
+    // Kernel calls handled natively, see bios_hle_call
+    bool hle;
+    const char *hle_dir;
+
+    // Fast boot, see boot_restore
+    const char *exe_path;
+    const char *boot_cache;
+
+    // Only available in builds with R3000_PROFILER and R3000_TRACE
+    bool profile;
+    const char *trace_path;
+} mdpsx_config_t;
+
+/*
+ * One emulated console. Instances share nothing, so each can run on its own
+ * thread as long as only one thread uses it at a time.
+ */
+typedef struct mdpsx_t {
+    r3000_state_t r3000_state;
+    bus_state_t bus_state;
+    block_cache_t block_cache;
+    jit_t jit;
+
+    bios_hle_t bios_hle;
+    boot_t boot;
+    profiler_t profiler;
+    trace_t trace;
+
+    gpu_video_sink_t video;
+
+    // Hidden frames take the sink out of the GPU, see mdpsx_set_hidden
+    bool has_video;
+    bool hidden;
+} mdpsx_t;
+
+/*
+ * In-memory copy of the emulated state. It can only be restored into the
+ * instance it was saved from, the pointers in the copied structs point into it.
+ */
+typedef struct mdpsx_snapshot_t {
+    r3000_state_t r3000_state;
+    bus_state_t bus_state;
+
+    uint8_t *ram;
+    uint8_t *scratchpad;
+} mdpsx_snapshot_t;
+
+mdpsx_t *mdpsx_create(const mdpsx_config_t *config);
+void mdpsx_set_video(mdpsx_t *mdpsx, const gpu_video_sink_t *video);
+void mdpsx_set_hidden(mdpsx_t *mdpsx, bool hidden);
+void mdpsx_run_frame(mdpsx_t *mdpsx);
+void mdpsx_run_frame_ahead(mdpsx_t *mdpsx, mdpsx_snapshot_t *snapshot, uint32_t frames);
+void mdpsx_run_cycles(mdpsx_t *mdpsx, uint32_t cycles);
+void mdpsx_destroy(mdpsx_t *mdpsx);
+uint64_t mdpsx_hash(const uint8_t *data, size_t size);
+
+mdpsx_snapshot_t *mdpsx_snapshot_create(void);
+void mdpsx_snapshot_save(mdpsx_t *mdpsx, mdpsx_snapshot_t *snapshot);
+void mdpsx_snapshot_restore(mdpsx_t *mdpsx, const mdpsx_snapshot_t *snapshot);
+void mdpsx_snapshot_destroy(mdpsx_snapshot_t *snapshot);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef _pacer_h
+#define _pacer_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Sleeps wake up late by up to about this much, the rest of the wait is spun
+#define PACER_SPIN_NS       1500000
+
+// Further behind than this many frames and the lost time is given up
+#define PACER_RESYNC_FRAMES 4
+
+/*
+ * Keeps the front end at the speed of the emulated video timing, a frame of
+ * cycles takes as long as it would on the console. In turbo it runs as fast as
+ * it can and only every turbo-th frame is shown.
+ *
+ * With a frame skip the frames after one that was done late are emulated but
+ * not drawn or presented, up to max_skip in a row, until it has caught up.
+ */
+typedef struct pacer_t {
+    // Present every this many frames unthrottled, 0 for real time
+    uint32_t turbo;
+    uint32_t frames;
+
+    // Frames skipped in a row at most while behind, 0 never skips
+    uint32_t max_skip;
+    uint32_t skipped;
+    bool behind;
+
+    // When the next frame is due, CLOCK_MONOTONIC nanoseconds, 0 before the first
+    uint64_t deadline;
+
+    // Frames that were done after they were due, skipped and resyncs
+    uint64_t late;
+    uint64_t skips;
+    uint64_t resyncs;
+} pacer_t;
+
+void pacer_init(pacer_t *pacer, uint32_t turbo, uint32_t max_skip);
+void pacer_reset(pacer_t *pacer);
+bool pacer_present(pacer_t *pacer);
+void pacer_wait(pacer_t *pacer, uint32_t cycles);
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef _rewind_h
+#define _rewind_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "core/mdpsx.h"
+
+// CPU and bus structs, RAM and scratchpad, the VRAM is part of the bus struct
+#define REWIND_REGION_COUNT 4
+
+// Most entries the ring holds, the byte limit usually kicks in first
+#define REWIND_MAX_ENTRIES  4096
+
+typedef struct rewind_entry_t {
+    // Run length coded regions, the keyframe of a group as it is and the rest XORed against it
+    uint32_t *data;
+    uint32_t words[REWIND_REGION_COUNT];
+    uint32_t size;
+
+    bool keyframe;
+    uint64_t group;
+} rewind_entry_t;
+
+/*
+ * Ring of past states for rewinding. The emulator thread only takes a snapshot
+ * every interval frames, the helper thread codes it against the last keyframe
+ * and evicts the oldest groups of entries to stay under the byte limit.
+ */
+typedef struct rewind_t {
+    uint32_t interval;
+    uint32_t keyframe_interval;
+    size_t limit;
+
+    rewind_entry_t *entries;
+    uint32_t first;
+    uint32_t count;
+    size_t size;
+
+    // Handed to the helper thread, the emulator thread skips a capture while it is busy
+    mdpsx_snapshot_t *capture;
+    bool pending;
+
+    // Decoded keyframe of the group the deltas are coded against or were last restored from
+    mdpsx_snapshot_t *keyframe;
+    uint64_t keyframe_group;
+    uint64_t group;
+    uint32_t group_entries;
+    size_t group_size;
+    bool need_keyframe;
+
+    mdpsx_snapshot_t *restore;
+    uint32_t *buffer;
+
+    uint32_t frames;
+    uint64_t captures;
+    uint64_t dropped;
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool quit;
+} rewind_t;
+
+bool rewind_init(rewind_t *rewind, uint32_t interval, uint32_t keyframe_interval, size_t limit);
+void rewind_destroy(rewind_t *rewind);
+void rewind_frame(rewind_t *rewind, mdpsx_t *mdpsx);
+bool rewind_back(rewind_t *rewind, mdpsx_t *mdpsx);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef _rle_h
+#define _rle_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Header words, bit 31 marks a run of zero words, the rest is the length in words
+#define RLE_ZERO_RUN    (1U << 31)
+#define RLE_LENGTH_MASK (RLE_ZERO_RUN - 1)
+
+// Longest output for the given number of input words
+#define RLE_MAX_WORDS(words)    ((words) + 1)
+
+size_t rle_encode(const uint32_t *src, size_t words, uint32_t *dst);
+size_t rle_encode_delta(const uint32_t *src, const uint32_t *base, size_t words, uint32_t *dst);
+bool rle_decode(const uint32_t *src, size_t src_words, uint32_t *dst, size_t words);
+bool rle_decode_delta(const uint32_t *src, size_t src_words, uint32_t *dst, size_t words);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef _savestate_h
+#define _savestate_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "core/mdpsx.h"
+
+#define SAVESTATE_MAGIC     "MDPSXSST"
+#define SAVESTATE_VERSION   1
+
+// Section data is run length coded, see rle_encode
+#define SAVESTATE_SECTION_RLE   (1 << 0)
+
+typedef struct savestate_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t bios_checksum;
+    uint32_t sections;
+} savestate_header_t;
+
+/* Followed by stored bytes of data, padded to a multiple of four */
+typedef struct savestate_section_header_t {
+    char id[4];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t size;
+    uint32_t stored;
+} savestate_section_header_t;
+
+/*
+ * Writer for save states. savestate_save only copies the state, the file is
+ * encoded and written on a thread of its own while the emulator keeps going.
+ */
+typedef struct savestate_t {
+    mdpsx_snapshot_t *snapshot;
+    bool boot_pending;
+
+    char *path;
+    bool compress;
+
+    pthread_t thread;
+    bool busy;
+    bool result;
+} savestate_t;
+
+void savestate_init(savestate_t *savestate);
+void savestate_destroy(savestate_t *savestate);
+bool savestate_save(savestate_t *savestate, mdpsx_t *mdpsx, const char *path, bool compress);
+bool savestate_wait(savestate_t *savestate);
+bool savestate_load(mdpsx_t *mdpsx, const char *path);
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef _block_cache_h
+#define _block_cache_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu/r3000.h"
+#include "bus/bus.h"
+
+#define BLOCK_CACHE_MAX_INSTRUCTIONS    64
+
+// Longest loop body that is considered for idle loop detection
+#define BLOCK_CACHE_IDLE_MAX_INSTRUCTIONS   16
+
+#define BLOCK_CACHE_RAM_SIZE            0x200000
+#define BLOCK_CACHE_BIOS_BASE           0x1FC00000
+#define BLOCK_CACHE_BIOS_SIZE           0x80000
+
+typedef struct jit_t jit_t;
+typedef struct jit_link_t jit_link_t;
+
+typedef struct block_t {
+    uint32_t phy_addr;
+    uint32_t length;
+
+    struct block_t *next_free;
+
+    // Native code from the JIT, only valid when entered at jit_pc
+    uint8_t *code;
+    uint32_t jit_pc;
+    uint32_t jit_length;
+    bool jit_failed;
+
+    // Jumps from other blocks straight into this one
+    jit_link_t *links;
+
+    // Branches back to its own start and only reads state, see block_cache_is_idle_loop
+    bool idle_loop;
+
+    r3000_instruction_t instructions[];
+} block_t;
+
+typedef struct block_cache_t {
+    // One slot per word, indexed by physical address
+    block_t **ram_blocks;
+    block_t **bios_blocks;
+
+    // One bit per RAM word that is part of a cached block
+    uint8_t *ram_code;
+
+    // Invalidated blocks might still be running, they are freed on the next lookup
+    block_t *free_list;
+
+    bool invalidated;
+    bool flush_pending;
+
+    jit_t *jit;
+} block_cache_t;
+
+void block_cache_init(block_cache_t *cache);
+void block_cache_destroy(block_cache_t *cache);
+void block_cache_flush(block_cache_t *cache);
+block_t *block_cache_lookup(block_cache_t *cache, r3000_state_t *r3000_state, bus_state_t *bus_state);
+void block_cache_invalidate(block_cache_t *cache, uint32_t phy_addr);
+void block_cache_isolated_write(block_cache_t *cache);
+bool block_cache_is_branch(r3000_instruction_t *instruction);
+bool block_cache_ends_block(r3000_instruction_t *instruction);
+
+/* Called for every RAM write, only does work if the word holds cached code */
+static inline void block_cache_write(block_cache_t *cache, uint32_t phy_addr)
+{
+    uint32_t word = (phy_addr & (BLOCK_CACHE_RAM_SIZE - 1)) >> 2;
+
+    if (cache->ram_code[word >> 3] & (1 << (word & 7))) {
+        block_cache_invalidate(cache, phy_addr);
+    }
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef _gte_h
+#define _gte_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define GTE_FLAG_ERROR              (1 << 31)
+#define GTE_FLAG_MAC1_POSITIVE      (1 << 30)
+#define GTE_FLAG_MAC1_NEGATIVE      (1 << 27)
+#define GTE_FLAG_IR1_SATURATED      (1 << 24)
+#define GTE_FLAG_R_SATURATED        (1 << 21)
+#define GTE_FLAG_SZ3_OTZ_SATURATED  (1 << 18)
+#define GTE_FLAG_DIVIDE_OVERFLOW    (1 << 17)
+#define GTE_FLAG_MAC0_POSITIVE      (1 << 16)
+#define GTE_FLAG_MAC0_NEGATIVE      (1 << 15)
+#define GTE_FLAG_SX2_SATURATED      (1 << 14)
+#define GTE_FLAG_SY2_SATURATED      (1 << 13)
+#define GTE_FLAG_IR0_SATURATED      (1 << 12)
+
+// Bits that also set the error bit
+#define GTE_FLAG_ERROR_MASK         0x7F87E000
+
+#define GTE_MATRIX_ROTATION     0
+#define GTE_MATRIX_LIGHT        1
+#define GTE_MATRIX_COLOR        2
+
+#define GTE_VECTOR_TRANSLATION  0
+#define GTE_VECTOR_BACKGROUND   1
+#define GTE_VECTOR_FAR_COLOR    2
+
+// Kernels for the matrix transforms, picked by CPU features
+#define GTE_TRANSFORM_SCALAR    0
+#define GTE_TRANSFORM_AVX2      1
+
+typedef struct gte_state_t {
+    /* Data registers */
+    int16_t v[3][3];
+    uint8_t rgbc[4];
+    uint16_t otz;
+    int16_t ir[4];
+
+    // Screen XY and Z FIFOs, the last entry is the newest
+    int16_t sxy[3][2];
+    uint16_t sz[4];
+    uint8_t rgb[3][4];
+
+    uint32_t res1;
+    int32_t mac[4];
+    uint32_t lzcs;
+    uint32_t lzcr;
+
+    /* Control registers */
+    int16_t matrix[3][3][3];
+    int32_t vector[3][3];
+
+    int32_t ofx;
+    int32_t ofy;
+    uint16_t h;
+    int16_t dqa;
+    int32_t dqb;
+    int16_t zsf3;
+    int16_t zsf4;
+
+    uint32_t flag;
+} gte_state_t;
+
+void gte_init(gte_state_t *state);
+uint32_t gte_read_data(gte_state_t *state, uint8_t reg);
+void gte_write_data(gte_state_t *state, uint8_t reg, uint32_t value);
+uint32_t gte_read_control(gte_state_t *state, uint8_t reg);
+void gte_write_control(gte_state_t *state, uint8_t reg, uint32_t value);
+void gte_command(gte_state_t *state, uint32_t command);
+bool gte_set_transform(uint8_t transform);
+
+#endif
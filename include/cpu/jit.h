@@ -0,0 +1,72 @@
+#ifndef _jit_h
+#define _jit_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu/r3000.h"
+#include "cpu/block_cache.h"
+#include "bus/bus.h"
+
+#define JIT_BUFFER_SIZE     (32 * 1024 * 1024)
+
+// Worst case size of a single compiled block
+#define JIT_BLOCK_MAX_SIZE  (64 * 1024)
+
+// Upper bound for a chain of linked blocks, every block in it has to fit the cycle budget
+#define JIT_MAX_CHAIN_CYCLES    256
+
+#define JIT_EXIT_STATIC     0
+#define JIT_EXIT_BRANCH     1
+#define JIT_EXIT_STATE      2
+
+typedef void (*jit_enter_t)(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t *code);
+
+typedef struct jit_link_t {
+    // rel32 of the jmp in the source block, the exit stub follows right after it
+    uint8_t *site;
+
+    struct jit_link_t *next;
+} jit_link_t;
+
+// Guest access through bus_state->fastmem, see jit_fault
+typedef struct jit_fastmem_t {
+    // Host instruction that faults on IO
+    uint8_t *access;
+
+    // Start of the fast path, gets overwritten by a jmp to slow
+    uint8_t *site;
+    uint8_t *slow;
+} jit_fastmem_t;
+
+typedef struct jit_t {
+    uint8_t *buffer;
+    uint8_t *ptr;
+
+    // Start of the block area, everything before holds the trampolines
+    uint8_t *blocks;
+
+    jit_enter_t enter;
+    uint8_t *exit;
+
+    // Set by the exit stub of an unlinked jump, the next block run at link_pc is linked to it
+    uint8_t *link_site;
+    uint32_t link_pc;
+
+    // Fastmem accesses in the order they were emitted, sorted by address
+    jit_fastmem_t *fastmem;
+    uint32_t fastmem_count;
+    uint32_t fastmem_size;
+
+    // Accesses that hit IO and were patched, each site faults only once per compile
+    uint32_t fastmem_faults;
+
+    block_cache_t *cache;
+} jit_t;
+
+bool jit_init(jit_t *jit, block_cache_t *cache);
+void jit_destroy(jit_t *jit);
+bool jit_execute(jit_t *jit, r3000_state_t *r3000_state, bus_state_t *bus_state, block_t *block, uint32_t cycles);
+void jit_unlink(block_t *block);
+
+#endif
@@ -9,44 +9,69 @@
 
 /* Load/Store instructions */
 
-void opcode_lb(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint16_t imm)
+void opcode_lb(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint16_t imm = instruction->imm;
+
     uint8_t value =  bus_read(bus_state, BUS_SIZE_BYTE, r3000_state->regs[rs] + (uint32_t) (int16_t) imm);
 
     r3000_enqueue_load(r3000_state, bus_state, rt, (int8_t) value);
 }
 
-void opcode_lbu(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint16_t imm)
+void opcode_lbu(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint16_t imm = instruction->imm;
+
     uint8_t value = bus_read(bus_state, BUS_SIZE_BYTE, r3000_state->regs[rs] + (uint32_t) (int16_t) imm);
 
     r3000_enqueue_load(r3000_state, bus_state, rt, value);
 }
 
-void opcode_lh(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint16_t imm)
+void opcode_lh(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint16_t imm = instruction->imm;
+
     uint16_t value = bus_read(bus_state, BUS_SIZE_WORD, r3000_state->regs[rs] + (uint32_t) (int16_t) imm);
 
     r3000_enqueue_load(r3000_state, bus_state, rt, (int16_t) value);
 }
 
-void opcode_lhu(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint16_t imm)
+void opcode_lhu(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint16_t imm = instruction->imm;
+
     uint16_t value = bus_read(bus_state, BUS_SIZE_WORD, r3000_state->regs[rs] + (uint32_t) (int16_t) imm);
 
     r3000_enqueue_load(r3000_state, bus_state, rt, value);
 }
 
-void opcode_lw(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint16_t imm)
+void opcode_lw(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint16_t imm = instruction->imm;
+
     uint32_t value = bus_read(bus_state, BUS_SIZE_DWORD, r3000_state->regs[rs] + (uint32_t) (int16_t) imm);
 
     r3000_enqueue_load(r3000_state, bus_state, rt, value);
 }
 
-void opcode_sb(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint16_t imm)
+void opcode_sb(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint16_t imm = instruction->imm;
+
     if (r3000_state->cop0_state.regs[COP0_REG_SR] & COP0_SR_ISC) {
+        bus_write_isolated(bus_state);
         return;
     }
 
@@ -55,9 +80,14 @@ void opcode_sb(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, u
     bus_write(bus_state, BUS_SIZE_BYTE, addr, r3000_state->regs[rt] & 0xFF);
 }
 
-void opcode_sh(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint16_t imm)
+void opcode_sh(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint16_t imm = instruction->imm;
+
     if (r3000_state->cop0_state.regs[COP0_REG_SR] & COP0_SR_ISC) {
+        bus_write_isolated(bus_state);
         return;
     }
 
@@ -66,9 +96,14 @@ void opcode_sh(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, u
     bus_write(bus_state, BUS_SIZE_WORD, addr, r3000_state->regs[rt] & 0xFFFF);
 }
 
-void opcode_sw(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint16_t imm)
+void opcode_sw(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint16_t imm = instruction->imm;
+
     if (r3000_state->cop0_state.regs[COP0_REG_SR] & COP0_SR_ISC) {
+        bus_write_isolated(bus_state);
         return;
     }
 
@@ -77,8 +112,12 @@ void opcode_sw(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, u
     bus_write(bus_state, BUS_SIZE_DWORD, addr, r3000_state->regs[rt]);
 }
 
-void opcode_lwl(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint16_t imm)
+void opcode_lwl(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint16_t imm = instruction->imm;
+
     uint32_t value = bus_read(bus_state, BUS_SIZE_DWORD, (r3000_state->regs[rs] + (uint32_t) (int16_t) imm) & ~0x3);
 
     switch((r3000_state->regs[rs] + (uint32_t) (int16_t) imm) & 0x3) {
@@ -91,8 +130,12 @@ void opcode_lwl(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs,
     r3000_enqueue_load(r3000_state, bus_state, rt, value);
 }
 
-void opcode_lwr(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint16_t imm)
+void opcode_lwr(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint16_t imm = instruction->imm;
+
     uint32_t value = bus_read(bus_state, BUS_SIZE_DWORD, (r3000_state->regs[rs] + (uint32_t) (int16_t) imm) & ~0x3);
 
     switch((r3000_state->regs[rs] + (uint32_t) (int16_t) imm) & 0x3) {
@@ -105,9 +148,14 @@ void opcode_lwr(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs,
     r3000_enqueue_load(r3000_state, bus_state, rt, value);
 }
 
-void opcode_swl(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint16_t imm)
+void opcode_swl(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint16_t imm = instruction->imm;
+
     if (r3000_state->cop0_state.regs[COP0_REG_SR] & COP0_SR_ISC) {
+        bus_write_isolated(bus_state);
         return;
     }
 
@@ -123,9 +171,14 @@ void opcode_swl(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs,
     bus_write(bus_state, BUS_SIZE_DWORD, (r3000_state->regs[rs] + (uint32_t) (int16_t) imm) & ~0x3, value);
 }
 
-void opcode_swr(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint16_t imm)
+void opcode_swr(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint16_t imm = instruction->imm;
+
     if (r3000_state->cop0_state.regs[COP0_REG_SR] & COP0_SR_ISC) {
+        bus_write_isolated(bus_state);
         return;
     }
 
@@ -143,192 +196,296 @@ void opcode_swr(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs,
 
 /* ALU Instructions */
 
-void opcode_add(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint8_t rd)
+void opcode_add(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint8_t rd = instruction->rd;
+
     uint32_t result = (int32_t) r3000_state->regs[rs] + (int32_t) r3000_state->regs[rt];
 
     r3000_state->regs[rd] = result;
 }
 
-void opcode_addu(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint8_t rd)
+void opcode_addu(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint8_t rd = instruction->rd;
+
     uint32_t result = r3000_state->regs[rs] + r3000_state->regs[rt];
 
     r3000_state->regs[rd] = result;
 }
 
-void opcode_sub(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint8_t rd)
+void opcode_sub(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint8_t rd = instruction->rd;
+
     uint32_t result = (int32_t) r3000_state->regs[rs] - (int32_t) r3000_state->regs[rt];
 
     r3000_state->regs[rd] = result;
 }
 
-void opcode_subu(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint8_t rd)
+void opcode_subu(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint8_t rd = instruction->rd;
+
     uint32_t result = r3000_state->regs[rs] - r3000_state->regs[rt];
 
     r3000_state->regs[rd] = result;
 }
 
-void opcode_addi(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint16_t imm)
+void opcode_addi(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint16_t imm = instruction->imm;
+
     uint32_t result = (int32_t) r3000_state->regs[rs] + (int32_t) (uint32_t) (int16_t) imm;
 
     r3000_state->regs[rt] = result;
 }
 
-void opcode_addiu(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint16_t imm)
+void opcode_addiu(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint16_t imm = instruction->imm;
+
     uint32_t result = r3000_state->regs[rs] + (uint32_t) (int16_t) imm;
 
     r3000_state->regs[rt] = result;
 }
 
-void opcode_slt(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint8_t rd)
+void opcode_slt(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint8_t rd = instruction->rd;
+
     uint32_t result = ((int32_t) r3000_state->regs[rs] < (int32_t) r3000_state->regs[rt]) ? 1 : 0;
 
     r3000_state->regs[rd] = result;
 }
 
-void opcode_sltu(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint8_t rd)
+void opcode_sltu(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint8_t rd = instruction->rd;
+
     uint32_t result = (r3000_state->regs[rs] < r3000_state->regs[rt]) ? 1 : 0;
 
     r3000_state->regs[rd] = result;
 }
 
-void opcode_slti(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint16_t imm)
+void opcode_slti(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint16_t imm = instruction->imm;
+
     uint32_t result = ((int32_t) r3000_state->regs[rs] < (int32_t) (uint32_t) (int16_t) imm) ? 1 : 0;
 
     r3000_state->regs[rt] = result;
 }
 
-void opcode_sltiu(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint16_t imm)
+void opcode_sltiu(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint16_t imm = instruction->imm;
+
     uint32_t result = (r3000_state->regs[rs] < (uint32_t) (int16_t) imm) ? 1 : 0;
 
     r3000_state->regs[rt] = result;
 }
 
-void opcode_and(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint8_t rd)
+void opcode_and(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint8_t rd = instruction->rd;
+
     uint32_t result = r3000_state->regs[rs] & r3000_state->regs[rt];
 
     r3000_state->regs[rd] = result;
 }
 
-void opcode_or(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint8_t rd)
+void opcode_or(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint8_t rd = instruction->rd;
+
     uint32_t result = r3000_state->regs[rs] | r3000_state->regs[rt];
 
     r3000_state->regs[rd] = result;
 }
 
-void opcode_xor(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint8_t rd)
+void opcode_xor(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint8_t rd = instruction->rd;
+
     uint32_t result = r3000_state->regs[rs] ^ r3000_state->regs[rt];
 
     r3000_state->regs[rd] = result;
 }
 
-void opcode_nor(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint8_t rd)
+void opcode_nor(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint8_t rd = instruction->rd;
+
     uint32_t result = ~(r3000_state->regs[rs] | r3000_state->regs[rt]);
 
     r3000_state->regs[rd] = result;
 }
 
-void opcode_andi(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint16_t imm)
+void opcode_andi(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint16_t imm = instruction->imm;
+
     uint32_t result = r3000_state->regs[rs] & imm;
 
     r3000_state->regs[rt] = result;
 }
 
-void opcode_ori(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint16_t imm)
+void opcode_ori(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint16_t imm = instruction->imm;
+
     uint32_t result = r3000_state->regs[rs] | imm;
 
     r3000_state->regs[rt] = result;
 }
 
-void opcode_xori(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint16_t imm)
+void opcode_xori(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint16_t imm = instruction->imm;
+
     uint32_t result = r3000_state->regs[rs] ^ imm;
 
     r3000_state->regs[rt] = result;
 }
 
-void opcode_sllv(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint8_t rd)
+void opcode_sllv(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint8_t rd = instruction->rd;
+
     uint32_t result = r3000_state->regs[rt] << (r3000_state->regs[rs] & 0x1F);
 
     r3000_state->regs[rd] = result;
 }
 
-void opcode_srlv(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint8_t rd)
+void opcode_srlv(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint8_t rd = instruction->rd;
+
     uint32_t result = r3000_state->regs[rt] >> (r3000_state->regs[rs] & 0x1F);
 
     r3000_state->regs[rd] = result;
 }
 
-void opcode_srav(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint8_t rd)
+void opcode_srav(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint8_t rd = instruction->rd;
+
     uint32_t result = ((int32_t) r3000_state->regs[rt]) >> (r3000_state->regs[rs] & 0x1F);
 
     r3000_state->regs[rd] = result;
 }
 
-void opcode_sll(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint8_t rd, uint8_t shamt)
+void opcode_sll(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rt = instruction->rt;
+    uint8_t rd = instruction->rd;
+    uint8_t shamt = instruction->shamt;
+
     uint32_t result = r3000_state->regs[rt] << shamt;
 
     r3000_state->regs[rd] = result;
 }
 
-void opcode_srl(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint8_t rd, uint8_t shamt)
+void opcode_srl(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rt = instruction->rt;
+    uint8_t rd = instruction->rd;
+    uint8_t shamt = instruction->shamt;
+
     uint32_t result = r3000_state->regs[rt] >> shamt;
 
     r3000_state->regs[rd] = result;
 }
 
-void opcode_sra(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint8_t rd, uint8_t shamt)
+void opcode_sra(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rt = instruction->rt;
+    uint8_t rd = instruction->rd;
+    uint8_t shamt = instruction->shamt;
+
     uint32_t result = ((int32_t) r3000_state->regs[rt] >> shamt);
 
     r3000_state->regs[rd] = result;
 }
 
-void opcode_lui(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint16_t imm)
+void opcode_lui(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rt = instruction->rt;
+    uint16_t imm = instruction->imm;
+
     uint32_t result = imm << 16;
 
     r3000_state->regs[rt] = result;
 }
 
-void opcode_mult(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt)
+void opcode_mult(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+
     uint64_t result = (int64_t) (int32_t) r3000_state->regs[rs] * (int64_t) (int32_t) r3000_state->regs[rt];
 
     r3000_state->hi = (result >> 32);
     r3000_state->lo = result;
 }
 
-void opcode_multu(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt)
+void opcode_multu(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+
     uint64_t result = (uint64_t) r3000_state->regs[rs] * (uint64_t) r3000_state->regs[rt];
 
     r3000_state->hi = (result >> 32);
     r3000_state->lo = result;
 }
 
-void opcode_div(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt)
+void opcode_div(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+
     if ((int32_t) r3000_state->regs[rt] == 0) {
         // Division by zero
         r3000_state->hi = r3000_state->regs[rs];
@@ -347,8 +504,11 @@ void opcode_div(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs,
     }
 }
 
-void opcode_divu(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt)
+void opcode_divu(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+
     if (r3000_state->regs[rt] == 0) {
         // Division by zero
         r3000_state->hi = r3000_state->regs[rs];
@@ -359,150 +519,322 @@ void opcode_divu(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs,
     }
 }
 
-void opcode_mfhi(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rd)
+void opcode_mfhi(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rd = instruction->rd;
+
     r3000_state->regs[rd] = r3000_state->hi;
 }
 
-void opcode_mflo(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rd)
+void opcode_mflo(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rd = instruction->rd;
+
     r3000_state->regs[rd] = r3000_state->lo;
 }
 
-void opcode_mthi(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs)
+void opcode_mthi(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+
     r3000_state->hi = r3000_state->regs[rs];
 }
 
-void opcode_mtlo(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs)
+void opcode_mtlo(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+
     r3000_state->lo = r3000_state->regs[rs];
 }
 
 /* Jump/Branch Instructions */
 
-void opcode_j(r3000_state_t *r3000_state, bus_state_t *bus_state, uint32_t imm_jump)
+void opcode_j(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint32_t imm_jump = instruction->imm_jump;
+
     r3000_branch(r3000_state, (r3000_state->pc & 0xF0000000) | (imm_jump << 2));
 }
 
-void opcode_jal(r3000_state_t *r3000_state, bus_state_t *bus_state, uint32_t imm_jump)
+void opcode_jal(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint32_t imm_jump = instruction->imm_jump;
+
     r3000_branch(r3000_state, (r3000_state->pc & 0xF0000000) | (imm_jump << 2));
 
     r3000_state->regs[R3000_REG_RA] = r3000_state->pc_next;
 }
 
-void opcode_jr(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs)
+void opcode_jr(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+
     r3000_branch(r3000_state, r3000_state->regs[rs]);
 }
 
-void opcode_jalr(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rd)
+void opcode_jalr(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rd = instruction->rd;
+
     r3000_branch(r3000_state, r3000_state->regs[rs]);
 
     r3000_state->regs[rd] = r3000_state->pc_next;
 }
 
-void opcode_beq(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint16_t imm)
+void opcode_beq(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint16_t imm = instruction->imm;
+
     if (r3000_state->regs[rs] == r3000_state->regs[rt]) {
         r3000_branch(r3000_state, r3000_state->pc + (((uint32_t) (int16_t) imm) << 2));
     }
 }
 
-void opcode_bne(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint16_t imm)
+void opcode_bne(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint8_t rt = instruction->rt;
+    uint16_t imm = instruction->imm;
+
     if (r3000_state->regs[rs] != r3000_state->regs[rt]) {
         r3000_branch(r3000_state, r3000_state->pc + (((uint32_t) (int16_t) imm) << 2));
     }
 }
 
-void opcode_bcondz(r3000_state_t *r3000_state, bus_state_t *bus_state, uint32_t instruction, uint8_t rs, uint16_t imm)
+void opcode_bltz(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
-    bool is_bgez = (instruction >> 16) & 1;
-    bool is_link = (instruction >> 17) & 0xF == 8;
+    uint8_t rs = instruction->rs;
+    uint16_t imm = instruction->imm;
+
+    if ((int32_t) r3000_state->regs[rs] < 0) {
+        r3000_branch(r3000_state, r3000_state->pc + (((uint32_t) (int16_t) imm) << 2));
+    }
+}
+
+void opcode_bgez(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
+{
+    uint8_t rs = instruction->rs;
+    uint16_t imm = instruction->imm;
+
+    if ((int32_t) r3000_state->regs[rs] >= 0) {
+        r3000_branch(r3000_state, r3000_state->pc + (((uint32_t) (int16_t) imm) << 2));
+    }
+}
+
+void opcode_bltzal(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
+{
+    uint8_t rs = instruction->rs;
+    uint16_t imm = instruction->imm;
 
     int32_t v = r3000_state->regs[rs];
-    uint32_t test = (v < 0) ^ is_bgez;
 
-    if (is_link) {
-        r3000_state->regs[R3000_REG_RA] = r3000_state->pc_next;
+    // Links even if the branch is not taken
+    r3000_state->regs[R3000_REG_RA] = r3000_state->pc_next;
+
+    if (v < 0) {
+        r3000_branch(r3000_state, r3000_state->pc + (((uint32_t) (int16_t) imm) << 2));
     }
+}
+
+void opcode_bgezal(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
+{
+    uint8_t rs = instruction->rs;
+    uint16_t imm = instruction->imm;
+
+    int32_t v = r3000_state->regs[rs];
 
-    if (test != 0) {
+    // Links even if the branch is not taken
+    r3000_state->regs[R3000_REG_RA] = r3000_state->pc_next;
+
+    if (v >= 0) {
         r3000_branch(r3000_state, r3000_state->pc + (((uint32_t) (int16_t) imm) << 2));
     }
 }
 
-void opcode_bgtz(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint16_t imm)
+void opcode_bgtz(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint16_t imm = instruction->imm;
+
     if ((int32_t) r3000_state->regs[rs] > 0) {
         r3000_branch(r3000_state, r3000_state->pc + (((uint32_t) (int16_t) imm) << 2));
     }
 }
 
-void opcode_blez(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint16_t imm)
+void opcode_blez(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
+    uint8_t rs = instruction->rs;
+    uint16_t imm = instruction->imm;
+
     if ((int32_t) r3000_state->regs[rs] <= 0) {
         r3000_branch(r3000_state, r3000_state->pc + (((uint32_t) (int16_t) imm) << 2));
     }
 }
 
-void opcode_syscall(r3000_state_t *r3000_state, bus_state_t *bus_state)
+void opcode_syscall(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
     r3000_exception(r3000_state, COP0_CAUSE_SYSCALL);
 }
 
+void opcode_break(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
+{
+    r3000_exception(r3000_state, COP0_CAUSE_BP);
+}
+
+void opcode_reserved(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
+{
+    log_debug(LOG_R3000_EXCEPTIONS, "R3000", "Reserved instruction %08x\n", instruction->word);
+
+    r3000_exception(r3000_state, COP0_CAUSE_RI);
+}
+
 /* Coprocessor instruction */
 
-void opcode_mfc0(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rt, uint8_t rd)
+void opcode_mfc0(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
-    #ifdef LOG_DEBUG_R3000
-    log_debug("COP0", "MFC | %s <- %s | %08x\n", r3000_register_names[rt], cop0_register_names[rd], r3000_state->cop0_state.regs[rd]);
-    #endif
+    uint8_t rt = instruction->rt;
+    uint8_t rd = instruction->rd;
+
+    log_debug(LOG_R3000, "COP0", "MFC | %s <- %s | %08x\n", r3000_register_names[rt], cop0_register_names[rd], r3000_state->cop0_state.regs[rd]);
+
+    uint32_t value = r3000_state->cop0_state.regs[rd];
+
+    // CAUSE.IP2 follows the interrupt controller
+    if (rd == COP0_REG_CAUSE) {
+        value |= irq_cause(&bus_state->irq_state);
+    }
 
-    r3000_enqueue_load(r3000_state, bus_state, rt, r3000_state->cop0_state.regs[rd]);
+    r3000_enqueue_load(r3000_state, bus_state, rt, value);
 }
 
-void opcode_mtc0(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rt, uint8_t rd)
+void opcode_mtc0(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
-    #ifdef LOG_DEBUG_R3000
-    log_debug("COP0", "MTC | %s -> %s | %08x\n", r3000_register_names[rt], cop0_register_names[rd], r3000_state->regs[rt]);
-    #endif
+    uint8_t rt = instruction->rt;
+    uint8_t rd = instruction->rd;
+
+    log_debug(LOG_R3000, "COP0", "MTC | %s -> %s | %08x\n", r3000_register_names[rt], cop0_register_names[rd], r3000_state->regs[rt]);
 
     uint32_t value = r3000_state->regs[rt];
 
     switch(rd) {
         case COP0_REG_SR:
             r3000_state->cop0_state.regs[COP0_REG_SR] = value;
+            r3000_update_irqs(r3000_state);
 
             break;
 
         case COP0_REG_CAUSE:
-            r3000_state->cop0_state.regs[COP0_REG_CAUSE] = r3000_state->cop0_state.regs[COP0_REG_CAUSE] | (value & 0x300);
+            // Only the software interrupt bits are writable
+            r3000_state->cop0_state.regs[COP0_REG_CAUSE] &= ~IRQ_CAUSE_SOFTWARE;
+            r3000_state->cop0_state.regs[COP0_REG_CAUSE] |= value & IRQ_CAUSE_SOFTWARE;
+            r3000_update_irqs(r3000_state);
+
             break;
     }
 }
 
-void opcode_rfe(r3000_state_t *r3000_state, bus_state_t *bus_state)
+void opcode_rfe(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
     r3000_rfe(r3000_state);
 }
 
-void opcode_cop0(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rs, uint8_t rt, uint8_t rd, uint16_t imm)
+/* COP1 and COP3 don't exist */
+void opcode_cop_unusable(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
+{
+    r3000_exception(r3000_state, COP0_CAUSE_CPU);
+
+    // Coprocessor number
+    r3000_state->cop0_state.regs[COP0_REG_CAUSE] |= (instruction->opcode & 0x3) << 28;
+}
+
+/* GTE, every access needs SR.CU2 */
+
+void opcode_mfc2(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
+{
+    if (!(r3000_state->cop0_state.regs[COP0_REG_SR] & COP0_SR_CU2)) {
+        opcode_cop_unusable(r3000_state, bus_state, instruction);
+        return;
+    }
+
+    r3000_enqueue_load(r3000_state, bus_state, instruction->rt, gte_read_data(&r3000_state->gte_state, instruction->rd));
+}
+
+void opcode_cfc2(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
+{
+    if (!(r3000_state->cop0_state.regs[COP0_REG_SR] & COP0_SR_CU2)) {
+        opcode_cop_unusable(r3000_state, bus_state, instruction);
+        return;
+    }
+
+    r3000_enqueue_load(r3000_state, bus_state, instruction->rt, gte_read_control(&r3000_state->gte_state, instruction->rd));
+}
+
+void opcode_mtc2(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
+{
+    if (!(r3000_state->cop0_state.regs[COP0_REG_SR] & COP0_SR_CU2)) {
+        opcode_cop_unusable(r3000_state, bus_state, instruction);
+        return;
+    }
+
+    gte_write_data(&r3000_state->gte_state, instruction->rd, r3000_state->regs[instruction->rt]);
+}
+
+void opcode_ctc2(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
+{
+    if (!(r3000_state->cop0_state.regs[COP0_REG_SR] & COP0_SR_CU2)) {
+        opcode_cop_unusable(r3000_state, bus_state, instruction);
+        return;
+    }
+
+    gte_write_control(&r3000_state->gte_state, instruction->rd, r3000_state->regs[instruction->rt]);
+}
+
+void opcode_cop2(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
 {
-    if (rs == 0) {
-        // MFC
-        opcode_mfc0(r3000_state, bus_state, rt, rd);
-    } else if (rs == 4) {
-        // MTC
-        opcode_mtc0(r3000_state, bus_state, rt, rd);
-    } else if (rs == 16 && imm == 16) {
-        // RFE
-        opcode_rfe(r3000_state, bus_state);
+    if (!(r3000_state->cop0_state.regs[COP0_REG_SR] & COP0_SR_CU2)) {
+        opcode_cop_unusable(r3000_state, bus_state, instruction);
+        return;
     }
+
+    gte_command(&r3000_state->gte_state, instruction->word & 0x1FFFFFF);
+}
+
+void opcode_lwc2(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
+{
+    uint8_t rs = instruction->rs;
+    uint16_t imm = instruction->imm;
+
+    if (!(r3000_state->cop0_state.regs[COP0_REG_SR] & COP0_SR_CU2)) {
+        opcode_cop_unusable(r3000_state, bus_state, instruction);
+        return;
+    }
+
+    uint32_t value = bus_read(bus_state, BUS_SIZE_DWORD, r3000_state->regs[rs] + (uint32_t) (int16_t) imm);
+
+    gte_write_data(&r3000_state->gte_state, instruction->rt, value);
+}
+
+void opcode_swc2(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction)
+{
+    uint8_t rs = instruction->rs;
+    uint16_t imm = instruction->imm;
+
+    if (!(r3000_state->cop0_state.regs[COP0_REG_SR] & COP0_SR_CU2)) {
+        opcode_cop_unusable(r3000_state, bus_state, instruction);
+        return;
+    }
+
+    if (r3000_state->cop0_state.regs[COP0_REG_SR] & COP0_SR_ISC) {
+        bus_write_isolated(bus_state);
+        return;
+    }
+
+    uint32_t addr = r3000_state->regs[rs] + (uint32_t) (int16_t) imm;
+
+    bus_write(bus_state, BUS_SIZE_DWORD, addr, gte_read_data(&r3000_state->gte_state, instruction->rt));
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,76 @@
+#ifndef _profiler_h
+#define _profiler_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu/r3000.h"
+
+#define PROFILER_RAM_WORDS      (0x200000 >> 2)
+#define PROFILER_BIOS_WORDS     (0x80000 >> 2)
+
+// Open addressed, functions past this all end up in the last slot
+#define PROFILER_FUNCTIONS      0x10000
+#define PROFILER_MAX_DEPTH      128
+
+// Rows of the tables printed by profiler_report
+#define PROFILER_TOP            20
+
+typedef struct profiler_function_t {
+    uint32_t addr;
+    bool used;
+
+    uint64_t calls;
+    uint64_t exclusive;
+    uint64_t inclusive;
+} profiler_function_t;
+
+/* Call tree, one node per distinct stack, becomes the collapsed stacks */
+typedef struct profiler_node_t {
+    uint32_t function;
+    uint32_t parent;
+    uint32_t child;
+    uint32_t sibling;
+
+    uint64_t cycles;
+} profiler_node_t;
+
+typedef struct profiler_frame_t {
+    profiler_function_t *function;
+    uint32_t node;
+
+    // Address the call returns to, exception frames are left by RFE instead
+    uint32_t ret;
+    bool exception;
+
+    uint64_t start;
+} profiler_frame_t;
+
+typedef struct profiler_t {
+    // Executions per instruction word, indexed by physical address
+    uint32_t *ram_counts;
+    uint32_t *bios_counts;
+
+    profiler_function_t *functions;
+
+    profiler_node_t *nodes;
+    uint32_t node_count;
+    uint32_t node_size;
+
+    profiler_frame_t stack[PROFILER_MAX_DEPTH];
+    uint32_t depth;
+
+    // Cycles are charged to the innermost frame when the next instruction starts
+    uint64_t cycles;
+    uint32_t last_cycles;
+} profiler_t;
+
+void profiler_init(profiler_t *profiler, uint32_t pc, uint32_t cycles);
+void profiler_destroy(profiler_t *profiler);
+void profiler_instruction(profiler_t *profiler, r3000_state_t *r3000_state, r3000_instruction_t *instruction);
+void profiler_exception(profiler_t *profiler, r3000_state_t *r3000_state);
+void profiler_report(profiler_t *profiler, FILE *fp);
+bool profiler_export(profiler_t *profiler, const char *path);
+
+#endif
@@ -3,6 +3,8 @@
 
 #include <stdbool.h>
 #include "bus/bus.h"
+#include "cpu/gte.h"
+#include "bios/bios.h"
 
 #define R3000_REG_AT        1
 #define R3000_REG_V0        2
@@ -53,6 +55,7 @@
 #define COP0_SR_IEO (1 << 4)
 #define COP0_SR_ISC (1 << 16)
 #define COP0_SR_BEV (1 << 22)
+#define COP0_SR_CU2 (1 << 30)
 
 #define COP0_CAUSE_INT      0x00
 #define COP0_CAUSE_ADEL     0x04
@@ -60,11 +63,47 @@
 #define COP0_CAUSE_IBE      0x06
 #define COP0_CAUSE_DBE      0x07
 #define COP0_CAUSE_SYSCALL  0x08
+#define COP0_CAUSE_BP       0x09
+#define COP0_CAUSE_RI       0x0A
+#define COP0_CAUSE_CPU      0x0B
 
 #define DELAY_SLOT_STATE_ARMED          1
 #define DELAY_SLOT_STATE_DELAY_CYCLE    2
 #define DELAY_SLOT_STATE_DONE           3
 
+/*
+ * Every instruction the decoder knows, X(op id, handler name).
+ * Used for the op id enum, the handler and name tables and the dispatch labels.
+ */
+#define R3000_OPS(X) \
+    X(SLL, sll) X(SRL, srl) X(SRA, sra) X(SLLV, sllv) X(SRLV, srlv) X(SRAV, srav) \
+    X(JR, jr) X(JALR, jalr) X(SYSCALL, syscall) X(BREAK, break) \
+    X(MFHI, mfhi) X(MTHI, mthi) X(MFLO, mflo) X(MTLO, mtlo) \
+    X(MULT, mult) X(MULTU, multu) X(DIV, div) X(DIVU, divu) \
+    X(ADD, add) X(ADDU, addu) X(SUB, sub) X(SUBU, subu) \
+    X(AND, and) X(OR, or) X(XOR, xor) X(NOR, nor) X(SLT, slt) X(SLTU, sltu) \
+    X(BLTZ, bltz) X(BGEZ, bgez) X(BLTZAL, bltzal) X(BGEZAL, bgezal) \
+    X(J, j) X(JAL, jal) X(BEQ, beq) X(BNE, bne) X(BLEZ, blez) X(BGTZ, bgtz) \
+    X(ADDI, addi) X(ADDIU, addiu) X(SLTI, slti) X(SLTIU, sltiu) \
+    X(ANDI, andi) X(ORI, ori) X(XORI, xori) X(LUI, lui) \
+    X(MFC0, mfc0) X(MTC0, mtc0) X(RFE, rfe) \
+    X(MFC2, mfc2) X(CFC2, cfc2) X(MTC2, mtc2) X(CTC2, ctc2) X(COP2, cop2) \
+    X(LB, lb) X(LH, lh) X(LWL, lwl) X(LW, lw) X(LBU, lbu) X(LHU, lhu) X(LWR, lwr) \
+    X(SB, sb) X(SH, sh) X(SWL, swl) X(SW, sw) X(SWR, swr) \
+    X(LWC2, lwc2) X(SWC2, swc2) \
+    X(COP_UNUSABLE, cop_unusable) X(RESERVED, reserved)
+
+#define R3000_OP_ID(id, name) R3000_OP_##id,
+
+enum {
+    R3000_OPS(R3000_OP_ID)
+    R3000_OP_COUNT
+};
+
+#define R3000_ENGINE_INTERPRETER    0
+#define R3000_ENGINE_CACHED         1
+#define R3000_ENGINE_JIT            2
+
 static const char *r3000_register_names[] = {
     "zero", "at", "v0", "v1", "a0", "a1", "a2", "v2",
     "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
@@ -101,6 +140,11 @@ static const char *r3000_irq_names[] = {
 #define R3000_IRQ_TMR1      (1 << 5)
 #define R3000_IRQ_TMR2      (1 << 6)
 
+typedef struct bios_hle_t bios_hle_t;
+typedef struct boot_t boot_t;
+typedef struct profiler_t profiler_t;
+typedef struct trace_t trace_t;
+
 typedef struct cop0_state_t {
     uint32_t regs[32];
 } cop0_state_t;
@@ -124,20 +168,78 @@ typedef struct r3000_state_t {
     uint8_t load_delay_reg;
     uint32_t load_delay_value;
 
-    uint32_t i_stat;
-    uint32_t i_mask;
-
     cop0_state_t cop0_state;
+    gte_state_t gte_state;
+
+    // Line the putchar calls are collecting, see bios_tty_putchar
+    bios_tty_t tty;
+
+    // Told about every SR and CAUSE change, see r3000_update_irqs
+    irq_state_t *irq_state;
+
+    // Services kernel calls natively if set, see bios_hle_call
+    bios_hle_t *hle;
+
+    // Fast boot, cleared once the BIOS gets to the shell, see boot_shell
+    boot_t *boot;
+
+    // Only used by builds with R3000_PROFILER, see profiler_instruction
+    profiler_t *profiler;
+
+    // Only used by builds with R3000_TRACE, see trace_begin
+    trace_t *trace;
 
-    bool *debug_enabled;
     uint32_t cycles;
+
+    // Part of cycles no instructions ran in, skipped idle loops and HLE calls
+    uint32_t idle_cycles;
+
+    // Compiled blocks chain into each other until cycles reaches this
+    uint32_t cycles_target;
+
+    uint8_t engine;
 } r3000_state_t; 
 
+typedef struct r3000_instruction_t r3000_instruction_t;
+typedef void (*r3000_handler_t)(r3000_state_t *r3000_state, bus_state_t *bus_state, r3000_instruction_t *instruction);
+
+/* Pre-decoded instruction record, filled once by r3000_decode */
+typedef struct r3000_instruction_t {
+    r3000_handler_t handler;
+    uint32_t word;
+
+    // R3000_OP_*
+    uint8_t op;
+
+    uint8_t opcode;
+    uint8_t funct;
+
+    uint8_t rs;
+    uint8_t rt;
+
+    /* R-Type */
+    uint8_t rd;
+    uint8_t shamt;
+
+    /* I-Type */
+    uint16_t imm;
+
+    /* J-Type */
+    uint32_t imm_jump;
+} r3000_instruction_t;
+
 void r3000_enqueue_load(r3000_state_t *r3000_state, bus_state_t *bus_state, uint8_t rt, uint32_t value);
 void r3000_branch(r3000_state_t *r3000_state, uint32_t addr);
 void r3000_exception(r3000_state_t *r3000_state, uint8_t cause);
 void r3000_rfe(r3000_state_t *r3000_state);
+void r3000_update_irqs(r3000_state_t *r3000_state);
 void r3000_init(r3000_state_t *state);
+extern const r3000_handler_t r3000_handlers[R3000_OP_COUNT];
+extern const char *r3000_op_names[R3000_OP_COUNT];
+
+void r3000_decode(r3000_instruction_t *instruction, uint32_t word);
 void r3000_step(r3000_state_t *r3000_state, bus_state_t *bus_state);
+void r3000_run_slice(r3000_state_t *r3000_state, bus_state_t *bus_state, uint32_t cycles);
+void r3000_run(r3000_state_t *r3000_state, bus_state_t *bus_state, uint32_t cycles);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,72 @@
+#ifndef _trace_h
+#define _trace_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "cpu/r3000.h"
+
+#define TRACE_MAGIC     "MDTRACE1"
+
+// Records in the ring, a power of two
+#define TRACE_RING_SIZE     (1 << 20)
+#define TRACE_RING_MASK     (TRACE_RING_SIZE - 1)
+
+#define TRACE_REG           (1 << 0)
+#define TRACE_REG_MULTIPLE  (1 << 1)
+#define TRACE_MEM_READ      (1 << 2)
+#define TRACE_MEM_WRITE     (1 << 3)
+
+typedef struct trace_file_header_t {
+    char magic[8];
+    uint32_t record_size;
+    uint32_t reserved;
+} trace_file_header_t;
+
+/* One per instruction, written to the file as is */
+typedef struct trace_record_t {
+    uint32_t cycles;
+    uint32_t pc;
+    uint32_t word;
+
+    // First register the instruction changed, TRACE_REG_MULTIPLE if there were more
+    uint32_t reg_value;
+    uint8_t reg;
+    uint8_t flags;
+    uint16_t reserved;
+
+    uint32_t mem_addr;
+    uint32_t mem_value;
+    uint32_t reserved2;
+} trace_record_t;
+
+typedef struct trace_t {
+    trace_record_t *ring;
+
+    // Only the CPU moves head and only the writer thread moves tail
+    _Atomic uint32_t head;
+    _Atomic uint32_t tail;
+    _Atomic bool stop;
+
+    // Times the CPU had to wait for the writer
+    uint64_t stalls;
+
+    // The instruction being executed, finished by trace_end
+    trace_record_t record;
+    uint8_t op;
+    uint8_t rt;
+    uint32_t regs[32];
+
+    FILE *fp;
+    pthread_t thread;
+} trace_t;
+
+bool trace_open(trace_t *trace, const char *path);
+void trace_begin(trace_t *trace, r3000_state_t *r3000_state, r3000_instruction_t *instruction);
+void trace_end(trace_t *trace, r3000_state_t *r3000_state);
+void trace_close(trace_t *trace);
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef _x64_h
+#define _x64_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define X64_RAX 0
+#define X64_RCX 1
+#define X64_RDX 2
+#define X64_RBX 3
+#define X64_RSP 4
+#define X64_RBP 5
+#define X64_RSI 6
+#define X64_RDI 7
+#define X64_R8  8
+#define X64_R9  9
+#define X64_R10 10
+#define X64_R11 11
+#define X64_R12 12
+#define X64_R13 13
+#define X64_R14 14
+#define X64_R15 15
+
+#define X64_NO_INDEX    -1
+
+/* ALU operations, values are the /digit of the 0x81 group */
+#define X64_ADD 0
+#define X64_OR  1
+#define X64_AND 4
+#define X64_SUB 5
+#define X64_XOR 6
+#define X64_CMP 7
+
+/* Shift operations, values are the /digit of the 0xC1/0xD3 groups */
+#define X64_SHL 4
+#define X64_SHR 5
+#define X64_SAR 7
+
+/* Condition codes */
+#define X64_CC_B    0x2
+#define X64_CC_AE   0x3
+#define X64_CC_E    0x4
+#define X64_CC_NE   0x5
+#define X64_CC_BE   0x6
+#define X64_CC_A    0x7
+#define X64_CC_S    0x8
+#define X64_CC_NS   0x9
+#define X64_CC_L    0xC
+#define X64_CC_GE   0xD
+#define X64_CC_LE   0xE
+#define X64_CC_G    0xF
+
+typedef struct x64_emitter_t {
+    uint8_t *ptr;
+} x64_emitter_t;
+
+void x64_byte(x64_emitter_t *e, uint8_t value);
+void x64_dword(x64_emitter_t *e, uint32_t value);
+void x64_qword(x64_emitter_t *e, uint64_t value);
+
+void x64_mov_rr(x64_emitter_t *e, uint8_t dst, uint8_t src);
+void x64_mov_rr64(x64_emitter_t *e, uint8_t dst, uint8_t src);
+void x64_mov_ri(x64_emitter_t *e, uint8_t dst, uint32_t imm);
+void x64_mov_ri64(x64_emitter_t *e, uint8_t dst, uint64_t imm);
+void x64_movsxd(x64_emitter_t *e, uint8_t dst, uint8_t src);
+void x64_movx_rr(x64_emitter_t *e, uint8_t size, bool sign, uint8_t dst, uint8_t src);
+
+void x64_load(x64_emitter_t *e, uint8_t size, bool sign, uint8_t dst, uint8_t base, int8_t index, int32_t disp);
+void x64_load64(x64_emitter_t *e, uint8_t dst, uint8_t base, int32_t disp);
+void x64_store(x64_emitter_t *e, uint8_t size, uint8_t src, uint8_t base, int8_t index, int32_t disp);
+void x64_store_imm(x64_emitter_t *e, uint8_t size, uint8_t base, int32_t disp, uint32_t imm);
+
+void x64_alu_rr(x64_emitter_t *e, uint8_t op, uint8_t dst, uint8_t src);
+void x64_alu_ri(x64_emitter_t *e, uint8_t op, uint8_t dst, uint32_t imm);
+void x64_alu_ri64(x64_emitter_t *e, uint8_t op, uint8_t dst, uint32_t imm);
+void x64_alu_rm(x64_emitter_t *e, uint8_t op, uint8_t dst, uint8_t base, int32_t disp);
+void x64_alu_mi(x64_emitter_t *e, uint8_t op, uint8_t base, int32_t disp, uint32_t imm);
+void x64_cmp_mi8(x64_emitter_t *e, uint8_t base, int32_t disp, uint8_t imm);
+void x64_test_ri(x64_emitter_t *e, uint8_t reg, uint32_t imm);
+void x64_test_mi(x64_emitter_t *e, uint8_t base, int32_t disp, uint32_t imm);
+void x64_shift_ri(x64_emitter_t *e, uint8_t op, uint8_t dst, uint8_t imm);
+void x64_shift_rcl(x64_emitter_t *e, uint8_t op, uint8_t dst);
+void x64_shift_ri64(x64_emitter_t *e, uint8_t op, uint8_t dst, uint8_t imm);
+void x64_not(x64_emitter_t *e, uint8_t reg);
+void x64_imul64(x64_emitter_t *e, uint8_t dst, uint8_t src);
+void x64_setcc(x64_emitter_t *e, uint8_t cc, uint8_t dst);
+void x64_bt_m(x64_emitter_t *e, uint8_t base, uint8_t bit);
+
+uint8_t *x64_jcc(x64_emitter_t *e, uint8_t cc);
+uint8_t *x64_jmp(x64_emitter_t *e);
+void x64_jmp_r(x64_emitter_t *e, uint8_t reg);
+void x64_call(x64_emitter_t *e, void *function);
+void x64_push(x64_emitter_t *e, uint8_t reg);
+void x64_pop(x64_emitter_t *e, uint8_t reg);
+void x64_ret(x64_emitter_t *e);
+
+void x64_patch(uint8_t *site, uint8_t *target);
+void x64_bind(x64_emitter_t *e, uint8_t *site);
+
+#endif
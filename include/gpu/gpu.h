@@ -1,9 +1,11 @@
 #ifndef _gpu_h
 #define _gpu_h
 
+#include <stdint.h>
 #include <stdbool.h>
 
-#include "renderer/renderer.h"
+#include "bus/irq.h"
+#include "bus/scheduler.h"
 
 #define GPU_COMMAND_BUFFER_SIZE     10
 
@@ -11,8 +13,49 @@
 #define GPU_STATE_WAITING_FOR_ARG       1
 #define GPU_STATE_WAITING_FOR_VRAM_DATA 2
 
+// CPU clock, the video timing is derived from it
+#define GPU_CPU_CLOCK   33868800
+
+// Video clock of each standard, the two are not the same multiple of the CPU clock
+#define GPU_VIDEO_CLOCK_NTSC    53693175
+#define GPU_VIDEO_CLOCK_PAL     53203425
+
+// Common factor of the CPU and both video clocks, keeps the ratios within 32 bits
+#define GPU_CLOCK_FACTOR    75
+
+// Video clocks per scanline
+#define GPU_SCANLINE_CLOCKS_NTSC    3413
+#define GPU_SCANLINE_CLOCKS_PAL     3406
+
+// Scanlines per frame
+#define GPU_SCANLINES_NTSC  263
+#define GPU_SCANLINES_PAL   314
+
+// VBlank starts at the end of the default display area
+#define GPU_VBLANK_LINE_NTSC    256
+#define GPU_VBLANK_LINE_PAL     308
+
+#define GPU_VRAM_WIDTH  1024
+#define GPU_VRAM_HEIGHT 512
+
+/*
+ * Where the drawing commands go, the front end plugs the OpenGL renderer in.
+ * Without one the GPU keeps its state and VRAM but draws nothing.
+ */
+typedef struct gpu_video_sink_t {
+    void *data;
+
+    void (*monochrome_opaque_quad)(void *data, uint32_t *args);
+    void (*textured_blend_quad)(void *data, uint32_t *args);
+    void (*gouraud_triangle)(void *data, uint32_t *args);
+    void (*gouraud_quad)(void *data, uint32_t *args);
+    void (*render)(void *data);
+} gpu_video_sink_t;
+
 typedef struct gpu_state_t {
-    renderer_t *renderer;
+    gpu_video_sink_t *video;
+
+    uint16_t vram[GPU_VRAM_WIDTH][GPU_VRAM_HEIGHT];
 
     uint32_t vram_transfer_loc_x;
     uint32_t vram_transfer_loc_y;
@@ -28,6 +71,15 @@ typedef struct gpu_state_t {
     uint32_t command_buf[10];
     uint8_t command_buf_index;
     uint32_t command_buf_left;
+
+    // GP0(1Fh) interrupt request, GPUSTAT bit 24
+    bool irq;
+
+    // VBlanks so far
+    uint32_t frames;
+
+    irq_state_t *irq_state;
+    scheduler_t *scheduler;
 } gpu_state_t;
 
 void gpu_write(gpu_state_t *gpu_state, uint32_t addr, uint32_t value);
@@ -36,4 +88,12 @@ uint32_t gpu_read(gpu_state_t *gpu_state, uint32_t addr);
 void gpu_send_gp0_command(gpu_state_t *gpu_state, uint32_t command);
 void gpu_send_gp1_command(gpu_state_t *gpu_state, uint32_t command);
 
+uint64_t gpu_line_cycles(gpu_state_t *gpu_state, uint32_t lines);
+uint32_t gpu_frame_cycles(gpu_state_t *gpu_state);
+uint32_t gpu_vblank_line(gpu_state_t *gpu_state);
+uint32_t gpu_dot_clocks(gpu_state_t *gpu_state);
+void gpu_clock_ratio(gpu_state_t *gpu_state, uint32_t *num, uint32_t *den);
+uint32_t gpu_scanline_clocks(gpu_state_t *gpu_state);
+void gpu_vblank(void *data, uint64_t cycles);
+
 #endif
\ No newline at end of file
@@ -2,32 +2,60 @@
 #define _log_h
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #define LOG_LEVEL_INFO  0
 #define LOG_LEVEL_ERROR 1
 #define LOG_LEVEL_DEBUG 2
 
-//#define LOG_DEBUG_R3000
-//#define LOG_DEBUG_R3000_EXCEPTIONS
-
-//#define LOG_DEBUG_BUS_READ
-//#define LOG_DEBUG_BUS_WRITE
-//#define LOG_DEBUG_BUS_WRITE_IO
-
-//#define LOG_DEBUG_GPU_READ
-#define LOG_DEBUG_GPU_COMMANDS
-
-//#define LOG_DEBUG_DMA
-
-//#define LOG_DEBUG_TIMER
-
-//#define LOG_DEBUG_RENDERER
-
-//#define LOG_DEBUG_BIOS
-//#define LOG_DEBUG_BIOS_TTY
+/*
+ * Debug categories, X(id, name). Selected at runtime with log_set_categories,
+ * "--log gpu_commands,tty" on the command line.
+ */
+#define LOG_CATEGORIES(X) \
+    X(R3000, "r3000") X(R3000_EXCEPTIONS, "exceptions") X(BLOCK_CACHE, "block_cache") X(JIT, "jit") X(GTE, "gte") \
+    X(BUS_READ, "bus_read") X(BUS_WRITE, "bus_write") X(BUS_WRITE_IO, "bus_write_io") \
+    X(IRQ, "irq") X(SCHEDULER, "scheduler") \
+    X(GPU_READ, "gpu_read") X(GPU_COMMANDS, "gpu_commands") \
+    X(DMA, "dma") X(TIMER, "timer") X(CDROM, "cdrom") \
+    X(RENDERER, "renderer") \
+    X(BIOS, "bios") X(BIOS_TTY, "tty") X(BIOS_HLE, "hle")
+
+#define LOG_CATEGORY_ID(id, name) LOG_##id,
+
+enum {
+    LOG_CATEGORIES(LOG_CATEGORY_ID)
+    LOG_CATEGORY_COUNT
+};
+
+// Per thread buffers are handed to the writer thread once they are this full
+#define LOG_BUFFER_SIZE     0x10000
+#define LOG_MESSAGE_SIZE    0x400
+
+// One bit per category, the only thing checked while a category is off
+extern uint32_t log_mask;
+
+static inline bool log_enabled(uint8_t category)
+{
+    return __builtin_expect((log_mask >> category) & 1, 0);
+}
+
+/* The arguments are only evaluated if the category is on */
+#define log_debug(category, prefix, ...) \
+    do { if (log_enabled(category)) log_write(category, prefix, __VA_ARGS__); } while (0)
+
+// Adds to the line the last log_debug of the category started
+#define log_continue(category, ...) \
+    do { if (log_enabled(category)) log_write(category, NULL, __VA_ARGS__); } while (0)
+
+void log_init(void);
+void log_close(void);
+void log_flush(void);
+bool log_set_categories(const char *list);
+void log_set_rate(uint32_t rate);
 
 void log_info(char *prefix, const char *format, ...);
 void log_error(char *prefix, const char *format, ...);
-void log_debug(char *prefix, const char *format, ...);
+void log_write(uint8_t category, char *prefix, const char *format, ...);
 
-#endif
\ No newline at end of file
+#endif
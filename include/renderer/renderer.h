@@ -10,6 +10,8 @@
 #include <GL/gl.h>
 #include "GL/glu.h"
 
+#include "gpu/gpu.h"
+
 typedef struct vertex_t {
     GLshort x;
     GLshort y;
@@ -44,8 +46,6 @@ typedef struct renderer_t {
     GLuint vbo;
     GLuint vao;
 
-    uint16_t vram[1024][512];
-
     uint32_t program;
     //vertex_t vertex_buffer[1000];
     renderer_entry_t entries[1000];
@@ -55,6 +55,7 @@ typedef struct renderer_t {
 
 void renderer_init(renderer_t *renderer, SDL_Window *window, SDL_Renderer *sdl_renderer, SDL_GLContext *gl_context);
 void renderer_render(renderer_t *renderer);
+void renderer_video_sink(renderer_t *renderer, gpu_video_sink_t *sink);
 
 void renderer_monochrome_opaque_quad(renderer_t *renderer, uint32_t *args);
 void renderer_textured_blend_quad(renderer_t *renderer, uint32_t *args);
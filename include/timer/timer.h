@@ -1,11 +1,20 @@
 #ifndef _timer_h
 #define _timer_h
 
+#include "bus/irq.h"
+#include "bus/scheduler.h"
+#include "gpu/gpu.h"
+
 typedef struct timer_channel_t {
+    // Value at timer_state->cycles, counted forward in timer_sync
     uint16_t counter;
     uint32_t mode;
     uint16_t target;
 
+    // Part of a tick left over from the last sync, in units of the clock source denominator
+    uint32_t fraction;
+
+    // Interrupt raised since the last mode write, one-shot channels stay quiet until then
     bool irq_req;
 } timer_channel_t;
 
@@ -13,10 +22,24 @@ typedef struct timer_state_t {
     timer_channel_t channel_0;
     timer_channel_t channel_1;
     timer_channel_t channel_2;
+
+    // Scheduler cycle the channels were last synced at, it does not wrap like the CPU counter
+    uint64_t cycles;
+
+    // Register reads so far, a loop polling the counters is not idle
+    uint32_t reads;
+
+    irq_state_t *irq_state;
+    scheduler_t *scheduler;
+
+    // Dot clock and scanline length for the video clock sources
+    gpu_state_t *gpu_state;
 } timer_state_t;
 
 uint32_t timer_read(timer_state_t *state, uint32_t addr);
 void timer_write(timer_state_t *state, uint32_t addr, uint32_t value);
-void timer_channel_tick(timer_channel_t *channel, uint8_t channel_num);
+void timer_sync(timer_state_t *state, uint32_t cycles);
+void timer_schedule(timer_state_t *state);
+void timer_event(void *data, uint64_t cycles);
 
 #endif
\ No newline at end of file
@@ -1,37 +1,379 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
 #include "log.h"
 
+typedef struct log_buffer_t {
+    struct log_buffer_t *next;
+    size_t size;
+    char data[LOG_BUFFER_SIZE];
+} log_buffer_t;
+
+/* Rate limit window of one category, shared by all threads */
+typedef struct log_limit_t {
+    _Atomic uint32_t window;
+    _Atomic uint32_t count;
+    _Atomic uint32_t dropped;
+} log_limit_t;
+
+#define LOG_CATEGORY_NAME(id, name) name,
+
+static const char *log_category_names[LOG_CATEGORY_COUNT] = {
+    LOG_CATEGORIES(LOG_CATEGORY_NAME)
+};
+
+uint32_t log_mask = 0;
+
+static uint32_t log_rate = 0;
+static log_limit_t log_limits[LOG_CATEGORY_COUNT];
+
+// Without log_init everything goes straight to stdout, like before
+static bool log_started = false;
+static bool log_stop = false;
+
+static pthread_t log_thread;
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+
+// Full buffers waiting for the writer, oldest first
+static log_buffer_t *log_queue_head = NULL;
+static log_buffer_t *log_queue_tail = NULL;
+static log_buffer_t *log_free = NULL;
+
+static _Thread_local log_buffer_t *log_current = NULL;
+
+// Categories whose last line was dropped, their continuations go with it
+static _Thread_local uint32_t log_dropping = 0;
+
+static void *log_writer(void *data)
+{
+    (void) data;
+
+    pthread_mutex_lock(&log_mutex);
+
+    while (true) {
+        while (!log_queue_head && !log_stop) {
+            pthread_cond_wait(&log_cond, &log_mutex);
+        }
+
+        if (!log_queue_head) {
+            break;
+        }
+
+        log_buffer_t *buffers = log_queue_head;
+        log_queue_head = NULL;
+        log_queue_tail = NULL;
+
+        pthread_mutex_unlock(&log_mutex);
+
+        log_buffer_t *last = buffers;
+
+        for (log_buffer_t *buffer=buffers; buffer; buffer=buffer->next) {
+            fwrite(buffer->data, 1, buffer->size, stdout);
+            buffer->size = 0;
+            last = buffer;
+        }
+
+        fflush(stdout);
+
+        pthread_mutex_lock(&log_mutex);
+
+        last->next = log_free;
+        log_free = buffers;
+    }
+
+    pthread_mutex_unlock(&log_mutex);
+
+    return NULL;
+}
+
+/* The writer must not be in the middle of the queue or stdout at a fork */
+static void log_fork_prepare(void)
+{
+    flockfile(stdout);
+    pthread_mutex_lock(&log_mutex);
+}
+
+static void log_fork_parent(void)
+{
+    pthread_mutex_unlock(&log_mutex);
+    funlockfile(stdout);
+}
+
+/*
+ * The writer thread is not forked along, a child writes straight to stdout
+ * like before log_init. What is queued is the parent's to write.
+ */
+static void log_fork_child(void)
+{
+    pthread_mutex_init(&log_mutex, NULL);
+    pthread_cond_init(&log_cond, NULL);
+
+    log_started = false;
+
+    log_queue_head = NULL;
+    log_queue_tail = NULL;
+    log_current = NULL;
+
+    funlockfile(stdout);
+}
+
+void log_init(void)
+{
+    static bool log_atfork = false;
+
+    if (log_started) {
+        return;
+    }
+
+    log_started = true;
+    log_stop = false;
+
+    if (!log_atfork) {
+        pthread_atfork(log_fork_prepare, log_fork_parent, log_fork_child);
+        log_atfork = true;
+    }
+
+    pthread_create(&log_thread, NULL, log_writer, NULL);
+
+    // Messages before an exit() still make it out
+    atexit(log_close);
+}
+
+/* Hands the buffer of this thread to the writer */
+static void log_submit(void)
+{
+    log_buffer_t *buffer = log_current;
+
+    if (!buffer || !buffer->size) {
+        return;
+    }
+
+    log_current = NULL;
+    buffer->next = NULL;
+
+    pthread_mutex_lock(&log_mutex);
+
+    if (log_queue_tail) {
+        log_queue_tail->next = buffer;
+    } else {
+        log_queue_head = buffer;
+    }
+
+    log_queue_tail = buffer;
+
+    pthread_cond_signal(&log_cond);
+    pthread_mutex_unlock(&log_mutex);
+}
+
+/* Room for one more message in the buffer of this thread */
+static log_buffer_t *log_reserve(void)
+{
+    if (log_current && LOG_BUFFER_SIZE - log_current->size < LOG_MESSAGE_SIZE) {
+        log_submit();
+    }
+
+    if (!log_current) {
+        pthread_mutex_lock(&log_mutex);
+
+        log_current = log_free;
+
+        if (log_current) {
+            log_free = log_current->next;
+        }
+
+        pthread_mutex_unlock(&log_mutex);
+
+        if (!log_current) {
+            log_current = (log_buffer_t *) malloc(sizeof(log_buffer_t));
+        }
+
+        log_current->size = 0;
+    }
+
+    return log_current;
+}
+
+static void log_vprint(const char *color, char *prefix, const char *format, va_list args)
+{
+    if (!log_started) {
+        if (prefix) {
+            fprintf(stdout, "\e[0;%sm%s\e[0m ", color, prefix);
+        }
+
+        vfprintf(stdout, format, args);
+        return;
+    }
+
+    log_buffer_t *buffer = log_reserve();
+    char *end = &buffer->data[buffer->size];
+    int length = 0;
+
+    if (prefix) {
+        length = snprintf(end, LOG_MESSAGE_SIZE, "\e[0;%sm%s\e[0m ", color, prefix);
+
+        if (length >= LOG_MESSAGE_SIZE) {
+            length = LOG_MESSAGE_SIZE - 1;
+        }
+    }
+
+    // Longer messages are cut off
+    int message = vsnprintf(end + length, LOG_MESSAGE_SIZE - length, format, args);
+
+    if (message > 0) {
+        length += (message < LOG_MESSAGE_SIZE - length) ? message : LOG_MESSAGE_SIZE - length - 1;
+    }
+
+    buffer->size += length;
+}
+
+void log_flush(void)
+{
+    log_submit();
+}
+
+void log_close(void)
+{
+    if (!log_started) {
+        return;
+    }
+
+    log_submit();
+
+    pthread_mutex_lock(&log_mutex);
+    log_stop = true;
+    pthread_cond_signal(&log_cond);
+    pthread_mutex_unlock(&log_mutex);
+
+    pthread_join(log_thread, NULL);
+
+    log_started = false;
+}
+
+/* Comma separated category names, "all" or "none" */
+bool log_set_categories(const char *list)
+{
+    uint32_t mask = 0;
+    const char *name = list;
+
+    while (*name) {
+        size_t length = strcspn(name, ",");
+        bool found = false;
+
+        if (length == 3 && !strncmp(name, "all", 3)) {
+            mask = (1u << LOG_CATEGORY_COUNT) - 1;
+            found = true;
+        } else if (length == 4 && !strncmp(name, "none", 4)) {
+            found = true;
+        }
+
+        for (uint8_t i=0; i < LOG_CATEGORY_COUNT && !found; i++) {
+            if (strlen(log_category_names[i]) == length && !strncmp(name, log_category_names[i], length)) {
+                mask |= 1u << i;
+                found = true;
+            }
+        }
+
+        if (!found) {
+            log_error("LOG", "Unknown category %.*s\n", (int) length, name);
+            return false;
+        }
+
+        name += length;
+
+        if (*name == ',') {
+            name++;
+        }
+    }
+
+    log_mask = mask;
+
+    return true;
+}
+
+/* Messages per second and category, 0 for no limit */
+void log_set_rate(uint32_t rate)
+{
+    log_rate = rate;
+}
+
+/* Whether the next line of the category is still within its window */
+static bool log_allow(uint8_t category)
+{
+    log_limit_t *limit = &log_limits[category];
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    uint32_t window = (uint32_t) now.tv_sec;
+    uint32_t last = atomic_load_explicit(&limit->window, memory_order_relaxed);
+
+    if (window != last && atomic_compare_exchange_strong(&limit->window, &last, window)) {
+        atomic_store(&limit->count, 0);
+
+        uint32_t dropped = atomic_exchange(&limit->dropped, 0);
+
+        if (dropped) {
+            log_write(LOG_CATEGORY_COUNT, "LOG", "Dropped %u %s messages\n", dropped, log_category_names[category]);
+        }
+    }
+
+    if (atomic_fetch_add(&limit->count, 1) < log_rate) {
+        return true;
+    }
+
+    atomic_fetch_add(&limit->dropped, 1);
+
+    return false;
+}
+
 void log_info(char *prefix, const char *format, ...)
 {
     va_list args;
-    
-    fprintf(stdout, "\e[0;32m%s\e[0m ", prefix);
-    
+
     va_start(args, format);
-    vfprintf(stdout, format, args);
+    log_vprint("32", prefix, format, args);
     va_end(args);
+
+    log_flush();
 }
 
 void log_error(char *prefix, const char *format, ...)
 {
     va_list args;
-        
-    fprintf(stdout, "\e[0;31m%s\e[0m ", prefix);        
 
     va_start(args, format);
-    vfprintf(stdout, format, args);
+    log_vprint("31", prefix, format, args);
     va_end(args);
+
+    log_flush();
 }
 
-void log_debug(char *prefix, const char *format, ...)
+/* Behind log_debug and log_continue, a NULL prefix continues the last line */
+void log_write(uint8_t category, char *prefix, const char *format, ...)
 {
+    if (log_rate && category < LOG_CATEGORY_COUNT) {
+        if (prefix) {
+            if (log_allow(category)) {
+                log_dropping &= ~(1u << category);
+            } else {
+                log_dropping |= 1u << category;
+            }
+        }
+
+        if (log_dropping & (1u << category)) {
+            return;
+        }
+    }
+
     va_list args;
-    
-    fprintf(stdout, "\e[0;94m%s\e[0m ", prefix);
 
     va_start(args, format);
-    vfprintf(stdout, format, args);
+    log_vprint("94", prefix, format, args);
     va_end(args);
-}
\ No newline at end of file
+}
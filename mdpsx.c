@@ -2,43 +2,156 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <pthread.h>
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 
-#include "cpu/r3000.h"
-#include "bus/bus.h"
-#include "bios/bios.h"
+#include "core/mdpsx.h"
+#include "core/lockstep.h"
+#include "core/savestate.h"
+#include "core/rewind.h"
+#include "core/pacer.h"
 #include "renderer/renderer.h"
 #include "log.h"
 
-bool running = true;
-r3000_state_t r3000_state;
-bus_state_t bus_state;
 renderer_t renderer;
 
-int main()
+int main(int argc, char **argv)
 {
+    mdpsx_config_t config;
+    memset(&config, 0x00, sizeof(config));
+
+    config.engine = R3000_ENGINE_CACHED;
+
+    bool running = true;
+    const char *profile_path = NULL;
+    uint32_t lockstep_interval = 0;
+
+    // F5 saves to it and F9 loads from it
+    const char *state_path = "mdpsx.state";
+    bool load_state = false;
+
+    // Backspace goes back through them, 0 MiB turns it off
+    uint32_t rewind_limit = 0;
+    bool rewinding = false;
+
+    // Frames emulated ahead of the one shown, see mdpsx_run_frame_ahead
+    uint32_t run_ahead = 0;
+
+    // Unthrottled and showing every this many frames, 0 runs in real time
+    uint32_t turbo = 0;
+
+    // Frames in a row that may go undrawn while the host cannot keep up
+    uint32_t frameskip = 0;
+
+    /* Debug output is formatted on the emulator thread and written by another one */
+    log_init();
+
+    /* Parse arguments */
+    for (int i=1; i < argc; i++) {
+        if (!strcmp(argv[i], "--cpu") && i + 1 < argc) {
+            char *engine = argv[++i];
+
+            if (!strcmp(engine, "interpreter")) {
+                config.engine = R3000_ENGINE_INTERPRETER;
+            } else if (!strcmp(engine, "cached")) {
+                config.engine = R3000_ENGINE_CACHED;
+            } else if (!strcmp(engine, "jit")) {
+                config.engine = R3000_ENGINE_JIT;
+            } else {
+                log_error("mdpsx", "Unknown cpu engine: %s\n", engine);
+                exit(0);
+            }
+        } else if (!strcmp(argv[i], "--fastmem")) {
+            config.fastmem = true;
+        } else if (!strcmp(argv[i], "--hle")) {
+            config.hle = true;
+        } else if (!strcmp(argv[i], "--hle-dir") && i + 1 < argc) {
+            config.hle = true;
+            config.hle_dir = argv[++i];
+        } else if (!strcmp(argv[i], "--exe") && i + 1 < argc) {
+            config.exe_path = argv[++i];
+        } else if (!strcmp(argv[i], "--boot-cache") && i + 1 < argc) {
+            config.boot_cache = argv[++i];
+        } else if (!strcmp(argv[i], "--profile") && i + 1 < argc) {
+            config.profile = true;
+            profile_path = argv[++i];
+        } else if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+            config.trace_path = argv[++i];
+        } else if (!strcmp(argv[i], "--lockstep") && i + 1 < argc) {
+            lockstep_interval = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--state") && i + 1 < argc) {
+            state_path = argv[++i];
+        } else if (!strcmp(argv[i], "--load-state") && i + 1 < argc) {
+            state_path = argv[++i];
+            load_state = true;
+        } else if (!strcmp(argv[i], "--rewind") && i + 1 < argc) {
+            rewind_limit = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--run-ahead") && i + 1 < argc) {
+            run_ahead = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--turbo") && i + 1 < argc) {
+            turbo = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--frameskip") && i + 1 < argc) {
+            frameskip = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--log") && i + 1 < argc) {
+            if (!log_set_categories(argv[++i])) {
+                exit(0);
+            }
+        } else if (!strcmp(argv[i], "--log-rate") && i + 1 < argc) {
+            log_set_rate(strtoul(argv[++i], NULL, 0));
+        }
+    }
+
     /* Read BIOS */
+    uint8_t *bios = (uint8_t *) malloc(BUS_BIOS_SIZE);
+
     FILE *bios_fp = fopen("bios/bios.bin", "rb");
-    bus_state.bios = (uint8_t *) malloc(524288);
-    fread(bus_state.bios, 1, 524288, bios_fp);
+    fread(bios, 1, BUS_BIOS_SIZE, bios_fp);
     fclose(bios_fp);
 
-    bios_print_header(bus_state.bios);
+    config.bios = bios;
 
-    /* Init CPU */
-    r3000_state.pc_instruction = 0xBFC00000;
-    r3000_state.pc = 0xBFC00000;
-    r3000_state.pc_next = 0xBFC00004;
+    /* The window shows the candidate, the interpreter runs next to it headless */
+    lockstep_t lockstep;
+    mdpsx_t *mdpsx;
 
-    /* Init memory */
-    bus_state.ram = (uint8_t *) malloc(2048 * 1024);
-    bus_state.scratchpad = (uint8_t *) malloc(1024);
+    if (lockstep_interval) {
+        mdpsx = lockstep_init(&lockstep, &config, lockstep_interval, stderr) ? lockstep.candidate : NULL;
+    } else {
+        mdpsx = mdpsx_create(&config);
+    }
+
+    free(bios);
+
+    if (!mdpsx) {
+        exit(0);
+    }
+
+    if (load_state) {
+        if (!savestate_load(mdpsx, state_path)) {
+            exit(0);
+        }
+
+        if (lockstep_interval) {
+            savestate_load(lockstep.reference, state_path);
+            lockstep_checkpoint(&lockstep);
+        }
+    }
 
-    r3000_state.debug_enabled = &bus_state.debug_enabled;
+    savestate_t savestate;
+    savestate_init(&savestate);
+
+    /* One state a frame, a keyframe every half second */
+    rewind_t rewind;
+
+    if (rewind_limit && (lockstep_interval || !rewind_init(&rewind, 1, 30, (size_t) rewind_limit << 20))) {
+        rewind_limit = 0;
+    }
+
+    mdpsx_snapshot_t *run_ahead_snapshot = mdpsx_snapshot_create();
 
     /* Init SDL */
     if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
@@ -65,8 +178,17 @@ int main()
     /* Create OpenGL context */
     SDL_GLContext *gl_context = SDL_GL_CreateContext(window);
 
+    /* The pacer keeps the time, a swap waiting for the display would hold up turbo */
+    SDL_GL_SetSwapInterval(0);
+
     renderer_init(&renderer, window, sdl_renderer, gl_context);
-    bus_state.gpu_state.renderer = &renderer;
+
+    gpu_video_sink_t video;
+    renderer_video_sink(&renderer, &video);
+    mdpsx_set_video(mdpsx, &video);
+
+    pacer_t pacer;
+    pacer_init(&pacer, turbo, frameskip);
 
     SDL_Event event;
     while(running) {
@@ -74,14 +196,70 @@ int main()
             if (event.type == SDL_QUIT) {
                 running = false;
             }
+
+            /* Save states, writing the file does not hold up the frame */
+            if (event.type == SDL_KEYDOWN && !event.key.repeat && !lockstep_interval) {
+                switch (event.key.keysym.sym) {
+                    case SDLK_F5:
+                        savestate_save(&savestate, mdpsx, state_path, true);
+                        break;
+
+                    case SDLK_F9:
+                        // Has to read what F5 just saved
+                        savestate_wait(&savestate);
+                        savestate_load(mdpsx, state_path);
+                        pacer_reset(&pacer);
+                        break;
+
+                    case SDLK_BACKSPACE:
+                        rewinding = rewind_limit != 0;
+                        break;
+                }
+            }
+
+            if (event.type == SDL_KEYUP && event.key.keysym.sym == SDLK_BACKSPACE) {
+                rewinding = false;
+            }
         }
 
-        for (uint32_t i=0; i < 10000; i++) {
-            r3000_step(&r3000_state, &bus_state);
-            
-            timer_channel_tick(&bus_state.timer_state.channel_0, 0);
-            timer_channel_tick(&bus_state.timer_state.channel_1, 1);
-            timer_channel_tick(&bus_state.timer_state.channel_2, 2);
+        // Frames turbo or the frame skip leave out are not drawn at all, the GPU still runs
+        mdpsx_set_hidden(mdpsx, !pacer_present(&pacer));
+
+        /* Back one state and forward one frame to get it drawn, the frame is not kept */
+        if (rewinding && rewind_back(&rewind, mdpsx)) {
+            mdpsx_run_frame(mdpsx);
+        } else if (!lockstep_interval) {
+            mdpsx_run_frame_ahead(mdpsx, run_ahead_snapshot, run_ahead);
+
+            if (rewind_limit) {
+                rewind_frame(&rewind, mdpsx);
+            }
+        } else if (!lockstep_run(&lockstep, gpu_frame_cycles(&mdpsx->bus_state.gpu_state))) {
+            running = false;
         }
+
+        pacer_wait(&pacer, gpu_frame_cycles(&mdpsx->bus_state.gpu_state));
+    }
+
+    if (rewind_limit) {
+        rewind_destroy(&rewind);
+    }
+
+    mdpsx_snapshot_destroy(run_ahead_snapshot);
+    savestate_destroy(&savestate);
+
+    log_close();
+
+    #ifdef R3000_PROFILER
+    if (mdpsx->r3000_state.profiler) {
+        profiler_report(&mdpsx->profiler, stdout);
+        profiler_export(&mdpsx->profiler, profile_path);
+    }
+    #endif
+
+    if (lockstep_interval) {
+        lockstep_destroy(&lockstep);
+    } else {
+        mdpsx_destroy(mdpsx);
     }
 }
\ No newline at end of file
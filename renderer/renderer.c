@@ -22,9 +22,7 @@ uint32_t renderer_compile_shader(const char *source, const GLint *size, uint8_t
 
     glShaderSource(shader, 1, &source, size);
 
-    #ifdef LOG_DEBUG_RENDERER
-    log_debug("RENDERER", "Compiling %s shader (%d bytes)", (shader_type == SHADER_TYPE_VERTEX) ? "vertex" : "fragment", *size);
-    #endif
+    log_debug(LOG_RENDERER, "RENDERER", "Compiling %s shader (%d bytes)", (shader_type == SHADER_TYPE_VERTEX) ? "vertex" : "fragment", *size);
 
     glCompileShader(shader);
 
@@ -34,15 +32,15 @@ uint32_t renderer_compile_shader(const char *source, const GLint *size, uint8_t
 
     glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
     
-    #ifdef LOG_DEBUG_RENDERER
-    if (!success) {
-        glGetShaderInfoLog(shader, 512, NULL, log);
+    if (log_enabled(LOG_RENDERER)) {
+        if (!success) {
+            glGetShaderInfoLog(shader, 512, NULL, log);
 
-        printf(" | %s", log);
-    } else {
-        printf("\n");
+            log_continue(LOG_RENDERER, " | %s", log);
+        } else {
+            log_continue(LOG_RENDERER, "\n");
+        }
     }
-    #endif
 
     return shader;
 }
@@ -68,9 +66,7 @@ uint32_t renderer_create_program(char *vertex_path, char *fragment_path)
     uint32_t vertex_shader = renderer_compile_shader(vertex_source, (const GLint *) &vertex_source_size, SHADER_TYPE_VERTEX);
     uint32_t fragment_shader = renderer_compile_shader(fragment_source, (const GLint *) &fragment_source_size, SHADER_TYPE_FRAGMENT);
 
-    #ifdef LOG_DEBUG_RENDERER
-    log_debug("RENDERER", "Creating shader program (%s, %s)", vertex_path, fragment_path);
-    #endif
+    log_debug(LOG_RENDERER, "RENDERER", "Creating shader program (%s, %s)", vertex_path, fragment_path);
 
     int program = glCreateProgram();
     glAttachShader(program, vertex_shader);
@@ -81,14 +77,14 @@ uint32_t renderer_create_program(char *vertex_path, char *fragment_path)
     char log[512];
     glGetProgramiv(program, GL_LINK_STATUS, &success);
     
-    #ifdef LOG_DEBUG_RENDERER
-    if (!success) {
-        glGetProgramInfoLog(program, 512, NULL, log);
-        printf(" | %s\n", log);
-    } else {
-        printf("\n");
+    if (log_enabled(LOG_RENDERER)) {
+        if (!success) {
+            glGetProgramInfoLog(program, 512, NULL, log);
+            log_continue(LOG_RENDERER, " | %s\n", log);
+        } else {
+            log_continue(LOG_RENDERER, "\n");
+        }
     }
-    #endif
 
     glDeleteShader(vertex_shader);
     glDeleteShader(fragment_shader);
@@ -158,9 +154,7 @@ void renderer_init(renderer_t *renderer, SDL_Window *window, SDL_Renderer *sdl_r
 
     glewInit();
 
-    #ifdef LOG_DEBUG_RENDERER
-    log_debug("RENDERER", "OpenGL Version: %s | Vendor: %s\n", glGetString(GL_VERSION), glGetString(GL_VENDOR));
-    #endif
+    log_debug(LOG_RENDERER, "RENDERER", "OpenGL Version: %s | Vendor: %s\n", glGetString(GL_VERSION), glGetString(GL_VENDOR));
 
     renderer->program = renderer_create_program("renderer/vertex.glsl", "renderer/fragment.glsl");
     glUseProgram(renderer->program);
@@ -204,9 +198,7 @@ void renderer_monochrome_opaque_quad(renderer_t *renderer, uint32_t *args)
     uint8_t first_color_g = (args[0] >> 8) & 0xFF;
     uint8_t first_color_b = (args[0] >> 16) & 0xFF;
 
-    #ifdef LOG_DEBUG_RENDERER
-    log_debug("RENDERER", "Monochrome Opaque Quad | v0: %d, %d v1: %d, %d v2: %d, %d v3: %d, %d\n", v0_x, v0_y, v1_x, v1_y, v2_x, v2_y, v3_x, v3_y);
-    #endif
+    log_debug(LOG_RENDERER, "RENDERER", "Monochrome Opaque Quad | v0: %d, %d v1: %d, %d v2: %d, %d v3: %d, %d\n", v0_x, v0_y, v1_x, v1_y, v2_x, v2_y, v3_x, v3_y);
 
     renderer_push_args_t args0;
     renderer_push_args_t args1;
@@ -300,9 +292,7 @@ void renderer_textured_blend_quad(renderer_t *renderer, uint32_t *args)
         }
     }
 
-    #ifdef LOG_DEBUG_RENDERER
-    log_debug("RENDERER", "Textured Blend Quad | v0: %d, %d v1: %d, %d v2: %d, %d v3: %d, %d\n", v0_x, v0_y, v1_x, v1_y, v2_x, v2_y, v3_x, v3_y);
-    #endif
+    log_debug(LOG_RENDERER, "RENDERER", "Textured Blend Quad | v0: %d, %d v1: %d, %d v2: %d, %d v3: %d, %d\n", v0_x, v0_y, v1_x, v1_y, v2_x, v2_y, v3_x, v3_y);
 
     renderer_push_args_t args0;
     renderer_push_args_t args1;
@@ -382,9 +372,7 @@ void renderer_gouraud_triangle(renderer_t *renderer, uint32_t *args)
     uint8_t v2_col_g = (args[4] >> 8) & 0xFF;
     uint8_t v2_col_b = (args[4] >> 16) & 0xFF;
 
-    #ifdef LOG_DEBUG_RENDERER
-    log_debug("RENDERER", "Gouraud Triangle | v0: %d, %d v1: %d, %d v2: %d, %d\n", v0_x, v0_y, v1_x, v1_y, v2_x, v2_y);
-    #endif
+    log_debug(LOG_RENDERER, "RENDERER", "Gouraud Triangle | v0: %d, %d v1: %d, %d v2: %d, %d\n", v0_x, v0_y, v1_x, v1_y, v2_x, v2_y);
 
     renderer_push_args_t args0;
 
@@ -438,9 +426,7 @@ void renderer_gouraud_quad(renderer_t *renderer, uint32_t *args)
     uint8_t v3_col_g = (args[6] >> 8) & 0xFF;
     uint8_t v3_col_b = (args[6] >> 16) & 0xFF;
 
-    #ifdef LOG_DEBUG_RENDERER
-    log_debug("RENDERER", "Gouraud Quad | v0: %d, %d v1: %d, %d v2: %d, %d v3: %d, %d\n", v0_x, v0_y, v1_x, v1_y, v2_x, v2_y, v3_x, v3_y);
-    #endif
+    log_debug(LOG_RENDERER, "RENDERER", "Gouraud Quad | v0: %d, %d v1: %d, %d v2: %d, %d v3: %d, %d\n", v0_x, v0_y, v1_x, v1_y, v2_x, v2_y, v3_x, v3_y);
 
     renderer_push_args_t args0;
     renderer_push_args_t args1;
@@ -481,4 +467,42 @@ void renderer_gouraud_quad(renderer_t *renderer, uint32_t *args)
 
     renderer_push(renderer, args0);
     renderer_push(renderer, args1);
-}
\ No newline at end of file
+}
+
+/* The GPU only knows the sink, these forward to the functions above */
+
+static void renderer_sink_monochrome_opaque_quad(void *data, uint32_t *args)
+{
+    renderer_monochrome_opaque_quad((renderer_t *) data, args);
+}
+
+static void renderer_sink_textured_blend_quad(void *data, uint32_t *args)
+{
+    renderer_textured_blend_quad((renderer_t *) data, args);
+}
+
+static void renderer_sink_gouraud_triangle(void *data, uint32_t *args)
+{
+    renderer_gouraud_triangle((renderer_t *) data, args);
+}
+
+static void renderer_sink_gouraud_quad(void *data, uint32_t *args)
+{
+    renderer_gouraud_quad((renderer_t *) data, args);
+}
+
+static void renderer_sink_render(void *data)
+{
+    renderer_render((renderer_t *) data);
+}
+
+void renderer_video_sink(renderer_t *renderer, gpu_video_sink_t *sink)
+{
+    sink->data = renderer;
+
+    sink->monochrome_opaque_quad = renderer_sink_monochrome_opaque_quad;
+    sink->textured_blend_quad = renderer_sink_textured_blend_quad;
+    sink->gouraud_triangle = renderer_sink_gouraud_triangle;
+    sink->gouraud_quad = renderer_sink_gouraud_quad;
+    sink->render = renderer_sink_render;
+}
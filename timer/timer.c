@@ -3,12 +3,14 @@
 #include <stdio.h>
 
 #include "timer/timer.h"
+#include "core/instrument.h"
 #include "log.h"
 
 #define TIMER_CHANNEL_MODE_RESET_COUNTER                (1 << 3)
 #define TIMER_CHANNEL_MODE_IRQ_COUNTER_EQUALS_TARGET    (1 << 4)
 #define TIMER_CHANNEL_MODE_IRQ_COUNTER_EQUALS_FFFF      (1 << 5)
 #define TIMER_CHANNEL_MODE_IRQ_REPEAT                   (1 << 6)
+#define TIMER_CHANNEL_MODE_CLOCK_SOURCE                 (3 << 8)
 #define TIMER_CHANNEL_MODE_REACHED_TARGET               (1 << 11)
 #define TIMER_CHANNEL_MODE_REACHED_FFFF                 (1 << 12)
 
@@ -16,18 +18,14 @@ uint32_t timer_channel_read(timer_channel_t *channel, uint8_t channel_num, uint8
 {
     uint32_t result = 0;
 
-    #ifdef LOG_DEBUG_TIMER
-    log_debug("TIMER", "Channel %d | ", channel_num);
-    #endif
+    log_debug(LOG_TIMER, "TIMER", "Channel %d | ", channel_num);
 
     switch(reg) {
         case 0x0:
             result = channel->counter;
 
             // Counter
-            #ifdef LOG_DEBUG_TIMER
-            printf("%08X <- Counter\n", result);
-            #endif
+            log_continue(LOG_TIMER, "%08X <- Counter\n", result);
 
             break;
 
@@ -35,9 +33,7 @@ uint32_t timer_channel_read(timer_channel_t *channel, uint8_t channel_num, uint8
             result = channel->mode;
 
             // Mode
-            #ifdef LOG_DEBUG_TIMER
-            printf("%08X <- Mode\n", result);
-            #endif
+            log_continue(LOG_TIMER, "%08X <- Mode\n", result);
 
             channel->mode &= ~TIMER_CHANNEL_MODE_REACHED_TARGET;
             channel->mode &= ~TIMER_CHANNEL_MODE_REACHED_FFFF;
@@ -48,9 +44,7 @@ uint32_t timer_channel_read(timer_channel_t *channel, uint8_t channel_num, uint8
             result = channel->target;
 
             // Target
-            #ifdef LOG_DEBUG_TIMER
-            printf("%08X <- Target\n", result);
-            #endif
+            log_continue(LOG_TIMER, "%08X <- Target\n", result);
 
             break;     
     }
@@ -60,16 +54,12 @@ uint32_t timer_channel_read(timer_channel_t *channel, uint8_t channel_num, uint8
 
 void timer_channel_write(timer_channel_t *channel, uint8_t channel_num, uint8_t reg, uint32_t value)
 {
-    #ifdef LOG_DEBUG_TIMER
-    log_debug("TIMER", "Channel %d | ", channel_num);
-    #endif
+    log_debug(LOG_TIMER, "TIMER", "Channel %d | ", channel_num);
 
     switch(reg) {
         case 0x0:
             // Counter
-            #ifdef LOG_DEBUG_TIMER
-            printf("%08X -> Counter\n", value);
-            #endif
+            log_continue(LOG_TIMER, "%08X -> Counter\n", value);
 
             channel->counter = value;
 
@@ -77,19 +67,18 @@ void timer_channel_write(timer_channel_t *channel, uint8_t channel_num, uint8_t
 
         case 0x4:
             // Mode
-            #ifdef LOG_DEBUG_TIMER
-            printf("%08X -> Mode\n", value);
-            #endif
+            log_continue(LOG_TIMER, "%08X -> Mode\n", value);
 
             channel->mode = value;
+            channel->counter = 0;
+            channel->fraction = 0;
+            channel->irq_req = false;
 
             break;
 
         case 0x8:
             // Target
-            #ifdef LOG_DEBUG_TIMER
-            printf("%08X -> Target\n", value);
-            #endif
+            log_continue(LOG_TIMER, "%08X -> Target\n", value);
 
             channel->target = value;
 
@@ -101,6 +90,10 @@ uint32_t timer_read(timer_state_t *state, uint32_t addr)
 {
     uint32_t result = 0;
 
+    instrument_begin(INSTRUMENT_TIMER);
+
+    state->reads++;
+
     switch(addr & 0xF0) {
         case 0x00:
             // Channel 0
@@ -118,11 +111,15 @@ uint32_t timer_read(timer_state_t *state, uint32_t addr)
             break;
     }
 
+    instrument_end();
+
     return result;
 }
 
 void timer_write(timer_state_t *state, uint32_t addr, uint32_t value)
 {
+    instrument_begin(INSTRUMENT_TIMER);
+
     switch(addr & 0xF0) {
         case 0x00:
             // Channel 0
@@ -139,38 +136,261 @@ void timer_write(timer_state_t *state, uint32_t addr, uint32_t value)
             timer_channel_write(&state->channel_2, 0, addr & 0xF, value);
             break;
     }
+
+    instrument_end();
+}
+
+static void timer_channel_irq(timer_state_t *state, timer_channel_t *channel, uint8_t channel_num)
+{
+    if (channel->irq_req && !(channel->mode & TIMER_CHANNEL_MODE_IRQ_REPEAT)) {
+        return;
+    }
+
+    channel->irq_req = true;
+
+    irq_raise(state->irq_state, IRQ_TIMER0 + channel_num);
+}
+
+static timer_channel_t *timer_channel(timer_state_t *state, uint8_t channel_num)
+{
+    switch(channel_num) {
+        case 0:
+            return &state->channel_0;
+
+        case 1:
+            return &state->channel_1;
+
+        default:
+            return &state->channel_2;
+    }
+}
+
+/* Ticks per CPU cycle as num / den, picked by the clock source bits of the mode */
+static void timer_channel_rate(timer_state_t *state, timer_channel_t *channel, uint8_t channel_num, uint32_t *num, uint32_t *den)
+{
+    uint8_t source = (channel->mode & TIMER_CHANNEL_MODE_CLOCK_SOURCE) >> 8;
+
+    *num = 1;
+    *den = 1;
+
+    switch(channel_num) {
+        case 0:
+            // Dot clock
+            if (source & 1) {
+                gpu_clock_ratio(state->gpu_state, num, den);
+                *den *= gpu_dot_clocks(state->gpu_state);
+            }
+
+            break;
+
+        case 1:
+            // HBlank
+            if (source & 1) {
+                gpu_clock_ratio(state->gpu_state, num, den);
+                *den *= gpu_scanline_clocks(state->gpu_state);
+            }
+
+            break;
+
+        case 2:
+            // System clock / 8
+            if (source & 2) {
+                *den = 8;
+            }
+
+            break;
+    }
+}
+
+/* Last value before the counter goes back to 0, past the target it has to go around through FFFF */
+static uint32_t timer_channel_end(timer_channel_t *channel)
+{
+    if ((channel->mode & TIMER_CHANNEL_MODE_RESET_COUNTER) && channel->counter <= channel->target) {
+        return channel->target;
+    }
+
+    return 0xFFFF;
 }
 
-void timer_channel_tick(timer_channel_t *channel, uint8_t channel_num)
+/* Flags and interrupts for every value in (from, to] */
+static void timer_channel_pass(timer_state_t *state, timer_channel_t *channel, uint8_t channel_num, int32_t from, uint32_t to)
 {
-    if (channel->counter == 0xFFFF) {
-        #ifdef LOG_DEBUG_TIMER
-        log_debug("TIMER", "Channel %d | Counter reached FFFF\n", channel_num);
-        #endif
- 
-        if (!(channel->mode & TIMER_CHANNEL_MODE_RESET_COUNTER)) {
-            channel->counter = 0x0000;
+    if ((int32_t) channel->target > from && channel->target <= to) {
+        log_debug(LOG_TIMER, "TIMER", "Channel %d | Counter reached target value\n", channel_num);
+
+        if (channel->mode & TIMER_CHANNEL_MODE_IRQ_COUNTER_EQUALS_TARGET) {
+            timer_channel_irq(state, channel, channel_num);
         }
 
+        channel->mode |= TIMER_CHANNEL_MODE_REACHED_TARGET;
+    }
+
+    if (from < 0xFFFF && to == 0xFFFF) {
+        log_debug(LOG_TIMER, "TIMER", "Channel %d | Counter reached FFFF\n", channel_num);
+
         if (channel->mode & TIMER_CHANNEL_MODE_IRQ_COUNTER_EQUALS_FFFF) {
-            channel->irq_req = true;
+            timer_channel_irq(state, channel, channel_num);
         }
 
         channel->mode |= TIMER_CHANNEL_MODE_REACHED_FFFF;
     }
+}
 
-    if (channel->counter == channel->target) {
-        #ifdef LOG_DEBUG_TIMER
-        log_debug("TIMER", "Channel %d | Counter reached target value\n", channel_num);
-        #endif
+/* Counts a number of ticks at once */
+static void timer_channel_advance(timer_state_t *state, timer_channel_t *channel, uint8_t channel_num, uint32_t ticks)
+{
+    while (ticks) {
+        uint32_t counter = channel->counter;
+        uint32_t end = timer_channel_end(channel);
+
+        if (ticks <= end - counter) {
+            timer_channel_pass(state, channel, channel_num, counter, counter + ticks);
+            channel->counter = counter + ticks;
+            return;
+        }
 
-        if (channel->mode & TIMER_CHANNEL_MODE_IRQ_COUNTER_EQUALS_TARGET) {
-            channel->irq_req = true;
+        // Up to the end and around to 0
+        timer_channel_pass(state, channel, channel_num, counter, end);
+        timer_channel_pass(state, channel, channel_num, -1, 0);
+
+        ticks -= end - counter + 1;
+        channel->counter = 0;
+
+        // Every further period from 0 passes the same values, the flags only have to be set once
+        uint32_t period = timer_channel_end(channel) + 1;
+
+        if (ticks >= period) {
+            timer_channel_pass(state, channel, channel_num, -1, period - 1);
+            ticks %= period;
         }
+    }
+}
 
-        channel->counter = 0x0000;
-        channel->mode |= TIMER_CHANNEL_MODE_REACHED_TARGET;
+/* Computes the counters for the given scheduler cycle from the cycles passed since the last sync */
+static void timer_sync_to(timer_state_t *state, uint64_t cycles)
+{
+    // They never go back
+    if (cycles <= state->cycles) {
+        return;
+    }
+
+    uint64_t elapsed = cycles - state->cycles;
+
+    instrument_begin(INSTRUMENT_TIMER);
+
+    for (uint8_t channel_num=0; channel_num < 3; channel_num++) {
+        timer_channel_t *channel = timer_channel(state, channel_num);
+        uint32_t num, den;
+
+        timer_channel_rate(state, channel, channel_num, &num, &den);
+
+        uint64_t total = channel->fraction + elapsed * num;
+        channel->fraction = total % den;
+
+        timer_channel_advance(state, channel, channel_num, total / den);
+    }
+
+    state->cycles = cycles;
+
+    instrument_end();
+}
+
+/* Same for the 32 bit CPU cycle counter */
+void timer_sync(timer_state_t *state, uint32_t cycles)
+{
+    timer_sync_to(state, scheduler_cycles(state->scheduler, cycles));
+}
+
+/* Ticks until the counter next holds the given value, UINT32_MAX if it never does */
+static uint32_t timer_channel_ticks_to(timer_channel_t *channel, uint32_t value)
+{
+    uint32_t counter = channel->counter;
+    uint32_t end = timer_channel_end(channel);
+
+    if (value > counter && value <= end) {
+        return value - counter;
+    }
+
+    // Around through 0, from there on the counter stays within the period
+    uint32_t period_end = (channel->mode & TIMER_CHANNEL_MODE_RESET_COUNTER) ? channel->target : 0xFFFF;
+
+    if (value > period_end) {
+        return UINT32_MAX;
+    }
+
+    return end - counter + 1 + value;
+}
+
+/* CPU cycles from the last sync until the channel requests an interrupt, UINT32_MAX if it never does */
+static uint32_t timer_channel_next_event(timer_state_t *state, timer_channel_t *channel, uint8_t channel_num)
+{
+    uint32_t ticks = UINT32_MAX;
+
+    // One-shot and already fired, nothing more happens until the mode is written
+    if (channel->irq_req && !(channel->mode & TIMER_CHANNEL_MODE_IRQ_REPEAT)) {
+        return UINT32_MAX;
+    }
+
+    if (channel->mode & TIMER_CHANNEL_MODE_IRQ_COUNTER_EQUALS_TARGET) {
+        ticks = timer_channel_ticks_to(channel, channel->target);
     }
 
-    channel->counter++;
-}
\ No newline at end of file
+    if (channel->mode & TIMER_CHANNEL_MODE_IRQ_COUNTER_EQUALS_FFFF) {
+        uint32_t ffff = timer_channel_ticks_to(channel, 0xFFFF);
+
+        if (ffff < ticks) ticks = ffff;
+    }
+
+    if (ticks == UINT32_MAX) {
+        return UINT32_MAX;
+    }
+
+    uint32_t num, den;
+    timer_channel_rate(state, channel, channel_num, &num, &den);
+
+    // The fraction can be left over from a faster dot clock
+    uint64_t needed = (uint64_t) ticks * den;
+    needed = needed > channel->fraction ? needed - channel->fraction : 0;
+
+    uint64_t cycles = (needed + num - 1) / num;
+
+    return cycles ? cycles : 1;
+}
+
+/* CPU cycles from the last sync until the first interrupt request, UINT32_MAX if none is armed */
+static uint32_t timer_next_event(timer_state_t *state)
+{
+    uint32_t next = UINT32_MAX;
+
+    for (uint8_t channel_num=0; channel_num < 3; channel_num++) {
+        uint32_t cycles = timer_channel_next_event(state, timer_channel(state, channel_num), channel_num);
+
+        if (cycles < next) next = cycles;
+    }
+
+    return next;
+}
+
+/* Puts the timer event at the first interrupt request, has to follow every sync that changed the channels */
+void timer_schedule(timer_state_t *state)
+{
+    uint32_t next = timer_next_event(state);
+
+    if (next == UINT32_MAX) {
+        scheduler_cancel(state->scheduler, SCHEDULER_EVENT_TIMER);
+    } else {
+        scheduler_schedule(state->scheduler, SCHEDULER_EVENT_TIMER, state->cycles + next);
+    }
+}
+
+void timer_event(void *data, uint64_t cycles)
+{
+    timer_state_t *state = (timer_state_t *) data;
+
+    instrument_begin(INSTRUMENT_TIMER);
+
+    timer_sync_to(state, cycles);
+    timer_schedule(state);
+
+    instrument_end();
+}
@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "core/mdpsx.h"
+#include "core/instrument.h"
+#include "core/lockstep.h"
+#include "core/savestate.h"
+#include "core/rewind.h"
+#include "log.h"
+
+#define MDBENCH_CLOCK       33868800
+#define MDBENCH_CYCLES      100000000
+
+static const char *mdbench_engine_names[] = {"interpreter", "cached", "jit"};
+
+static double mdbench_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void mdbench_usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [options]\n", name);
+    fprintf(stderr, "  --cycles N           Run N emulated cycles (default %u)\n", MDBENCH_CYCLES);
+    fprintf(stderr, "  --frames N           Run N emulated frames instead\n");
+    fprintf(stderr, "  --cpu ENGINE         interpreter, cached or jit (default cached)\n");
+    fprintf(stderr, "  --fastmem            Use the fastmem window (default page tables)\n");
+    fprintf(stderr, "  --hle                Use the HLE kernel calls\n");
+    fprintf(stderr, "  --exe FILE           Side-load a PS-X EXE\n");
+    fprintf(stderr, "  --boot-cache FILE    Fast boot from a cached kernel state\n");
+    fprintf(stderr, "  --bios FILE          BIOS image (default bios/bios.bin)\n");
+    fprintf(stderr, "  --load-state FILE    Start from a save state\n");
+    fprintf(stderr, "  --save-state FILE    Save the state at the end of the run\n");
+    fprintf(stderr, "  --rewind MB          Keep rewind states every frame, up to MB MiB\n");
+    fprintf(stderr, "  --run-ahead N        Emulate N hidden frames ahead of every frame\n");
+    fprintf(stderr, "  --lockstep N         Check against the interpreter every N slices\n");
+    fprintf(stderr, "  --json FILE          Write the results as JSON, - for stdout\n");
+}
+
+int main(int argc, char **argv)
+{
+    mdpsx_config_t config;
+    memset(&config, 0x00, sizeof(config));
+
+    config.engine = R3000_ENGINE_CACHED;
+
+    const char *bios_path = "bios/bios.bin";
+    const char *json_path = NULL;
+    uint64_t target_cycles = MDBENCH_CYCLES;
+    uint32_t target_frames = 0;
+    uint32_t lockstep_interval = 0;
+    const char *load_state_path = NULL;
+    const char *save_state_path = NULL;
+    uint32_t rewind_limit = 0;
+    uint32_t run_ahead = 0;
+
+    /* Parse arguments */
+    for (int i=1; i < argc; i++) {
+        if (!strcmp(argv[i], "--cycles") && i + 1 < argc) {
+            target_cycles = strtoull(argv[++i], NULL, 0);
+            target_frames = 0;
+        } else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            target_frames = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--cpu") && i + 1 < argc) {
+            char *engine = argv[++i];
+
+            if (!strcmp(engine, "interpreter")) {
+                config.engine = R3000_ENGINE_INTERPRETER;
+            } else if (!strcmp(engine, "cached")) {
+                config.engine = R3000_ENGINE_CACHED;
+            } else if (!strcmp(engine, "jit")) {
+                config.engine = R3000_ENGINE_JIT;
+            } else {
+                fprintf(stderr, "Unknown cpu engine: %s\n", engine);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--fastmem")) {
+            config.fastmem = true;
+        } else if (!strcmp(argv[i], "--hle")) {
+            config.hle = true;
+        } else if (!strcmp(argv[i], "--exe") && i + 1 < argc) {
+            config.exe_path = argv[++i];
+        } else if (!strcmp(argv[i], "--boot-cache") && i + 1 < argc) {
+            config.boot_cache = argv[++i];
+        } else if (!strcmp(argv[i], "--bios") && i + 1 < argc) {
+            bios_path = argv[++i];
+        } else if (!strcmp(argv[i], "--load-state") && i + 1 < argc) {
+            load_state_path = argv[++i];
+        } else if (!strcmp(argv[i], "--save-state") && i + 1 < argc) {
+            save_state_path = argv[++i];
+        } else if (!strcmp(argv[i], "--rewind") && i + 1 < argc) {
+            rewind_limit = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--run-ahead") && i + 1 < argc) {
+            run_ahead = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--lockstep") && i + 1 < argc) {
+            lockstep_interval = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--json") && i + 1 < argc) {
+            json_path = argv[++i];
+        } else {
+            mdbench_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    /* Read BIOS */
+    uint8_t *bios = (uint8_t *) malloc(BUS_BIOS_SIZE);
+    FILE *bios_fp = fopen(bios_path, "rb");
+
+    if (!bios_fp || fread(bios, 1, BUS_BIOS_SIZE, bios_fp) != BUS_BIOS_SIZE) {
+        fprintf(stderr, "Failed to read BIOS %s\n", bios_path);
+        return 1;
+    }
+
+    fclose(bios_fp);
+
+    config.bios = bios;
+
+    // Setup and side-loading are not part of the measurement
+    lockstep_t lockstep;
+    mdpsx_t *mdpsx;
+
+    if (lockstep_interval) {
+        mdpsx = lockstep_init(&lockstep, &config, lockstep_interval, stderr) ? lockstep.candidate : NULL;
+    } else {
+        mdpsx = mdpsx_create(&config);
+    }
+
+    free(bios);
+
+    if (!mdpsx) {
+        return 1;
+    }
+
+    // Both sides of a lockstep run have to start from the same state
+    if (load_state_path) {
+        if (!savestate_load(mdpsx, load_state_path)) {
+            return 1;
+        }
+
+        if (lockstep_interval) {
+            if (!savestate_load(lockstep.reference, load_state_path)) {
+                return 1;
+            }
+
+            lockstep_checkpoint(&lockstep);
+        }
+    }
+
+    r3000_state_t *r3000_state = &mdpsx->r3000_state;
+    gpu_state_t *gpu_state = &mdpsx->bus_state.gpu_state;
+
+    rewind_t rewind;
+
+    if (rewind_limit && !rewind_init(&rewind, 1, 30, (size_t) rewind_limit << 20)) {
+        return 1;
+    }
+
+    // Only the real frames count, the speculative ones are thrown away
+    mdpsx_snapshot_t *run_ahead_snapshot = mdpsx_snapshot_create();
+
+    uint64_t cycles = 0;
+    uint64_t idle_cycles = 0;
+    uint32_t frames = 0;
+
+    instrument_reset();
+    double start = mdbench_now();
+
+    /* Run headless in slices of one frame, the counters are 32 bit and would wrap on long runs */
+    while (target_frames ? (frames < target_frames) : (cycles < target_cycles)) {
+        uint32_t slice = gpu_frame_cycles(gpu_state);
+
+        if (!target_frames && target_cycles - cycles < slice) {
+            slice = target_cycles - cycles;
+        }
+
+        uint32_t cycles_start = r3000_state->cycles;
+        uint32_t idle_start = r3000_state->idle_cycles;
+        uint32_t frames_start = gpu_state->frames;
+
+        if (lockstep_interval) {
+            if (!lockstep_run(&lockstep, slice)) {
+                lockstep_destroy(&lockstep);
+                return 2;
+            }
+        } else if (slice == gpu_frame_cycles(gpu_state)) {
+            mdpsx_run_frame_ahead(mdpsx, run_ahead_snapshot, run_ahead);
+        } else {
+            mdpsx_run_cycles(mdpsx, slice);
+        }
+
+        if (rewind_limit) {
+            rewind_frame(&rewind, mdpsx);
+        }
+
+        cycles += (uint32_t) (r3000_state->cycles - cycles_start);
+        idle_cycles += (uint32_t) (r3000_state->idle_cycles - idle_start);
+        frames += gpu_state->frames - frames_start;
+    }
+
+    double seconds = mdbench_now() - start;
+
+    // Skipped idle loops and HLE calls count as cycles but not as instructions
+    uint64_t instructions = cycles - idle_cycles;
+
+    double mips = instructions / seconds / 1e6;
+    double fps = frames / seconds;
+    double realtime = (cycles / (double) MDBENCH_CLOCK) / seconds;
+
+    uint32_t pc = r3000_state->pc;
+    uint64_t ram_hash = mdpsx_hash(mdpsx->bus_state.ram, BUS_RAM_SIZE);
+    uint64_t vram_hash = mdpsx_hash((uint8_t *) gpu_state->vram, sizeof(gpu_state->vram));
+
+    // The JIT falls back to the cached interpreter when it can not run
+    const char *engine = mdbench_engine_names[r3000_state->engine];
+    bool fastmem = mdpsx->bus_state.fastmem;
+    uint32_t fastmem_faults = mdpsx->block_cache.jit ? mdpsx->jit.fastmem_faults : 0;
+
+    if (save_state_path) {
+        savestate_t savestate;
+        savestate_init(&savestate);
+
+        bool saved = savestate_save(&savestate, mdpsx, save_state_path, true) && savestate_wait(&savestate);
+        savestate_destroy(&savestate);
+
+        if (!saved) {
+            return 1;
+        }
+    }
+
+    log_flush();
+
+    /* Report */
+    printf("Engine:        %s%s%s\n", engine, fastmem ? " fastmem" : "", config.hle ? " hle" : "");
+    printf("Wall time:     %.3f s\n", seconds);
+    printf("Cycles:        %lu (%.2fx real time)\n", cycles, realtime);
+    printf("Instructions:  %lu (%.2f MIPS)\n", instructions, mips);
+    printf("Frames:        %u (%.1f fps)\n", frames, fps);
+    printf("PC:            %08X\n", pc);
+    printf("RAM hash:      %016lx\n", ram_hash);
+    printf("VRAM hash:     %016lx\n", vram_hash);
+
+    // Every fault is a patched IO access, this only grows with recompiled blocks
+    if (fastmem) {
+        printf("Fastmem:       %u faults\n", fastmem_faults);
+    }
+
+    #ifdef MDPSX_INSTRUMENT
+    printf("\n%-10s %10s %7s\n", "Subsystem", "Time", "Share");
+
+    for (int i=0; i < INSTRUMENT_COUNT; i++) {
+        double section = instrument_nanoseconds(i) / 1e9;
+        printf("%-10s %8.3f s %6.1f%%\n", instrument_section_names[i], section, section / seconds * 100);
+    }
+    #else
+    printf("\nSubsystem times need a build with make INSTRUMENT=1\n");
+    #endif
+
+    if (json_path) {
+        FILE *fp = strcmp(json_path, "-") ? fopen(json_path, "w") : stdout;
+
+        if (!fp) {
+            fprintf(stderr, "Failed to open %s\n", json_path);
+            return 1;
+        }
+
+        fprintf(fp, "{\"engine\": \"%s\", \"fastmem\": %s, \"hle\": %s, ", engine, fastmem ? "true" : "false", config.hle ? "true" : "false");
+        fprintf(fp, "\"seconds\": %.6f, \"cycles\": %lu, \"instructions\": %lu, \"frames\": %u, ", seconds, cycles, instructions, frames);
+        fprintf(fp, "\"mips\": %.3f, \"fps\": %.3f, \"realtime\": %.4f, ", mips, fps, realtime);
+        fprintf(fp, "\"pc\": \"%08X\", \"ram_hash\": \"%016lx\", \"vram_hash\": \"%016lx\"", pc, ram_hash, vram_hash);
+
+        if (fastmem) {
+            fprintf(fp, ", \"fastmem_faults\": %u", fastmem_faults);
+        }
+
+        #ifdef MDPSX_INSTRUMENT
+        fprintf(fp, ", \"subsystems\": {");
+
+        for (int i=0; i < INSTRUMENT_COUNT; i++) {
+            fprintf(fp, "%s\"%s\": %.6f", i ? ", " : "", instrument_section_names[i], instrument_nanoseconds(i) / 1e9);
+        }
+
+        fprintf(fp, "}");
+        #endif
+
+        fprintf(fp, "}\n");
+
+        if (fp != stdout) {
+            fclose(fp);
+        }
+    }
+
+    mdpsx_snapshot_destroy(run_ahead_snapshot);
+
+    if (rewind_limit) {
+        fprintf(stderr, "Rewind: %lu captures, %lu dropped, %u kept in %.1f MiB\n", rewind.captures, rewind.dropped, rewind.count, rewind.size / 1048576.0);
+        rewind_destroy(&rewind);
+    }
+
+    if (lockstep_interval) {
+        fprintf(stderr, "Lockstep: %lu slices, %lu comparisons, no divergence\n", lockstep.slices, lockstep.comparisons);
+        lockstep_destroy(&lockstep);
+    } else {
+        mdpsx_destroy(mdpsx);
+    }
+
+    return 0;
+}
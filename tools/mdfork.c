@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "core/mdpsx.h"
+#include "core/forkserver.h"
+#include "core/savestate.h"
+#include "log.h"
+
+#define MDFORK_BOOT_CYCLES  200000000
+
+typedef struct mdfork_case_t {
+    const char *path;
+    uint8_t *data;
+    uint32_t size;
+} mdfork_case_t;
+
+typedef struct mdfork_input_t {
+    mdfork_case_t *cases;
+    uint32_t count;
+
+    // RAM address every test case is written to
+    uint32_t addr;
+} mdfork_input_t;
+
+static double mdfork_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Runs in the child, the RAM pages it touches are the only ones that get copied */
+static void mdfork_setup(mdpsx_t *mdpsx, uint32_t test, void *data)
+{
+    mdfork_input_t *input = (mdfork_input_t *) data;
+
+    if (!input->count) {
+        return;
+    }
+
+    mdfork_case_t *test_case = &input->cases[test % input->count];
+    uint32_t addr = input->addr & (BUS_RAM_SIZE - 1);
+    uint32_t size = (addr + test_case->size > BUS_RAM_SIZE) ? BUS_RAM_SIZE - addr : test_case->size;
+
+    memcpy(mdpsx->bus_state.ram + addr, test_case->data, size);
+
+    // Compiled blocks over the input have to go
+    for (uint32_t offset=0; offset < size; offset += 4) {
+        block_cache_write(mdpsx->bus_state.block_cache, addr + offset);
+    }
+}
+
+static bool mdfork_read_case(mdfork_case_t *test_case, const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+
+    if (!fp) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return false;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    test_case->path = path;
+    test_case->data = (uint8_t *) malloc(size ? size : 1);
+    test_case->size = fread(test_case->data, 1, size, fp);
+
+    fclose(fp);
+
+    return true;
+}
+
+static void mdfork_usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [options] [CASE...]\n", name);
+    fprintf(stderr, "  --cpu ENGINE         interpreter, cached or jit (default cached)\n");
+    fprintf(stderr, "  --hle                Use the HLE kernel calls\n");
+    fprintf(stderr, "  --exe FILE           Side-load a PS-X EXE\n");
+    fprintf(stderr, "  --boot-cache FILE    Fast boot from a cached kernel state\n");
+    fprintf(stderr, "  --bios FILE          BIOS image (default bios/bios.bin)\n");
+    fprintf(stderr, "  --load-state FILE    Start from a save state\n");
+    fprintf(stderr, "  --boot-pc PC         Boot until PC before forking\n");
+    fprintf(stderr, "  --boot-frames N      Boot N frames before forking\n");
+    fprintf(stderr, "  --cycles N           Cycle budget of a test (default one frame)\n");
+    fprintf(stderr, "  --frames N           Frame budget of a test instead\n");
+    fprintf(stderr, "  --stop-pc PC         End a test once it gets to PC\n");
+    fprintf(stderr, "  --input ADDR         Write every CASE file to RAM at ADDR\n");
+    fprintf(stderr, "  --tests N            Number of tests, the cases repeat (default one per case)\n");
+    fprintf(stderr, "  --jobs N             Children running at the same time (default 1)\n");
+}
+
+int main(int argc, char **argv)
+{
+    mdpsx_config_t config;
+    memset(&config, 0x00, sizeof(config));
+
+    config.engine = R3000_ENGINE_CACHED;
+
+    const char *bios_path = "bios/bios.bin";
+    const char *load_state_path = NULL;
+    uint32_t boot_pc = 0;
+    uint32_t boot_frames = 0;
+    uint32_t cycles = 0;
+    uint32_t frames = 0;
+    uint32_t stop_pc = 0;
+    uint32_t tests = 0;
+    uint32_t jobs = 1;
+
+    mdfork_input_t input;
+    memset(&input, 0x00, sizeof(input));
+
+    input.cases = (mdfork_case_t *) calloc(argc, sizeof(mdfork_case_t));
+
+    /* Parse arguments */
+    for (int i=1; i < argc; i++) {
+        if (!strcmp(argv[i], "--cpu") && i + 1 < argc) {
+            char *engine = argv[++i];
+
+            if (!strcmp(engine, "interpreter")) {
+                config.engine = R3000_ENGINE_INTERPRETER;
+            } else if (!strcmp(engine, "cached")) {
+                config.engine = R3000_ENGINE_CACHED;
+            } else if (!strcmp(engine, "jit")) {
+                config.engine = R3000_ENGINE_JIT;
+            } else {
+                fprintf(stderr, "Unknown cpu engine: %s\n", engine);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--hle")) {
+            config.hle = true;
+        } else if (!strcmp(argv[i], "--exe") && i + 1 < argc) {
+            config.exe_path = argv[++i];
+        } else if (!strcmp(argv[i], "--boot-cache") && i + 1 < argc) {
+            config.boot_cache = argv[++i];
+        } else if (!strcmp(argv[i], "--bios") && i + 1 < argc) {
+            bios_path = argv[++i];
+        } else if (!strcmp(argv[i], "--load-state") && i + 1 < argc) {
+            load_state_path = argv[++i];
+        } else if (!strcmp(argv[i], "--boot-pc") && i + 1 < argc) {
+            boot_pc = strtoul(argv[++i], NULL, 16);
+        } else if (!strcmp(argv[i], "--boot-frames") && i + 1 < argc) {
+            boot_frames = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--cycles") && i + 1 < argc) {
+            cycles = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            frames = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--stop-pc") && i + 1 < argc) {
+            stop_pc = strtoul(argv[++i], NULL, 16);
+        } else if (!strcmp(argv[i], "--input") && i + 1 < argc) {
+            input.addr = strtoul(argv[++i], NULL, 16);
+        } else if (!strcmp(argv[i], "--tests") && i + 1 < argc) {
+            tests = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--jobs") && i + 1 < argc) {
+            jobs = strtoul(argv[++i], NULL, 0);
+        } else if (argv[i][0] != '-') {
+            if (!mdfork_read_case(&input.cases[input.count++], argv[i])) {
+                return 1;
+            }
+        } else {
+            mdfork_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!tests) {
+        tests = input.count ? input.count : 1;
+    }
+
+    /* Read BIOS */
+    uint8_t *bios = (uint8_t *) malloc(BUS_BIOS_SIZE);
+    FILE *bios_fp = fopen(bios_path, "rb");
+
+    if (!bios_fp || fread(bios, 1, BUS_BIOS_SIZE, bios_fp) != BUS_BIOS_SIZE) {
+        fprintf(stderr, "Failed to read BIOS %s\n", bios_path);
+        return 1;
+    }
+
+    fclose(bios_fp);
+
+    config.bios = bios;
+
+    mdpsx_t *mdpsx = mdpsx_create(&config);
+    free(bios);
+
+    if (!mdpsx) {
+        return 1;
+    }
+
+    /* Boot once, every child starts from here */
+    double start = mdfork_now();
+
+    if (load_state_path && !savestate_load(mdpsx, load_state_path)) {
+        return 1;
+    }
+
+    for (uint32_t i=0; i < boot_frames; i++) {
+        mdpsx_run_frame(mdpsx);
+    }
+
+    if (boot_pc && !forkserver_run_to_pc(mdpsx, boot_pc, MDFORK_BOOT_CYCLES)) {
+        fprintf(stderr, "Did not get to %08X within %u cycles\n", boot_pc, MDFORK_BOOT_CYCLES);
+        return 1;
+    }
+
+    double boot = mdfork_now() - start;
+
+    forkserver_t forkserver;
+
+    if (!forkserver_init(&forkserver, mdpsx, jobs)) {
+        return 1;
+    }
+
+    if (cycles) {
+        forkserver.cycles = cycles;
+    }
+
+    forkserver.frames = frames;
+    forkserver.stop_pc = stop_pc;
+    forkserver.setup = mdfork_setup;
+    forkserver.data = &input;
+
+    forkserver_result_t *results = (forkserver_result_t *) malloc(tests * sizeof(forkserver_result_t));
+
+    start = mdfork_now();
+
+    if (!forkserver_run(&forkserver, tests, results)) {
+        return 1;
+    }
+
+    double seconds = mdfork_now() - start;
+
+    /* Report */
+    uint32_t counts[3] = {0};
+
+    for (uint32_t i=0; i < tests; i++) {
+        forkserver_result_t *result = &results[i];
+        counts[result->result]++;
+
+        printf("%6u %-6s %08X %10u %016lx %016lx %s\n", i, forkserver_result_names[result->result], result->pc, result->cycles,
+            result->ram_hash, result->vram_hash, input.count ? input.cases[i % input.count].path : "-");
+    }
+
+    fprintf(stderr, "Boot:   %.3f s at %08X\n", boot, mdpsx->r3000_state.pc);
+    fprintf(stderr, "Tests:  %u in %.3f s (%.1f/s), %u budget, %u stop, %u crash\n", tests, seconds, tests / seconds,
+        counts[FORKSERVER_RESULT_BUDGET], counts[FORKSERVER_RESULT_STOP], counts[FORKSERVER_RESULT_CRASH]);
+
+    forkserver_destroy(&forkserver);
+    mdpsx_destroy(mdpsx);
+
+    return 0;
+}
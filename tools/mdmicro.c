@@ -0,0 +1,919 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "core/mdpsx.h"
+
+/*
+ * Micro-benchmarks for the core hot paths. Every benchmark gets a fresh
+ * instance with an empty BIOS, runs its warmup samples and then times a batch
+ * of operations per sample. Results are nanoseconds per operation.
+ */
+
+#define MICRO_CODE_BASE     0x80010000
+#define MICRO_DATA_BASE     0x80100000
+#define MICRO_OT_BASE       0x80140000
+#define MICRO_PACKET_BASE   0x80160000
+
+#define MICRO_CODE_LENGTH   256
+#define MICRO_OT_LENGTH     1024
+#define MICRO_STREAM_LENGTH 4096
+
+typedef struct micro_t {
+    mdpsx_t *mdpsx;
+    r3000_state_t *r3000_state;
+    bus_state_t *bus_state;
+
+    // Keeps the reads from being optimized out
+    uint32_t sink;
+    uint32_t index;
+
+    uint32_t stream[MICRO_STREAM_LENGTH];
+    uint32_t stream_length;
+} micro_t;
+
+typedef struct micro_bench_t {
+    const char *name;
+
+    // Operations per timed sample
+    uint32_t ops;
+
+    void (*setup)(micro_t *micro);
+    void (*run)(micro_t *micro, uint32_t ops);
+} micro_bench_t;
+
+typedef struct micro_result_t {
+    double median;
+    double p99;
+    double mean;
+    double stddev;
+} micro_result_t;
+
+static uint32_t micro_random_state;
+
+/* Same sequence on every run so the inputs stay comparable */
+static uint32_t micro_random(void)
+{
+    micro_random_state = micro_random_state * 1103515245 + 12345;
+    return micro_random_state >> 8;
+}
+
+static double micro_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+/* Instruction encoding */
+static uint32_t micro_r(uint8_t rs, uint8_t rt, uint8_t rd, uint8_t shamt, uint8_t funct)
+{
+    return (rs << 21) | (rt << 16) | (rd << 11) | (shamt << 6) | funct;
+}
+
+static uint32_t micro_i(uint8_t op, uint8_t rs, uint8_t rt, uint16_t imm)
+{
+    return (op << 26) | (rs << 21) | (rt << 16) | imm;
+}
+
+static void micro_write_word(micro_t *micro, uint32_t addr, uint32_t value)
+{
+    bus_write(micro->bus_state, BUS_SIZE_DWORD, addr, value);
+}
+
+/* Puts the code at MICRO_CODE_BASE with a jump back to the start at the end */
+static void micro_load_code(micro_t *micro, uint32_t *code, uint32_t length)
+{
+    for (uint32_t i=0; i < length; i++) {
+        micro_write_word(micro, MICRO_CODE_BASE + i * 4, code[i]);
+    }
+
+    micro_write_word(micro, MICRO_CODE_BASE + length * 4, (0x02 << 26) | ((MICRO_CODE_BASE & 0x0FFFFFFF) >> 2));
+    micro_write_word(micro, MICRO_CODE_BASE + length * 4 + 4, 0);
+
+    r3000_state_t *r3000_state = micro->r3000_state;
+
+    r3000_state->pc_instruction = MICRO_CODE_BASE;
+    r3000_state->pc = MICRO_CODE_BASE;
+    r3000_state->pc_next = MICRO_CODE_BASE + 4;
+
+    // s0 and s1 are the load/store bases, the mixes never write them
+    r3000_state->regs[16] = MICRO_DATA_BASE;
+    r3000_state->regs[17] = BUS_SCRATCHPAD_BASE;
+}
+
+/* Bus */
+static void micro_bus_read_ram(micro_t *micro, uint32_t ops)
+{
+    for (uint32_t i=0; i < ops; i++) {
+        micro->sink += bus_read(micro->bus_state, BUS_SIZE_DWORD, 0x80000000 | ((micro->index++ << 2) & 0xFFFC));
+    }
+}
+
+static void micro_bus_read_scratchpad(micro_t *micro, uint32_t ops)
+{
+    for (uint32_t i=0; i < ops; i++) {
+        micro->sink += bus_read(micro->bus_state, BUS_SIZE_DWORD, BUS_SCRATCHPAD_BASE | ((micro->index++ << 2) & 0x3FC));
+    }
+}
+
+static void micro_bus_read_bios(micro_t *micro, uint32_t ops)
+{
+    for (uint32_t i=0; i < ops; i++) {
+        micro->sink += bus_read(micro->bus_state, BUS_SIZE_DWORD, 0xBFC00000 | ((micro->index++ << 2) & 0xFFFC));
+    }
+}
+
+static void micro_bus_read_io(micro_t *micro, uint32_t ops)
+{
+    // I_STAT and I_MASK
+    for (uint32_t i=0; i < ops; i++) {
+        micro->sink += bus_read(micro->bus_state, BUS_SIZE_DWORD, 0x1F801070 | ((micro->index++ & 1) << 2));
+    }
+}
+
+static void micro_bus_read_timer(micro_t *micro, uint32_t ops)
+{
+    // Counter reads sync the timers first
+    for (uint32_t i=0; i < ops; i++) {
+        micro->r3000_state->cycles += 4;
+        micro->sink += bus_read(micro->bus_state, BUS_SIZE_DWORD, 0x1F801100 | ((micro->index++ % 3) << 4));
+    }
+}
+
+static void micro_bus_write_ram(micro_t *micro, uint32_t ops)
+{
+    for (uint32_t i=0; i < ops; i++) {
+        bus_write(micro->bus_state, BUS_SIZE_DWORD, 0x80000000 | ((micro->index << 2) & 0xFFFC), micro->index);
+        micro->index++;
+    }
+}
+
+static void micro_bus_write_scratchpad(micro_t *micro, uint32_t ops)
+{
+    for (uint32_t i=0; i < ops; i++) {
+        bus_write(micro->bus_state, BUS_SIZE_DWORD, BUS_SCRATCHPAD_BASE | ((micro->index << 2) & 0x3FC), micro->index);
+        micro->index++;
+    }
+}
+
+static void micro_bus_write_io(micro_t *micro, uint32_t ops)
+{
+    // I_MASK, nothing is pending so no interrupt goes up
+    for (uint32_t i=0; i < ops; i++) {
+        bus_write(micro->bus_state, BUS_SIZE_DWORD, 0x1F801074, micro->index++ & 0x7FF);
+    }
+}
+
+/* CPU, synthetic loops of one instruction mix */
+static void micro_setup_alu(micro_t *micro)
+{
+    uint32_t code[MICRO_CODE_LENGTH];
+
+    for (uint32_t i=0; i < MICRO_CODE_LENGTH; i++) {
+        // t0-t7
+        uint8_t rd = 8 + (micro_random() & 7);
+        uint8_t rs = 8 + (micro_random() & 7);
+        uint8_t rt = 8 + (micro_random() & 7);
+        uint16_t imm = micro_random();
+
+        switch(i % 8) {
+            case 0: code[i] = micro_r(rs, rt, rd, 0, 0x21); break;     // addu
+            case 1: code[i] = micro_i(0x09, rs, rt, imm); break;        // addiu
+            case 2: code[i] = micro_r(rs, rt, rd, 0, 0x26); break;     // xor
+            case 3: code[i] = micro_r(0, rt, rd, imm & 31, 0x00); break;   // sll
+            case 4: code[i] = micro_r(rs, rt, rd, 0, 0x2A); break;     // slt
+            case 5: code[i] = micro_i(0x0C, rs, rt, imm); break;        // andi
+            case 6: code[i] = micro_r(rs, rt, rd, 0, 0x23); break;     // subu
+            case 7: code[i] = micro_i(0x0F, 0, rt, imm); break;         // lui
+        }
+    }
+
+    micro_load_code(micro, code, MICRO_CODE_LENGTH);
+}
+
+static void micro_setup_load_store(micro_t *micro)
+{
+    uint32_t code[MICRO_CODE_LENGTH];
+
+    for (uint32_t i=0; i < MICRO_CODE_LENGTH; i++) {
+        uint8_t rd = 8 + (micro_random() & 7);
+        uint8_t rt = 8 + (micro_random() & 7);
+        uint16_t offset = micro_random() & 0x3FC;
+
+        switch(i % 8) {
+            case 0: code[i] = micro_i(0x23, 16, rt, offset); break;    // lw from RAM
+            case 1: code[i] = micro_i(0x2B, 16, rt, offset); break;    // sw to RAM
+            case 2: code[i] = micro_i(0x24, 16, rt, offset); break;    // lbu
+            case 3: code[i] = micro_i(0x29, 16, rt, offset); break;    // sh
+            case 4: code[i] = micro_i(0x23, 17, rt, offset); break;    // lw from scratchpad
+            case 5: code[i] = micro_i(0x2B, 17, rt, offset); break;    // sw to scratchpad
+            case 6: code[i] = micro_r(rt, rd, rd, 0, 0x21); break;     // addu
+            case 7: code[i] = micro_i(0x21, 16, rt, offset); break;    // lh
+        }
+    }
+
+    micro_load_code(micro, code, MICRO_CODE_LENGTH);
+}
+
+static void micro_setup_branch(micro_t *micro)
+{
+    uint32_t code[MICRO_CODE_LENGTH];
+    uint32_t length = 0;
+
+    // Taken every other time, so both paths get executed
+    while (length + 5 <= MICRO_CODE_LENGTH) {
+        code[length++] = micro_i(0x09, 8, 8, 1);       // addiu t0, t0, 1
+        code[length++] = micro_i(0x0C, 8, 9, 1);       // andi t1, t0, 1
+        code[length++] = micro_i(0x04, 9, 0, 2);       // beq t1, zero, +2
+        code[length++] = 0;                             // nop
+        code[length++] = micro_i(0x09, 10, 10, 1);     // addiu t2, t2, 1
+    }
+
+    micro_load_code(micro, code, length);
+}
+
+static void micro_r3000_step(micro_t *micro, uint32_t ops)
+{
+    for (uint32_t i=0; i < ops; i++) {
+        r3000_step(micro->r3000_state, micro->bus_state);
+    }
+}
+
+/* GPU, a stream of the primitives the GPU knows with some state commands in between */
+static void micro_stream_push(micro_t *micro, uint32_t word)
+{
+    micro->stream[micro->stream_length++] = word;
+}
+
+static uint32_t micro_vertex(void)
+{
+    return ((micro_random() & 0x1FF) << 16) | (micro_random() & 0x3FF);
+}
+
+static void micro_setup_gp0(micro_t *micro)
+{
+    micro->stream_length = 0;
+
+    // Every packet fits, the stream always ends on a command
+    while (micro->stream_length + 256 <= MICRO_STREAM_LENGTH) {
+        switch(micro_random() % 6) {
+            case 0:
+                micro_stream_push(micro, 0x28000000 | (micro_random() & 0xFFFFFF));
+
+                for (int i=0; i < 4; i++) {
+                    micro_stream_push(micro, micro_vertex());
+                }
+
+                break;
+
+            case 1:
+                micro_stream_push(micro, 0x2C000000 | (micro_random() & 0xFFFFFF));
+
+                for (int i=0; i < 4; i++) {
+                    micro_stream_push(micro, micro_vertex());
+                    micro_stream_push(micro, micro_random() & 0xFFFF);
+                }
+
+                break;
+
+            case 2:
+                micro_stream_push(micro, 0x30000000 | (micro_random() & 0xFFFFFF));
+
+                for (int i=0; i < 3; i++) {
+                    if (i) micro_stream_push(micro, micro_random() & 0xFFFFFF);
+                    micro_stream_push(micro, micro_vertex());
+                }
+
+                break;
+
+            case 3:
+                micro_stream_push(micro, 0x38000000 | (micro_random() & 0xFFFFFF));
+
+                for (int i=0; i < 4; i++) {
+                    if (i) micro_stream_push(micro, micro_random() & 0xFFFFFF);
+                    micro_stream_push(micro, micro_vertex());
+                }
+
+                break;
+
+            case 4:
+                // Texpage, drawing area and offset
+                micro_stream_push(micro, 0xE1000000 | (micro_random() & 0x7FF));
+                micro_stream_push(micro, 0xE3000000);
+                micro_stream_push(micro, 0xE4000000 | (239 << 10) | 319);
+                micro_stream_push(micro, 0xE5000000);
+
+                break;
+
+            case 5:
+                // 16x16 CPU->VRAM upload
+                micro_stream_push(micro, 0xA0000000);
+                micro_stream_push(micro, micro_vertex());
+                micro_stream_push(micro, (16 << 16) | 16);
+
+                for (int i=0; i < 16 * 16 / 2; i++) {
+                    micro_stream_push(micro, micro_random());
+                }
+
+                break;
+        }
+    }
+}
+
+static void micro_video_primitive(void *data, uint32_t *command_buf)
+{
+    ((micro_t *) data)->sink += command_buf[0];
+}
+
+static void micro_video_render(void *data)
+{
+    ((micro_t *) data)->sink++;
+}
+
+static void micro_setup_gp0_video(micro_t *micro)
+{
+    micro_setup_gp0(micro);
+
+    // Calls that do nothing, so only the command handling and the dispatch are timed
+    gpu_video_sink_t video = {
+        .data = micro,
+        .monochrome_opaque_quad = micro_video_primitive,
+        .textured_blend_quad = micro_video_primitive,
+        .gouraud_triangle = micro_video_primitive,
+        .gouraud_quad = micro_video_primitive,
+        .render = micro_video_render
+    };
+
+    mdpsx_set_video(micro->mdpsx, &video);
+}
+
+static void micro_gp0(micro_t *micro, uint32_t ops)
+{
+    gpu_state_t *gpu_state = &micro->bus_state->gpu_state;
+
+    for (uint32_t i=0; i < ops; i++) {
+        gpu_send_gp0_command(gpu_state, micro->stream[micro->index]);
+        micro->index = (micro->index + 1) % micro->stream_length;
+    }
+}
+
+/* DMA, an ordering table the way OTC clears it with packets linked into every fourth entry */
+static void micro_setup_ordering_table(micro_t *micro)
+{
+    uint32_t packet = MICRO_PACKET_BASE;
+
+    for (uint32_t i=0; i < MICRO_OT_LENGTH; i++) {
+        uint32_t entry = MICRO_OT_BASE + i * 4;
+        uint32_t next = i ? ((entry - 4) & 0x1FFFFF) : 0xFFFFFF;
+
+        if (i % 4 == 0) {
+            // Gouraud triangle
+            micro_write_word(micro, packet, (6 << 24) | next);
+            micro_write_word(micro, packet + 4, 0x30000000 | (micro_random() & 0xFFFFFF));
+
+            for (uint32_t j=0; j < 5; j++) {
+                micro_write_word(micro, packet + 8 + j * 4, (j & 1) ? (micro_random() & 0xFFFFFF) : micro_vertex());
+            }
+
+            next = packet & 0x1FFFFF;
+            packet += 7 * 4;
+        }
+
+        micro_write_word(micro, entry, next);
+    }
+
+    // The CPU hands the last entry to the GPU channel
+    micro->bus_state->dma_state.channels[DMA_CHANNEL_GPU].madr = MICRO_OT_BASE + (MICRO_OT_LENGTH - 1) * 4;
+}
+
+static void micro_dma_linked_list(micro_t *micro, uint32_t ops)
+{
+    dma_state_t *dma_state = &micro->bus_state->dma_state;
+
+    for (uint32_t i=0; i < ops; i++) {
+        micro->sink += dma_transfer_linked_list(dma_state, &dma_state->channels[DMA_CHANNEL_GPU], micro->bus_state);
+    }
+}
+
+/* Timers, one channel on every clock source with interrupts at the target and at FFFF */
+static void micro_setup_timers(micro_t *micro)
+{
+    // Dot clock, reset at the target, repeated interrupt
+    micro_write_word(micro, 0x1F801108, 0x100);
+    micro_write_word(micro, 0x1F801104, (1 << 8) | (1 << 6) | (1 << 4) | (1 << 3));
+
+    // HBlank, interrupt at FFFF
+    micro_write_word(micro, 0x1F801114, (1 << 8) | (1 << 6) | (1 << 5));
+
+    // System clock / 8
+    micro_write_word(micro, 0x1F801128, 0x80);
+    micro_write_word(micro, 0x1F801124, (2 << 8) | (1 << 6) | (1 << 4) | (1 << 3));
+}
+
+static void micro_timer_sync(micro_t *micro, uint32_t ops)
+{
+    timer_state_t *timer_state = &micro->bus_state->timer_state;
+
+    // About as far apart as the syncs from IO accesses in a game loop
+    for (uint32_t i=0; i < ops; i++) {
+        timer_sync(timer_state, (uint32_t) timer_state->cycles + 64);
+    }
+}
+
+/* GTE, every command that goes through the transform kernel */
+static const uint8_t micro_gte_commands[] = {
+    0x01, 0x12, 0x13, 0x16, 0x1B, 0x1E, 0x20, 0x30, 0x3F
+};
+
+// sf, lm and the MVMVA operands
+#define MICRO_GTE_COMMAND_BITS  ((1 << 19) | (0x3F << 13) | (1 << 10))
+
+/*
+ * Random registers, scaled down by a random amount so plain results come up
+ * too. Some translations sit right at the 44 bit limit, so each of the terms
+ * can be the one that overflows.
+ */
+static void micro_random_gte(gte_state_t *state)
+{
+    uint8_t *bytes = (uint8_t *) state;
+
+    for (uint32_t i=0; i < sizeof(gte_state_t); i++) {
+        bytes[i] = micro_random();
+    }
+
+    for (uint32_t i=0; i < 3; i++) {
+        for (uint32_t j=0; j < 3; j++) {
+            state->v[i][j] >>= micro_random() % 16;
+            state->vector[i][j] >>= micro_random() % 32;
+
+            if (!(micro_random() & 3)) {
+                int32_t distance = micro_random() & 0x3FFFF;
+                state->vector[i][j] = (micro_random() & 1) ? INT32_MAX - distance : INT32_MIN + distance;
+            }
+
+            for (uint32_t k=0; k < 3; k++) {
+                state->matrix[i][j][k] >>= micro_random() % 16;
+            }
+        }
+    }
+}
+
+static void micro_print_gte(const char *name, gte_state_t *state)
+{
+    printf("  %-6s MAC %08X %08X %08X %08X IR %04X %04X %04X %04X", name,
+        state->mac[0], state->mac[1], state->mac[2], state->mac[3],
+        (uint16_t) state->ir[0], (uint16_t) state->ir[1], (uint16_t) state->ir[2], (uint16_t) state->ir[3]);
+
+    printf(" SXY %04X,%04X %04X,%04X %04X,%04X SZ %04X %04X %04X %04X FLAG %08X\n",
+        (uint16_t) state->sxy[0][0], (uint16_t) state->sxy[0][1], (uint16_t) state->sxy[1][0], (uint16_t) state->sxy[1][1],
+        (uint16_t) state->sxy[2][0], (uint16_t) state->sxy[2][1], state->sz[0], state->sz[1], state->sz[2], state->sz[3], state->flag);
+}
+
+/* Runs the same random commands with the scalar and the AVX2 kernel, every register has to match */
+static bool micro_check_gte(uint32_t cases)
+{
+    if (!gte_set_transform(GTE_TRANSFORM_AVX2)) {
+        printf("GTE check: no AVX2 on this CPU, nothing to compare\n");
+        return true;
+    }
+
+    uint32_t mismatches = 0;
+
+    micro_random_state = 1;
+
+    for (uint32_t i=0; i < cases; i++) {
+        gte_state_t input;
+        micro_random_gte(&input);
+
+        uint32_t command = micro_gte_commands[micro_random() % sizeof(micro_gte_commands)] | (micro_random() & MICRO_GTE_COMMAND_BITS);
+
+        gte_state_t scalar = input;
+        gte_state_t avx2 = input;
+
+        gte_set_transform(GTE_TRANSFORM_SCALAR);
+        gte_command(&scalar, command);
+
+        gte_set_transform(GTE_TRANSFORM_AVX2);
+        gte_command(&avx2, command);
+
+        if (!memcmp(&scalar, &avx2, sizeof(gte_state_t))) {
+            continue;
+        }
+
+        // The first few are enough to see what is off
+        if (mismatches++ < 8) {
+            printf("Case %u, command %08X:\n", i, command);
+            micro_print_gte("scalar", &scalar);
+            micro_print_gte("avx2", &avx2);
+        }
+    }
+
+    printf("GTE check: %u cases, %u mismatches\n", cases, mismatches);
+
+    return !mismatches;
+}
+
+/* Regression checks, --check runs all of them on an instance with an empty BIOS */
+typedef struct micro_check_t {
+    const char *name;
+    bool (*run)(const uint8_t *bios);
+} micro_check_t;
+
+static mdpsx_t *micro_create(const uint8_t *bios, bool hle)
+{
+    mdpsx_config_t config;
+    memset(&config, 0x00, sizeof(config));
+
+    config.bios = bios;
+    config.engine = R3000_ENGINE_INTERPRETER;
+    config.hle = hle;
+
+    return mdpsx_create(&config);
+}
+
+static bool micro_check_gte_cases(const uint8_t *bios)
+{
+    (void) bios;
+
+    return micro_check_gte(100000);
+}
+
+/* Conversions the host printf must not see are printed as they are, %5d still takes the first argument */
+static bool micro_check_hle_printf(const uint8_t *bios)
+{
+    const char *format = "a%nb%fc%Lgd%5de";
+    const char *expected = "a%nb%fc%Lgd   42e";
+
+    mdpsx_t *mdpsx = micro_create(bios, true);
+
+    if (!mdpsx) {
+        return false;
+    }
+
+    r3000_state_t *r3000_state = &mdpsx->r3000_state;
+
+    for (uint32_t i=0; i <= strlen(format); i++) {
+        bus_write(&mdpsx->bus_state, BUS_SIZE_BYTE, MICRO_DATA_BASE + i, format[i]);
+    }
+
+    // printf is A(3Fh), a %n would write through the 42
+    r3000_state->regs[R3000_REG_A0] = MICRO_DATA_BASE;
+    r3000_state->regs[R3000_REG_A1] = 42;
+    r3000_state->regs[R3000_REG_T1] = 0x3F;
+    r3000_state->regs[R3000_REG_RA] = MICRO_CODE_BASE;
+
+    r3000_state->pc_instruction = 0xA0;
+    r3000_state->pc = 0xA0;
+    r3000_state->pc_next = 0xA4;
+
+    r3000_step(r3000_state, &mdpsx->bus_state);
+
+    bool passed = r3000_state->pc == MICRO_CODE_BASE && !strcmp(r3000_state->tty.buf, expected) &&
+        r3000_state->regs[R3000_REG_V0] == strlen(expected);
+
+    if (!passed) {
+        printf("  printed \"%s\", expected \"%s\"\n", r3000_state->tty.buf, expected);
+    }
+
+    mdpsx_destroy(mdpsx);
+
+    return passed;
+}
+
+/* Whether boot_load_exe takes an EXE with the given text section and a file of size bytes */
+static bool micro_load_exe(uint32_t t_addr, uint32_t t_size, uint32_t size)
+{
+    char path[] = "/tmp/mdmicro-XXXXXX";
+    int fd = mkstemp(path);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    uint8_t *exe = (uint8_t *) calloc(1, size);
+    boot_exe_header_t *header = (boot_exe_header_t *) exe;
+
+    memcpy(header->id, "PS-X EXE", 8);
+    header->pc = t_addr;
+    header->t_addr = t_addr;
+    header->t_size = t_size;
+
+    bool written = write(fd, exe, size) == (ssize_t) size;
+    close(fd);
+    free(exe);
+
+    boot_t boot;
+    boot_init(&boot, NULL);
+
+    bool loaded = written && boot_load_exe(&boot, path);
+
+    boot_destroy(&boot);
+    unlink(path);
+
+    return loaded;
+}
+
+/* Text sizes that wrap the bounds checks around have to be rejected before anything is copied */
+static bool micro_check_exe_header(const uint8_t *bios)
+{
+    (void) bios;
+
+    bool valid = micro_load_exe(0x80010000, 0x800, 0x1000);
+    bool oversized = micro_load_exe(0x80010000, 0xFFFFF900, 0x1000);
+    bool past_ram = micro_load_exe(0x801FFC00, 0x800, 0x1000);
+
+    return valid && !oversized && !past_ram;
+}
+
+/* Frame length of each standard, with the HBlank timer counting one line per scanline over it */
+static bool micro_check_frame_cycles(const uint8_t *bios)
+{
+    // 263 * 3413 video clocks at 53693175 Hz and 314 * 3406 at 53203425 Hz
+    const uint32_t expected[2] = {566203, 680823};
+
+    mdpsx_t *mdpsx = micro_create(bios, false);
+
+    if (!mdpsx) {
+        return false;
+    }
+
+    gpu_state_t *gpu_state = &mdpsx->bus_state.gpu_state;
+    timer_state_t *timer_state = &mdpsx->bus_state.timer_state;
+    bool passed = true;
+
+    for (uint8_t pal=0; pal < 2; pal++) {
+        gpu_state->pal = pal;
+
+        uint32_t frame = gpu_frame_cycles(gpu_state);
+        uint32_t lines = pal ? GPU_SCANLINES_PAL : GPU_SCANLINES_NTSC;
+
+        // The frame length is rounded down, the last line ends one cycle later
+        timer_write(timer_state, 0x14, 1 << 8);
+        timer_sync(timer_state, (uint32_t) timer_state->cycles + frame + 1);
+
+        uint32_t counted = timer_read(timer_state, 0x10);
+
+        if (frame != expected[pal] || counted != lines) {
+            printf("  %s: %u cycles, %u lines, expected %u cycles, %u lines\n", pal ? "PAL" : "NTSC", frame, counted, expected[pal], lines);
+            passed = false;
+        }
+    }
+
+    mdpsx_destroy(mdpsx);
+
+    return passed;
+}
+
+static const micro_check_t micro_checks[] = {
+    {"gte", micro_check_gte_cases},
+    {"hle_printf", micro_check_hle_printf},
+    {"exe_header", micro_check_exe_header},
+    {"frame_cycles", micro_check_frame_cycles}
+};
+
+static bool micro_check_all(const uint8_t *bios)
+{
+    uint32_t failed = 0;
+
+    for (uint32_t i=0; i < sizeof(micro_checks) / sizeof(micro_checks[0]); i++) {
+        bool passed = micro_checks[i].run(bios);
+
+        printf("%-28s %s\n", micro_checks[i].name, passed ? "ok" : "FAILED");
+        failed += !passed;
+    }
+
+    return !failed;
+}
+
+static const micro_bench_t micro_benches[] = {
+    {"bus_read ram", 10000, NULL, micro_bus_read_ram},
+    {"bus_read scratchpad", 10000, NULL, micro_bus_read_scratchpad},
+    {"bus_read bios", 10000, NULL, micro_bus_read_bios},
+    {"bus_read io", 10000, NULL, micro_bus_read_io},
+    {"bus_read timer", 10000, micro_setup_timers, micro_bus_read_timer},
+    {"bus_write ram", 10000, NULL, micro_bus_write_ram},
+    {"bus_write scratchpad", 10000, NULL, micro_bus_write_scratchpad},
+    {"bus_write io", 10000, NULL, micro_bus_write_io},
+    {"r3000_step alu", 10000, micro_setup_alu, micro_r3000_step},
+    {"r3000_step load_store", 10000, micro_setup_load_store, micro_r3000_step},
+    {"r3000_step branch", 10000, micro_setup_branch, micro_r3000_step},
+    {"gpu_send_gp0_command", 10000, micro_setup_gp0, micro_gp0},
+    {"gpu_send_gp0_command video", 10000, micro_setup_gp0_video, micro_gp0},
+    {"dma_transfer_linked_list", 4, micro_setup_ordering_table, micro_dma_linked_list},
+    {"timer_sync", 10000, micro_setup_timers, micro_timer_sync}
+};
+
+static int micro_compare(const void *a, const void *b)
+{
+    double x = *((const double *) a);
+    double y = *((const double *) b);
+
+    return (x > y) - (x < y);
+}
+
+static void micro_summarize(micro_result_t *result, double *samples, uint32_t count)
+{
+    qsort(samples, count, sizeof(double), micro_compare);
+
+    result->median = (count & 1) ? samples[count / 2] : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+    result->p99 = samples[(uint32_t) ceil(count * 0.99) - 1];
+
+    double sum = 0;
+
+    for (uint32_t i=0; i < count; i++) {
+        sum += samples[i];
+    }
+
+    result->mean = sum / count;
+
+    double variance = 0;
+
+    for (uint32_t i=0; i < count; i++) {
+        variance += (samples[i] - result->mean) * (samples[i] - result->mean);
+    }
+
+    result->stddev = (count > 1) ? sqrt(variance / (count - 1)) : 0;
+}
+
+static bool micro_run(const micro_bench_t *bench, const uint8_t *bios, uint32_t warmup, uint32_t count, micro_result_t *result)
+{
+    mdpsx_config_t config;
+    memset(&config, 0x00, sizeof(config));
+
+    config.bios = bios;
+    config.engine = R3000_ENGINE_INTERPRETER;
+
+    micro_t *micro = (micro_t *) calloc(1, sizeof(micro_t));
+    micro->mdpsx = mdpsx_create(&config);
+
+    if (!micro->mdpsx) {
+        free(micro);
+        return false;
+    }
+
+    micro->r3000_state = &micro->mdpsx->r3000_state;
+    micro->bus_state = &micro->mdpsx->bus_state;
+
+    micro_random_state = 1;
+
+    if (bench->setup) {
+        bench->setup(micro);
+    }
+
+    double *samples = (double *) malloc(count * sizeof(double));
+
+    for (uint32_t i=0; i < warmup; i++) {
+        bench->run(micro, bench->ops);
+    }
+
+    for (uint32_t i=0; i < count; i++) {
+        double start = micro_now();
+        bench->run(micro, bench->ops);
+
+        samples[i] = (micro_now() - start) / bench->ops;
+    }
+
+    micro_summarize(result, samples, count);
+
+    free(samples);
+    mdpsx_destroy(micro->mdpsx);
+    free(micro);
+
+    return true;
+}
+
+static void micro_usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [options]\n", name);
+    fprintf(stderr, "  --samples N      Timed samples per benchmark (default 101)\n");
+    fprintf(stderr, "  --warmup N       Untimed samples before them (default 10)\n");
+    fprintf(stderr, "  --filter TEXT    Only run the benchmarks with TEXT in their name\n");
+    fprintf(stderr, "  --list           List the benchmarks\n");
+    fprintf(stderr, "  --json FILE      Write the results as JSON, - for stdout\n");
+    fprintf(stderr, "  --check-gte N    Compare the GTE kernels on N random commands instead\n");
+    fprintf(stderr, "  --check          Run the regression checks instead\n");
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t count = 101;
+    uint32_t warmup = 10;
+    const char *filter = NULL;
+    const char *json_path = NULL;
+    uint32_t gte_cases = 0;
+    bool check = false;
+
+    uint32_t bench_count = sizeof(micro_benches) / sizeof(micro_benches[0]);
+
+    /* Parse arguments */
+    for (int i=1; i < argc; i++) {
+        if (!strcmp(argv[i], "--samples") && i + 1 < argc) {
+            count = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--warmup") && i + 1 < argc) {
+            warmup = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--filter") && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (!strcmp(argv[i], "--json") && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (!strcmp(argv[i], "--check-gte") && i + 1 < argc) {
+            gte_cases = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--check")) {
+            check = true;
+        } else if (!strcmp(argv[i], "--list")) {
+            for (uint32_t j=0; j < bench_count; j++) {
+                printf("%s\n", micro_benches[j].name);
+            }
+
+            return 0;
+        } else {
+            micro_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (count == 0) {
+        micro_usage(argv[0]);
+        return 1;
+    }
+
+    if (gte_cases) {
+        return micro_check_gte(gte_cases) ? 0 : 1;
+    }
+
+    // Nothing runs the BIOS code, the synthetic loops are in RAM
+    uint8_t *bios = (uint8_t *) calloc(1, BUS_BIOS_SIZE);
+
+    if (check) {
+        bool passed = micro_check_all(bios);
+
+        free(bios);
+        return passed ? 0 : 1;
+    }
+
+    micro_result_t results[bench_count];
+    bool ran[bench_count];
+
+    printf("%-28s %8s %10s %10s %10s %10s\n", "Benchmark (ns/op)", "Ops", "Median", "p99", "Mean", "Stddev");
+
+    for (uint32_t i=0; i < bench_count; i++) {
+        const micro_bench_t *bench = &micro_benches[i];
+        micro_result_t *result = &results[i];
+
+        ran[i] = false;
+
+        if (filter && !strstr(bench->name, filter)) {
+            continue;
+        }
+
+        if (!micro_run(bench, bios, warmup, count, result)) {
+            fprintf(stderr, "Failed to set up %s\n", bench->name);
+            continue;
+        }
+
+        ran[i] = true;
+
+        printf("%-28s %8u %10.2f %10.2f %10.2f %10.2f\n", bench->name, bench->ops, result->median, result->p99, result->mean, result->stddev);
+    }
+
+    if (json_path) {
+        FILE *fp = strcmp(json_path, "-") ? fopen(json_path, "w") : stdout;
+
+        if (!fp) {
+            fprintf(stderr, "Failed to open %s\n", json_path);
+            free(bios);
+            return 1;
+        }
+
+        fprintf(fp, "{\"samples\": %u, \"warmup\": %u, \"benchmarks\": [", count, warmup);
+
+        bool first = true;
+
+        for (uint32_t i=0; i < bench_count; i++) {
+            if (!ran[i]) {
+                continue;
+            }
+
+            fprintf(fp, "%s{\"name\": \"%s\", \"ops\": %u, \"median_ns\": %.3f, \"p99_ns\": %.3f, \"mean_ns\": %.3f, \"stddev_ns\": %.3f}",
+                first ? "" : ", ", micro_benches[i].name, micro_benches[i].ops, results[i].median, results[i].p99, results[i].mean, results[i].stddev);
+
+            first = false;
+        }
+
+        fprintf(fp, "]}\n");
+
+        if (fp != stdout) {
+            fclose(fp);
+        }
+    }
+
+    free(bios);
+
+    return 0;
+}
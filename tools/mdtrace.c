@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu/r3000.h"
+#include "cpu/trace.h"
+
+/* Operands in the usual assembler order */
+static void mdtrace_operands(char *buf, size_t size, r3000_instruction_t *instruction, uint32_t pc)
+{
+    const char *rs = r3000_register_names[instruction->rs];
+    const char *rt = r3000_register_names[instruction->rt];
+    const char *rd = r3000_register_names[instruction->rd];
+
+    int16_t simm = (int16_t) instruction->imm;
+    uint32_t branch = pc + 4 + (simm << 2);
+
+    switch(instruction->op) {
+        case R3000_OP_SLL: case R3000_OP_SRL: case R3000_OP_SRA:
+            snprintf(buf, size, "%s, %s, %d", rd, rt, instruction->shamt);
+            break;
+
+        case R3000_OP_SLLV: case R3000_OP_SRLV: case R3000_OP_SRAV:
+            snprintf(buf, size, "%s, %s, %s", rd, rt, rs);
+            break;
+
+        case R3000_OP_JR: case R3000_OP_MTHI: case R3000_OP_MTLO:
+            snprintf(buf, size, "%s", rs);
+            break;
+
+        case R3000_OP_JALR:
+            snprintf(buf, size, "%s, %s", rd, rs);
+            break;
+
+        case R3000_OP_SYSCALL: case R3000_OP_BREAK:
+            snprintf(buf, size, "0x%x", (instruction->word >> 6) & 0xFFFFF);
+            break;
+
+        case R3000_OP_MFHI: case R3000_OP_MFLO:
+            snprintf(buf, size, "%s", rd);
+            break;
+
+        case R3000_OP_MULT: case R3000_OP_MULTU: case R3000_OP_DIV: case R3000_OP_DIVU:
+            snprintf(buf, size, "%s, %s", rs, rt);
+            break;
+
+        case R3000_OP_ADD: case R3000_OP_ADDU: case R3000_OP_SUB: case R3000_OP_SUBU:
+        case R3000_OP_AND: case R3000_OP_OR: case R3000_OP_XOR: case R3000_OP_NOR:
+        case R3000_OP_SLT: case R3000_OP_SLTU:
+            snprintf(buf, size, "%s, %s, %s", rd, rs, rt);
+            break;
+
+        case R3000_OP_BLTZ: case R3000_OP_BGEZ: case R3000_OP_BLTZAL: case R3000_OP_BGEZAL:
+        case R3000_OP_BLEZ: case R3000_OP_BGTZ:
+            snprintf(buf, size, "%s, %08X", rs, branch);
+            break;
+
+        case R3000_OP_BEQ: case R3000_OP_BNE:
+            snprintf(buf, size, "%s, %s, %08X", rs, rt, branch);
+            break;
+
+        case R3000_OP_J: case R3000_OP_JAL:
+            snprintf(buf, size, "%08X", ((pc + 4) & 0xF0000000) | (instruction->imm_jump << 2));
+            break;
+
+        case R3000_OP_ADDI: case R3000_OP_ADDIU: case R3000_OP_SLTI: case R3000_OP_SLTIU:
+            snprintf(buf, size, "%s, %s, %d", rt, rs, simm);
+            break;
+
+        case R3000_OP_ANDI: case R3000_OP_ORI: case R3000_OP_XORI:
+            snprintf(buf, size, "%s, %s, 0x%x", rt, rs, instruction->imm);
+            break;
+
+        case R3000_OP_LUI:
+            snprintf(buf, size, "%s, 0x%x", rt, instruction->imm);
+            break;
+
+        case R3000_OP_MFC0: case R3000_OP_MTC0:
+            snprintf(buf, size, "%s, %s", rt, cop0_register_names[instruction->rd][0] ? cop0_register_names[instruction->rd] : "?");
+            break;
+
+        case R3000_OP_MFC2: case R3000_OP_MTC2:
+            snprintf(buf, size, "%s, gd%d", rt, instruction->rd);
+            break;
+
+        case R3000_OP_CFC2: case R3000_OP_CTC2:
+            snprintf(buf, size, "%s, gc%d", rt, instruction->rd);
+            break;
+
+        case R3000_OP_COP2:
+            snprintf(buf, size, "0x%07x", instruction->word & 0x1FFFFFF);
+            break;
+
+        case R3000_OP_LB: case R3000_OP_LH: case R3000_OP_LWL: case R3000_OP_LW:
+        case R3000_OP_LBU: case R3000_OP_LHU: case R3000_OP_LWR:
+        case R3000_OP_SB: case R3000_OP_SH: case R3000_OP_SWL: case R3000_OP_SW: case R3000_OP_SWR:
+            snprintf(buf, size, "%s, %d(%s)", rt, simm, rs);
+            break;
+
+        case R3000_OP_LWC2: case R3000_OP_SWC2:
+            snprintf(buf, size, "gd%d, %d(%s)", instruction->rt, simm, rs);
+            break;
+
+        default:
+            buf[0] = 0;
+            break;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <trace> [first record] [count]\n", argv[0]);
+        return 1;
+    }
+
+    FILE *fp = fopen(argv[1], "rb");
+
+    if (!fp) {
+        fprintf(stderr, "Failed to open %s\n", argv[1]);
+        return 1;
+    }
+
+    trace_file_header_t header;
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, TRACE_MAGIC, 8) || header.record_size != sizeof(trace_record_t)) {
+        fprintf(stderr, "%s is not a trace from this version\n", argv[1]);
+        fclose(fp);
+        return 1;
+    }
+
+    uint64_t first = (argc > 2) ? strtoull(argv[2], NULL, 0) : 0;
+    uint64_t count = (argc > 3) ? strtoull(argv[3], NULL, 0) : UINT64_MAX;
+
+    fseek(fp, first * sizeof(trace_record_t), SEEK_CUR);
+
+    trace_record_t record;
+    r3000_instruction_t instruction;
+    char operands[64];
+
+    for (uint64_t i=0; i < count && fread(&record, sizeof(record), 1, fp) == 1; i++) {
+        r3000_decode(&instruction, record.word);
+        mdtrace_operands(operands, sizeof(operands), &instruction, record.pc);
+
+        if (record.word == 0) {
+            operands[0] = 0;
+        }
+
+        printf("%10u %08X %08X  %-8s %-24s", record.cycles, record.pc, record.word, (record.word == 0) ? "NOP" : r3000_op_names[instruction.op], operands);
+
+        if (record.flags & TRACE_REG) {
+            printf(" %s=%08X%s", r3000_register_names[record.reg], record.reg_value, (record.flags & TRACE_REG_MULTIPLE) ? "+" : "");
+        }
+
+        if (record.flags & TRACE_MEM_READ) {
+            printf(" [%08X] -> %08X", record.mem_addr, record.mem_value);
+        }
+
+        if (record.flags & TRACE_MEM_WRITE) {
+            printf(" [%08X] <- %08X", record.mem_addr, record.mem_value);
+        }
+
+        printf("\n");
+    }
+
+    fclose(fp);
+
+    return 0;
+}